@@ -195,6 +195,13 @@ bgpstream_data_interface_id_t bgpstream_get_data_interface_id(bgpstream_t *bs)
   return bgpstream_di_mgr_get_data_interface_id(bs->di_mgr);
 }
 
+int bgpstream_set_live_data_interface(bgpstream_t *bs,
+                                      bgpstream_data_interface_id_t di)
+{
+  assert(!bs->started);
+  return bgpstream_di_mgr_set_live_data_interface(bs->di_mgr, di);
+}
+
 /* configure the interface so that it blocks
  * waiting for new data
  */
@@ -204,6 +211,25 @@ void bgpstream_set_live_mode(bgpstream_t *bs)
   bgpstream_di_mgr_set_blocking(bs->di_mgr);
 }
 
+void bgpstream_set_readahead(bgpstream_t *bs, uint64_t len)
+{
+  assert(!bs->started);
+  bgpstream_di_mgr_set_readahead(bs->di_mgr, len);
+}
+
+void bgpstream_set_max_skew(bgpstream_t *bs, uint32_t skew)
+{
+  assert(!bs->started);
+  bgpstream_di_mgr_set_max_skew(bs->di_mgr, skew);
+}
+
+int bgpstream_add_mirror(bgpstream_t *bs, const char *url_prefix,
+                         const char *path)
+{
+  assert(!bs->started);
+  return bgpstream_di_mgr_add_mirror(bs->di_mgr, url_prefix, path);
+}
+
 /* turn on the bgpstream interface, i.e.:
  * it makes the interface ready
  * for a new get next call
@@ -145,6 +145,9 @@ typedef enum {
   /** (Beta) BMP Stream interface */
   BGPSTREAM_DATA_INTERFACE_BETABMP,
 
+  /** Local archive directory interface */
+  BGPSTREAM_DATA_INTERFACE_LOCALDIR,
+
   /** The number of data interfaces */
   _BGPSTREAM_DATA_INTERFACE_CNT,
 
@@ -352,6 +355,37 @@ bgpstream_data_interface_id_t bgpstream_get_data_interface_id(bgpstream_t *bs);
 void bgpstream_set_data_interface(bgpstream_t *bs,
                                   bgpstream_data_interface_id_t if_id);
 
+/** Set a data interface to switch to once the current data interface has
+ * caught up
+ *
+ * @param bs            pointer to a BGP Stream instance to configure
+ * @param if_id         ID of the live data interface to switch to
+ * @return 0 if the data interface was set successfully, -1 otherwise
+ *
+ * This allows a stream to recover after an outage by first reading archived
+ * data with a historical data interface (e.g., the broker or a local mirror)
+ * and then streaming from a live one (e.g., kafka). The stream switches over
+ * once the historical data interface has no more data to offer, and from then
+ * on behaves as if live mode was enabled.
+ *
+ * The time of the most recent record read from the historical interface is
+ * tracked for every collector. Records from the live interface that are older
+ * than this watermark are dropped (records from collectors that the historical
+ * interface did not provide, e.g., because the two interfaces name them
+ * differently, are compared against the newest record overall). Records from
+ * the watermark second itself are kept, as the historical interface may have
+ * stopped part-way through that second. So as long as the live interface
+ * starts early enough (e.g., a kafka topic read from the earliest offset),
+ * there is no gap at the seam, but records of the watermark second may be
+ * delivered by both interfaces.
+ *
+ * Options for the live data interface are set using
+ * bgpstream_set_data_interface_option, in the same way as for the historical
+ * one.
+ */
+int bgpstream_set_live_data_interface(bgpstream_t *bs,
+                                      bgpstream_data_interface_id_t if_id);
+
 /** Configure the interface to block waiting for new data instead of returning
  * end-of-stream if no more data is available.
  *
@@ -363,6 +397,56 @@ void bgpstream_set_data_interface(bgpstream_t *bs,
  */
 void bgpstream_set_live_mode(bgpstream_t *bs);
 
+/** Read each resource in a background thread, ahead of the parser
+ *
+ * @param bs            pointer to a BGP Stream instance to configure
+ * @param len           maximum number of bytes to buffer for each open
+ *                      resource (0 disables read-ahead, the default)
+ *
+ * With read-ahead enabled, disk and network I/O and decompression overlap
+ * with parsing. The memory used by the stream grows by up to `len` bytes for
+ * every resource that is open at the same time.
+ */
+void bgpstream_set_readahead(bgpstream_t *bs, uint64_t len);
+
+/** Allow records from live streams to be delivered out of order by a bounded
+ * amount of time
+ *
+ * @param bs            pointer to a BGP Stream instance to configure
+ * @param skew          maximum skew in seconds (0 disables, the default)
+ *
+ * Records from several streams (e.g., the partitions of a Kafka topic read by
+ * separate consumers) are merged in time order. By default, when the stream
+ * with the oldest record has no data available, the merged stream waits for
+ * it. With a skew set, records from the other streams are delivered meanwhile,
+ * as long as they are no more than `skew` seconds newer than the last record
+ * seen from the stalled stream.
+ *
+ * With a skew set, streams that have not delivered a record for more than
+ * `skew` seconds (of wall-clock time) are not waited for, and neither are
+ * streams that have never delivered a record (e.g., a consumer that was
+ * assigned no partitions). Without a skew, records are strictly ordered, so
+ * every stream is waited for, even one that never delivers a record.
+ */
+void bgpstream_set_max_skew(bgpstream_t *bs, uint32_t skew);
+
+/** Read files from a local mirror of a remote archive when possible
+ *
+ * @param bs            pointer to a BGP Stream instance to configure
+ * @param url_prefix    URL prefix of the mirrored files
+ *                      (e.g., "http://archive.routeviews.org/")
+ * @param path          local directory that mirrors `url_prefix`
+ * @return 0 if the mirror was added successfully, -1 otherwise
+ *
+ * Whenever a data interface finds a file whose URL starts with `url_prefix`,
+ * and a file exists at the same relative location under `path`, the local file
+ * is read instead of the remote one (and is not copied into the cache). Files
+ * missing from the mirror are still fetched remotely. This function may be
+ * called multiple times, the longest matching prefix is used.
+ */
+int bgpstream_add_mirror(bgpstream_t *bs, const char *url_prefix,
+                         const char *path);
+
 /** Start the given BGP Stream instance.
  *
  * @param bs            pointer to a BGP Stream instance to start
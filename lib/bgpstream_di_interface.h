@@ -54,6 +54,14 @@
 #define BSDI_GET_FILTER_MGR(interface) ((interface)->filter_mgr)
 #define BSDI_GET_RES_MGR(interface) ((interface)->res_mgr)
 
+/** Convenience macro to allow implementations to publish a file descriptor
+ * that becomes readable when new resource metadata may be available (or -1 to
+ * withdraw it) */
+#define BSDI_SET_WAIT_FD(interface, fd)                                 \
+  do {                                                                  \
+    (interface)->wait_fd = (fd);                                        \
+  } while (0)
+
 /** Convenience macro that defines all the function prototypes for the data
  * interface API
  */
@@ -184,6 +192,15 @@ struct bsdi {
   /** Borrowed pointer to a resource manager instance */
   bgpstream_resource_mgr_t *res_mgr;
 
+  /** File descriptor that becomes readable when new resource metadata may be
+   * available (-1 if the interface can only be polled)
+   *
+   * In blocking mode, the interface manager waits on this descriptor rather
+   * than sleeping, and calls `update_resources` as soon as it is readable. The
+   * interface is responsible for draining it in `update_resources`.
+   */
+  int wait_fd;
+
   /** }@ */
 };
 
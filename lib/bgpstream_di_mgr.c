@@ -25,12 +25,18 @@
  */
 
 #include "bgpstream_di_mgr.h"
+#include "bgpstream_di_interface.h"
+#include "bgpstream_log.h"
 #include "config.h"
+#include "khash.h"
 #include "utils.h"
 #include <assert.h>
+#include <errno.h>
 #include <inttypes.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
@@ -61,6 +67,10 @@
 #include "bsdi_betabmp.h"
 #endif
 
+#ifdef WITH_DATA_INTERFACE_LOCALDIR
+#include "bsdi_localdir.h"
+#endif
+
 /* After 10 retries, start exponential backoff */
 #define DATA_INTERFACE_BLOCKING_RETRY_CNT 10
 /* Wait at least 20 seconds if the broker has no new data for us */
@@ -69,6 +79,12 @@
 #define DATA_INTERFACE_BLOCKING_MAX_WAIT 150
 
 #define ACTIVE_DI (di_mgr->interfaces[di_mgr->active_di])
+#define LIVE_DI (di_mgr->interfaces[di_mgr->live_di])
+
+/** Map from collector name to the time of the most recent record delivered
+ * for that collector by the historical DI */
+KHASH_INIT(watermarks, char *, uint32_t, 1, kh_str_hash_func,
+           kh_str_hash_equal)
 
 struct bgpstream_di_mgr {
 
@@ -80,6 +96,17 @@ struct bgpstream_di_mgr {
   // ID of the DI that is active
   bgpstream_data_interface_id_t active_di;
 
+  // ID of the DI to hand over to once the active DI has caught up (0 if none)
+  bgpstream_data_interface_id_t live_di;
+
+  // are we still reading historical data from the first DI?
+  int backfilling;
+
+  // per-collector handover watermarks, and the overall maximum (used for
+  // collectors that the historical DI did not know about)
+  khash_t(watermarks) *watermarks;
+  uint32_t watermark;
+
   // resource queue manager
   bgpstream_resource_mgr_t *res_mgr;
 
@@ -90,6 +117,16 @@ struct bgpstream_di_mgr {
   int blocking;
   int backoff_time;
   int retry_cnt;
+
+  // when (in msec) the DI last told us that new metadata was available (0 if
+  // we have not been notified since the last delivered record)
+  uint64_t notify_time;
+
+  // metadata-to-delivery latency (in msec) of notified updates
+  uint64_t notify_cnt;
+  uint64_t latency_last;
+  uint64_t latency_max;
+  uint64_t latency_total;
 };
 
 /** Convenience typedef for the interface alloc function type */
@@ -140,6 +177,12 @@ static const di_alloc_func_t di_alloc_functions[] = {
   NULL,
 #endif
 
+#ifdef WITH_DATA_INTERFACE_LOCALDIR
+  bsdi_localdir_alloc,
+#else
+  NULL,
+#endif
+
 };
 
 #define GET_DEFAULT_STR_VALUE(var_store, default_value)                        \
@@ -196,6 +239,7 @@ static bsdi_t *di_alloc(bgpstream_filter_mgr_t *filter_mgr,
 
   di->filter_mgr = filter_mgr;
   di->res_mgr = res_mgr;
+  di->wait_fd = -1;
 
   /* call the init function to allow the plugin to create state */
   if (di->init(di) != 0) {
@@ -215,6 +259,128 @@ static bsdi_t *get_di(bgpstream_di_mgr_t *di_mgr,
   return NULL;
 }
 
+/* Wait for the active DI to have new metadata, for at most the current backoff
+ * time. Returns 1 if the DI signalled that metadata is available, 0 if the
+ * timeout expired, and -1 if the wait was interrupted. */
+static int wait_for_di(bgpstream_di_mgr_t *di_mgr)
+{
+  struct pollfd pfd;
+  int rc;
+
+  if (ACTIVE_DI->wait_fd < 0) {
+    // the DI can only be polled
+    return (sleep(di_mgr->backoff_time) != 0) ? -1 : 0;
+  }
+
+  pfd.fd = ACTIVE_DI->wait_fd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  if ((rc = poll(&pfd, 1, di_mgr->backoff_time * 1000)) < 0) {
+    if (errno != EINTR) {
+      bgpstream_log(BGPSTREAM_LOG_WARN,
+                    "could not wait on data interface: %s", strerror(errno));
+    }
+    return -1;
+  }
+  if (rc == 0) {
+    return 0;
+  }
+  if ((pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) != 0) {
+    // the descriptor is no longer usable, so fall back to plain polling
+    bgpstream_log(BGPSTREAM_LOG_WARN,
+                  "data interface wait descriptor failed, falling back to "
+                  "polling every %d seconds",
+                  di_mgr->backoff_time);
+    ACTIVE_DI->wait_fd = -1;
+    return 0;
+  }
+  return 1;
+}
+
+static void record_latency(bgpstream_di_mgr_t *di_mgr)
+{
+  uint64_t latency = epoch_msec() - di_mgr->notify_time;
+
+  di_mgr->notify_time = 0;
+  di_mgr->notify_cnt++;
+  di_mgr->latency_last = latency;
+  di_mgr->latency_total += latency;
+  if (latency > di_mgr->latency_max) {
+    di_mgr->latency_max = latency;
+  }
+  bgpstream_log(BGPSTREAM_LOG_FINE,
+                "metadata-to-delivery latency: %" PRIu64 " ms (mean %" PRIu64
+                " ms, max %" PRIu64 " ms over %" PRIu64 " updates)",
+                latency, di_mgr->latency_total / di_mgr->notify_cnt,
+                di_mgr->latency_max, di_mgr->notify_cnt);
+}
+
+/* Raise the watermark of the collector of a record delivered by the
+ * historical DI */
+static int update_watermark(bgpstream_di_mgr_t *di_mgr,
+                            bgpstream_record_t *record)
+{
+  khiter_t k;
+  char *name;
+  int khret;
+
+  if (record->time_sec > di_mgr->watermark) {
+    di_mgr->watermark = record->time_sec;
+  }
+  if ((k = kh_get(watermarks, di_mgr->watermarks, record->collector_name)) ==
+      kh_end(di_mgr->watermarks)) {
+    if ((name = strdup(record->collector_name)) == NULL) {
+      return -1;
+    }
+    k = kh_put(watermarks, di_mgr->watermarks, name, &khret);
+    if (khret < 0) {
+      free(name);
+      return -1;
+    }
+    kh_val(di_mgr->watermarks, k) = record->time_sec;
+  } else if (record->time_sec > kh_val(di_mgr->watermarks, k)) {
+    kh_val(di_mgr->watermarks, k) = record->time_sec;
+  }
+  return 0;
+}
+
+/* Is this record from the live DI already covered by the historical DI?
+ *
+ * Only records strictly older than the watermark are. The historical DI may
+ * not have delivered every record of the watermark second (e.g., the dump
+ * ended part-way through it), and there is no reliable way to match records
+ * across sources (MRT and BMP records of the same update differ), so the
+ * records of that second are passed on even if this means some of them are
+ * delivered twice. */
+static int below_watermark(bgpstream_di_mgr_t *di_mgr,
+                           bgpstream_record_t *record)
+{
+  khiter_t k;
+
+  if (record->time_sec == 0) {
+    // no way to tell, so don't risk dropping it
+    return 0;
+  }
+  if ((k = kh_get(watermarks, di_mgr->watermarks, record->collector_name)) !=
+      kh_end(di_mgr->watermarks)) {
+    return record->time_sec < kh_val(di_mgr->watermarks, k);
+  }
+  return record->time_sec < di_mgr->watermark;
+}
+
+/* Switch from the historical DI to the live DI */
+static void hand_over(bgpstream_di_mgr_t *di_mgr)
+{
+  bgpstream_log(BGPSTREAM_LOG_INFO,
+                "historical data exhausted, switching to the '%s' data "
+                "interface (watermark: %" PRIu32 ")",
+                LIVE_DI->info.name, di_mgr->watermark);
+  di_mgr->active_di = di_mgr->live_di;
+  di_mgr->backfilling = 0;
+  // from now on we stream
+  di_mgr->blocking = 1;
+}
+
 /* ========== PUBLIC FUNCTIONS BELOW HERE ========== */
 
 bgpstream_di_mgr_t *bgpstream_di_mgr_create(bgpstream_filter_mgr_t *filter_mgr)
@@ -230,6 +396,9 @@ bgpstream_di_mgr_t *bgpstream_di_mgr_create(bgpstream_filter_mgr_t *filter_mgr)
   if((mgr->res_mgr = bgpstream_resource_mgr_create(filter_mgr)) == NULL) {
     goto err;
   }
+  if ((mgr->watermarks = kh_init(watermarks)) == NULL) {
+    goto err;
+  }
   mgr->active_di = BGPSTREAM_DATA_INTERFACE_BROKER;
   mgr->backoff_time = DATA_INTERFACE_BLOCKING_MIN_WAIT;
 
@@ -314,6 +483,16 @@ bgpstream_di_mgr_get_data_interface_id(bgpstream_di_mgr_t *di_mgr)
   return di_mgr->active_di;
 }
 
+int bgpstream_di_mgr_set_live_data_interface(bgpstream_di_mgr_t *di_mgr,
+                                             bgpstream_data_interface_id_t di_id)
+{
+  if (di_id != 0 && get_di(di_mgr, di_id) == NULL) {
+    return -1;
+  }
+  di_mgr->live_di = di_id;
+  return 0;
+}
+
 int bgpstream_di_mgr_set_data_interface_option(bgpstream_di_mgr_t *di_mgr,
                            const bgpstream_data_interface_option_t *option_type,
                            const char *option_value)
@@ -332,6 +511,19 @@ int bgpstream_di_mgr_start(bgpstream_di_mgr_t *di_mgr)
   if (di_mgr == NULL || ACTIVE_DI == NULL) {
     return -1;
   }
+  if (di_mgr->live_di != 0) {
+    if (di_mgr->live_di == di_mgr->active_di) {
+      bgpstream_log(BGPSTREAM_LOG_ERR,
+                    "the live data interface must differ from the historical "
+                    "one");
+      return -1;
+    }
+    // start it now so that configuration problems surface up front
+    if (LIVE_DI->start(LIVE_DI) != 0) {
+      return -1;
+    }
+    di_mgr->backfilling = 1;
+  }
   return ACTIVE_DI->start(ACTIVE_DI);
 }
 
@@ -340,6 +532,22 @@ void bgpstream_di_mgr_set_blocking(bgpstream_di_mgr_t *di_mgr)
   di_mgr->blocking = 1;
 }
 
+void bgpstream_di_mgr_set_readahead(bgpstream_di_mgr_t *di_mgr, uint64_t len)
+{
+  bgpstream_resource_mgr_set_readahead(di_mgr->res_mgr, len);
+}
+
+void bgpstream_di_mgr_set_max_skew(bgpstream_di_mgr_t *di_mgr, uint32_t skew)
+{
+  bgpstream_resource_mgr_set_max_skew(di_mgr->res_mgr, skew);
+}
+
+int bgpstream_di_mgr_add_mirror(bgpstream_di_mgr_t *di_mgr,
+                                const char *url_prefix, const char *path)
+{
+  return bgpstream_resource_mgr_add_mirror(di_mgr->res_mgr, url_prefix, path);
+}
+
 int
 bgpstream_di_mgr_get_next_record(bgpstream_di_mgr_t *di_mgr,
                                  bgpstream_record_t **record)
@@ -363,10 +571,25 @@ bgpstream_di_mgr_get_next_record(bgpstream_di_mgr_t *di_mgr,
         return -1;
       }
       if (rc > 0) {
+        if (di_mgr->backfilling != 0) {
+          if (update_watermark(di_mgr, *record) != 0) {
+            return -1;
+          }
+        } else if (di_mgr->live_di != 0 && below_watermark(di_mgr, *record)) {
+          // the historical DI already delivered this
+          continue;
+        }
+        if (di_mgr->notify_time != 0) {
+          record_latency(di_mgr);
+        }
         break;
       }
       // must be EOS, try immediately to refill the queue
       continue;
+    } else if (di_mgr->backfilling != 0) {
+      // the historical DI has caught up, so start streaming
+      hand_over(di_mgr);
+      continue;
     } else if (di_mgr->blocking == 0) {
       // queue is empty after a fill attempt, and we're not in blocking mode, so
       // signal EOS
@@ -376,12 +599,21 @@ bgpstream_di_mgr_get_next_record(bgpstream_di_mgr_t *di_mgr,
 
     // either the queue was empty, or it is now
     assert(bgpstream_resource_mgr_empty(di_mgr->res_mgr) != 0);
+    // and so any notification we had was for metadata we weren't interested in
+    di_mgr->notify_time = 0;
 
-    // we're in blocking mode, so we sleep
-    if (sleep(di_mgr->backoff_time) != 0) {
+    // we're in blocking mode, so wait until the DI has something for us (or
+    // until the backoff time expires if it cannot tell us)
+    if ((rc = wait_for_di(di_mgr)) < 0) {
       // interrupted
+      rc = 0;
       break;
     }
+    if (rc > 0) {
+      // the DI has new metadata, so don't back off any further
+      di_mgr->notify_time = epoch_msec();
+      continue;
+    }
     // adjust our sleep time, perhaps
     if (di_mgr->retry_cnt >= DATA_INTERFACE_BLOCKING_RETRY_CNT) {
       di_mgr->backoff_time = di_mgr->backoff_time * 2;
@@ -407,6 +639,18 @@ void bgpstream_di_mgr_destroy(bgpstream_di_mgr_t *di_mgr)
   bgpstream_resource_mgr_destroy(di_mgr->res_mgr);
   di_mgr->res_mgr = NULL;
 
+  if (di_mgr->watermarks != NULL) {
+    khiter_t k;
+    for (k = kh_begin(di_mgr->watermarks); k != kh_end(di_mgr->watermarks);
+         k++) {
+      if (kh_exist(di_mgr->watermarks, k)) {
+        free(kh_key(di_mgr->watermarks, k));
+      }
+    }
+    kh_destroy(watermarks, di_mgr->watermarks);
+    di_mgr->watermarks = NULL;
+  }
+
   free(di_mgr->available_dis);
   di_mgr->available_dis = NULL;
   di_mgr->available_dis_cnt = 0;
@@ -115,6 +115,17 @@ bgpstream_di_mgr_set_data_interface(bgpstream_di_mgr_t *di_mgr,
 bgpstream_data_interface_id_t
 bgpstream_di_mgr_get_data_interface_id(bgpstream_di_mgr_t *di_mgr);
 
+/** Set the data interface to hand over to once the current data interface has
+ * no more historical data
+ *
+ * @param di_mgr        pointer to a data interface manager instance
+ * @param di_id         ID of the live data interface (0 to disable hand-over)
+ * @return 0 if the data interface was set successfully, -1 otherwise
+ */
+int
+bgpstream_di_mgr_set_live_data_interface(bgpstream_di_mgr_t *di_mgr,
+                                         bgpstream_data_interface_id_t di_id);
+
 /** Set the given option to the given value for the given data interface
  *
  * @param di_mgr        pointer to a data interface manager instance
@@ -134,6 +145,31 @@ int bgpstream_di_mgr_set_data_interface_option(
  */
 void bgpstream_di_mgr_set_blocking(bgpstream_di_mgr_t *di_mgr);
 
+/** Set the maximum number of bytes to read ahead of the parser for each open
+ * resource
+ *
+ * @param di_mgr        pointer to a data interface manager instance
+ * @param len           read-ahead allowance in bytes (0 disables read-ahead)
+ */
+void bgpstream_di_mgr_set_readahead(bgpstream_di_mgr_t *di_mgr, uint64_t len);
+
+/** Set how far ahead of a stalled stream other streams may be read
+ *
+ * @param di_mgr        pointer to a data interface manager instance
+ * @param skew          maximum skew in seconds (0 keeps strict time order)
+ */
+void bgpstream_di_mgr_set_max_skew(bgpstream_di_mgr_t *di_mgr, uint32_t skew);
+
+/** Add a local mirror of a remote archive
+ *
+ * @param di_mgr        pointer to a data interface manager instance
+ * @param url_prefix    URL prefix of the files that are mirrored
+ * @param path          local directory that holds the mirrored files
+ * @return 0 if the mirror was added successfully, -1 otherwise
+ */
+int bgpstream_di_mgr_add_mirror(bgpstream_di_mgr_t *di_mgr,
+                                const char *url_prefix, const char *path);
+
 /** Start the data interface
  *
  * @param di_mgr        pointer to a data interface manager instance
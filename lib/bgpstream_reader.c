@@ -29,7 +29,9 @@
 #include "bgpstream_log.h"
 #include "utils.h"
 #include <assert.h>
+#include <errno.h>
 #include <pthread.h>
+#include <sys/time.h>
 #include <unistd.h>
 
 #define DUMP_OPEN_MAX_RETRIES 5
@@ -38,6 +40,14 @@
 #define PREFETCH_IDX (reader->rec_buf_prefetch_idx)
 #define EXPORTED_IDX ((reader->rec_buf_prefetch_idx + 1) % 2)
 
+/** Number of records that a stream decoder thread may decode ahead of the
+    consumer */
+#define DECODE_RING_LEN 32
+
+/** How long a stream decoder thread waits before polling an idle stream again
+    (in msec) */
+#define DECODE_IDLE_WAIT 100
+
 
 struct bgpstream_reader {
 
@@ -76,6 +86,30 @@ struct bgpstream_reader {
 
   // what is the time of the next record (PREFETCH)
   uint32_t next_time;
+
+  // is this a stream that is decoded on the opener thread? (set at creation)
+  int threaded;
+
+  // STREAM DECODER STATE (only used if threaded, must use mutex)
+
+  // ring of decoded records, ring_cnt of which (starting at ring_head) are
+  // waiting to be exported
+  bgpstream_record_t *ring[DECODE_RING_LEN];
+  int ring_head;
+  int ring_cnt;
+
+  // index of the record currently lent to the caller (-1 if none)
+  int ring_lent;
+
+  // signalled when space is freed in the ring (or the reader is destroyed)
+  pthread_cond_t ring_space_cond;
+
+  // has the decoder stopped? (decoder_status says why)
+  int decoder_done;
+  bgpstream_format_status_t decoder_status;
+
+  // should the decoder stop?
+  int shutdown;
 };
 
 static int prefetch_record(bgpstream_reader_t *reader)
@@ -147,6 +181,74 @@ static int prepopulate_record(bgpstream_record_t *record,
   return 0;
 }
 
+/* Can this resource be decoded ahead of the consumer on its own thread?
+ *
+ * This is only done for (live) streams, where decoding is the bottleneck.
+ * Formats whose elem extraction depends on state shared between records (e.g.,
+ * the MRT TABLE_DUMP_V2 peer index table) must be decoded in lockstep with the
+ * consumer, so for now only BMP streams qualify. */
+static int use_decoder_thread(bgpstream_resource_t *res)
+{
+  return res->duration == BGPSTREAM_FOREVER &&
+         res->format_type == BGPSTREAM_RESOURCE_FORMAT_BMP;
+}
+
+/* Decode records into the ring until the reader is destroyed or the stream
+ * ends. Called (on the opener thread) with the mutex held. */
+static void decode_stream(bgpstream_reader_t *reader)
+{
+  bgpstream_record_t *record;
+  bgpstream_format_status_t status;
+  struct timeval tv;
+  struct timespec deadline;
+
+  while (reader->shutdown == 0) {
+    if (reader->ring_cnt + (reader->ring_lent >= 0) == DECODE_RING_LEN) {
+      // wait for the consumer to catch up
+      pthread_cond_wait(&reader->ring_space_cond, &reader->mutex);
+      continue;
+    }
+    record = reader->ring[(reader->ring_head + reader->ring_cnt) %
+                          DECODE_RING_LEN];
+    pthread_mutex_unlock(&reader->mutex);
+
+    bgpstream_record_clear(record);
+    status = bgpstream_format_populate_record(reader->format, record);
+
+    pthread_mutex_lock(&reader->mutex);
+    switch (status) {
+    case BGPSTREAM_FORMAT_OK:
+      reader->ring_cnt++;
+      break;
+
+    case BGPSTREAM_FORMAT_END_OF_DUMP:
+    case BGPSTREAM_FORMAT_FILTERED_DUMP:
+    case BGPSTREAM_FORMAT_EMPTY_DUMP:
+      // nothing to read right now, check back soon
+      gettimeofday(&tv, NULL);
+      deadline.tv_sec = tv.tv_sec + DECODE_IDLE_WAIT / 1000;
+      deadline.tv_nsec =
+        (tv.tv_usec + (DECODE_IDLE_WAIT % 1000) * 1000) * 1000;
+      if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+      }
+      while (reader->shutdown == 0 &&
+             pthread_cond_timedwait(&reader->ring_space_cond, &reader->mutex,
+                                    &deadline) != ETIMEDOUT)
+        ;
+      break;
+
+    default:
+      // the record carries the bad news to the consumer, and we're done
+      reader->ring_cnt++;
+      reader->decoder_status = status;
+      reader->decoder_done = 1;
+      return;
+    }
+  }
+}
+
 static void *threaded_opener(void *user)
 {
   bgpstream_reader_t *reader = (bgpstream_reader_t *)user;
@@ -176,6 +278,16 @@ static void *threaded_opener(void *user)
       "Could not open dumpfile (%s) after %d attempts. Giving up.",
       reader->res->uri, DUMP_OPEN_MAX_RETRIES);
     reader->status = BGPSTREAM_FORMAT_CANT_OPEN_DUMP;
+  } else if (reader->threaded != 0) {
+    // create the decode ring
+    for (i = 0; i < DECODE_RING_LEN; i++) {
+      if ((reader->ring[i] = bgpstream_record_create(reader->format)) ==
+            NULL ||
+          prepopulate_record(reader->ring[i], reader->res) != 0) {
+        reader->status = BGPSTREAM_FORMAT_CANT_OPEN_DUMP;
+        break;
+      }
+    }
   } else {
     // create the pair of records
     for (i=0; i<2; i++) {
@@ -195,6 +307,12 @@ static void *threaded_opener(void *user)
   }
   reader->dump_ready = 1;
   pthread_cond_signal(&reader->dump_ready_cond);
+
+  // streams are decoded here from now on
+  if (reader->threaded != 0 &&
+      reader->status != BGPSTREAM_FORMAT_CANT_OPEN_DUMP) {
+    decode_stream(reader);
+  }
   pthread_mutex_unlock(&reader->mutex);
 
   return NULL;
@@ -222,6 +340,9 @@ bgpstream_reader_create(bgpstream_resource_t *resource,
   pthread_cond_init(&reader->dump_ready_cond, NULL);
   reader->dump_ready = 0;
   reader->skip_dump_check = 0;
+  reader->threaded = use_decoder_thread(resource);
+  reader->ring_lent = -1;
+  pthread_cond_init(&reader->ring_space_cond, NULL);
   pthread_create(&reader->opener_thread, NULL, threaded_opener, reader);
 
   return reader;
@@ -239,16 +360,25 @@ void bgpstream_reader_destroy(bgpstream_reader_t *reader)
     return;
   }
 
-  // Ensure the thread is done
+  // Ensure the thread is done (stopping the decoder if there is one)
+  pthread_mutex_lock(&reader->mutex);
+  reader->shutdown = 1;
+  pthread_cond_signal(&reader->ring_space_cond);
+  pthread_mutex_unlock(&reader->mutex);
   pthread_join(reader->opener_thread, NULL);
   pthread_mutex_destroy(&reader->mutex);
   pthread_cond_destroy(&reader->dump_ready_cond);
+  pthread_cond_destroy(&reader->ring_space_cond);
 
   int i;
   for (i=0; i<2; i++) {
     bgpstream_record_destroy(reader->rec_buf[i]);
     reader->rec_buf[i] = NULL;
   }
+  for (i = 0; i < DECODE_RING_LEN; i++) {
+    bgpstream_record_destroy(reader->ring[i]);
+    reader->ring[i] = NULL;
+  }
 
   bgpstream_format_destroy(reader->format);
 
@@ -275,6 +405,43 @@ int bgpstream_reader_open_wait(bgpstream_reader_t *reader)
   return 0;
 }
 
+/* get_next_record for streams that are decoded on their own thread */
+static bgpstream_reader_status_t
+get_next_decoded_record(bgpstream_reader_t *reader,
+                        bgpstream_record_t **record)
+{
+  bgpstream_reader_status_t rs;
+
+  pthread_mutex_lock(&reader->mutex);
+
+  // the caller is done with the previous record
+  if (reader->ring_lent >= 0) {
+    reader->ring_lent = -1;
+    pthread_cond_signal(&reader->ring_space_cond);
+  }
+
+  if (reader->ring_cnt > 0) {
+    *record = reader->ring[reader->ring_head];
+    reader->ring_lent = reader->ring_head;
+    reader->ring_head = (reader->ring_head + 1) % DECODE_RING_LEN;
+    reader->ring_cnt--;
+    // (the time only changes here so that the resource manager sees a
+    // consistent value)
+    reader->next_time = (reader->ring_cnt > 0)
+                          ? reader->ring[reader->ring_head]->time_sec
+                          : (*record)->time_sec;
+    rs = BGPSTREAM_READER_STATUS_OK;
+  } else if (reader->decoder_done != 0 &&
+             reader->decoder_status == BGPSTREAM_FORMAT_OUTSIDE_TIME_INTERVAL) {
+    rs = BGPSTREAM_READER_STATUS_EOS;
+  } else {
+    rs = BGPSTREAM_READER_STATUS_AGAIN;
+  }
+
+  pthread_mutex_unlock(&reader->mutex);
+  return rs;
+}
+
 int bgpstream_reader_get_next_record(bgpstream_reader_t *reader,
                                      bgpstream_record_t **record)
 {
@@ -290,6 +457,10 @@ int bgpstream_reader_get_next_record(bgpstream_reader_t *reader,
     return BGPSTREAM_READER_STATUS_EOS;
   }
 
+  if (reader->threaded != 0) {
+    return get_next_decoded_record(reader, record);
+  }
+
   // mark the previous record as unfilled (about to become PREFETCH_IDX)
   reader->rec_buf_filled[EXPORTED_IDX] = 0;
   // the record contents will be cleared by the next prefetch
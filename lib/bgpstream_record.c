@@ -92,51 +92,40 @@ void bgpstream_record_print_mrt_data(bgpstream_record_t *const record)
 static int bgpstream_elem_prefix_match(bgpstream_patricia_tree_t *prefixes,
                                        bgpstream_pfx_t *search)
 {
-
-  bgpstream_patricia_tree_result_set_t *res = NULL;
+  bgpstream_patricia_tree_iter_t iter;
   bgpstream_patricia_node_t *it;
-  int matched = 0;
 
   /* If this is an exact match, the allowable matches don't matter */
   if (bgpstream_patricia_tree_search_exact(prefixes, search)) {
     return 1;
   }
 
-  bgpstream_patricia_node_t *n =
-    bgpstream_patricia_tree_insert(prefixes, search);
-
   /* Check for less specific prefixes that have the "MORE" match flag */
-  res = bgpstream_patricia_tree_result_set_create();
-  bgpstream_patricia_tree_get_less_specifics(prefixes, n, res);
+  bgpstream_patricia_tree_iter_less_specifics(&iter, prefixes, search);
 
-  while ((it = bgpstream_patricia_tree_result_set_next(res)) != NULL) {
+  while ((it = bgpstream_patricia_tree_iter_next(&iter)) != NULL) {
     bgpstream_pfx_t *pfx = bgpstream_patricia_tree_get_pfx(it);
 
     if (pfx->allowed_matches == BGPSTREAM_PREFIX_MATCH_ANY ||
         pfx->allowed_matches == BGPSTREAM_PREFIX_MATCH_MORE) {
-      matched = 1;
-      goto endmatch;
+      return 1;
     }
   }
 
-  bgpstream_patricia_tree_get_more_specifics(prefixes, n, res);
+  bgpstream_patricia_tree_iter_more_specifics(&iter, prefixes, search);
 
-  while ((it = bgpstream_patricia_tree_result_set_next(res)) != NULL) {
+  while ((it = bgpstream_patricia_tree_iter_next(&iter)) != NULL) {
     bgpstream_pfx_t *pfx = bgpstream_patricia_tree_get_pfx(it);
 
     /* TODO maybe have a way of limiting the amount of bits we are allowed to
      * go back? or make it specifiable via the language? */
     if (pfx->allowed_matches == BGPSTREAM_PREFIX_MATCH_ANY ||
         pfx->allowed_matches == BGPSTREAM_PREFIX_MATCH_LESS) {
-      matched = 1;
-      goto endmatch;
+      return 1;
     }
   }
 
-endmatch:
-  bgpstream_patricia_tree_result_set_destroy(&res);
-  bgpstream_patricia_tree_remove_node(prefixes, n);
-  return matched;
+  return 0;
 }
 
 static int elem_check_filters(bgpstream_record_t *record,
@@ -32,6 +32,7 @@
 #include "config.h"
 #include "utils.h"
 #include "bgpstream_resource.h"
+#include <inttypes.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -151,3 +152,11 @@ int bgpstream_resource_hash_snprintf(char* buf, size_t buf_len, bgpstream_resour
                   res->record_type == BGPSTREAM_RIB ? "ribs" : "updates",
                   res->initial_time, res->duration);
 }
+
+int bgpstream_resource_kafka_group_snprintf(char *buf, size_t buf_len)
+{
+  uint64_t ts = epoch_msec();
+
+  srand(ts);
+  return snprintf(buf, buf_len, "bgpstream-%" PRIx64 "-%x", ts, rand());
+}
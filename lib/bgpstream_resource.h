@@ -71,7 +71,8 @@ typedef enum bgpstream_resource_attr_type {
 
   /* BGPSTREAM_RESOURCE_TRANSPORT_KAFKA options */
 
-  /** The topics to consume raw BMP data from (comma-separated) */
+  /** The topics to consume raw BMP data from (comma-separated). Topics that
+      start with "^" are regular expressions */
   BGPSTREAM_RESOURCE_ATTR_KAFKA_TOPICS = 0,
 
   /** The consumer group to use (for load balancing). If unset, defaults to a
@@ -84,6 +85,21 @@ typedef enum bgpstream_resource_attr_type {
   /** The path toward a local cache */
   BGPSTREAM_RESOURCE_ATTR_CACHE_DIR_PATH = 3,
 
+  /** The maximum number of concurrent range requests to use when downloading
+      a resource into the local cache (only used for HTTP(S) URIs) */
+  BGPSTREAM_RESOURCE_ATTR_CACHE_FETCH_CONNECTIONS = 4,
+
+  /** Unix time (in seconds) to start consuming from. Each partition is read
+      from the first message produced at or after this time (or from the
+      consumer group's committed offset, if that is later). Overrides the
+      initial offset when set */
+  BGPSTREAM_RESOURCE_ATTR_KAFKA_TIMESTAMP_FROM = 5,
+
+  /** How often (in seconds) to refresh topic metadata. Topics that match a
+      regex subscription (i.e., one that starts with "^") are only found when
+      the metadata is refreshed */
+  BGPSTREAM_RESOURCE_ATTR_KAFKA_METADATA_REFRESH = 6,
+
   /** INTERNAL: The total number of attribute types in use */
   _BGPSTREAM_RESOURCE_ATTR_CNT,
 
@@ -128,6 +144,10 @@ typedef struct bgpstream_resource {
   /** The type of records provided by the resource */
   bgpstream_record_type_t record_type;
 
+  /** Maximum number of bytes that a background thread may read from the
+      transport ahead of the parser. A value of 0 disables read-ahead. */
+  uint64_t readahead_len;
+
   /** Extra attributes provided by the data interface that can be used by the
    * transport or format layers (they are optional as some may be provided by
    * the transport or format layers)
@@ -188,4 +208,15 @@ bgpstream_resource_get_attr(bgpstream_resource_t *resource,
  */
 int bgpstream_resource_hash_snprintf(char* buf, size_t buf_len, bgpstream_resource_t *resource);
 
+/** Generate a "random" Kafka consumer group name
+ *
+ * @param buf           pointer to the buffer that stores the group name
+ * @param buf_len       buffer size
+ * @return the number of characters written (as for snprintf)
+ *
+ * The name is built from the current time and a random number, so that
+ * separate BGPStream instances do not share a group by accident.
+ */
+int bgpstream_resource_kafka_group_snprintf(char *buf, size_t buf_len);
+
 #endif /* __BGPSTREAM_RESOURCE_H */
@@ -31,9 +31,11 @@
 #include "config.h"
 #include "utils.h"
 #include <assert.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 /** TODO: Fix the rib period filter to not need to build this string as this
@@ -45,6 +47,9 @@
 #define AGAIN_POLL_INTERVAL 500
 #define MSEC_TO_NSEC 1000000
 
+/** Maximum length of the path of a mirrored file */
+#define MIRROR_PATH_LEN 4096
+
 struct res_list_elem {
   /** The resource info */
   bgpstream_resource_t *res;
@@ -59,6 +64,10 @@ struct res_list_elem {
       immediately) */
   uint32_t next_poll;
 
+  /** Time (in msec) when this resource last gave us a record (0 if it never
+      has) */
+  uint64_t last_record;
+
   /** Previous list elem */
   struct res_list_elem *prev;
 
@@ -96,6 +105,17 @@ struct res_group {
   struct res_group *next;
 };
 
+struct mirror {
+
+  /** URL prefix of the mirrored files */
+  char *url_prefix;
+
+  size_t url_prefix_len;
+
+  /** Local directory that replaces the URL prefix */
+  char *path;
+};
+
 struct bgpstream_resource_mgr {
 
   /** Ordered queue of resources, grouped by timestamp (i.e. group by second).
@@ -113,6 +133,17 @@ struct bgpstream_resource_mgr {
   // borrowed pointer to a filter manager instance
   bgpstream_filter_mgr_t *filter_mgr;
 
+  // read-ahead allowance given to each new resource
+  uint64_t readahead_len;
+
+  // how far (in seconds) other streams may be read ahead of a stalled one
+  uint32_t max_skew;
+
+  // local mirrors of remote archives
+  struct mirror *mirrors;
+
+  int mirrors_cnt;
+
 };
 
 static int open_batch(bgpstream_resource_mgr_t *q, struct res_group *gp);
@@ -635,6 +666,91 @@ static int open_batch(bgpstream_resource_mgr_t *q, struct res_group *gp)
   return 0;
 }
 
+/* Move a resource to the back of its group's list (without changing any
+ * counts) */
+static void move_to_back(struct res_group *gp, struct res_list_elem *el)
+{
+  struct res_list_elem *tail = el;
+
+  if (el->next == NULL) {
+    return;
+  }
+  while (tail->next != NULL) {
+    tail = tail->next;
+  }
+  // unlink
+  el->next->prev = el->prev;
+  if (el->prev != NULL) {
+    el->prev->next = el->next;
+  } else {
+    gp->res_list[el->res->record_type] = el->next;
+  }
+  // and append
+  el->next = NULL;
+  el->prev = tail;
+  tail->next = el;
+}
+
+/* Should other streams stop waiting for this one? This is the case if it has
+ * never given us a record (e.g., a consumer that was assigned no partitions),
+ * or has been quiet for longer than the skew. With strict ordering (no skew),
+ * every stream is waited for */
+static int stream_idle(bgpstream_resource_mgr_t *q, struct res_list_elem *el,
+                       uint64_t now)
+{
+  if (q->max_skew == 0 || el->res->duration != BGPSTREAM_FOREVER) {
+    // dump files never stall
+    return 0;
+  }
+  return el->last_record == 0 ||
+         now - el->last_record > (uint64_t)q->max_skew * 1000;
+}
+
+/* Find an open resource that is not waiting to be polled, in a group that is
+ * at most max_skew seconds newer than the oldest stream that is not idle */
+static struct res_list_elem *find_ready_elem(bgpstream_resource_mgr_t *q,
+                                             uint32_t now,
+                                             struct res_group **gpp)
+{
+  static const bgpstream_record_type_t types[] = {BGPSTREAM_RIB,
+                                                 BGPSTREAM_UPDATE};
+  struct res_group *gp;
+  struct res_list_elem *el;
+  uint64_t now_msec = epoch_msec();
+  uint32_t base = 0;
+  int base_found = 0;
+  int i;
+
+  // idle streams would otherwise hold the head of the queue (forever, if they
+  // never give us a record), so the skew is measured from the oldest stream
+  // that is still active. if there is none, any ready resource will do
+  for (gp = q->head; gp != NULL && base_found == 0; gp = gp->next) {
+    for (i = 0; i < ARR_CNT(types) && base_found == 0; i++) {
+      for (el = gp->res_list[types[i]]; el != NULL; el = el->next) {
+        if (el->open != 0 && stream_idle(q, el, now_msec) == 0) {
+          base = gp->time;
+          base_found = 1;
+          break;
+        }
+      }
+    }
+  }
+
+  for (gp = q->head; gp != NULL && (base_found == 0 || gp->time <= base ||
+                                    gp->time - base <= q->max_skew);
+       gp = gp->next) {
+    for (i = 0; i < ARR_CNT(types); i++) {
+      for (el = gp->res_list[types[i]]; el != NULL; el = el->next) {
+        if (el->open != 0 && (el->next_poll == 0 || el->next_poll <= now)) {
+          *gpp = gp;
+          return el;
+        }
+      }
+    }
+  }
+  return NULL;
+}
+
 // when this is called we are guaranteed to have at least one open resource, and
 // if things have gone right, we should read from the first resource in the
 // queue. once we have read from the resource, we should check the new time of
@@ -645,15 +761,17 @@ static bgpstream_reader_status_t pop_record(bgpstream_resource_mgr_t *q,
   uint32_t prev_time;
   bgpstream_reader_status_t rs;
   struct res_list_elem *el = NULL;
-  struct res_list_elem *tmp_el = NULL;
-  struct res_group *gp = NULL;
+  struct res_group *gp = q->head;
+  struct res_list_elem *ready_el;
+  struct res_group *ready_gp;
   uint32_t now;
   uint64_t sleep_nsec;
   struct timespec rqtp;
 
   // the resource we want to read from MUST be in the first group (q->head), and
   // will either be the head of the RIBS list if there are any ribs, otherwise
-  // it will be the head of the updates list
+  // it will be the head of the updates list (unless it is a stalled stream and
+  // a skew is allowed, see below)
   if (q->head->res_list[BGPSTREAM_RIB] != NULL) {
     el = q->head->res_list[BGPSTREAM_RIB];
   } else {
@@ -667,6 +785,13 @@ static bgpstream_reader_status_t pop_record(bgpstream_resource_mgr_t *q,
   // all other resources already polled.
   if (el->next_poll > 0) {
     now = epoch_msec();
+    // rather than wait for this stream, read from one that is not too far
+    // ahead of it (or of the oldest stream that is not idle)
+    if (el->next_poll > now && q->max_skew > 0 &&
+        (ready_el = find_ready_elem(q, now, &ready_gp)) != NULL) {
+      el = ready_el;
+      gp = ready_gp;
+    }
     if (el->next_poll > now) {
       sleep_nsec = (el->next_poll - now) * MSEC_TO_NSEC;
       rqtp.tv_sec = sleep_nsec / 1000000000;
@@ -695,17 +820,7 @@ static bgpstream_reader_status_t pop_record(bgpstream_resource_mgr_t *q,
   // if we got AGAIN, then move ourselves to the end of our group to give others
   // a fair shake
   if (rs == BGPSTREAM_READER_STATUS_AGAIN) {
-    assert(el->prev == NULL);
-    if (el->next != NULL) {
-      tmp_el = el;
-      while (tmp_el->next != NULL) {
-        tmp_el = tmp_el->next;
-      }
-      assert(el != tmp_el);
-      el->next = NULL;
-      tmp_el->next = el;
-      el->prev = tmp_el;
-    }
+    move_to_back(gp, el);
     // and then tell the caller that while we didn't get anything useful, they
     // should try again soon
     el->next_poll = epoch_msec() + AGAIN_POLL_INTERVAL;
@@ -714,26 +829,18 @@ static bgpstream_reader_status_t pop_record(bgpstream_resource_mgr_t *q,
 
   // otherwise we must valid, or EOS
   assert(rs == BGPSTREAM_READER_STATUS_EOS || rs == BGPSTREAM_READER_STATUS_OK);
+  if (rs == BGPSTREAM_READER_STATUS_OK) {
+    el->last_record = epoch_msec();
+  }
 
   // if the time has changed or we've reached EOS, pop from the queue
   if (get_next_time(el) != prev_time || rs == BGPSTREAM_READER_STATUS_EOS) {
     // first, remove this list elem from the group
-    pop_res_el(q, q->head, el);
+    pop_res_el(q, gp, el);
 
     // if we have emptied the group, remove the group
-    if (q->head->res_cnt == 0) {
-      gp = q->head;
-      q->head = gp->next;
-      if (q->head != NULL) {
-        q->head->prev = NULL;
-      }
-      if (q->tail == gp) {
-        q->tail = q->head;
-      }
-
-      // and then destroy the group
-      gp->next = NULL;
-      res_group_destroy(gp, 0);
+    if (gp->res_cnt == 0) {
+      reap_groups(q);
     }
 
     if (rs == BGPSTREAM_READER_STATUS_EOS) {
@@ -785,6 +892,36 @@ static int wanted_resource(bgpstream_resource_t *res,
   return 1;
 }
 
+/* if a local copy of the given uri exists, write its path into buf and return
+   1, otherwise return 0 */
+static int find_mirror_copy(bgpstream_resource_mgr_t *q, const char *uri,
+                            char *buf, size_t len)
+{
+  struct mirror *m = NULL;
+  struct stat st;
+  int i;
+
+  for (i = 0; i < q->mirrors_cnt; i++) {
+    if (strncmp(uri, q->mirrors[i].url_prefix, q->mirrors[i].url_prefix_len) ==
+          0 &&
+        (m == NULL || q->mirrors[i].url_prefix_len > m->url_prefix_len)) {
+      m = &q->mirrors[i];
+    }
+  }
+  if (m == NULL) {
+    return 0;
+  }
+
+  if (snprintf(buf, len, "%s/%s", m->path, uri + m->url_prefix_len) >= len) {
+    return 0;
+  }
+  if (stat(buf, &st) != 0 || !S_ISREG(st.st_mode)) {
+    // not mirrored (yet), use the remote copy
+    return 0;
+  }
+  return 1;
+}
+
 /* ========== PUBLIC METHODS BELOW HERE ========== */
 
 bgpstream_resource_mgr_t *
@@ -819,9 +956,58 @@ bgpstream_resource_mgr_destroy(bgpstream_resource_mgr_t *q)
   // filter manager is a borrowed pointer
   q->filter_mgr = NULL;
 
+  int i;
+  for (i = 0; i < q->mirrors_cnt; i++) {
+    free(q->mirrors[i].url_prefix);
+    free(q->mirrors[i].path);
+  }
+  free(q->mirrors);
+  q->mirrors = NULL;
+  q->mirrors_cnt = 0;
+
   free(q);
 }
 
+void
+bgpstream_resource_mgr_set_readahead(bgpstream_resource_mgr_t *q,
+                                     uint64_t len)
+{
+  q->readahead_len = len;
+}
+
+void
+bgpstream_resource_mgr_set_max_skew(bgpstream_resource_mgr_t *q,
+                                    uint32_t skew)
+{
+  q->max_skew = skew;
+}
+
+int
+bgpstream_resource_mgr_add_mirror(bgpstream_resource_mgr_t *q,
+                                  const char *url_prefix, const char *path)
+{
+  struct mirror *m;
+
+  if ((m = realloc(q->mirrors, sizeof(struct mirror) * (q->mirrors_cnt + 1))) ==
+      NULL) {
+    return -1;
+  }
+  q->mirrors = m;
+  m = &q->mirrors[q->mirrors_cnt];
+
+  if ((m->url_prefix = strdup(url_prefix)) == NULL) {
+    return -1;
+  }
+  m->url_prefix_len = strlen(url_prefix);
+  if ((m->path = strdup(path)) == NULL) {
+    free(m->url_prefix);
+    return -1;
+  }
+  q->mirrors_cnt++;
+
+  return 0;
+}
+
 int
 bgpstream_resource_mgr_push(bgpstream_resource_mgr_t *q,
                             bgpstream_resource_transport_type_t transport_type,
@@ -835,16 +1021,28 @@ bgpstream_resource_mgr_push(bgpstream_resource_mgr_t *q,
 {
   bgpstream_resource_t *res = NULL;
   struct res_list_elem *el = NULL;
+  char mirror_path[MIRROR_PATH_LEN];
   if (resp != NULL) {
     *resp = NULL;
   }
 
+  // prefer a local copy of the file if we have one
+  if ((transport_type == BGPSTREAM_RESOURCE_TRANSPORT_FILE ||
+       transport_type == BGPSTREAM_RESOURCE_TRANSPORT_CACHE) &&
+      find_mirror_copy(q, uri, mirror_path, sizeof(mirror_path)) != 0) {
+    bgpstream_log(BGPSTREAM_LOG_FINE, "Using mirrored copy %s of %s",
+                  mirror_path, uri);
+    uri = mirror_path;
+    transport_type = BGPSTREAM_RESOURCE_TRANSPORT_FILE;
+  }
+
   // first create the resource
   if ((res = bgpstream_resource_create(transport_type, format_type, uri,
                                        initial_time, duration, project,
                                        collector, record_type)) == NULL) {
     return -1;
   }
+  res->readahead_len = q->readahead_len;
 
   // before we insert, lets check if it matches our RIB period filter (if we
   // have one)
@@ -876,6 +1074,66 @@ bgpstream_resource_mgr_push(bgpstream_resource_mgr_t *q,
   return -1;
 }
 
+int
+bgpstream_resource_mgr_push_kafka(bgpstream_resource_mgr_t *q,
+                                  bgpstream_resource_format_type_t format_type,
+                                  const char *brokers,
+                                  const char *project, const char *collector,
+                                  const char *topics, const char *group,
+                                  const char *offset,
+                                  uint32_t metadata_refresh,
+                                  uint32_t consumers)
+{
+  char group_buf[64];
+  char refresh_buf[32];
+  char from_buf[32];
+  bgpstream_resource_t *res = NULL;
+  uint32_t i;
+  int rc;
+
+  // all of the consumers must join the same group to share the partitions
+  if (consumers > 1 && group == NULL) {
+    bgpstream_resource_kafka_group_snprintf(group_buf, sizeof(group_buf));
+    group = group_buf;
+  }
+
+  snprintf(refresh_buf, sizeof(refresh_buf), "%" PRIu32, metadata_refresh);
+  snprintf(from_buf, sizeof(from_buf), "%" PRIi64,
+           q->filter_mgr->time_intervals_min);
+
+  for (i = 0; i < consumers; i++) {
+    // we treat kafka as having data from <recent> to <forever>
+    if ((rc = bgpstream_resource_mgr_push(
+           q, BGPSTREAM_RESOURCE_TRANSPORT_KAFKA, format_type, brokers,
+           0, // indicate we don't know how much historical data there is
+           BGPSTREAM_FOREVER, // indicate that the resource is a "stream"
+           project, collector, BGPSTREAM_UPDATE, &res)) <= 0) {
+      return rc;
+    }
+    assert(res != NULL);
+
+    if (bgpstream_resource_set_attr(res, BGPSTREAM_RESOURCE_ATTR_KAFKA_TOPICS,
+                                    topics) != 0 ||
+        (group != NULL &&
+         bgpstream_resource_set_attr(
+           res, BGPSTREAM_RESOURCE_ATTR_KAFKA_CONSUMER_GROUP, group) != 0) ||
+        (offset != NULL &&
+         bgpstream_resource_set_attr(
+           res, BGPSTREAM_RESOURCE_ATTR_KAFKA_INIT_OFFSET, offset) != 0) ||
+        (metadata_refresh > 0 &&
+         bgpstream_resource_set_attr(
+           res, BGPSTREAM_RESOURCE_ATTR_KAFKA_METADATA_REFRESH,
+           refresh_buf) != 0) ||
+        (q->filter_mgr->time_intervals_min > 0 &&
+         bgpstream_resource_set_attr(
+           res, BGPSTREAM_RESOURCE_ATTR_KAFKA_TIMESTAMP_FROM, from_buf) != 0)) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
 int
 bgpstream_resource_mgr_empty(bgpstream_resource_mgr_t *q)
 {
@@ -45,6 +45,43 @@ bgpstream_resource_mgr_create(bgpstream_filter_mgr_t *filter_mgr);
 void
 bgpstream_resource_mgr_destroy(bgpstream_resource_mgr_t *q);
 
+/** Set the read-ahead allowance for resources added to the queue
+ *
+ * @param q             pointer to the queue
+ * @param len           maximum number of bytes to read ahead of the parser for
+ *                      each open resource (0 disables read-ahead)
+ */
+void
+bgpstream_resource_mgr_set_readahead(bgpstream_resource_mgr_t *q,
+                                     uint64_t len);
+
+/** Set how far ahead of a stalled stream other streams may be read
+ *
+ * @param q             pointer to the queue
+ * @param skew          maximum time (in seconds) that records may be delivered
+ *                      ahead of a stream that has no data available
+ *                      (0 keeps strict time order, the default)
+ */
+void
+bgpstream_resource_mgr_set_max_skew(bgpstream_resource_mgr_t *q,
+                                    uint32_t skew);
+
+/** Add a local mirror of a remote archive
+ *
+ * @param q             pointer to the queue
+ * @param url_prefix    URL prefix of the files that are mirrored
+ * @param path          local directory that holds the mirrored files
+ * @return 0 if the mirror was added successfully, -1 otherwise
+ *
+ * When a resource is pushed whose URI starts with `url_prefix`, the prefix is
+ * replaced with `path` and, if a file exists there, the resource is read from
+ * it using the file transport instead. If several mirrors match, the one with
+ * the longest prefix is used.
+ */
+int
+bgpstream_resource_mgr_add_mirror(bgpstream_resource_mgr_t *q,
+                                  const char *url_prefix, const char *path);
+
 /** Add a resource item to the queue
  *
  * @param q               pointer to the queue
@@ -72,6 +109,37 @@ bgpstream_resource_mgr_push(bgpstream_resource_mgr_t *q,
                             bgpstream_record_type_t record_type,
                             bgpstream_resource_t **res);
 
+/** Add a set of Kafka consumers of the same topics to the queue
+ *
+ * @param q               pointer to the queue
+ * @param format_type     format of the messages in the topics
+ * @param brokers         borrowed pointer to a comma-separated broker list
+ * @param project         borrowed pointer to a project name string
+ * @param collector       borrowed pointer to a collector name string
+ * @param topics          borrowed pointer to the topics to consume from
+ * @param group           borrowed pointer to a consumer group name (or NULL)
+ * @param offset          borrowed pointer to the initial offset (or NULL)
+ * @param metadata_refresh  how often (in seconds) the consumers refresh the
+ *                        topic metadata (0 to use the transport default)
+ * @param consumers       number of consumers (i.e., resources) to add
+ * @return 0 if the consumers were added (or filtered out), -1 if an error
+ * occurred
+ *
+ * Consumers in the same group share the partitions of the topics between them,
+ * so if there is more than one and no group is given, a random group is
+ * created for them to join. Each consumer skips straight to the first message
+ * that could pass the interval filters.
+ */
+int
+bgpstream_resource_mgr_push_kafka(bgpstream_resource_mgr_t *q,
+                                  bgpstream_resource_format_type_t format_type,
+                                  const char *brokers,
+                                  const char *project, const char *collector,
+                                  const char *topics, const char *group,
+                                  const char *offset,
+                                  uint32_t metadata_refresh,
+                                  uint32_t consumers);
+
 /** Check if the resource manager queue contains any resources
  *
  * @param q             pointer to the queue
@@ -33,6 +33,11 @@
 #include "bgpstream_transport.h"
 #include "bgpstream_log.h"
 #include "utils.h"
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/time.h>
 
 // WITH_TRANSPORT_FILE
 #include "bs_transport_file.h"
@@ -42,6 +47,73 @@
 #include "bs_transport_kafka.h"
 #endif
 
+/** Largest chunk that the read-ahead thread will ask the transport for. This
+    matches the parser buffer and the wandio thread buffer sizes. */
+#define READAHEAD_CHUNK_LEN (1024 * 1024)
+
+/** How long the read-ahead thread waits before polling a stream resource
+    that had no data for us (in msec) */
+#define READAHEAD_STREAM_POLL_INTERVAL 100
+
+/** A single buffer of data read from the transport */
+struct readahead_chunk {
+
+  /** Buffer holding the data */
+  uint8_t *buf;
+
+  /** Number of bytes read into the buffer */
+  int64_t len;
+
+  /** Number of bytes already handed to the caller */
+  int64_t offset;
+};
+
+/** State for the background read-ahead thread.
+ *
+ * The chunks are used as a ring: the reader thread fills the chunk at
+ * (head + filled_cnt), while the caller consumes the chunk at head.
+ */
+struct bgpstream_transport_readahead {
+
+  /** Thread that reads from the transport */
+  pthread_t thread;
+
+  /** Ring of chunk buffers */
+  struct readahead_chunk *chunks;
+
+  /** Number of chunks in the ring */
+  int chunk_cnt;
+
+  /** Size of each chunk buffer */
+  int64_t chunk_len;
+
+  /** Is the resource a stream? (i.e. a zero-length read is not EOF) */
+  int is_stream;
+
+  // ALL BELOW HERE MUST USE MUTEX
+
+  /** Index of the next chunk to hand to the caller */
+  int head;
+
+  /** Number of chunks that are filled and waiting for the caller */
+  int filled_cnt;
+
+  /** Set when the transport reached EOF */
+  int eof;
+
+  /** Set when the transport returned an error */
+  int error;
+
+  /** Set when the transport is being destroyed */
+  int shutdown;
+
+  pthread_mutex_t mutex;
+  pthread_cond_t not_empty;
+  pthread_cond_t not_full;
+};
+
+#define RA (transport->readahead)
+
 /** Convenience typedef for the transport create function type */
 typedef int (*transport_create_func_t)(bgpstream_transport_t *transport);
 
@@ -63,6 +135,219 @@ static const transport_create_func_t create_functions[] = {
 
 };
 
+static void readahead_wait_poll(struct bgpstream_transport_readahead *ra)
+{
+  struct timeval now;
+  struct timespec deadline;
+  uint64_t nsec;
+
+  gettimeofday(&now, NULL);
+  nsec = ((uint64_t)now.tv_usec * 1000) +
+         ((uint64_t)READAHEAD_STREAM_POLL_INTERVAL * 1000000);
+  deadline.tv_sec = now.tv_sec + (nsec / 1000000000);
+  deadline.tv_nsec = nsec % 1000000000;
+
+  // we are woken early only if we are being shut down
+  while (ra->shutdown == 0 &&
+         pthread_cond_timedwait(&ra->not_full, &ra->mutex, &deadline) !=
+           ETIMEDOUT)
+    ;
+}
+
+static void *readahead_thread(void *user)
+{
+  bgpstream_transport_t *transport = (bgpstream_transport_t *)user;
+  struct readahead_chunk *chunk;
+  int64_t rc;
+
+  pthread_mutex_lock(&RA->mutex);
+  while (RA->shutdown == 0) {
+    // wait for a free chunk
+    while (RA->filled_cnt == RA->chunk_cnt && RA->shutdown == 0) {
+      pthread_cond_wait(&RA->not_full, &RA->mutex);
+    }
+    if (RA->shutdown != 0) {
+      break;
+    }
+    // the caller never touches chunks beyond head + filled_cnt, so we can
+    // fill this one without holding the lock
+    chunk = &RA->chunks[(RA->head + RA->filled_cnt) % RA->chunk_cnt];
+    pthread_mutex_unlock(&RA->mutex);
+
+    rc = transport->read(transport, chunk->buf, RA->chunk_len);
+
+    pthread_mutex_lock(&RA->mutex);
+    if (rc < 0) {
+      RA->error = 1;
+      pthread_cond_signal(&RA->not_empty);
+      break;
+    }
+    if (rc == 0) {
+      if (RA->is_stream == 0) {
+        RA->eof = 1;
+        pthread_cond_signal(&RA->not_empty);
+        break;
+      }
+      // nothing available from the stream right now
+      readahead_wait_poll(RA);
+      continue;
+    }
+    chunk->len = rc;
+    chunk->offset = 0;
+    RA->filled_cnt++;
+    pthread_cond_signal(&RA->not_empty);
+  }
+  pthread_mutex_unlock(&RA->mutex);
+
+  return NULL;
+}
+
+static int64_t readahead_read(bgpstream_transport_t *transport,
+                              uint8_t *buffer, int64_t len)
+{
+  struct readahead_chunk *chunk;
+  int64_t copied = 0;
+  int64_t cpy_len;
+
+  pthread_mutex_lock(&RA->mutex);
+  while (RA->filled_cnt == 0 && RA->eof == 0 && RA->error == 0) {
+    if (RA->is_stream != 0) {
+      // streams must not block the caller
+      pthread_mutex_unlock(&RA->mutex);
+      return 0;
+    }
+    pthread_cond_wait(&RA->not_empty, &RA->mutex);
+  }
+
+  // hand over as much buffered data as fits. for streams we stop at the end
+  // of a chunk so that the caller sees the same read boundaries as it would
+  // without read-ahead (e.g., one Kafka message per read).
+  while (RA->filled_cnt > 0 && copied < len) {
+    chunk = &RA->chunks[RA->head];
+    // the reader thread never touches filled chunks, so copy without the lock
+    pthread_mutex_unlock(&RA->mutex);
+
+    cpy_len = chunk->len - chunk->offset;
+    if (cpy_len > len - copied) {
+      cpy_len = len - copied;
+    }
+    memcpy(buffer + copied, chunk->buf + chunk->offset, cpy_len);
+    chunk->offset += cpy_len;
+    copied += cpy_len;
+
+    pthread_mutex_lock(&RA->mutex);
+    if (chunk->offset < chunk->len) {
+      break;
+    }
+    // chunk is drained, give it back to the reader thread
+    RA->head = (RA->head + 1) % RA->chunk_cnt;
+    RA->filled_cnt--;
+    pthread_cond_signal(&RA->not_full);
+    if (RA->is_stream != 0) {
+      break;
+    }
+  }
+
+  // only report an error once all the data read before it has been consumed
+  if (copied == 0 && RA->error != 0) {
+    copied = -1;
+  }
+  pthread_mutex_unlock(&RA->mutex);
+
+  return copied;
+}
+
+static void readahead_destroy(bgpstream_transport_t *transport)
+{
+  int i;
+
+  if (RA == NULL) {
+    return;
+  }
+
+  pthread_mutex_lock(&RA->mutex);
+  RA->shutdown = 1;
+  pthread_cond_broadcast(&RA->not_full);
+  pthread_cond_broadcast(&RA->not_empty);
+  pthread_mutex_unlock(&RA->mutex);
+
+  // this may wait for a blocking transport read to complete
+  pthread_join(RA->thread, NULL);
+
+  pthread_mutex_destroy(&RA->mutex);
+  pthread_cond_destroy(&RA->not_empty);
+  pthread_cond_destroy(&RA->not_full);
+
+  for (i = 0; i < RA->chunk_cnt; i++) {
+    free(RA->chunks[i].buf);
+  }
+  free(RA->chunks);
+
+  free(RA);
+  RA = NULL;
+}
+
+static int readahead_create(bgpstream_transport_t *transport)
+{
+  uint64_t max_len = transport->res->readahead_len;
+  int i;
+
+  if ((RA = malloc_zero(sizeof(struct bgpstream_transport_readahead))) ==
+      NULL) {
+    return -1;
+  }
+
+  // split the memory allowance into chunks
+  if (max_len < READAHEAD_CHUNK_LEN) {
+    RA->chunk_len = max_len;
+    RA->chunk_cnt = 1;
+  } else {
+    RA->chunk_len = READAHEAD_CHUNK_LEN;
+    RA->chunk_cnt = max_len / READAHEAD_CHUNK_LEN;
+  }
+  RA->is_stream = (transport->res->duration == BGPSTREAM_FOREVER);
+
+  if ((RA->chunks = malloc_zero(sizeof(struct readahead_chunk) *
+                                RA->chunk_cnt)) == NULL) {
+    goto err;
+  }
+  for (i = 0; i < RA->chunk_cnt; i++) {
+    if ((RA->chunks[i].buf = malloc(RA->chunk_len)) == NULL) {
+      // only free the chunks that we managed to allocate
+      RA->chunk_cnt = i;
+      goto err_chunks;
+    }
+  }
+
+  pthread_mutex_init(&RA->mutex, NULL);
+  pthread_cond_init(&RA->not_empty, NULL);
+  pthread_cond_init(&RA->not_full, NULL);
+
+  if (pthread_create(&RA->thread, NULL, readahead_thread, transport) != 0) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "Could not start read-ahead thread (%s)",
+                  transport->res->uri);
+    pthread_mutex_destroy(&RA->mutex);
+    pthread_cond_destroy(&RA->not_empty);
+    pthread_cond_destroy(&RA->not_full);
+    goto err_chunks;
+  }
+
+  bgpstream_log(BGPSTREAM_LOG_FINE,
+                "Reading ahead of %s (%d chunks of %" PRIi64 " bytes)",
+                transport->res->uri, RA->chunk_cnt, RA->chunk_len);
+  return 0;
+
+ err_chunks:
+  for (i = 0; i < RA->chunk_cnt; i++) {
+    free(RA->chunks[i].buf);
+  }
+  free(RA->chunks);
+ err:
+  free(RA);
+  RA = NULL;
+  return -1;
+}
+
 bgpstream_transport_t *bgpstream_transport_create(bgpstream_resource_t *res)
 {
   bgpstream_transport_t *transport = NULL;
@@ -96,6 +381,12 @@ bgpstream_transport_t *bgpstream_transport_create(bgpstream_resource_t *res)
     goto err;
   }
 
+  // optionally move transport reads into a background thread
+  if (res->readahead_len > 0 && readahead_create(transport) != 0) {
+    transport->destroy(transport);
+    goto err;
+  }
+
   return transport;
 
  err:
@@ -106,15 +397,34 @@ bgpstream_transport_t *bgpstream_transport_create(bgpstream_resource_t *res)
 int64_t bgpstream_transport_read(bgpstream_transport_t *transport,
                                  void *buffer, int64_t len)
 {
+  if (transport->readahead != NULL) {
+    return readahead_read(transport, buffer, len);
+  }
   return transport->read(transport, buffer, len);
 }
 
+int bgpstream_transport_can_borrow(bgpstream_transport_t *transport)
+{
+  // data that has been read ahead has already been copied out of the messages
+  return (transport->borrow != NULL && transport->readahead == NULL);
+}
+
+int64_t bgpstream_transport_borrow(bgpstream_transport_t *transport,
+                                   uint8_t **buf)
+{
+  assert(bgpstream_transport_can_borrow(transport));
+  return transport->borrow(transport, buf);
+}
+
 void bgpstream_transport_destroy(bgpstream_transport_t *transport)
 {
   if (transport == NULL) {
     return;
   }
 
+  // the read-ahead thread must be stopped before the transport goes away
+  readahead_destroy(transport);
+
   transport->destroy(transport);
 
   free(transport);
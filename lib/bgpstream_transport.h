@@ -55,6 +55,29 @@ bgpstream_transport_create(bgpstream_resource_t *res);
 int64_t bgpstream_transport_read(bgpstream_transport_t *transport,
                                  void *buffer, int64_t len);
 
+/** Check if the given transport can lend messages to the caller
+ *
+ * @param transport     pointer to a transport handler
+ * @return 1 if bgpstream_transport_borrow may be used, 0 otherwise
+ *
+ * Transports that lend messages are message-oriented: every message returned
+ * by bgpstream_transport_borrow is self-contained.
+ */
+int bgpstream_transport_can_borrow(bgpstream_transport_t *transport);
+
+/** Get a pointer to the next message from the given transport handler
+ *
+ * @param transport     pointer to a transport handler to read from
+ * @param[out] buf      set to a borrowed pointer to the message data
+ * @return the length of the message if successful, 0 if no message is
+ * available, -1 otherwise
+ *
+ * The message is owned by the transport and is released by the next call to
+ * bgpstream_transport_borrow or bgpstream_transport_read.
+ */
+int64_t bgpstream_transport_borrow(bgpstream_transport_t *transport,
+                                   uint8_t **buf);
+
 /** Shutdown and destroy the given transport handler
  *
  * @param transport     pointer to a transport handler to destroy
@@ -74,6 +74,18 @@ struct bgpstream_transport {
    */
   int64_t (*read)(struct bgpstream_transport *t, uint8_t *buffer, int64_t len);
 
+  /** Lend the next message to the caller without copying it (optional)
+   *
+   * @param t           The data transport object to read from
+   * @param[out] buf    set to point to the message data
+   * @return the length of the message if successful, 0 if no message is
+   * available, -1 otherwise
+   *
+   * Only message-oriented transports (e.g., Kafka) implement this method. The
+   * data remains valid until the next call to read or borrow.
+   */
+  int64_t (*borrow)(struct bgpstream_transport *t, uint8_t **buf);
+
   /** Shutdown and free this data transport
    *
    * @param transport   The data transport object to free
@@ -98,7 +110,11 @@ struct bgpstream_transport {
   /** An opaque pointer to transport-specific state if needed by the
       transport */
   void *state;
-  
+
+  /** Read-ahead state (managed by bgpstream_transport.c). NULL if the
+      transport is read directly by the caller */
+  struct bgpstream_transport_readahead *readahead;
+
   /** }@ */
 };
 
@@ -37,9 +37,15 @@
 
 #define DEFAULT_BROKERS "bmp.bgpstream.caida.org"
 #define DEFAULT_OFFSET "latest"
+#define DEFAULT_CONSUMERS 1
+#define DEFAULT_METADATA_REFRESH 60
 #define DEFAULT_PROJECT "caida"
 
-#define TOPIC_PATTERN "^openbmp\\.router--%s\\.peer-as--%s\\.bmp_raw"
+// topics are named "openbmp.router--<router>.peer-as--<peer>.bmp_raw"
+#define TOPIC_PREFIX "^openbmp\\.router--"
+#define TOPIC_PEER "\\.peer-as--"
+#define TOPIC_SUFFIX "\\.bmp_raw$"
+#define REGEX_SPECIAL ".^$|()[]{}*+?\\"
 #define ALL_ROUTERS ".+"
 #define ALL_PEERS ".+"
 
@@ -56,6 +62,8 @@ enum {
   OPTION_BROKERS,        // stored in res->uri
   OPTION_CONSUMER_GROUP, // allow multiple BGPStream instances to load-balance
   OPTION_OFFSET,         // earliest, latest
+  OPTION_CONSUMERS,      // split partitions between several consumers
+  OPTION_METADATA_REFRESH, // how often to look for new topics
 };
 
 /* define the options this data interface accepts */
@@ -81,6 +89,22 @@ static bgpstream_data_interface_option_t options[] = {
     "offset",                       // name
     "initial offset (earliest/latest) (default: " DEFAULT_OFFSET ")",
   },
+  /* Number of consumers */
+  {
+    BGPSTREAM_DATA_INTERFACE_BETABMP, // interface ID
+    OPTION_CONSUMERS,                 // internal ID
+    "consumers",                      // name
+    "number of consumers to share the topic partitions between "
+    "(default: " STR(DEFAULT_CONSUMERS) ")",
+  },
+  /* Metadata refresh interval */
+  {
+    BGPSTREAM_DATA_INTERFACE_BETABMP, // interface ID
+    OPTION_METADATA_REFRESH,          // internal ID
+    "metadata-refresh",               // name
+    "how often (in seconds) to look for topics of new routers "
+    "(default: " STR(DEFAULT_METADATA_REFRESH) ")",
+  },
 };
 
 /* create the class structure for this data interface */
@@ -110,98 +134,109 @@ typedef struct bsdi_betabmp_state {
   // Offset
   char *offset;
 
-  // we only ever yield one resource
+  // Number of consumers (i.e., resources) to read the topics with
+  uint32_t consumers;
+
+  // How often (in seconds) to refresh topic metadata
+  uint32_t metadata_refresh;
+
+  // we only ever yield one set of resources
   int done;
 
 } bsdi_betabmp_state_t;
 
 /* ========== PRIVATE METHODS BELOW HERE ========== */
 
-static int append_topic(char **list, char *router, uint32_t *peer_asn)
+/* Append a string to the (NUL-terminated) list, optionally escaping any
+ * regex metacharacters that it contains */
+static int append_str(char **list, const char *str, int escape)
 {
-  char buf[256]; // temp buffer for this topic
-  char as_buf[12];
-  char *peer_str = ALL_PEERS;
-  int new_len = 0;
-  int need_comma = (*list != NULL);
+  size_t len = (*list == NULL) ? 0 : strlen(*list);
+  char *p;
 
-  if (router == NULL) {
-    router = ALL_ROUTERS;
+  // worst case every character needs escaping
+  if ((*list = realloc(*list, len + (strlen(str) * 2) + 1)) == NULL) {
+    return -1;
   }
+  p = *list + len;
 
-  if (peer_asn != NULL) {
-    // build the string representation of the peer AS
-    if (snprintf(as_buf, sizeof(as_buf), "%" PRIu32, *peer_asn) >=
-        sizeof(as_buf)) {
-      return -1;
+  for (; *str != '\0'; str++) {
+    if (escape != 0 && strchr(REGEX_SPECIAL, *str) != NULL) {
+      *(p++) = '\\';
     }
-    peer_str = as_buf;
+    *(p++) = *str;
   }
+  *p = '\0';
 
-  // build the string for this topic
-  if (snprintf(buf, sizeof(buf), TOPIC_PATTERN, router, peer_str) >=
-      sizeof(buf)) {
-    return -1;
-  }
+  return 0;
+}
 
-  // and append it to the list
-  if (need_comma) {
-    new_len = strlen(*list) + need_comma;
+/* Append an alternation that matches any of the wanted routers */
+static int append_routers(bsdi_t *di, char **list)
+{
+  bgpstream_filter_mgr_t *filter_mgr = BSDI_GET_FILTER_MGR(di);
+  char *router = NULL;
+  int first = 1;
+
+  if (filter_mgr->routers == NULL) {
+    return append_str(list, ALL_ROUTERS, 0);
   }
-  new_len += strlen(buf) + 1;
 
-  if ((*list = realloc(*list, new_len)) == NULL) {
+  if (append_str(list, "(", 0) != 0) {
     return -1;
   }
-
-  if (need_comma) {
-    strcat(*list, ",");
-  } else {
-    *list[0] = '\0';
+  bgpstream_str_set_rewind(filter_mgr->routers);
+  while ((router = bgpstream_str_set_next(filter_mgr->routers)) != NULL) {
+    if ((first == 0 && append_str(list, "|", 0) != 0) ||
+        append_str(list, router, 1) != 0) {
+      return -1;
+    }
+    first = 0;
   }
-
-  strcat(*list, buf);
-
-  return new_len;
+  return append_str(list, ")", 0);
 }
 
-static int build_topic_list_peers(bsdi_t *di, char **list, char *router)
+/* Append an alternation that matches any of the wanted peer ASNs */
+static int append_peers(bsdi_t *di, char **list)
 {
   bgpstream_filter_mgr_t *filter_mgr = BSDI_GET_FILTER_MGR(di);
   uint32_t *peer_asn = NULL;
+  char as_buf[12];
+  int first = 1;
 
   if (filter_mgr->peer_asns == NULL) {
-    return append_topic(list, router, NULL);
+    return append_str(list, ALL_PEERS, 0);
   }
 
+  if (append_str(list, "(", 0) != 0) {
+    return -1;
+  }
   bgpstream_id_set_rewind(filter_mgr->peer_asns);
   while ((peer_asn = bgpstream_id_set_next(filter_mgr->peer_asns)) != NULL) {
-    if (append_topic(list, router, peer_asn) < 0) {
+    snprintf(as_buf, sizeof(as_buf), "%" PRIu32, *peer_asn);
+    if ((first == 0 && append_str(list, "|", 0) != 0) ||
+        append_str(list, as_buf, 0) != 0) {
       return -1;
     }
+    first = 0;
   }
-
-  return 0;
+  return append_str(list, ")", 0);
 }
 
+/* Build a single regex subscription that matches the topic of every wanted
+ * router/peer combination (and nothing else). Since it is a pattern rather
+ * than a list of topics, topics created after we start (e.g., for a new
+ * router) are picked up when the consumer next refreshes its metadata. */
 static char *build_topic_list(bsdi_t *di)
 {
-  bgpstream_filter_mgr_t *filter_mgr = BSDI_GET_FILTER_MGR(di);
   char *topic_list = NULL;
-  char *router = NULL;
 
-  // we need r * p topics, one for each router/peer combination
-  if (filter_mgr->routers == NULL) {
-    if (build_topic_list_peers(di, &topic_list, ALL_ROUTERS) < 0) {
-      goto err;
-    }
-  } else {
-    bgpstream_str_set_rewind(filter_mgr->routers);
-    while ((router = bgpstream_str_set_next(filter_mgr->routers)) != NULL) {
-      if (build_topic_list_peers(di, &topic_list, router) < 0) {
-        goto err;
-      }
-    }
+  if (append_str(&topic_list, TOPIC_PREFIX, 0) != 0 ||
+      append_routers(di, &topic_list) != 0 ||
+      append_str(&topic_list, TOPIC_PEER, 0) != 0 ||
+      append_peers(di, &topic_list) != 0 ||
+      append_str(&topic_list, TOPIC_SUFFIX, 0) != 0) {
+    goto err;
   }
 
   return topic_list;
@@ -224,6 +259,8 @@ int bsdi_betabmp_init(bsdi_t *di)
 
   /* set default state */
   state->brokers = strdup(DEFAULT_BROKERS);
+  state->consumers = DEFAULT_CONSUMERS;
+  state->metadata_refresh = DEFAULT_METADATA_REFRESH;
   // can't build topic list now since filters aren't yet set
 
   return 0;
@@ -281,6 +318,21 @@ int bsdi_betabmp_set_option(bsdi_t *di,
     }
     break;
 
+  case OPTION_CONSUMERS:
+    if ((STATE->consumers = strtoul(option_value, NULL, 10)) == 0) {
+      fprintf(stderr, "ERROR: At least one consumer is required\n");
+      return -1;
+    }
+    break;
+
+  case OPTION_METADATA_REFRESH:
+    if ((STATE->metadata_refresh = strtoul(option_value, NULL, 10)) == 0) {
+      fprintf(stderr,
+              "ERROR: Metadata refresh interval must be at least 1s\n");
+      return -1;
+    }
+    break;
+
   default:
     return -1;
   }
@@ -312,10 +364,7 @@ void bsdi_betabmp_destroy(bsdi_t *di)
 
 int bsdi_betabmp_update_resources(bsdi_t *di)
 {
-  int rc;
-  bgpstream_resource_t *res = NULL;
-
-  // we only ever yield one resource
+  // we only ever yield one set of resources
   if (STATE->done != 0) {
     return 0;
   }
@@ -327,36 +376,13 @@ int bsdi_betabmp_update_resources(bsdi_t *di)
     return -1;
   }
 
-  // we treat kafka as having data from <recent> to <forever>
-  if ((rc = bgpstream_resource_mgr_push(
-         BSDI_GET_RES_MGR(di), BGPSTREAM_RESOURCE_TRANSPORT_KAFKA,
-         BGPSTREAM_RESOURCE_FORMAT_BMP, STATE->brokers,
-         0, // indicate we don't know how much historical data there is
-         BGPSTREAM_FOREVER, // indicate that the resource is a "stream"
-         DEFAULT_PROJECT, // fix our project to "caida"
-         "", // leave collector unset since we'll get it from openbmp hdrs
-         BGPSTREAM_UPDATE, //
-         &res)) <= 0) {
-    return rc;
-  }
-  assert(res != NULL);
-
-  if (bgpstream_resource_set_attr(res, BGPSTREAM_RESOURCE_ATTR_KAFKA_TOPICS,
-                                  STATE->topic_name) != 0) {
-    return -1;
-  }
-
-  if (STATE->group != NULL &&
-      bgpstream_resource_set_attr(
-        res, BGPSTREAM_RESOURCE_ATTR_KAFKA_CONSUMER_GROUP, STATE->group) != 0) {
-    return -1;
-  }
-
-  if (STATE->offset != NULL &&
-      bgpstream_resource_set_attr(
-        res, BGPSTREAM_RESOURCE_ATTR_KAFKA_INIT_OFFSET, STATE->offset) != 0) {
-    return -1;
-  }
-
-  return 0;
+  // consumers in the same group share the partitions of the topic between
+  // them, and so are decoded in parallel (and merged by time)
+  return bgpstream_resource_mgr_push_kafka(
+    BSDI_GET_RES_MGR(di), BGPSTREAM_RESOURCE_FORMAT_BMP, STATE->brokers,
+    DEFAULT_PROJECT, // fix our project to "caida"
+    "", // leave collector unset since we'll get it from openbmp hdrs
+    STATE->topic_name, STATE->group, STATE->offset,
+    STATE->metadata_refresh, // so that topics of new routers are found
+    STATE->consumers);
 }
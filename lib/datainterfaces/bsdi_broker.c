@@ -35,17 +35,22 @@
 #include "libjsmn/jsmn.h"
 #include <assert.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 #include <wandio.h>
 
 #define STATE (BSDI_GET_STATE(di, broker))
 
+/* Default max age of a cached broker response (one week) */
+#define RESPONSE_CACHE_TTL_DEFAULT 604800
+
 /* ---------- START CLASS DEFINITION ---------- */
 
 /* define the internal option ID values */
@@ -53,6 +58,9 @@ enum {
   OPTION_BROKER_URL,
   OPTION_PARAM,
   OPTION_CACHE_DIR,
+  OPTION_CACHE_CONNECTIONS,
+  OPTION_RESPONSE_CACHE_DIR,
+  OPTION_RESPONSE_CACHE_TTL,
 };
 
 /* define the options this data interface accepts */
@@ -78,6 +86,28 @@ static bgpstream_data_interface_option_t options[] = {
     "cache-dir", // name
     "Enable local cache at provided directory.", // description
   },
+  /* Broker Cache Connections */
+  {
+    BGPSTREAM_DATA_INTERFACE_BROKER, // interface ID
+    OPTION_CACHE_CONNECTIONS, // internal ID
+    "cache-connections", // name
+    "Max parallel range requests per cached download (default: 1)", // description
+  },
+  /* Broker Response Cache */
+  {
+    BGPSTREAM_DATA_INTERFACE_BROKER, // interface ID
+    OPTION_RESPONSE_CACHE_DIR, // internal ID
+    "response-cache-dir", // name
+    "Cache broker responses for historical queries in provided directory", // description
+  },
+  /* Broker Response Cache TTL */
+  {
+    BGPSTREAM_DATA_INTERFACE_BROKER, // interface ID
+    OPTION_RESPONSE_CACHE_TTL, // internal ID
+    "response-cache-ttl", // name
+    "Max age (s) of cached broker responses, 0 for no limit (default: "
+    STR(RESPONSE_CACHE_TTL_DEFAULT) ")", // description
+  },
 };
 
 /* create the class structure for this data interface */
@@ -114,6 +144,17 @@ typedef struct bsdi_broker_state {
   // User-specified location for cache: NULL means cache disabled
   char *cache_dir;
 
+  // Max number of parallel range requests used to fill the cache (as a
+  // string, since it is passed as a resource attribute): NULL means 1
+  char *cache_connections;
+
+  // Directory to cache broker responses in: NULL means responses are not
+  // cached
+  char *response_cache_dir;
+
+  // Max age of a cached response (in seconds): 0 means no limit
+  uint32_t response_cache_ttl;
+
   /* internal state: */
 
   // working space to build query urls
@@ -127,12 +168,19 @@ typedef struct bsdi_broker_state {
   // have any parameters been added to the url?
   int first_param;
 
+  // value of first_param at query_url_end
+  int first_param_end;
+
   // time of the last response we got from the broker
   uint32_t last_response_time;
 
   // the max (file_time + duration) that we have seen
   uint32_t current_window_end;
 
+  // request for the next window, made while the current one is being read
+  // (NULL if there is none)
+  struct broker_fetch *prefetch;
+
 } bsdi_broker_state_t;
 
 // the max time we will wait between retries to the broker
@@ -257,19 +305,229 @@ static jsmntok_t *json_skip(jsmntok_t *t)
     }                                                                          \
   } while (0)
 
-static int process_json(bsdi_t *di, const char *js, jsmntok_t *root_tok,
-                        size_t count)
+/* ---------- BACKGROUND REQUESTS ---------- */
+
+// size of the chunks read from the broker
+#define FETCH_BUFSIZE 4096
+
+enum {
+  FETCH_IN_PROGRESS = 0,
+  FETCH_DONE = 1,
+  FETCH_OPEN_FAILED = -1,
+  FETCH_READ_FAILED = -2,
+};
+
+/* A broker request running in its own thread. The response body is
+   accumulated in data, and is handed to the JSON parser as it arrives */
+typedef struct broker_fetch {
+
+  // the query URL
+  char url[URL_BUFLEN];
+
+  pthread_t thread;
+
+  // protects all of the below fields
+  pthread_mutex_t mutex;
+
+  // signalled when data arrives or the request finishes
+  pthread_cond_t cond;
+
+  // response received so far
+  char *data;
+
+  size_t data_len;
+
+  // number of bytes already given to the reader (only used by the reader)
+  size_t consumed;
+
+  // one of the FETCH_* codes
+  int status;
+
+  // set if the owner lost interest: the thread frees the request when done
+  int abandoned;
+
+} broker_fetch_t;
+
+static void fetch_free(broker_fetch_t *fetch)
 {
-  int i, j, k;
-  jsmntok_t *t = root_tok + 1;
+  pthread_mutex_destroy(&fetch->mutex);
+  pthread_cond_destroy(&fetch->cond);
+  free(fetch->data);
+  free(fetch);
+}
 
-  int arr_len, obj_len;
+static void *fetch_thread(void *user)
+{
+  broker_fetch_t *fetch = (broker_fetch_t *)user;
+  io_t *jsonfile;
+  char buf[FETCH_BUFSIZE];
+  char *tmp;
+  int64_t ret = 0;
+  int status = FETCH_DONE;
+  int abandoned;
+
+  if ((jsonfile = wandio_create(fetch->url)) == NULL) {
+    fprintf(stderr, "ERROR: Could not open %s for reading\n", fetch->url);
+    status = FETCH_OPEN_FAILED;
+  } else {
+    while ((ret = wandio_read(jsonfile, buf, FETCH_BUFSIZE)) > 0) {
+      pthread_mutex_lock(&fetch->mutex);
+      if ((tmp = realloc(fetch->data, fetch->data_len + ret)) == NULL) {
+        pthread_mutex_unlock(&fetch->mutex);
+        ret = -1;
+        break;
+      }
+      fetch->data = tmp;
+      memcpy(fetch->data + fetch->data_len, buf, ret);
+      fetch->data_len += ret;
+      pthread_cond_signal(&fetch->cond);
+      pthread_mutex_unlock(&fetch->mutex);
+    }
+    if (ret < 0) {
+      fprintf(stderr, "ERROR: Reading from broker failed\n");
+      status = FETCH_READ_FAILED;
+    }
+    wandio_destroy(jsonfile);
+  }
+
+  pthread_mutex_lock(&fetch->mutex);
+  fetch->status = status;
+  abandoned = fetch->abandoned;
+  pthread_cond_signal(&fetch->cond);
+  pthread_mutex_unlock(&fetch->mutex);
+
+  if (abandoned != 0) {
+    fetch_free(fetch);
+  }
+  return NULL;
+}
 
-  int time_set = 0;
+static broker_fetch_t *fetch_start(const char *url)
+{
+  broker_fetch_t *fetch;
+
+  if ((fetch = malloc_zero(sizeof(broker_fetch_t))) == NULL) {
+    return NULL;
+  }
+  strcpy(fetch->url, url);
+  pthread_mutex_init(&fetch->mutex, NULL);
+  pthread_cond_init(&fetch->cond, NULL);
+
+  if (pthread_create(&fetch->thread, NULL, fetch_thread, fetch) != 0) {
+    fprintf(stderr, "ERROR: Could not start broker request thread\n");
+    fetch_free(fetch);
+    return NULL;
+  }
+  return fetch;
+}
+
+/* Append newly received data to the given buffer (waiting for some to arrive
+   if needed). Returns the number of bytes appended, 0 when the response is
+   complete, or a FETCH_*_FAILED code */
+static int64_t fetch_read(broker_fetch_t *fetch, char **buf, size_t *buf_len)
+{
+  int64_t len;
+  char *tmp;
+
+  pthread_mutex_lock(&fetch->mutex);
+  while (fetch->consumed == fetch->data_len &&
+         fetch->status == FETCH_IN_PROGRESS) {
+    pthread_cond_wait(&fetch->cond, &fetch->mutex);
+  }
+  if (fetch->consumed == fetch->data_len) {
+    pthread_mutex_unlock(&fetch->mutex);
+    return (fetch->status == FETCH_DONE) ? 0 : fetch->status;
+  }
+  len = fetch->data_len - fetch->consumed;
+  // the buffer is kept nul-terminated for the benefit of error messages
+  if ((tmp = realloc(*buf, *buf_len + len + 1)) == NULL) {
+    pthread_mutex_unlock(&fetch->mutex);
+    return FETCH_READ_FAILED;
+  }
+  *buf = tmp;
+  memcpy(*buf + *buf_len, fetch->data + fetch->consumed, len);
+  *buf_len += len;
+  (*buf)[*buf_len] = '\0';
+  fetch->consumed += len;
+  pthread_mutex_unlock(&fetch->mutex);
+
+  return len;
+}
+
+static void fetch_destroy(broker_fetch_t *fetch)
+{
+  if (fetch == NULL) {
+    return;
+  }
+  pthread_mutex_lock(&fetch->mutex);
+  if (fetch->status == FETCH_IN_PROGRESS) {
+    // don't wait for a (possibly slow) response we no longer need
+    fetch->abandoned = 1;
+    pthread_mutex_unlock(&fetch->mutex);
+    pthread_detach(fetch->thread);
+    return;
+  }
+  pthread_mutex_unlock(&fetch->mutex);
+  pthread_join(fetch->thread, NULL);
+  fetch_free(fetch);
+}
+
+/* ---------- INCREMENTAL RESPONSE PARSING ---------- */
+
+/* State used to process a broker response as it arrives. The jsmn parser is
+   resumable, so each call to jsmn_parse only looks at new data, and tokens are
+   processed (and resources pushed) as soon as they are complete */
+typedef struct broker_response {
+
+  jsmn_parser p;
+
+  jsmntok_t *tok;
+
+  size_t tokcount;
+
+  // response received so far
+  char *js;
+
+  size_t jslen;
+
+  // index of the next token to process
+  int next_tok;
+
+  // number of keys of the root object that have been processed
+  int root_keys_cnt;
+
+  // index of the dumpFiles array token (0 if not currently inside it)
+  int files_tok;
+
+  // number of elements of the dumpFiles array that have been processed
+  int files_cnt;
+
+  // number of dump files (from the start of the response) to skip, since they
+  // were pushed during a failed attempt to read the same response
+  int files_skip;
+
+  int time_set;
+
+  // working space for file URLs
+  char *url;
+
+  size_t url_len;
+
+} broker_response_t;
+
+// is the given token available and fully parsed?
+#define TOK_COMPLETE(r, idx)                                                   \
+  ((idx) < (int)(r)->p.toknext && (r)->tok[(idx)].end != -1)
+
+static int process_dump_file(bsdi_t *di, broker_response_t *r,
+                             jsmntok_t *file_tok)
+{
+  const char *js = r->js;
+  jsmntok_t *t = file_tok;
+  int k;
+  int obj_len;
 
   // per-file info
-  char *url = NULL;
-  size_t url_len = 0;
   int url_set = 0;
   char collector[BGPSTREAM_UTILS_STR_NAME_LEN] = "";
   int collector_set = 0;
@@ -286,36 +544,229 @@ static int process_json(bsdi_t *di, const char *js, jsmntok_t *root_tok,
   bgpstream_resource_t *res = NULL;
   int transport_type = 0;
 
+  json_type_assert(t, JSMN_OBJECT);
+  obj_len = t->size;
+  NEXT_TOK;
 
-  if (count == 0) {
-    fprintf(stderr, "ERROR: Empty JSON response from broker\n");
-    goto retry;
+  for (k = 0; k < obj_len; k++) {
+    if (json_strcmp(js, t, "urlType") == 0) {
+      NEXT_TOK;
+      if (json_strcmp(js, t, "simple") != 0) {
+        // not yet supported?
+        fprintf(stderr, "ERROR: Unsupported URL type '%.*s'\n",
+                t->end - t->start, js + t->start);
+        goto err;
+      }
+      NEXT_TOK;
+    } else if (json_strcmp(js, t, "url") == 0) {
+      NEXT_TOK;
+      json_type_assert(t, JSMN_STRING);
+      if (r->url_len < (t->end - t->start + 1)) {
+        r->url_len = t->end - t->start + 1;
+        if ((r->url = realloc(r->url, r->url_len)) == NULL) {
+          fprintf(stderr, "ERROR: Could not realloc URL string\n");
+          goto err;
+        }
+      }
+      json_strcpy(r->url, t, js);
+      unescape_url(r->url);
+      url_set = 1;
+      NEXT_TOK;
+    } else if (json_strcmp(js, t, "project") == 0) {
+      NEXT_TOK;
+      json_type_assert(t, JSMN_STRING);
+      json_strcpy(project, t, js);
+      project_set = 1;
+      NEXT_TOK;
+    } else if (json_strcmp(js, t, "collector") == 0) {
+      NEXT_TOK;
+      json_type_assert(t, JSMN_STRING);
+      json_strcpy(collector, t, js);
+      collector_set = 1;
+      NEXT_TOK;
+    } else if (json_strcmp(js, t, "type") == 0) {
+      NEXT_TOK;
+      json_type_assert(t, JSMN_STRING);
+      if (json_strcmp(js, t, "ribs") == 0) {
+        type = BGPSTREAM_RIB;
+      } else if (json_strcmp(js, t, "updates") == 0) {
+        type = BGPSTREAM_UPDATE;
+      } else {
+        fprintf(stderr, "ERROR: Invalid type '%.*s'\n",
+                t->end - t->start, js+t->start);
+        goto err;
+      }
+      type_set = 1;
+      NEXT_TOK;
+    } else if (json_strcmp(js, t, "initialTime") == 0) {
+      NEXT_TOK;
+      json_type_assert(t, JSMN_PRIMITIVE);
+      json_strtoul(initial_time, t);
+      initial_time_set = 1;
+      NEXT_TOK;
+    } else if (json_strcmp(js, t, "duration") == 0) {
+      NEXT_TOK;
+      json_type_assert(t, JSMN_PRIMITIVE);
+      json_strtoul(duration, t);
+      duration_set = 1;
+      NEXT_TOK;
+    } else {
+      fprintf(stderr, "ERROR: Unknown field '%.*s'\n", t->end - t->start,
+              js + t->start);
+      goto err;
+    }
+  }
+  // file obj has been completely read
+  if (url_set == 0 || project_set == 0 || collector_set == 0 ||
+      type_set == 0 || initial_time_set == 0 || duration_set == 0) {
+    fprintf(stderr, "ERROR: Invalid dumpFile record\n");
+    return ERR_RETRY;
   }
 
-  if (root_tok->type != JSMN_OBJECT) {
-    fprintf(stderr, "ERROR: Root object is not JSON\n");
-    fprintf(stderr, "INFO: JSON: %s\n", js);
-    goto err;
+  if (r->files_cnt < r->files_skip) {
+    // already pushed
+    return 0;
+  }
+
+#ifdef BROKER_DEBUG
+  fprintf(stderr, "----------\n");
+  fprintf(stderr, "URL: %s\n", r->url);
+  fprintf(stderr, "Project: %s\n", project);
+  fprintf(stderr, "Collector: %s\n", collector);
+  fprintf(stderr, "Type: %d\n", type);
+  fprintf(stderr, "InitialTime: %" PRIu32 "\n", initial_time);
+  fprintf(stderr, "Duration: %" PRIu32 "\n", duration);
+#endif
+
+  // do we need to update our current_window_end?
+  if (initial_time + duration > STATE->current_window_end) {
+    STATE->current_window_end = (initial_time + duration);
+  }
+
+  transport_type = STATE->cache_dir == NULL? BGPSTREAM_RESOURCE_TRANSPORT_FILE: BGPSTREAM_RESOURCE_TRANSPORT_CACHE;
+  if (bgpstream_resource_mgr_push(BSDI_GET_RES_MGR(di),
+                                  transport_type,
+                                  BGPSTREAM_RESOURCE_FORMAT_MRT,
+                                  r->url,
+                                  initial_time,
+                                  duration,
+                                  project,
+                                  collector,
+                                  type,
+                                  &res) < 0) {
+    return ERR_FATAL;
+  }
+  // set cache attribute to resource
+  if (transport_type == BGPSTREAM_RESOURCE_TRANSPORT_CACHE &&
+      bgpstream_resource_set_attr(res, BGPSTREAM_RESOURCE_ATTR_CACHE_DIR_PATH, STATE->cache_dir) != 0) {
+    return ERR_FATAL;
+  }
+  if (transport_type == BGPSTREAM_RESOURCE_TRANSPORT_CACHE &&
+      STATE->cache_connections != NULL &&
+      bgpstream_resource_set_attr(
+        res, BGPSTREAM_RESOURCE_ATTR_CACHE_FETCH_CONNECTIONS,
+        STATE->cache_connections) != 0) {
+    return ERR_FATAL;
   }
 
-  // iterate over the children of the root object
-  for (i = 0; i < root_tok->size; i++) {
+  return 0;
+
+err:
+  fprintf(stderr, "ERROR: Invalid JSON response received from broker\n");
+  return ERR_RETRY;
+}
+
+/* Process all complete tokens that have not yet been processed */
+static int process_json(bsdi_t *di, broker_response_t *r)
+{
+  const char *js = r->js;
+  jsmntok_t *root_tok = r->tok;
+  jsmntok_t *t;
+  jsmntok_t *arr;
+  int rc;
+
+  while (1) {
+    if (r->next_tok == 0) {
+      if (r->p.toknext == 0) {
+        // nothing parsed yet
+        return 0;
+      }
+      if (root_tok->type != JSMN_OBJECT) {
+        fprintf(stderr, "ERROR: Root object is not JSON\n");
+        fprintf(stderr, "INFO: JSON: %s\n", js);
+        goto err;
+      }
+      r->next_tok = 1;
+    }
+
+    if (r->files_tok != 0) {
+      // working through the dumpFiles array
+      arr = &r->tok[r->files_tok];
+      if (arr->end != -1 && r->files_cnt == arr->size) {
+        // that was the last file
+        r->files_tok = 0;
+        r->root_keys_cnt++;
+        continue;
+      }
+      if (!TOK_COMPLETE(r, r->next_tok)) {
+        return 0;
+      }
+      t = &r->tok[r->next_tok];
+      if ((rc = process_dump_file(di, r, t)) != 0) {
+        return rc;
+      }
+      r->next_tok = json_skip(t) - r->tok;
+      r->files_cnt++;
+      continue;
+    }
+
+    // otherwise we are at a key of the root object
+    if (root_tok->end != -1 && r->root_keys_cnt == root_tok->size) {
+      // the whole response has been processed
+      return 0;
+    }
+    if (r->next_tok + 1 >= (int)r->p.toknext) {
+      // need the key and (the start of) its value
+      return 0;
+    }
+    t = &r->tok[r->next_tok];
+
     // all keys must be strings
     if (t->type != JSMN_STRING) {
       fprintf(stderr, "ERROR: Encountered non-string key: '%.*s'\n",
               t->end - t->start, js + t->start);
       goto err;
     }
+
+    if (json_strcmp(js, t, "data") == 0) {
+      // don't wait for the whole data object, just for the array of files
+      if (r->next_tok + 3 >= (int)r->p.toknext) {
+        return 0;
+      }
+      NEXT_TOK;
+      json_type_assert(t, JSMN_OBJECT);
+      NEXT_TOK;
+      json_str_assert(js, t, "dumpFiles");
+      NEXT_TOK;
+      json_type_assert(t, JSMN_ARRAY);
+      r->files_tok = t - r->tok;
+      r->files_cnt = 0;
+      r->next_tok = r->files_tok + 1; // first elem in array
+      continue;
+    }
+
+    // other values are small, so just wait until they are complete
+    if (!TOK_COMPLETE(r, r->next_tok + 1)) {
+      return 0;
+    }
     if (json_strcmp(js, t, "time") == 0) {
       NEXT_TOK;
       json_type_assert(t, JSMN_PRIMITIVE);
       json_strtoul(STATE->last_response_time, t);
-      time_set = 1;
-      NEXT_TOK;
+      r->time_set = 1;
     } else if (json_strcmp(js, t, "type") == 0) {
       NEXT_TOK;
       json_str_assert(js, t, "data");
-      NEXT_TOK;
     } else if (json_strcmp(js, t, "error") == 0) {
       NEXT_TOK;
       if (json_isnull(js, t) == 0) { // i.e. there is an error set
@@ -323,234 +774,134 @@ static int process_json(bsdi_t *di, const char *js, jsmntok_t *root_tok,
                 t->end - t->start, js + t->start);
         goto err;
       }
-      NEXT_TOK;
     } else if (json_strcmp(js, t, "queryParameters") == 0) {
       NEXT_TOK;
       json_type_assert(t, JSMN_OBJECT);
-      // skip over this object
-      t = json_skip(t);
-    } else if (json_strcmp(js, t, "data") == 0) {
-      NEXT_TOK;
-      json_type_assert(t, JSMN_OBJECT);
-      NEXT_TOK;
-      json_str_assert(js, t, "dumpFiles");
+    } else {
+      // skip unknown keys
       NEXT_TOK;
-      json_type_assert(t, JSMN_ARRAY);
-      arr_len = t->size; // number of dump files
-      NEXT_TOK;          // first elem in array
-      for (j = 0; j < arr_len; j++) {
-        json_type_assert(t, JSMN_OBJECT);
-        obj_len = t->size;
-        NEXT_TOK;
-
-        url_set = 0;
-        project_set = 0;
-        collector_set = 0;
-        type_set = 0;
-        initial_time_set = 0;
-        duration_set = 0;
-
-        for (k = 0; k < obj_len; k++) {
-          if (json_strcmp(js, t, "urlType") == 0) {
-            NEXT_TOK;
-            if (json_strcmp(js, t, "simple") != 0) {
-              // not yet supported?
-              fprintf(stderr, "ERROR: Unsupported URL type '%.*s'\n",
-                      t->end - t->start, js + t->start);
-              goto err;
-            }
-            NEXT_TOK;
-          } else if (json_strcmp(js, t, "url") == 0) {
-            NEXT_TOK;
-            json_type_assert(t, JSMN_STRING);
-            if (url_len < (t->end - t->start + 1)) {
-              url_len = t->end - t->start + 1;
-              if ((url = realloc(url, url_len)) == NULL) {
-                fprintf(stderr, "ERROR: Could not realloc URL string\n");
-                goto err;
-              }
-            }
-            json_strcpy(url, t, js);
-            unescape_url(url);
-            url_set = 1;
-            NEXT_TOK;
-          } else if (json_strcmp(js, t, "project") == 0) {
-            NEXT_TOK;
-            json_type_assert(t, JSMN_STRING);
-            json_strcpy(project, t, js);
-            project_set = 1;
-            NEXT_TOK;
-          } else if (json_strcmp(js, t, "collector") == 0) {
-            NEXT_TOK;
-            json_type_assert(t, JSMN_STRING);
-            json_strcpy(collector, t, js);
-            collector_set = 1;
-            NEXT_TOK;
-          } else if (json_strcmp(js, t, "type") == 0) {
-            NEXT_TOK;
-            json_type_assert(t, JSMN_STRING);
-            if (json_strcmp(js, t, "ribs") == 0) {
-              type = BGPSTREAM_RIB;
-            } else if (json_strcmp(js, t, "updates") == 0) {
-              type = BGPSTREAM_UPDATE;
-            } else {
-              fprintf(stderr, "ERROR: Invalid type '%.*s'\n",
-                      t->end - t->start, js+t->start);
-              goto err;
-            }
-            type_set = 1;
-            NEXT_TOK;
-          } else if (json_strcmp(js, t, "initialTime") == 0) {
-            NEXT_TOK;
-            json_type_assert(t, JSMN_PRIMITIVE);
-            json_strtoul(initial_time, t);
-            initial_time_set = 1;
-            NEXT_TOK;
-          } else if (json_strcmp(js, t, "duration") == 0) {
-            NEXT_TOK;
-            json_type_assert(t, JSMN_PRIMITIVE);
-            json_strtoul(duration, t);
-            duration_set = 1;
-            NEXT_TOK;
-          } else {
-            fprintf(stderr, "ERROR: Unknown field '%.*s'\n", t->end - t->start,
-                    js + t->start);
-            goto err;
-          }
-        }
-        // file obj has been completely read
-        if (url_set == 0 || project_set == 0 || collector_set == 0 ||
-            type_set == 0 || initial_time_set == 0 || duration_set == 0) {
-          fprintf(stderr, "ERROR: Invalid dumpFile record\n");
-          goto retry;
-        }
-#ifdef BROKER_DEBUG
-        fprintf(stderr, "----------\n");
-        fprintf(stderr, "URL: %s\n", url);
-        fprintf(stderr, "Project: %s\n", project);
-        fprintf(stderr, "Collector: %s\n", collector);
-        fprintf(stderr, "Type: %d\n", type);
-        fprintf(stderr, "InitialTime: %" PRIu32 "\n", initial_time);
-        fprintf(stderr, "Duration: %" PRIu32 "\n", duration);
-#endif
-
-        // do we need to update our current_window_end?
-        if (initial_time + duration > STATE->current_window_end) {
-          STATE->current_window_end = (initial_time + duration);
-        }
-
-        transport_type = STATE->cache_dir == NULL? BGPSTREAM_RESOURCE_TRANSPORT_FILE: BGPSTREAM_RESOURCE_TRANSPORT_CACHE;
-        if (bgpstream_resource_mgr_push(BSDI_GET_RES_MGR(di),
-                                        transport_type,
-                                        BGPSTREAM_RESOURCE_FORMAT_MRT,
-                                        url,
-                                        initial_time,
-                                        duration,
-                                        project,
-                                        collector,
-                                        type,
-                                        &res) < 0) {
-          goto err;
-        }
-        // set cache attribute to resource
-        if (transport_type == BGPSTREAM_RESOURCE_TRANSPORT_CACHE &&
-            bgpstream_resource_set_attr(res, BGPSTREAM_RESOURCE_ATTR_CACHE_DIR_PATH, STATE->cache_dir) != 0) {
-          return -1;
-        }
-      }
     }
-    // TODO: handle unknown tokens
-  }
-
-  if (time_set == 0) {
-    goto err;
+    r->next_tok = json_skip(t) - r->tok;
+    r->root_keys_cnt++;
   }
 
-  free(url);
-  return 0;
-
-retry:
-  free(url);
-  return ERR_RETRY;
-
 err:
   fprintf(stderr, "ERROR: Invalid JSON response received from broker\n");
-  free(url);
   return ERR_RETRY;
 }
 
-static int read_json(bsdi_t *di, io_t *jsonfile)
+/* Run the parser over the first len bytes of the response */
+static int parse_json(broker_response_t *r, size_t len, int final)
 {
-  jsmn_parser p;
-  jsmntok_t *tok = NULL;
-  size_t tokcount = 128;
-
   int ret;
-  char *js = NULL;
-  size_t jslen = 0;
-#define BUFSIZE 1024
-  char buf[BUFSIZE];
-
-  // prepare parser
-  jsmn_init(&p);
-
-  // allocate some tokens to start
-  if ((tok = malloc(sizeof(jsmntok_t) * tokcount)) == NULL) {
-    fprintf(stderr, "ERROR: Could not malloc initial tokens\n");
-    goto err;
-  }
-
-  // slurp the whole file into a buffer
-  while (1) {
-    /* do a read */
-    ret = wandio_read(jsonfile, buf, BUFSIZE);
-    if (ret < 0) {
-      fprintf(stderr, "ERROR: Reading from broker failed\n");
-      goto err;
-    }
-    if (ret == 0) {
-      // we're done
-      break;
-    }
-    if ((js = realloc(js, jslen + ret + 1)) == NULL) {
-      fprintf(stderr, "ERROR: Could not realloc json string\n");
-      goto err;
-    }
-    strncpy(js + jslen, buf, ret);
-    jslen += ret;
-  }
 
 again:
-  if ((ret = jsmn_parse(&p, js, jslen, tok, tokcount)) < 0) {
+  if ((ret = jsmn_parse(&r->p, r->js, len, r->tok, r->tokcount)) < 0) {
     if (ret == JSMN_ERROR_NOMEM) {
-      tokcount *= 2;
-      if ((tok = realloc(tok, sizeof(jsmntok_t) * tokcount)) == NULL) {
+      // the parser picks up from where it stopped
+      r->tokcount *= 2;
+      if ((r->tok = realloc(r->tok, sizeof(jsmntok_t) * r->tokcount)) ==
+          NULL) {
         fprintf(stderr, "ERROR: Could not realloc tokens\n");
-        goto err;
+        return ERR_FATAL;
       }
       goto again;
     }
+    if (ret == JSMN_ERROR_PART && final == 0) {
+      // wait for more data
+      return 0;
+    }
     if (ret == JSMN_ERROR_INVAL) {
       fprintf(stderr, "ERROR: Invalid character in JSON string\n");
-      goto err;
+      return ERR_FATAL;
     }
     fprintf(stderr, "ERROR: JSON parser returned %d\n", ret);
-    goto err;
+    return ERR_FATAL;
   }
-  ret = process_json(di, js, tok, p.toknext);
+  return 0;
+}
+
+/* If body is non-NULL, it is set to the raw response when it is successfully
+   processed (the caller must free it) */
+static int read_json(bsdi_t *di, broker_fetch_t *fetch, int *files_cnt,
+                     char **body, size_t *body_len)
+{
+  broker_response_t r;
+  size_t len;
+  int64_t ret;
+  int rc;
+
+  memset(&r, 0, sizeof(r));
+  r.files_skip = *files_cnt;
 
-  free(js);
-  free(tok);
-  if (ret == ERR_FATAL) {
-    fprintf(stderr, "ERROR: Received fatal error from process_json\n");
+  // prepare parser
+  jsmn_init(&r.p);
+
+  // allocate some tokens to start
+  r.tokcount = 128;
+  if ((r.tok = malloc(sizeof(jsmntok_t) * r.tokcount)) == NULL) {
+    fprintf(stderr, "ERROR: Could not malloc initial tokens\n");
+    rc = ERR_FATAL;
+    goto done;
   }
-  return ret;
 
-err:
-  free(js);
-  free(tok);
-  fprintf(stderr, "%s: Returning fatal error code\n", __func__);
-  return ERR_FATAL;
+  while ((ret = fetch_read(fetch, &r.js, &r.jslen)) > 0) {
+    // a primitive (number) at the very end of the data may be incomplete, so
+    // only parse up to the last delimiter we have seen
+    len = r.jslen;
+    while (len > 0 && strchr(",]} \t\r\n", r.js[len - 1]) == NULL) {
+      len--;
+    }
+    if ((rc = parse_json(&r, len, 0)) != 0 ||
+        (rc = process_json(di, &r)) != 0) {
+      goto done;
+    }
+  }
+  if (ret == FETCH_OPEN_FAILED) {
+    rc = ERR_RETRY;
+    goto done;
+  }
+  if (ret < 0) {
+    rc = ERR_FATAL;
+    goto done;
+  }
+
+  // the whole response is here
+  if ((rc = parse_json(&r, r.jslen, 1)) != 0) {
+    goto done;
+  }
+  if (r.p.toknext == 0) {
+    fprintf(stderr, "ERROR: Empty JSON response from broker\n");
+    rc = ERR_RETRY;
+    goto done;
+  }
+  if ((rc = process_json(di, &r)) != 0) {
+    goto done;
+  }
+  if (r.root_keys_cnt != r.tok[0].size || r.time_set == 0) {
+    fprintf(stderr, "ERROR: Invalid JSON response received from broker\n");
+    rc = ERR_RETRY;
+    goto done;
+  }
+  rc = 0;
+  if (body != NULL) {
+    *body = r.js;
+    *body_len = r.jslen;
+    r.js = NULL;
+  }
+
+done:
+  // remember what we pushed, in case we have to retry
+  if (r.files_cnt > *files_cnt) {
+    *files_cnt = r.files_cnt;
+  }
+  free(r.js);
+  free(r.tok);
+  free(r.url);
+  if (rc == ERR_FATAL) {
+    fprintf(stderr, "%s: Returning fatal error code\n", __func__);
+  }
+  return rc;
 }
 
 static int update_query_url(bsdi_t *di)
@@ -644,6 +995,7 @@ static int update_query_url(bsdi_t *di)
   // query later
   STATE->query_url_end = STATE->query_url_buf + strlen(STATE->query_url_buf);
   assert((*STATE->query_url_end) == '\0');
+  STATE->first_param_end = STATE->first_param;
 
   return 0;
 
@@ -651,6 +1003,188 @@ static int update_query_url(bsdi_t *di)
   return -1;
 }
 
+// we need to set two parameters:
+//  - dataAddedSince ("time" from last response we got)
+//  - minInitialTime (max("initialTime"+"duration") of any file we've ever seen)
+static int append_window_params(bsdi_t *di)
+{
+  char buf[BUFLEN];
+
+  if (STATE->last_response_time > 0) {
+    // need to add dataAddedSince
+    if (snprintf(buf, BUFLEN, "%" PRIu32, STATE->last_response_time) >=
+        BUFLEN) {
+      fprintf(stderr, "ERROR: Could not build dataAddedSince param string\n");
+      goto err;
+    }
+    AMPORQ;
+    APPEND_STR("dataAddedSince=");
+    APPEND_STR(buf);
+  }
+  if (STATE->current_window_end > 0) {
+    // need to add minInitialTime
+    if (snprintf(buf, BUFLEN, "%" PRIu32, STATE->current_window_end) >=
+        BUFLEN) {
+      fprintf(stderr, "ERROR: Could not build minInitialTime param string\n");
+      goto err;
+    }
+    AMPORQ;
+    APPEND_STR("minInitialTime=");
+    APPEND_STR(buf);
+  }
+
+  return 0;
+
+err:
+  return -1;
+}
+
+static void reset_window_params(bsdi_t *di)
+{
+  *STATE->query_url_end = '\0';
+  STATE->query_url_remaining = URL_BUFLEN - strlen(STATE->query_url_buf);
+  STATE->first_param = STATE->first_param_end;
+}
+
+/* ---------- RESPONSE CACHE ---------- */
+
+// queries for windows that ended less than this long ago are never cached,
+// since the broker may still be adding data for them
+#define RESPONSE_CACHE_SETTLE_TIME 86400
+
+// can the response to the current query be cached?
+static int query_is_historical(bsdi_t *di)
+{
+  bgpstream_interval_filter_t *tif = BSDI_GET_FILTER_MGR(di)->time_intervals;
+  uint32_t now = time(NULL);
+
+  if (tif == NULL) {
+    // all data, including the live edge
+    return 0;
+  }
+  for (; tif != NULL; tif = tif->next) {
+    if (tif->end_time == BGPSTREAM_FOREVER ||
+        tif->end_time + RESPONSE_CACHE_SETTLE_TIME > now) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static int param_cmp(const void *a, const void *b)
+{
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* Build the path of the cache file for the current query. The query
+   parameters are sorted so that the order options were given in doesn't
+   matter, and the result is hashed (FNV-1a) to give the file name */
+static int response_cache_path(bsdi_t *di, char *path, size_t path_len)
+{
+  char url[URL_BUFLEN];
+  char **params = NULL;
+  int params_cnt = 0;
+  char *p;
+  uint64_t hash = 14695981039346656037ULL;
+  int i;
+
+  strcpy(url, STATE->query_url_buf);
+
+  // one more than the number of separators
+  params_cnt = 1;
+  for (p = url; *p != '\0'; p++) {
+    if (*p == '&') {
+      params_cnt++;
+    }
+  }
+  if ((params = malloc(sizeof(char *) * params_cnt)) == NULL) {
+    return -1;
+  }
+  params_cnt = 0;
+  if ((p = strchr(url, '?')) != NULL) {
+    *p++ = '\0';
+    params[params_cnt++] = p;
+    while ((p = strchr(p, '&')) != NULL) {
+      *p++ = '\0';
+      params[params_cnt++] = p;
+    }
+    qsort(params, params_cnt, sizeof(char *), param_cmp);
+  }
+
+#define FNV_HASH_STR(str)                                                      \
+  do {                                                                         \
+    const char *c;                                                             \
+    for (c = (str); *c != '\0'; c++) {                                         \
+      hash = (hash ^ (uint8_t)*c) * 1099511628211ULL;                          \
+    }                                                                          \
+  } while (0)
+
+  FNV_HASH_STR(url);
+  for (i = 0; i < params_cnt; i++) {
+    FNV_HASH_STR(i == 0 ? "?" : "&");
+    FNV_HASH_STR(params[i]);
+  }
+  free(params);
+
+  if (snprintf(path, path_len, "%s/broker-%016" PRIx64 ".json",
+               STATE->response_cache_dir, hash) >= (int)path_len) {
+    return -1;
+  }
+  return 0;
+}
+
+/* Decide where to read the response to the current query from. Returns the
+   cache file if it holds a fresh copy of the response, otherwise the query URL
+   (setting store if the response should be written to the cache) */
+static const char *request_source(bsdi_t *di, char *path, size_t path_len,
+                                  int *store)
+{
+  struct stat st;
+
+  *store = 0;
+  if (STATE->response_cache_dir == NULL || query_is_historical(di) == 0 ||
+      response_cache_path(di, path, path_len) != 0) {
+    return STATE->query_url_buf;
+  }
+  if (stat(path, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 &&
+      (STATE->response_cache_ttl == 0 ||
+       time(NULL) - st.st_mtime <= STATE->response_cache_ttl)) {
+    return path;
+  }
+  *store = 1;
+  return STATE->query_url_buf;
+}
+
+static void response_cache_store(const char *path, const char *body,
+                                 size_t body_len)
+{
+  char tmp_path[URL_BUFLEN];
+  FILE *fh;
+
+  // write to a temporary file first so readers never see a partial response
+  if (snprintf(tmp_path, sizeof(tmp_path), "%s.%d", path, getpid()) >=
+      (int)sizeof(tmp_path)) {
+    return;
+  }
+  if ((fh = fopen(tmp_path, "w")) == NULL) {
+    fprintf(stderr, "WARN: Could not create broker response cache file %s\n",
+            tmp_path);
+    return;
+  }
+  if (fwrite(body, 1, body_len, fh) != body_len) {
+    fprintf(stderr, "WARN: Could not write broker response cache file %s\n",
+            tmp_path);
+    fclose(fh);
+    unlink(tmp_path);
+    return;
+  }
+  if (fclose(fh) != 0 || rename(tmp_path, path) != 0) {
+    fprintf(stderr, "WARN: Could not write broker response cache file %s\n",
+            path);
+    unlink(tmp_path);
+  }
+}
+
 /* ========== PUBLIC METHODS BELOW HERE ========== */
 
 int bsdi_broker_init(bsdi_t *di)
@@ -663,6 +1197,8 @@ int bsdi_broker_init(bsdi_t *di)
   BSDI_SET_STATE(di, state);
 
   /* set default state */
+  state->response_cache_ttl = RESPONSE_CACHE_TTL_DEFAULT;
+
   if ((state->broker_url = strdup(BGPSTREAM_DI_BROKER_URL)) == NULL) {
     goto err;
   }
@@ -715,6 +1251,34 @@ int bsdi_broker_set_option(bsdi_t *di,
     }
     break;
 
+  case OPTION_CACHE_CONNECTIONS:
+    if (atoi(option_value) < 1) {
+      fprintf(stderr, "ERROR: Invalid number of cache connections (%s)\n",
+              option_value);
+      return -1;
+    }
+    free(STATE->cache_connections);
+    if ((STATE->cache_connections = strdup(option_value)) == NULL) {
+      return -1;
+    }
+    break;
+
+  case OPTION_RESPONSE_CACHE_DIR:
+    if (access(option_value, F_OK) == -1) {
+      fprintf(stderr, "ERROR: Response cache directory %s does not exist.\n",
+              option_value);
+      return -1;
+    }
+    free(STATE->response_cache_dir);
+    if ((STATE->response_cache_dir = strdup(option_value)) == NULL) {
+      return -1;
+    }
+    break;
+
+  case OPTION_RESPONSE_CACHE_TTL:
+    STATE->response_cache_ttl = strtoul(option_value, NULL, 10);
+    break;
+
   default:
     return -1;
   }
@@ -738,49 +1302,42 @@ void bsdi_broker_destroy(bsdi_t *di)
   }
   STATE->params_cnt = 0;
 
+  free(STATE->cache_dir);
+  STATE->cache_dir = NULL;
+
+  free(STATE->cache_connections);
+  STATE->cache_connections = NULL;
+
+  free(STATE->response_cache_dir);
+  STATE->response_cache_dir = NULL;
+
+  fetch_destroy(STATE->prefetch);
+  STATE->prefetch = NULL;
+
   free(STATE);
   BSDI_SET_STATE(di, NULL);
 }
 
 int bsdi_broker_update_resources(bsdi_t *di)
 {
-
-// we need to set two parameters:
-//  - dataAddedSince ("time" from last response we got)
-//  - minInitialTime (max("initialTime"+"duration") of any file we've ever seen)
-
-#define BUFLEN 20
-  char buf[BUFLEN];
-
-  io_t *jsonfile = NULL;
+  broker_fetch_t *fetch = NULL;
+  char cache_path[URL_BUFLEN];
+  const char *src = NULL;
+  int store = 0;
+  char *body = NULL;
+  size_t body_len = 0;
 
   int rc;
   int attempts = 0;
   int wait_time = 1;
 
+  // number of files of this window that have been pushed
+  int files_cnt = 0;
+
   int success = 0;
 
-  if (STATE->last_response_time > 0) {
-    // need to add dataAddedSince
-    if (snprintf(buf, BUFLEN, "%" PRIu32, STATE->last_response_time) >=
-        BUFLEN) {
-      fprintf(stderr, "ERROR: Could not build dataAddedSince param string\n");
-      goto err;
-    }
-    AMPORQ;
-    APPEND_STR("dataAddedSince=");
-    APPEND_STR(buf);
-  }
-  if (STATE->current_window_end > 0) {
-    // need to add minInitialTime
-    if (snprintf(buf, BUFLEN, "%" PRIu32, STATE->current_window_end) >=
-        BUFLEN) {
-      fprintf(stderr, "ERROR: Could not build minInitialTime param string\n");
-      goto err;
-    }
-    AMPORQ;
-    APPEND_STR("minInitialTime=");
-    APPEND_STR(buf);
+  if (append_window_params(di) != 0) {
+    goto err;
   }
 
   do {
@@ -798,13 +1355,36 @@ int bsdi_broker_update_resources(bsdi_t *di)
     fprintf(stderr, "\nQuery URL: \"%s\"\n", STATE->query_url_buf);
 #endif
 
-    if ((jsonfile = wandio_create(STATE->query_url_buf)) == NULL) {
-      fprintf(stderr, "ERROR: Could not open %s for reading\n",
-              STATE->query_url_buf);
-      goto retry;
+    // try the response cache first
+    if (attempts == 1) {
+      src = request_source(di, cache_path, sizeof(cache_path), &store);
+    } else if (src == cache_path) {
+      // the cached response was bad, replace it
+      src = STATE->query_url_buf;
+      store = 1;
+    }
+
+    // use the request we made in the background (if it is still valid)
+    if (STATE->prefetch != NULL) {
+      if (strcmp(STATE->prefetch->url, src) == 0) {
+        fetch = STATE->prefetch;
+      } else {
+        fetch_destroy(STATE->prefetch);
+      }
+      STATE->prefetch = NULL;
+    }
+    if (fetch == NULL && (fetch = fetch_start(src)) == NULL) {
+      goto err;
     }
 
-    if ((rc = read_json(di, jsonfile)) == ERR_FATAL) {
+    rc = read_json(di, fetch, &files_cnt, store ? &body : NULL, &body_len);
+    if (rc == ERR_FATAL && src == cache_path) {
+      fprintf(stderr, "WARN: Discarding bad cached broker response %s\n",
+              cache_path);
+      unlink(cache_path);
+      rc = ERR_RETRY;
+    }
+    if (rc == ERR_FATAL) {
       fprintf(stderr, "ERROR: Received fatal error code from read_json\n");
       goto err;
     } else if (rc == ERR_RETRY) {
@@ -815,22 +1395,34 @@ int bsdi_broker_update_resources(bsdi_t *di)
     }
 
   retry:
-    if (jsonfile != NULL) {
-      wandio_destroy(jsonfile);
-      jsonfile = NULL;
-    }
+    fetch_destroy(fetch);
+    fetch = NULL;
   } while (success == 0);
 
+  if (body != NULL) {
+    response_cache_store(cache_path, body, body_len);
+    free(body);
+  }
+
   // reset the variable params
-  *STATE->query_url_end = '\0';
-  STATE->query_url_remaining = URL_BUFLEN - strlen(STATE->query_url_end);
+  reset_window_params(di);
+
+  // while these files are being read, ask the broker for the next window. if
+  // there were no files we are either done or waiting for new data to be
+  // published, and a response fetched now would be stale when we use it.
+  if (files_cnt > 0) {
+    if (append_window_params(di) == 0) {
+      src = request_source(di, cache_path, sizeof(cache_path), &store);
+      STATE->prefetch = fetch_start(src);
+    }
+    // this is only an optimization, so errors are not fatal
+    reset_window_params(di);
+  }
+
   return 0;
 
 err:
   fprintf(stderr, "ERROR: Fatal error in broker data source\n");
-  if (jsonfile != NULL) {
-    wandio_destroy(jsonfile);
-  }
+  fetch_destroy(fetch);
   return -1;
 }
-
@@ -70,6 +70,9 @@ BSDI_CREATE_CLASS(
 
 /* ---------- END CLASS DEFINITION ---------- */
 
+/* Size of the read buffer (and so the maximum length of a line) */
+#define CSVFILE_BUFFER_LEN 65536
+
 typedef struct bsdi_csvfile_state {
   /* user-provided options */
 
@@ -99,6 +102,16 @@ typedef struct bsdi_csvfile_state {
   uint32_t last_processed_ts;
   /* maximum timestamp accepted in the current round */
   uint32_t max_accepted_ts;
+
+  /* set if the current row was too recent to be accepted */
+  int row_deferred;
+
+  /* number of bytes at the start of the file that have been completely
+     processed (and so need not be parsed again) */
+  int64_t offset;
+
+  /* holds data read from the file until a complete line is available */
+  char buffer[CSVFILE_BUFFER_LEN];
 } bsdi_csvfile_state_t;
 
 enum {
@@ -252,6 +265,10 @@ static void parse_rowend(int c, void *user_data)
   /* ensure fields read is compliant with the expected file format */
   assert(STATE->current_field == CSVFILE_FIELDCNT);
 
+  if (STATE->timestamp > STATE->max_accepted_ts) {
+    STATE->row_deferred = 1;
+  }
+
   /* check if the timestamp is acceptable */
   if (STATE->timestamp > STATE->last_processed_ts &&
       STATE->timestamp <= STATE->max_accepted_ts) {
@@ -352,12 +369,67 @@ void bsdi_csvfile_destroy(bsdi_t *di)
   BSDI_SET_STATE(di, NULL);
 }
 
+/* Move the file to the end of the data processed by previous updates. Returns
+   0 if the file is now at offset, 1 if the file is shorter than offset, and -1
+   on error */
+static int skip_processed(bsdi_t *di, io_t *file_io)
+{
+  int64_t remain;
+  int64_t read;
+  char c;
+
+  if (STATE->offset == 0) {
+    return 0;
+  }
+
+  // wandio_seek returns the new offset (or -1 if the reader can't seek).
+  // Processed data always ends with a newline, so seek to that and check that
+  // it is still there (seeking past the end of a truncated file succeeds)
+  if (wandio_seek(file_io, STATE->offset - 1, SEEK_SET) == STATE->offset - 1) {
+    if (wandio_read(file_io, &c, 1) != 1 || c != '\n') {
+      return 1;
+    }
+    return 0;
+  }
+
+  // not seekable (e.g., compressed), so read up to offset
+  remain = STATE->offset;
+  while (remain > 0) {
+    read = wandio_read(file_io, STATE->buffer,
+                       remain < CSVFILE_BUFFER_LEN ? remain
+                                                   : CSVFILE_BUFFER_LEN);
+    if (read < 0) {
+      return -1;
+    }
+    if (read == 0) {
+      return 1;
+    }
+    remain -= read;
+  }
+  return 0;
+}
+
+static int parse_csv(bsdi_t *di, const char *buf, size_t len)
+{
+  if (csv_parse(&(STATE->parser), buf, len, parse_field, parse_rowend, di) !=
+      len) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "CSV parsing error %s",
+                  csv_strerror(csv_error(&STATE->parser)));
+    return -1;
+  }
+  return 0;
+}
+
 int bsdi_csvfile_update_resources(bsdi_t *di)
 {
   io_t *file_io = NULL;
-#define BUFFER_LEN 1024
-  char buffer[BUFFER_LEN];
-  int read = 0;
+  char *buffer = STATE->buffer;
+  size_t buffer_len = 0;
+  size_t line_start;
+  char *nl;
+  int64_t read = 0;
+  int64_t offset;
+  int rc;
 
   /* we accept all timestamp earlier than now() - 1 second */
   STATE->max_accepted_ts = epoch_sec() - 1;
@@ -369,13 +441,62 @@ int bsdi_csvfile_update_resources(bsdi_t *di)
     goto err;
   }
 
-  while ((read = wandio_read(file_io, &buffer, BUFFER_LEN)) > 0) {
-    if (csv_parse(&(STATE->parser), buffer, read, parse_field,
-                  parse_rowend, di) != read) {
-      bgpstream_log(BGPSTREAM_LOG_ERR, "CSV parsing error %s",
-                        csv_strerror(csv_error(&STATE->parser)));
+  /* rows before offset have already been pushed or rejected, so only parse
+     rows that were appended since the last update */
+  if ((rc = skip_processed(di, file_io)) < 0) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "can't read file %s", STATE->csv_file);
+    goto err;
+  }
+  if (rc == 1) {
+    /* the file was truncated or replaced, start over (rows that were already
+       processed are still skipped thanks to last_processed_ts) */
+    bgpstream_log(BGPSTREAM_LOG_WARN, "%s is shorter than expected, rereading",
+                  STATE->csv_file);
+    wandio_destroy(file_io);
+    STATE->offset = 0;
+    if ((file_io = wandio_create(STATE->csv_file)) == NULL) {
+      bgpstream_log(BGPSTREAM_LOG_ERR, "can't open file %s", STATE->csv_file);
+      goto err;
+    }
+  }
+  offset = STATE->offset;
+
+  /* feed the parser one line at a time, so that we know the offset of the
+     first row that has to be looked at again during the next update (i.e.,
+     the first row too recent to be accepted) */
+  STATE->row_deferred = 0;
+  while ((read = wandio_read(file_io, buffer + buffer_len,
+                             CSVFILE_BUFFER_LEN - buffer_len)) > 0) {
+    buffer_len += read;
+    line_start = 0;
+    while ((nl = memchr(buffer + line_start, '\n', buffer_len - line_start)) !=
+           NULL) {
+      if (parse_csv(di, buffer + line_start, nl - buffer + 1 - line_start) !=
+          0) {
+        goto err;
+      }
+      offset += nl - buffer + 1 - line_start;
+      line_start = nl - buffer + 1;
+      if (STATE->row_deferred == 0) {
+        STATE->offset = offset;
+      }
+    }
+    if (line_start == 0 && buffer_len == CSVFILE_BUFFER_LEN) {
+      bgpstream_log(BGPSTREAM_LOG_ERR, "line too long in %s", STATE->csv_file);
       goto err;
     }
+    memmove(buffer, buffer + line_start, buffer_len - line_start);
+    buffer_len -= line_start;
+  }
+  if (read < 0) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "can't read file %s", STATE->csv_file);
+    goto err;
+  }
+
+  /* a final line without a newline may still be being written, so it is
+     parsed (as before) but not marked as processed */
+  if (buffer_len > 0 && parse_csv(di, buffer, buffer_len) != 0) {
+    goto err;
   }
 
   if (csv_fini(&(STATE->parser), parse_field, parse_rowend, di) != 0) {
@@ -386,9 +507,15 @@ int bsdi_csvfile_update_resources(bsdi_t *di)
 
   wandio_destroy(file_io);
 
-  STATE->last_processed_ts = STATE->max_ts_infile;
+  /* only rows newer than last_processed_ts were accepted */
+  if (STATE->max_ts_infile > STATE->last_processed_ts) {
+    STATE->last_processed_ts = STATE->max_ts_infile;
+  }
   return 0;
 
  err:
+  if (file_io != NULL) {
+    wandio_destroy(file_io);
+  }
   return -1;
 }
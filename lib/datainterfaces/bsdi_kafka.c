@@ -36,6 +36,7 @@
 #define STATE (BSDI_GET_STATE(di, kafka))
 
 #define DEFAULT_OFFSET "latest"
+#define DEFAULT_CONSUMERS 1
 #define DEFAULT_PROJECT ""
 #define DEFAULT_COLLECTOR ""
 
@@ -62,6 +63,7 @@ enum {
   OPTION_DATA_TYPE,      //
   OPTION_PROJECT,        //
   OPTION_COLLECTOR,      //
+  OPTION_CONSUMERS,      // split partitions between several consumers
 };
 
 /* define the options this data interface accepts */
@@ -115,6 +117,14 @@ static bgpstream_data_interface_option_t options[] = {
     "collector",                         // name
     "set collector name (default: unset)",
   },
+  /* Number of consumers */
+  {
+    BGPSTREAM_DATA_INTERFACE_KAFKA, // interface ID
+    OPTION_CONSUMERS,               // internal ID
+    "consumers",                    // name
+    "number of consumers to share the topic partitions between "
+    "(default: " STR(DEFAULT_CONSUMERS) ")",
+  },
 };
 
 /* create the class structure for this data interface */
@@ -152,7 +162,10 @@ typedef struct bsdi_kafka_state {
   // Type of the data to be consumed
   bgpstream_resource_format_type_t data_type;
 
-  // we only ever yield one resource
+  // Number of consumers (i.e., resources) to read the topic with
+  uint32_t consumers;
+
+  // we only ever yield one set of resources
   int done;
 
 } bsdi_kafka_state_t;
@@ -170,6 +183,7 @@ int bsdi_kafka_init(bsdi_t *di)
 
   /* set default state */
   state->data_type = BGPSTREAM_RESOURCE_FORMAT_BMP;
+  state->consumers = DEFAULT_CONSUMERS;
   state->project = strdup(DEFAULT_PROJECT);
   state->collector = strdup(DEFAULT_COLLECTOR);
 
@@ -273,6 +287,13 @@ int bsdi_kafka_set_option(bsdi_t *di,
     }
     break;
 
+  case OPTION_CONSUMERS:
+    if ((STATE->consumers = strtoul(option_value, NULL, 10)) == 0) {
+      fprintf(stderr, "ERROR: At least one consumer is required\n");
+      return -1;
+    }
+    break;
+
   default:
     return -1;
   }
@@ -310,42 +331,16 @@ void bsdi_kafka_destroy(bsdi_t *di)
 
 int bsdi_kafka_update_resources(bsdi_t *di)
 {
-  int rc;
-  bgpstream_resource_t *res = NULL;
-
-  // we only ever yield one resource
+  // we only ever yield one set of resources
   if (STATE->done != 0) {
     return 0;
   }
   STATE->done = 1;
 
-  // we treat kafka as having data from <recent> to <forever>
-  if ((rc = bgpstream_resource_mgr_push(
-         BSDI_GET_RES_MGR(di), BGPSTREAM_RESOURCE_TRANSPORT_KAFKA,
-         STATE->data_type, STATE->brokers,
-         0, // indicate we don't know how much historical data there is
-         BGPSTREAM_FOREVER, // indicate that the resource is a "stream"
-         STATE->project, STATE->collector, BGPSTREAM_UPDATE, &res)) <= 0) {
-    return rc;
-  }
-  assert(res != NULL);
-
-  if (bgpstream_resource_set_attr(res, BGPSTREAM_RESOURCE_ATTR_KAFKA_TOPICS,
-                                  STATE->topic_name) != 0) {
-    return -1;
-  }
-
-  if (STATE->group != NULL &&
-      bgpstream_resource_set_attr(
-        res, BGPSTREAM_RESOURCE_ATTR_KAFKA_CONSUMER_GROUP, STATE->group) != 0) {
-    return -1;
-  }
-
-  if (STATE->offset != NULL &&
-      bgpstream_resource_set_attr(
-        res, BGPSTREAM_RESOURCE_ATTR_KAFKA_INIT_OFFSET, STATE->offset) != 0) {
-    return -1;
-  }
-
-  return 0;
+  // consumers in the same group share the partitions of the topic between
+  // them, and so are decoded in parallel (and merged by time)
+  return bgpstream_resource_mgr_push_kafka(
+    BSDI_GET_RES_MGR(di), STATE->data_type, STATE->brokers, STATE->project,
+    STATE->collector, STATE->topic_name, STATE->group, STATE->offset, 0,
+    STATE->consumers);
 }
@@ -0,0 +1,998 @@
+/*
+ * Copyright (C) 2018 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "bsdi_localdir.h"
+#include "bgpstream_log.h"
+#include "config.h"
+#include "khash.h"
+#include "utils.h"
+#include <assert.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+
+#define STATE (BSDI_GET_STATE(di, localdir))
+
+/* Pattern used if none are given (e.g., ris.rrc06.updates.1427846400.gz) */
+#define DEFAULT_PATTERN "%P.%C.%T.%s.*"
+
+/* Default durations of dump files */
+#define DEFAULT_RIB_DURATION 120
+#define DEFAULT_UPDATE_DURATION 900
+
+/* Default width (in seconds of file time) of the windows of files queued by
+   each update */
+#define DEFAULT_WINDOW_SIZE 3600
+
+/* ---------- START CLASS DEFINITION ---------- */
+
+/* define the internal option ID values */
+enum {
+  OPTION_DIR,
+  OPTION_PATTERN,
+  OPTION_PROJECT,
+  OPTION_COLLECTOR,
+  OPTION_RIB_DURATION,
+  OPTION_UPDATE_DURATION,
+  OPTION_WINDOW_SIZE,
+};
+
+/* define the options this data interface accepts */
+static bgpstream_data_interface_option_t options[] = {
+  /* Archive directory */
+  {
+    BGPSTREAM_DATA_INTERFACE_LOCALDIR, // interface ID
+    OPTION_DIR, // internal ID
+    "dir", // name
+    "root of the directory tree holding the dump files",
+  },
+  /* File name pattern */
+  {
+    BGPSTREAM_DATA_INTERFACE_LOCALDIR, // interface ID
+    OPTION_PATTERN, // internal ID
+    "pattern", // name
+    "pattern of dump file names (or of paths relative to dir if it has a "
+    "'/'), using %P project, "
+    "%C collector, %T type, %s unix time, %Y%m%d%H%M%S UTC time, * anything "
+    "(default: " DEFAULT_PATTERN ")*",
+  },
+  /* Project */
+  {
+    BGPSTREAM_DATA_INTERFACE_LOCALDIR, // interface ID
+    OPTION_PROJECT, // internal ID
+    "project", // name
+    "project name to use if the pattern has no %P",
+  },
+  /* Collector */
+  {
+    BGPSTREAM_DATA_INTERFACE_LOCALDIR, // interface ID
+    OPTION_COLLECTOR, // internal ID
+    "collector", // name
+    "collector name to use if the pattern has no %C",
+  },
+  /* RIB duration */
+  {
+    BGPSTREAM_DATA_INTERFACE_LOCALDIR, // interface ID
+    OPTION_RIB_DURATION, // internal ID
+    "rib-duration", // name
+    "time span (s) of a RIB dump (default: " STR(DEFAULT_RIB_DURATION) ")",
+  },
+  /* Updates duration */
+  {
+    BGPSTREAM_DATA_INTERFACE_LOCALDIR, // interface ID
+    OPTION_UPDATE_DURATION, // internal ID
+    "update-duration", // name
+    "time span (s) of an updates dump (default: " STR(
+      DEFAULT_UPDATE_DURATION) ")",
+  },
+  /* Window size */
+  {
+    BGPSTREAM_DATA_INTERFACE_LOCALDIR, // interface ID
+    OPTION_WINDOW_SIZE, // internal ID
+    "window-size", // name
+    "seconds of data to queue at a time (default: " STR(
+      DEFAULT_WINDOW_SIZE) ")",
+  },
+};
+
+/* create the class structure for this data interface */
+BSDI_CREATE_CLASS(
+  localdir,
+  BGPSTREAM_DATA_INTERFACE_LOCALDIR,
+  "Retrieve metadata information from the names of files in a local directory",
+  options
+);
+
+/* ---------- END CLASS DEFINITION ---------- */
+
+/* The maximum number of patterns we let users set */
+#define MAX_PATTERNS 16
+
+/* The maximum length of a path */
+#define PATH_LEN 4096
+
+KHASH_INIT(strset, char *, char, 0, kh_str_hash_func, kh_str_hash_equal)
+
+#ifdef HAVE_SYS_INOTIFY_H
+KHASH_MAP_INIT_INT(wdmap, char *)
+#endif
+
+/* A dump file found in the directory */
+typedef struct localdir_file {
+
+  // full path (owned by the paths set)
+  char *path;
+
+  // project and collector names (owned by the names set)
+  char *project;
+
+  char *collector;
+
+  bgpstream_record_type_t type;
+
+  uint32_t time;
+
+} localdir_file_t;
+
+typedef struct bsdi_localdir_state {
+  /* user-provided options: */
+
+  // Root of the archive
+  char *dir;
+
+  // Path patterns
+  char *patterns[MAX_PATTERNS];
+
+  int patterns_cnt;
+
+  // Project and collector names (used if the pattern doesn't give them)
+  char *project;
+
+  char *collector;
+
+  uint32_t rib_duration;
+
+  uint32_t update_duration;
+
+  uint32_t window_size;
+
+  /* internal state: */
+
+  // Files that match a pattern and the filters. Files before files_next have
+  // been pushed, and the rest are ordered by time
+  localdir_file_t *files;
+
+  int files_cnt;
+
+  int files_alloc;
+
+  int files_next;
+
+  // Full paths of all files seen so far (so that a file is only indexed once)
+  khash_t(strset) *paths;
+
+  // Distinct project and collector names
+  khash_t(strset) *names;
+
+  // Should we watch for new files?
+  int live;
+
+#ifdef HAVE_SYS_INOTIFY_H
+  int inotify_fd;
+
+  // Map from watch descriptor to the (relative) path of the directory
+  khash_t(wdmap) *watches;
+#endif
+
+} bsdi_localdir_state_t;
+
+/* ---------- PATH PATTERNS ---------- */
+
+/* Fields of a path that matched a pattern */
+typedef struct pattern_match {
+
+  const char *project;
+
+  int project_len;
+
+  const char *collector;
+
+  int collector_len;
+
+  bgpstream_record_type_t type;
+
+  // value of %s (-1 if not in the pattern)
+  int64_t unix_time;
+
+  // values of %Y, %m, %d, %H, %M, %S (-1 if not in the pattern)
+  int tm[6];
+
+} pattern_match_t;
+
+static const char *tm_fields = "YmdHMS";
+
+static int parse_type(const char *str, int len, bgpstream_record_type_t *type)
+{
+  const char *ribs[] = {"ribs", "rib", "bview"};
+  const char *updates[] = {"updates", "update"};
+  int i;
+
+#define TYPE_CMP(words, t)                                                     \
+  do {                                                                         \
+    for (i = 0; i < (int)ARR_CNT(words); i++) {                                \
+      if ((int)strlen(words[i]) == len &&                                      \
+          strncasecmp(words[i], str, len) == 0) {                              \
+        *type = t;                                                             \
+        return 0;                                                              \
+      }                                                                        \
+    }                                                                          \
+  } while (0)
+
+  TYPE_CMP(ribs, BGPSTREAM_RIB);
+  TYPE_CMP(updates, BGPSTREAM_UPDATE);
+
+  return -1;
+}
+
+/* Can the given character be part of the given variable-length field? */
+static int field_char(char field, char c)
+{
+  switch (field) {
+  case 'T':
+    return isalpha(c);
+  case 's':
+    return isdigit(c);
+  default:
+    return c != '/';
+  }
+}
+
+static int capture(pattern_match_t *m, char field, const char *str, int len)
+{
+  switch (field) {
+  case 'P':
+    m->project = str;
+    m->project_len = len;
+    break;
+  case 'C':
+    m->collector = str;
+    m->collector_len = len;
+    break;
+  case 'T':
+    return parse_type(str, len, &m->type);
+  case 's':
+    m->unix_time = strtoll(str, NULL, 10);
+    break;
+  }
+  return 0;
+}
+
+/* Match a path against a pattern, backtracking over the lengths of the
+   variable-length fields. Returns 1 if the path matches */
+static int match_pattern(const char *pat, const char *str, pattern_match_t *m)
+{
+  const char *f;
+  int width;
+  int len;
+  int i;
+
+  if (*pat == '\0') {
+    return *str == '\0';
+  }
+
+  if (*pat == '*') {
+    // any run of characters within one path component
+    for (len = 0;; len++) {
+      if (match_pattern(pat + 1, str + len, m) != 0) {
+        return 1;
+      }
+      if (str[len] == '\0' || str[len] == '/') {
+        return 0;
+      }
+    }
+  }
+
+  if (*pat != '%') {
+    return *str == *pat && match_pattern(pat + 1, str + 1, m);
+  }
+
+  switch (pat[1]) {
+  case '%':
+    return *str == '%' && match_pattern(pat + 2, str + 1, m);
+
+  case 'P':
+  case 'C':
+  case 'T':
+  case 's':
+    for (len = 1; str[len - 1] != '\0' && field_char(pat[1], str[len - 1]);
+         len++) {
+      if (capture(m, pat[1], str, len) == 0 &&
+          match_pattern(pat + 2, str + len, m) != 0) {
+        return 1;
+      }
+    }
+    return 0;
+
+  default:
+    if ((f = strchr(tm_fields, pat[1])) == NULL) {
+      return 0;
+    }
+    width = (pat[1] == 'Y') ? 4 : 2;
+    m->tm[f - tm_fields] = 0;
+    for (i = 0; i < width; i++) {
+      if (isdigit(str[i]) == 0) {
+        return 0;
+      }
+      m->tm[f - tm_fields] = m->tm[f - tm_fields] * 10 + (str[i] - '0');
+    }
+    return match_pattern(pat + 2, str + width, m);
+  }
+}
+
+/* Convert a UTC date to unix time (without relying on timegm) */
+static int64_t utc_to_unix(int year, int mon, int day, int hour, int min,
+                           int sec)
+{
+  // days since 1970-01-01 of the given civil date
+  int64_t y = year - (mon <= 2);
+  int64_t era = (y >= 0 ? y : y - 399) / 400;
+  int64_t yoe = y - era * 400;
+  int64_t doy = (153 * (mon + (mon > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  int64_t days = era * 146097 + doe - 719468;
+
+  return days * 86400 + hour * 3600 + min * 60 + sec;
+}
+
+/* Match a path against all patterns, and fill in the time of the file.
+   Patterns without a '/' are matched against the file name only */
+static int match_path(bsdi_t *di, const char *path, pattern_match_t *m,
+                      uint32_t *time)
+{
+  const char *name = strrchr(path, '/');
+  int i, j;
+
+  name = (name == NULL) ? path : name + 1;
+
+  for (i = 0; i < STATE->patterns_cnt; i++) {
+    memset(m, 0, sizeof(pattern_match_t));
+    m->unix_time = -1;
+    for (j = 0; j < 6; j++) {
+      m->tm[j] = -1;
+    }
+    if (match_pattern(STATE->patterns[i],
+                      (strchr(STATE->patterns[i], '/') == NULL) ? name : path,
+                      m) == 0) {
+      continue;
+    }
+    if (m->unix_time >= 0) {
+      *time = m->unix_time;
+    } else {
+      // hour, minute and second are optional
+      for (j = 3; j < 6; j++) {
+        if (m->tm[j] < 0) {
+          m->tm[j] = 0;
+        }
+      }
+      *time = utc_to_unix(m->tm[0], m->tm[1], m->tm[2], m->tm[3], m->tm[4],
+                          m->tm[5]);
+    }
+    return 1;
+  }
+  return 0;
+}
+
+/* Check that a pattern gives everything we need to know about a file */
+static int check_pattern(const char *pat)
+{
+  if (strstr(pat, "%T") == NULL) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "pattern '%s' has no %%T", pat);
+    return -1;
+  }
+  if (strstr(pat, "%s") == NULL &&
+      (strstr(pat, "%Y") == NULL || strstr(pat, "%m") == NULL ||
+       strstr(pat, "%d") == NULL)) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "pattern '%s' has no %%s or %%Y%%m%%d",
+                  pat);
+    return -1;
+  }
+  return 0;
+}
+
+/* ---------- INDEX ---------- */
+
+static int filters_match(bsdi_t *di, char *project, char *collector,
+                         bgpstream_record_type_t type, uint32_t time)
+{
+  bgpstream_filter_mgr_t *filter_mgr = BSDI_GET_FILTER_MGR(di);
+  bgpstream_interval_filter_t *tif;
+
+  if (filter_mgr->projects != NULL &&
+      bgpstream_str_set_exists(filter_mgr->projects, project) == 0) {
+    return 0;
+  }
+  if (filter_mgr->collectors != NULL &&
+      bgpstream_str_set_exists(filter_mgr->collectors, collector) == 0) {
+    return 0;
+  }
+  if (filter_mgr->bgp_types != NULL &&
+      bgpstream_str_set_exists(filter_mgr->bgp_types, type == BGPSTREAM_RIB
+                                                        ? "ribs"
+                                                        : "updates") == 0) {
+    return 0;
+  }
+
+  if (filter_mgr->time_intervals == NULL) {
+    return 1;
+  }
+  for (tif = filter_mgr->time_intervals; tif != NULL; tif = tif->next) {
+    // as in the csvfile interface, we accept files up to 15 mins (+ 120s
+    // margin) before the interval so as to get RouteViews updates
+    if (time >= (tif->begin_time - (15 * 60) - 120) &&
+        (tif->end_time == BGPSTREAM_FOREVER || time <= tif->end_time)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* Return a stored copy of the given name */
+static char *intern_name(bsdi_t *di, const char *name, int len)
+{
+  char buf[BGPSTREAM_UTILS_STR_NAME_LEN];
+  char *cpy;
+  khiter_t k;
+  int khret;
+
+  if (len >= BGPSTREAM_UTILS_STR_NAME_LEN) {
+    return NULL;
+  }
+  memcpy(buf, name, len);
+  buf[len] = '\0';
+
+  if ((k = kh_get(strset, STATE->names, buf)) == kh_end(STATE->names)) {
+    if ((cpy = strdup(buf)) == NULL) {
+      return NULL;
+    }
+    k = kh_put(strset, STATE->names, cpy, &khret);
+  }
+  return kh_key(STATE->names, k);
+}
+
+/* Index the file at the given path (relative to dir) if it matches a pattern
+   and the filters, and we haven't seen it before */
+static int add_file(bsdi_t *di, const char *rel_path)
+{
+  char path[PATH_LEN];
+  pattern_match_t m;
+  localdir_file_t *file;
+  char *project;
+  char *collector;
+  uint32_t time;
+  khiter_t k;
+  int khret;
+
+  if (snprintf(path, PATH_LEN, "%s/%s", STATE->dir, rel_path) >= PATH_LEN) {
+    bgpstream_log(BGPSTREAM_LOG_WARN, "path too long: %s/%s", STATE->dir,
+                  rel_path);
+    return 0;
+  }
+  if (kh_get(strset, STATE->paths, path) != kh_end(STATE->paths)) {
+    return 0;
+  }
+  // remember every file (even those we don't want) so that rescans are cheap
+  k = kh_put(strset, STATE->paths, path, &khret);
+  if ((kh_key(STATE->paths, k) = strdup(path)) == NULL) {
+    kh_del(strset, STATE->paths, k);
+    return -1;
+  }
+
+  if (match_path(di, rel_path, &m, &time) == 0) {
+    return 0;
+  }
+  project = (m.project != NULL)
+              ? intern_name(di, m.project, m.project_len)
+              : STATE->project;
+  collector = (m.collector != NULL)
+                ? intern_name(di, m.collector, m.collector_len)
+                : STATE->collector;
+  if (project == NULL || collector == NULL) {
+    bgpstream_log(BGPSTREAM_LOG_WARN, "invalid project/collector in %s",
+                  rel_path);
+    return 0;
+  }
+  if (filters_match(di, project, collector, m.type, time) == 0) {
+    return 0;
+  }
+
+  if (STATE->files_cnt == STATE->files_alloc) {
+    STATE->files_alloc = (STATE->files_alloc == 0) ? 1024
+                                                   : STATE->files_alloc * 2;
+    if ((file = realloc(STATE->files,
+                        sizeof(localdir_file_t) * STATE->files_alloc)) ==
+        NULL) {
+      return -1;
+    }
+    STATE->files = file;
+  }
+  file = &STATE->files[STATE->files_cnt++];
+  file->path = kh_key(STATE->paths, k);
+  file->project = project;
+  file->collector = collector;
+  file->type = m.type;
+  file->time = time;
+
+  return 0;
+}
+
+static int file_cmp(const void *a, const void *b)
+{
+  const localdir_file_t *fa = (const localdir_file_t *)a;
+  const localdir_file_t *fb = (const localdir_file_t *)b;
+
+  if (fa->time != fb->time) {
+    return (fa->time < fb->time) ? -1 : 1;
+  }
+  // RIBs before updates
+  if (fa->type != fb->type) {
+    return (fa->type == BGPSTREAM_RIB) ? -1 : 1;
+  }
+  return strcmp(fa->path, fb->path);
+}
+
+/* Order the files that have not been pushed yet */
+static void sort_pending(bsdi_t *di)
+{
+  qsort(STATE->files + STATE->files_next,
+        STATE->files_cnt - STATE->files_next, sizeof(localdir_file_t),
+        file_cmp);
+}
+
+#ifdef HAVE_SYS_INOTIFY_H
+static int add_watch(bsdi_t *di, const char *path, const char *rel_path)
+{
+  khiter_t k;
+  int khret;
+  int wd;
+
+  if ((wd = inotify_add_watch(STATE->inotify_fd, path,
+                              IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE |
+                                IN_ONLYDIR)) < 0) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "could not watch %s: %s", path,
+                  strerror(errno));
+    return -1;
+  }
+  // the same directory gives the same descriptor
+  if ((k = kh_get(wdmap, STATE->watches, wd)) != kh_end(STATE->watches)) {
+    free(kh_val(STATE->watches, k));
+  } else {
+    k = kh_put(wdmap, STATE->watches, wd, &khret);
+  }
+  if ((kh_val(STATE->watches, k) = strdup(rel_path)) == NULL) {
+    kh_del(wdmap, STATE->watches, k);
+    return -1;
+  }
+  return 0;
+}
+#endif
+
+/* Index all files under the given directory (relative to dir) */
+static int scan_dir(bsdi_t *di, const char *rel_path)
+{
+  char path[PATH_LEN];
+  char child[PATH_LEN];
+  char child_path[PATH_LEN];
+  DIR *dir;
+  struct dirent *ent;
+  struct stat st;
+  int rc = 0;
+
+  if (snprintf(path, PATH_LEN, "%s%s%s", STATE->dir,
+               (*rel_path == '\0') ? "" : "/", rel_path) >= PATH_LEN) {
+    bgpstream_log(BGPSTREAM_LOG_WARN, "path too long: %s/%s", STATE->dir,
+                  rel_path);
+    return 0;
+  }
+
+#ifdef HAVE_SYS_INOTIFY_H
+  // watch before listing, so that no file can slip between the two
+  if (STATE->live != 0 && add_watch(di, path, rel_path) != 0) {
+    return -1;
+  }
+#endif
+
+  if ((dir = opendir(path)) == NULL) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "could not open directory %s: %s", path,
+                  strerror(errno));
+    return -1;
+  }
+
+  while (rc == 0 && (ent = readdir(dir)) != NULL) {
+    // skip ., .. and hidden (e.g., partially transferred) files
+    if (ent->d_name[0] == '.') {
+      continue;
+    }
+    if (snprintf(child, PATH_LEN, "%s%s%s", rel_path,
+                 (*rel_path == '\0') ? "" : "/", ent->d_name) >= PATH_LEN ||
+        snprintf(child_path, PATH_LEN, "%s/%s", path, ent->d_name) >=
+          PATH_LEN) {
+      continue;
+    }
+    if (stat(child_path, &st) != 0) {
+      continue;
+    }
+    if (S_ISDIR(st.st_mode)) {
+      rc = scan_dir(di, child);
+    } else if (S_ISREG(st.st_mode)) {
+      rc = add_file(di, child);
+    }
+  }
+  closedir(dir);
+
+  return rc;
+}
+
+#ifdef HAVE_SYS_INOTIFY_H
+/* Index files that have appeared since the last call */
+static int process_events(bsdi_t *di)
+{
+  char buf[4096]
+    __attribute__((aligned(__alignof__(struct inotify_event))));
+  char child[PATH_LEN];
+  struct inotify_event *ev;
+  const char *dir_path;
+  ssize_t len;
+  char *p;
+  khiter_t k;
+  int rescan = 0;
+
+  while ((len = read(STATE->inotify_fd, buf, sizeof(buf))) > 0) {
+    for (p = buf; p < buf + len; p += sizeof(struct inotify_event) + ev->len) {
+      ev = (struct inotify_event *)p;
+      if ((ev->mask & IN_Q_OVERFLOW) != 0) {
+        // events were lost
+        rescan = 1;
+        continue;
+      }
+      if (ev->len == 0 || ev->name[0] == '.' ||
+          (k = kh_get(wdmap, STATE->watches, ev->wd)) ==
+            kh_end(STATE->watches)) {
+        continue;
+      }
+      dir_path = kh_val(STATE->watches, k);
+      if (snprintf(child, PATH_LEN, "%s%s%s", dir_path,
+                   (*dir_path == '\0') ? "" : "/", ev->name) >= PATH_LEN) {
+        continue;
+      }
+      if ((ev->mask & IN_ISDIR) != 0) {
+        if ((ev->mask & (IN_CREATE | IN_MOVED_TO)) != 0 &&
+            scan_dir(di, child) != 0) {
+          return -1;
+        }
+      } else if ((ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) != 0) {
+        // (files are only indexed once they have been written)
+        if (add_file(di, child) != 0) {
+          return -1;
+        }
+      }
+    }
+  }
+  if (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "could not read inotify events: %s",
+                  strerror(errno));
+    return -1;
+  }
+
+  if (rescan != 0) {
+    bgpstream_log(BGPSTREAM_LOG_WARN, "inotify queue overflowed, rescanning %s",
+                  STATE->dir);
+    return scan_dir(di, "");
+  }
+  return 0;
+}
+#endif
+
+/* ========== PUBLIC METHODS BELOW HERE ========== */
+
+int bsdi_localdir_init(bsdi_t *di)
+{
+  bsdi_localdir_state_t *state;
+
+  if ((state = malloc_zero(sizeof(bsdi_localdir_state_t))) == NULL) {
+    goto err;
+  }
+  BSDI_SET_STATE(di, state);
+
+  /* set default state */
+  state->rib_duration = DEFAULT_RIB_DURATION;
+  state->update_duration = DEFAULT_UPDATE_DURATION;
+  state->window_size = DEFAULT_WINDOW_SIZE;
+#ifdef HAVE_SYS_INOTIFY_H
+  state->inotify_fd = -1;
+#endif
+
+  if ((state->paths = kh_init(strset)) == NULL ||
+      (state->names = kh_init(strset)) == NULL) {
+    goto err;
+  }
+#ifdef HAVE_SYS_INOTIFY_H
+  if ((state->watches = kh_init(wdmap)) == NULL) {
+    goto err;
+  }
+#endif
+
+  return 0;
+err:
+  bsdi_localdir_destroy(di);
+  return -1;
+}
+
+int bsdi_localdir_start(bsdi_t *di)
+{
+  bgpstream_interval_filter_t *tif;
+  int i;
+
+  /* check user-provided options */
+  if (STATE->dir == NULL) {
+    fprintf(stderr, "ERROR: The 'dir' option must be set\n");
+    return -1;
+  }
+  if (STATE->patterns_cnt == 0 &&
+      (STATE->patterns[STATE->patterns_cnt++] = strdup(DEFAULT_PATTERN)) ==
+        NULL) {
+    return -1;
+  }
+  for (i = 0; i < STATE->patterns_cnt; i++) {
+    if ((strstr(STATE->patterns[i], "%P") == NULL && STATE->project == NULL) ||
+        (strstr(STATE->patterns[i], "%C") == NULL &&
+         STATE->collector == NULL)) {
+      fprintf(stderr, "ERROR: Pattern '%s' needs the 'project' and/or "
+                      "'collector' options to be set\n",
+              STATE->patterns[i]);
+      return -1;
+    }
+  }
+
+  // watch for new files if we are asked for data with no end
+  for (tif = BSDI_GET_FILTER_MGR(di)->time_intervals; tif != NULL;
+       tif = tif->next) {
+    if (tif->end_time == BGPSTREAM_FOREVER) {
+      STATE->live = 1;
+    }
+  }
+#ifdef HAVE_SYS_INOTIFY_H
+  if (STATE->live != 0 &&
+      (STATE->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "could not initialize inotify: %s",
+                  strerror(errno));
+    return -1;
+  }
+  // let the DI manager wake up as soon as a new file shows up
+  BSDI_SET_WAIT_FD(di, STATE->inotify_fd);
+#endif
+
+  if (scan_dir(di, "") != 0) {
+    return -1;
+  }
+  sort_pending(di);
+
+  return 0;
+}
+
+int bsdi_localdir_set_option(bsdi_t *di,
+                             const bgpstream_data_interface_option_t *option_type,
+                             const char *option_value)
+{
+  char **dst = NULL;
+  uint32_t *dst_int = NULL;
+
+  switch (option_type->id) {
+  case OPTION_DIR:
+    dst = &STATE->dir;
+    break;
+
+  case OPTION_PATTERN:
+    // adds a pattern
+    if (STATE->patterns_cnt == MAX_PATTERNS) {
+      fprintf(stderr, "ERROR: At most %d patterns can be set\n", MAX_PATTERNS);
+      return -1;
+    }
+    if (check_pattern(option_value) != 0 ||
+        (STATE->patterns[STATE->patterns_cnt] = strdup(option_value)) ==
+          NULL) {
+      return -1;
+    }
+    STATE->patterns_cnt++;
+    break;
+
+  case OPTION_PROJECT:
+    dst = &STATE->project;
+    break;
+
+  case OPTION_COLLECTOR:
+    dst = &STATE->collector;
+    break;
+
+  case OPTION_RIB_DURATION:
+    dst_int = &STATE->rib_duration;
+    break;
+
+  case OPTION_UPDATE_DURATION:
+    dst_int = &STATE->update_duration;
+    break;
+
+  case OPTION_WINDOW_SIZE:
+    dst_int = &STATE->window_size;
+    break;
+
+  default:
+    return -1;
+  }
+
+  if (dst != NULL) {
+    // replaces the current value
+    free(*dst);
+    if ((*dst = strdup(option_value)) == NULL) {
+      return -1;
+    }
+  }
+  if (dst_int != NULL && (*dst_int = strtoul(option_value, NULL, 10)) == 0) {
+    fprintf(stderr, "ERROR: Invalid value for %s: '%s'\n", option_type->name,
+            option_value);
+    return -1;
+  }
+
+  return 0;
+}
+
+void bsdi_localdir_destroy(bsdi_t *di)
+{
+  khiter_t k;
+  int i;
+
+  if (di == NULL || STATE == NULL) {
+    return;
+  }
+
+  free(STATE->dir);
+  STATE->dir = NULL;
+
+  for (i = 0; i < STATE->patterns_cnt; i++) {
+    free(STATE->patterns[i]);
+    STATE->patterns[i] = NULL;
+  }
+  STATE->patterns_cnt = 0;
+
+  free(STATE->project);
+  STATE->project = NULL;
+
+  free(STATE->collector);
+  STATE->collector = NULL;
+
+  free(STATE->files);
+  STATE->files = NULL;
+
+  if (STATE->paths != NULL) {
+    for (k = kh_begin(STATE->paths); k != kh_end(STATE->paths); k++) {
+      if (kh_exist(STATE->paths, k)) {
+        free(kh_key(STATE->paths, k));
+      }
+    }
+    kh_destroy(strset, STATE->paths);
+    STATE->paths = NULL;
+  }
+
+  if (STATE->names != NULL) {
+    for (k = kh_begin(STATE->names); k != kh_end(STATE->names); k++) {
+      if (kh_exist(STATE->names, k)) {
+        free(kh_key(STATE->names, k));
+      }
+    }
+    kh_destroy(strset, STATE->names);
+    STATE->names = NULL;
+  }
+
+#ifdef HAVE_SYS_INOTIFY_H
+  if (STATE->watches != NULL) {
+    for (k = kh_begin(STATE->watches); k != kh_end(STATE->watches); k++) {
+      if (kh_exist(STATE->watches, k)) {
+        free(kh_val(STATE->watches, k));
+      }
+    }
+    kh_destroy(wdmap, STATE->watches);
+    STATE->watches = NULL;
+  }
+  if (STATE->inotify_fd >= 0) {
+    BSDI_SET_WAIT_FD(di, -1);
+    close(STATE->inotify_fd);
+  }
+#endif
+
+  free(STATE);
+  BSDI_SET_STATE(di, NULL);
+}
+
+int bsdi_localdir_update_resources(bsdi_t *di)
+{
+  localdir_file_t *file;
+  uint32_t window_end;
+  int queued = 0;
+  int rc;
+
+  if (STATE->live != 0) {
+#ifdef HAVE_SYS_INOTIFY_H
+    if (process_events(di) != 0) {
+      return -1;
+    }
+#else
+    // no way to be told about new files, so look for them
+    if (STATE->files_next == STATE->files_cnt && scan_dir(di, "") != 0) {
+      return -1;
+    }
+#endif
+    sort_pending(di);
+  }
+
+  // queue the next window of files. if the filters reject every file in it
+  // (e.g., RIBs inside the RIB period), an empty queue would look like the
+  // end of the stream, so keep going until something is queued or we run
+  // out of files
+  while (queued == 0 && STATE->files_next < STATE->files_cnt) {
+    window_end = STATE->files[STATE->files_next].time + STATE->window_size;
+    while (STATE->files_next < STATE->files_cnt &&
+           (file = &STATE->files[STATE->files_next])->time < window_end) {
+      if ((rc = bgpstream_resource_mgr_push(BSDI_GET_RES_MGR(di),
+                                            BGPSTREAM_RESOURCE_TRANSPORT_FILE,
+                                            BGPSTREAM_RESOURCE_FORMAT_MRT,
+                                            file->path,
+                                            file->time,
+                                            (file->type == BGPSTREAM_RIB)
+                                              ? STATE->rib_duration
+                                              : STATE->update_duration,
+                                            file->project,
+                                            file->collector,
+                                            file->type,
+                                            NULL)) < 0) {
+        return -1;
+      }
+      queued += rc;
+      STATE->files_next++;
+    }
+  }
+
+  return 0;
+}
@@ -40,11 +40,16 @@
 
 #define STATE (BSDI_GET_STATE(di, sqlite))
 
+/* Default width (in seconds of file time) of the windows used to page through
+   the archive */
+#define WINDOW_SIZE_DEFAULT 3600
+
 /* ---------- START CLASS DEFINITION ---------- */
 
 /* define the internal option ID values */
 enum {
   OPTION_DB_FILE,
+  OPTION_WINDOW_SIZE,
 };
 
 /* define the options this data interface accepts */
@@ -56,6 +61,14 @@ static bgpstream_data_interface_option_t options[] = {
     "db-file", // name
     "SQLite database file (default: " STR(BGPSTREAM_DI_SQLITE_DB_FILE) ")",
   },
+  /* Window size */
+  {
+    BGPSTREAM_DATA_INTERFACE_SQLITE, // interface ID
+    OPTION_WINDOW_SIZE, // internal ID
+    "window-size", // name
+    "Seconds of data to queue at a time (default: " STR(
+      WINDOW_SIZE_DEFAULT) ")",
+  },
 };
 
 /* create the class structure for this data interface */
@@ -75,17 +88,33 @@ typedef struct bsdi_sqlite_state {
 
   char *db_file;
 
+  // width of the windows (of file time) used to page through the archive
+  uint32_t window_size;
+
   /* internal state: */
 
   // DB handle
   sqlite3 *db;
 
-  // statement handle
+  // statement that selects the files in a window
   sqlite3_stmt *stmt;
 
+  // statement that finds the earliest file time at or after a given time
+  sqlite3_stmt *next_stmt;
+
   // buffer for building queries XXX
   char query_buf[MAX_QUERY_LEN];
 
+  // files added to the DB before this time are read one window at a time,
+  // files added later are read as they are added
+  uint32_t backlog_ts;
+
+  // file time at which the next window starts
+  int64_t window_start;
+
+  // have all windows of the backlog been read?
+  int backlog_done;
+
   // current timestamp
   uint32_t current_ts;
 
@@ -106,8 +135,43 @@ typedef struct bsdi_sqlite_state {
     rem_buf_space -= len;                                                      \
   } while (0)
 
-static int prepare_db(bsdi_t *di)
+/* Is there an index on bgp_data whose first column is the given one? */
+static int has_index(bsdi_t *di, const char *column)
 {
+  sqlite3_stmt *list_stmt = NULL;
+  sqlite3_stmt *info_stmt = NULL;
+  char query[256];
+  int found = 0;
+
+  if (sqlite3_prepare_v2(STATE->db, "PRAGMA index_list(bgp_data)", -1,
+                         &list_stmt, NULL) != SQLITE_OK) {
+    return 0;
+  }
+  while (found == 0 && sqlite3_step(list_stmt) == SQLITE_ROW) {
+    if (snprintf(query, sizeof(query), "PRAGMA index_info('%s')",
+                 sqlite3_column_text(list_stmt, 1)) >= (int)sizeof(query) ||
+        sqlite3_prepare_v2(STATE->db, query, -1, &info_stmt, NULL) !=
+          SQLITE_OK) {
+      continue;
+    }
+    // rows are ordered by position in the index
+    if (sqlite3_step(info_stmt) == SQLITE_ROW &&
+        sqlite3_column_int(info_stmt, 0) == 0 &&
+        strcmp((const char *)sqlite3_column_text(info_stmt, 2), column) == 0) {
+      found = 1;
+    }
+    sqlite3_finalize(info_stmt);
+  }
+  sqlite3_finalize(list_stmt);
+
+  return found;
+}
+
+static int open_db(bsdi_t *di)
+{
+  const char *indexed[] = {"file_time", "ts"};
+  int i;
+
   if (sqlite3_open_v2(STATE->db_file, &STATE->db, SQLITE_OPEN_READONLY, NULL)
       != SQLITE_OK) {
     bgpstream_log(BGPSTREAM_LOG_ERR, "can't open database: %s",
@@ -115,11 +179,14 @@ static int prepare_db(bsdi_t *di)
     return -1;
   }
 
-  if (sqlite3_prepare_v2(STATE->db, STATE->query_buf, -1, &STATE->stmt, NULL)
-      != SQLITE_OK) {
-    bgpstream_log(BGPSTREAM_LOG_ERR, "failed to prepare statement: %s",
-                  sqlite3_errmsg(STATE->db));
-    return -1;
+  // the database is opened read-only, so we can't create these ourselves
+  for (i = 0; i < (int)(sizeof(indexed) / sizeof(indexed[0])); i++) {
+    if (has_index(di, indexed[i]) == 0) {
+      bgpstream_log(BGPSTREAM_LOG_WARN,
+                    "bgp_data.%s is not indexed, queries will be slow "
+                    "(CREATE INDEX bgp_data_%s ON bgp_data(%s))",
+                    indexed[i], indexed[i], indexed[i]);
+    }
   }
   return 0;
 }
@@ -136,7 +203,7 @@ int bsdi_sqlite_init(bsdi_t *di)
   BSDI_SET_STATE(di, state);
 
   /* set default state */
-  // none
+  state->window_size = WINDOW_SIZE_DEFAULT;
 
   return 0;
 err:
@@ -144,7 +211,11 @@ err:
   return -1;
 }
 
-static int build_query(bsdi_t *di)
+/* Build a query that selects the given columns from the bgp_data rows that
+   match the filters, then append suffix. String filters are given as
+   positional parameters (see bind_filters), and the ranges of insertion time
+   and file time as named parameters */
+static int build_query(bsdi_t *di, const char *columns, const char *suffix)
 {
   size_t rem_buf_space = MAX_QUERY_LEN;
   char interval_str[MAX_INTERVAL_LEN];
@@ -152,10 +223,10 @@ static int build_query(bsdi_t *di)
   /* reset the query buffer. probably unnecessary, but lets do it anyway */
   STATE->query_buf[0] = '\0';
 
+  APPEND_STR("SELECT ");
+  APPEND_STR(columns);
   APPEND_STR(
-    "SELECT bgp_data.file_path, collectors.project, collectors.name, "
-    "bgp_types.name, time_span.time_span, bgp_data.file_time, bgp_data.ts "
-    "FROM  collectors JOIN bgp_data JOIN bgp_types JOIN time_span "
+    " FROM  collectors JOIN bgp_data JOIN bgp_types JOIN time_span "
     "WHERE bgp_data.collector_id = collectors.id  AND "
     "bgp_data.collector_id = time_span.collector_id AND "
     "bgp_data.type_id = bgp_types.id AND "
@@ -177,9 +248,7 @@ static int build_query(bsdi_t *di)
       if (!first) {
         APPEND_STR(", ");
       }
-      APPEND_STR("'");
-      APPEND_STR(f);
-      APPEND_STR("'");
+      APPEND_STR("?");
       first = 0;
     }
     APPEND_STR(" ) ");
@@ -194,9 +263,7 @@ static int build_query(bsdi_t *di)
       if (!first) {
         APPEND_STR(", ");
       }
-      APPEND_STR("'");
-      APPEND_STR(f);
-      APPEND_STR("'");
+      APPEND_STR("?");
       first = 0;
     }
     APPEND_STR(" ) ");
@@ -211,9 +278,7 @@ static int build_query(bsdi_t *di)
       if (!first) {
         APPEND_STR(", ");
       }
-      APPEND_STR("'");
-      APPEND_STR(f);
-      APPEND_STR("'");
+      APPEND_STR("?");
       first = 0;
     }
     APPEND_STR(" ) ");
@@ -265,12 +330,11 @@ static int build_query(bsdi_t *di)
   /*  in order to compensate for this kind of situations we  */
   /*  retrieve data that are 120 seconds older than the requested  */
 
-  // minimum timestamp and current timestamp are the two placeholders
-  APPEND_STR(" AND bgp_data.ts > ? AND bgp_data.ts <= ?");
-  // order by filetime and bgptypes in reverse order: this way the
-  // input insertions are always "head" insertions, i.e. queue insertion is
-  // faster
-  APPEND_STR(" ORDER BY file_time DESC, bgp_types.name DESC");
+  // ranges of insertion time and file time
+  APPEND_STR(" AND bgp_data.ts > :ts_min AND bgp_data.ts <= :ts_max");
+  APPEND_STR(" AND bgp_data.file_time >= :ft_min"
+             " AND bgp_data.file_time < :ft_max");
+  APPEND_STR(suffix);
 
   return 0;
 
@@ -278,6 +342,148 @@ static int build_query(bsdi_t *di)
   return -1;
 }
 
+/* Bind the string filters in the order they appear in the query */
+static int bind_filters(bsdi_t *di, sqlite3_stmt *stmt)
+{
+  bgpstream_filter_mgr_t *filter_mgr = BSDI_GET_FILTER_MGR(di);
+  bgpstream_str_set_t *sets[] = {filter_mgr->projects, filter_mgr->collectors,
+                                 filter_mgr->bgp_types};
+  int idx = 1;
+  int i;
+  char *f;
+
+  for (i = 0; i < (int)(sizeof(sets) / sizeof(sets[0])); i++) {
+    if (sets[i] == NULL) {
+      continue;
+    }
+    bgpstream_str_set_rewind(sets[i]);
+    while ((f = bgpstream_str_set_next(sets[i])) != NULL) {
+      if (sqlite3_bind_text(stmt, idx++, f, -1, SQLITE_TRANSIENT) !=
+          SQLITE_OK) {
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+static int prepare_stmt(bsdi_t *di, const char *columns, const char *suffix,
+                        sqlite3_stmt **stmt)
+{
+  if (build_query(di, columns, suffix) != 0) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "query too long");
+    return -1;
+  }
+  if (sqlite3_prepare_v2(STATE->db, STATE->query_buf, -1, stmt, NULL)
+      != SQLITE_OK) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "failed to prepare statement: %s",
+                  sqlite3_errmsg(STATE->db));
+    return -1;
+  }
+  if (bind_filters(di, *stmt) != 0) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "failed to bind filters: %s",
+                  sqlite3_errmsg(STATE->db));
+    return -1;
+  }
+  return 0;
+}
+
+static void bind_ranges(sqlite3_stmt *stmt, int64_t ts_min, int64_t ts_max,
+                        int64_t ft_min, int64_t ft_max)
+{
+  sqlite3_bind_int64(stmt, sqlite3_bind_parameter_index(stmt, ":ts_min"),
+                     ts_min);
+  sqlite3_bind_int64(stmt, sqlite3_bind_parameter_index(stmt, ":ts_max"),
+                     ts_max);
+  sqlite3_bind_int64(stmt, sqlite3_bind_parameter_index(stmt, ":ft_min"),
+                     ft_min);
+  sqlite3_bind_int64(stmt, sqlite3_bind_parameter_index(stmt, ":ft_max"),
+                     ft_max);
+}
+
+/* Find the earliest file time, at or after window_start, of a file added
+   before backlog_ts. Returns 1 if there is one, 0 if not, and -1 on error */
+static int find_next_window(bsdi_t *di, int64_t *start)
+{
+  int found = 0;
+
+  bind_ranges(STATE->next_stmt, 0, STATE->backlog_ts, STATE->window_start,
+              INT64_MAX);
+
+  if (sqlite3_step(STATE->next_stmt) != SQLITE_ROW) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "error while finding next window: %s",
+                  sqlite3_errmsg(STATE->db));
+    sqlite3_reset(STATE->next_stmt);
+    return -1;
+  }
+  // MIN() gives NULL if there are no rows
+  if (sqlite3_column_type(STATE->next_stmt, 0) != SQLITE_NULL) {
+    *start = sqlite3_column_int64(STATE->next_stmt, 0);
+    found = 1;
+  }
+  sqlite3_reset(STATE->next_stmt);
+
+  return found;
+}
+
+/* Push the files added in (ts_min, ts_max] with a file time in
+   [ft_min, ft_max). Returns the number of files queued (i.e., not rejected by
+   the filters), or -1 on error */
+static int push_resources(bsdi_t *di, int64_t ts_min, int64_t ts_max,
+                          int64_t ft_min, int64_t ft_max)
+{
+  int queued = 0;
+  int rc;
+
+  bind_ranges(STATE->stmt, ts_min, ts_max, ft_min, ft_max);
+
+  while ((rc = sqlite3_step(STATE->stmt)) != SQLITE_DONE) {
+    if (rc != SQLITE_ROW) {
+      bgpstream_log(BGPSTREAM_LOG_ERR,
+                    "error while stepping through results");
+      goto err;
+    }
+
+    const char *path = (const char *)sqlite3_column_text(STATE->stmt, 0);
+    const char *proj = (const char *)sqlite3_column_text(STATE->stmt, 1);
+    const char *coll = (const char *)sqlite3_column_text(STATE->stmt, 2);
+    const char *type_str = (const char *)sqlite3_column_text(STATE->stmt, 3);
+    bgpstream_record_type_t type;
+    if (strcmp("ribs", type_str) == 0) {
+      type = BGPSTREAM_RIB;
+    } else if (strcmp("updates", type_str) == 0) {
+      type = BGPSTREAM_UPDATE;
+    } else {
+      bgpstream_log(BGPSTREAM_LOG_ERR, "invalid record type found '%s'",
+                    type_str);
+      goto err;
+    }
+    uint32_t file_time = sqlite3_column_int(STATE->stmt, 5);
+    uint32_t duration = sqlite3_column_int(STATE->stmt, 4);
+
+    if ((rc = bgpstream_resource_mgr_push(BSDI_GET_RES_MGR(di),
+                                          BGPSTREAM_RESOURCE_TRANSPORT_FILE,
+                                          BGPSTREAM_RESOURCE_FORMAT_MRT,
+                                          path,
+                                          file_time,
+                                          duration,
+                                          proj,
+                                          coll,
+                                          type,
+                                          NULL)) < 0) {
+      goto err;
+    }
+    queued += rc;
+  }
+
+  sqlite3_reset(STATE->stmt);
+  return queued;
+
+ err:
+  sqlite3_reset(STATE->stmt);
+  return -1;
+}
+
 int bsdi_sqlite_start(bsdi_t *di)
 {
   /* check user-provided options */
@@ -286,11 +492,23 @@ int bsdi_sqlite_start(bsdi_t *di)
     return -1;
   }
 
-  if (build_query(di) != 0) {
+  if (open_db(di) != 0 ||
+      prepare_stmt(di,
+                   "bgp_data.file_path, collectors.project, collectors.name, "
+                   "bgp_types.name, time_span.time_span, bgp_data.file_time, "
+                   "bgp_data.ts",
+                   " ORDER BY bgp_data.file_time, bgp_types.name",
+                   &STATE->stmt) != 0 ||
+      prepare_stmt(di, "MIN(bgp_data.file_time)", "", &STATE->next_stmt) !=
+        0) {
     return -1;
   }
 
-  return prepare_db(di);
+  // files already in the DB are read in windows of file time
+  STATE->backlog_ts = epoch_sec() - 1;
+  STATE->current_ts = STATE->backlog_ts;
+
+  return 0;
 }
 
 int bsdi_sqlite_set_option(bsdi_t *di,
@@ -309,6 +527,14 @@ int bsdi_sqlite_set_option(bsdi_t *di,
     }
     break;
 
+  case OPTION_WINDOW_SIZE:
+    if ((STATE->window_size = strtoul(option_value, NULL, 10)) == 0) {
+      bgpstream_log(BGPSTREAM_LOG_ERR, "invalid window size '%s'",
+                    option_value);
+      return -1;
+    }
+    break;
+
   default:
     return -1;
   }
@@ -326,6 +552,7 @@ void bsdi_sqlite_destroy(bsdi_t *di)
   STATE->db_file = NULL;
 
   sqlite3_finalize(STATE->stmt);
+  sqlite3_finalize(STATE->next_stmt);
   sqlite3_close(STATE->db);
 
   free(STATE);
@@ -334,57 +561,37 @@ void bsdi_sqlite_destroy(bsdi_t *di)
 
 int bsdi_sqlite_update_resources(bsdi_t *di)
 {
+  int64_t start;
   int rc;
 
   STATE->last_ts = STATE->current_ts;
   // update current_timestamp - we always ask for data 1 second old at least
   STATE->current_ts = epoch_sec() - 1; // now() - 1 second
 
-  sqlite3_bind_int(STATE->stmt, 1, STATE->last_ts);
-  sqlite3_bind_int(STATE->stmt, 2, STATE->current_ts);
-
-  while ((rc = sqlite3_step(STATE->stmt)) != SQLITE_DONE) {
-    if (rc != SQLITE_ROW) {
-      bgpstream_log(BGPSTREAM_LOG_ERR,
-                    "error while stepping through results");
-      goto err;
-    }
-
-    const char *path = (const char *)sqlite3_column_text(STATE->stmt, 0);
-    const char *proj = (const char *)sqlite3_column_text(STATE->stmt, 1);
-    const char *coll = (const char *)sqlite3_column_text(STATE->stmt, 2);
-    const char *type_str = (const char *)sqlite3_column_text(STATE->stmt, 3);
-    bgpstream_record_dump_type_t type;
-    if (strcmp("ribs", type_str) == 0) {
-      type = BGPSTREAM_RIB;
-    } else if (strcmp("updates", type_str) == 0) {
-      type = BGPSTREAM_UPDATE;
-    } else {
-      bgpstream_log(BGPSTREAM_LOG_ERR, "invalid record type found '%s'",
-                    type_str);
-      goto err;
+  while (STATE->backlog_done == 0) {
+    // skip any gap to the next window that has files in it
+    if ((rc = find_next_window(di, &start)) < 0) {
+      return -1;
     }
-    uint32_t file_time = sqlite3_column_int(STATE->stmt, 5);
-    uint32_t duration = sqlite3_column_int(STATE->stmt, 4);
-
-    if (bgpstream_resource_mgr_push(BSDI_GET_RES_MGR(di),
-                                    BGPSTREAM_RESOURCE_TRANSPORT_FILE,
-                                    BGPSTREAM_RESOURCE_FORMAT_MRT,
-                                    path,
-                                    file_time,
-                                    duration,
-                                    proj,
-                                    coll,
-                                    type,
-                                    NULL) < 0) {
-      goto err;
+    if (rc == 1) {
+      STATE->window_start = start + STATE->window_size;
+      if ((rc = push_resources(di, 0, STATE->backlog_ts, start,
+                               STATE->window_start)) != 0) {
+        return rc < 0 ? -1 : 0;
+      }
+      // the filters rejected every file in this window (e.g., RIBs inside
+      // the RIB period), an empty queue would look like the end of the
+      // stream, so move on to the next window
+      continue;
     }
+    // the backlog is done, move on to files added since we started
+    STATE->backlog_done = 1;
+    STATE->last_ts = STATE->backlog_ts;
   }
 
-  sqlite3_reset(STATE->stmt);
+  if (push_resources(di, STATE->last_ts, STATE->current_ts, 0, INT64_MAX) <
+      0) {
+    return -1;
+  }
   return 0;
-
- err:
-  return -1;
 }
-
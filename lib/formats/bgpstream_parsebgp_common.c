@@ -471,10 +471,35 @@ bgpstream_format_status_t bgpstream_parsebgp_populate_record(
 
   assert(record->time_sec == 0);
 
-  // TODO: break our beautiful structure and check the transport type, because
-  // if it is kafka we really mustn't refill a partially filled buffer.
-
  refill:
+  // message-oriented transports (i.e., Kafka) lend us each message directly.
+  // a BGP message never spans two transport messages, so rather than refill a
+  // partially parsed buffer (and mix the tail of one message with the next),
+  // we drop the truncated data and move on to the next message.
+  if (bgpstream_transport_can_borrow(format->transport) &&
+      (state->remain == 0 || refill != 0)) {
+    if (refill != 0) {
+      bgpstream_log(BGPSTREAM_LOG_WARN,
+                    "Skipping %zu bytes of truncated message from '%s'",
+                    state->remain, format->res->uri);
+      // the prep callback may already have filled some record fields
+      record->time_sec = 0;
+      record->time_usec = 0;
+      state->remain = 0;
+      refill = 0;
+    }
+    if ((fill_len = bgpstream_transport_borrow(format->transport,
+                                               &state->ptr)) < 0) {
+      bgpstream_log(BGPSTREAM_LOG_ERR, "Could not read from transport");
+      return BGPSTREAM_FORMAT_READ_ERROR;
+    }
+    if (fill_len == 0) {
+      // no message available right now
+      return handle_eof(state, record, skipped_cnt);
+    }
+    state->remain = fill_len;
+  }
+
   // if there's nothing left in the buffer, it could just be because we happened
   // to empty it, so let's try and get some more data from the transport just in
   // case.
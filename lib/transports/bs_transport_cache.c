@@ -30,8 +30,13 @@
 #include "bgpstream_transport_interface.h"
 #include "bgpstream_log.h"
 #include "bs_transport_cache.h"
+#include "config.h"
 #include "wandio.h"
 #include "utils.h"
+#ifdef WITH_CURL
+#include "bs_transport_cache_fetch.h"
+#endif
+#include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -70,6 +75,12 @@ typedef struct cache_state {
   /** cache content writer */
   iow_t* writer;
 
+#ifdef WITH_CURL
+  /** parallel download of the remote file straight into the temporary file
+      (used instead of the writer when available) */
+  bs_cache_fetch_t *fetch;
+#endif
+
 } cache_state_t;
 
 /**
@@ -193,6 +204,30 @@ int bs_transport_cache_create(bgpstream_transport_t *transport)
       // lock file created successfully, now safe to create write cache
       // enable write_to_cache flag
       STATE->write_to_cache = 1;
+      close(lock_fd);
+
+#ifdef WITH_CURL
+      // if allowed to, try downloading the (still compressed) remote file
+      // using parallel range requests. the data is read back through a pipe
+      // as it arrives, and wandio detects the compression when the cache file
+      // is read later.
+      const char *conn_str = bgpstream_resource_get_attr(
+        transport->res, BGPSTREAM_RESOURCE_ATTR_CACHE_FETCH_CONNECTIONS);
+      if (conn_str != NULL && atoi(conn_str) > 1 &&
+          (strncmp(transport->res->uri, "http://", 7) == 0 ||
+           strncmp(transport->res->uri, "https://", 8) == 0) &&
+          (STATE->fetch = bs_cache_fetch_create(transport->res->uri,
+                                                STATE->temp_file_path,
+                                                atoi(conn_str))) != NULL) {
+        const char *read_path = bs_cache_fetch_get_read_path(STATE->fetch);
+        if ((STATE->reader = wandio_create(read_path)) == NULL) {
+          bgpstream_log(BGPSTREAM_LOG_ERR, "ERROR: Could not open %s for reading",
+                        read_path);
+          return -1;
+        }
+        return 0;
+      }
+#endif
 
       // create cache file writer using wandio with compression enabled at default compression level
       // ZLib default compression level is 6: https://zlib.net/manual.html
@@ -223,14 +258,33 @@ int64_t bs_transport_cache_read(bgpstream_transport_t *transport,
   // if cache-writing is enabled
   if(STATE->write_to_cache == 1){
 
+#ifdef WITH_CURL
+    if (STATE->fetch != NULL) {
+      if (ret != 0) {
+        // the fetch thread writes the temporary file itself
+        return ret;
+      }
+      // the pipe also reaches EOF if the download failed
+      if (bs_cache_fetch_finish(STATE->fetch) != 0) {
+        bgpstream_log(BGPSTREAM_LOG_ERR, "ERROR: could not download %s",
+                      transport->res->uri);
+        return -1;
+      }
+      bs_cache_fetch_destroy(STATE->fetch);
+      STATE->fetch = NULL;
+    }
+#endif
+
     if(ret == 0){
       // reader's EOF reached:
       //   finished reading a remote content
       //   save to close cache writer; rename temporary file to cache file; and remove write lock
 
       // close cache writer
-      wandio_wdestroy(STATE->writer);
-      STATE->writer = NULL;
+      if (STATE->writer != NULL) {
+        wandio_wdestroy(STATE->writer);
+        STATE->writer = NULL;
+      }
 
       // rename temporary file to cache file
       if(rename(STATE->temp_file_path, STATE->cache_file_path) !=0){
@@ -263,6 +317,16 @@ void bs_transport_cache_destroy(bgpstream_transport_t *transport)
     return;
   }
 
+#ifdef WITH_CURL
+  // abandon an unfinished download
+  if (STATE->fetch != NULL) {
+    bs_cache_fetch_destroy(STATE->fetch);
+    STATE->fetch = NULL;
+    remove(STATE->temp_file_path);
+    remove(STATE->lock_file_path);
+  }
+#endif
+
   // close reader
   if (STATE->reader != NULL) {
     wandio_destroy(STATE->reader);
@@ -0,0 +1,658 @@
+/*
+ * Copyright (C) 2018 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "bs_transport_cache_fetch.h"
+#include "bgpstream_log.h"
+#include "utils.h"
+#include <curl/curl.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+/** Size of each range request */
+#define PIECE_LEN (4 * 1024 * 1024)
+
+/** Number of times a failed range request is retried before giving up */
+#define PIECE_MAX_RETRIES 3
+
+/** Maximum number of milliseconds to wait for activity in the fetch thread
+    (bounds the time needed to notice a cancellation) */
+#define WAIT_TIMEOUT_MS 100
+
+/** Size of the buffer used to copy data from the file into the pipe */
+#define FEED_BUFLEN (64 * 1024)
+
+/** Maximum number of concurrent range requests */
+#define MAX_CONN_CNT 32
+
+typedef enum {
+  PIECE_PENDING = 0,
+  PIECE_INFLIGHT = 1,
+  PIECE_DONE = 2,
+} piece_state_t;
+
+typedef struct piece {
+
+  /** Offset of this piece in the file */
+  uint64_t offset;
+
+  /** Length of this piece */
+  uint64_t len;
+
+  /** Current state of this piece */
+  piece_state_t state;
+
+  /** Number of failed attempts to fetch this piece */
+  int retries;
+
+} piece_t;
+
+typedef struct conn {
+
+  /** Back-pointer to the fetch this connection belongs to */
+  struct bs_cache_fetch *fetch;
+
+  /** Easy handle used to issue range requests */
+  CURL *easy;
+
+  /** Index of the piece being fetched (-1 if idle) */
+  int piece;
+
+  /** Number of bytes of the current piece written so far */
+  uint64_t written;
+
+  /** Set if the server sent more than was asked for */
+  int bad_response;
+
+} conn_t;
+
+struct bs_cache_fetch {
+
+  /** URL to fetch (after following redirects) */
+  char *url;
+
+  /** Total size of the remote file */
+  uint64_t size;
+
+  /** File the data is written to */
+  int fd;
+
+  /** Pipe used to deliver the data in order to the reader */
+  int pipe_fds[2];
+
+  /** Path that can be used to open the read end of the pipe */
+  char read_path[64];
+
+  /** Pieces the file has been split into */
+  piece_t *pieces;
+  int pieces_cnt;
+
+  /** Index of the next piece to assign to a connection */
+  int next_piece;
+
+  /** Number of pieces (from the start) that have been completely fetched */
+  int done_cnt;
+
+  /** Number of bytes that have been written to the pipe */
+  uint64_t fed;
+
+  /** Set if the pipe is full and there is more data ready to be written */
+  int pipe_full;
+
+  /** Connection that is fetching the whole file in one go, because the server
+      ignored a range request (NULL while fetching pieces) */
+  struct conn *whole_conn;
+
+  /** Connections */
+  conn_t conns[MAX_CONN_CNT];
+  int conns_cnt;
+
+  CURLM *multi;
+
+  pthread_t thread;
+
+  /** Set once the fetch thread has been joined */
+  int joined;
+
+  /** Set by the owner to stop the fetch thread */
+  int shutdown;
+  pthread_mutex_t mutex;
+
+  /** Result of the fetch (0 if the whole file was fetched) */
+  int status;
+};
+
+static pthread_once_t curl_init_once = PTHREAD_ONCE_INIT;
+
+static void curl_init(void)
+{
+  curl_global_init(CURL_GLOBAL_ALL);
+}
+
+static size_t probe_header_cb(char *buf, size_t size, size_t nitems,
+                              void *user)
+{
+  int *accept_ranges = (int *)user;
+  size_t len = size * nitems;
+  const char *hdr = "accept-ranges:";
+  size_t hdr_len = strlen(hdr);
+  size_t i;
+
+  if (len > hdr_len && strncasecmp(buf, hdr, hdr_len) == 0) {
+    for (i = hdr_len; i + 5 <= len; i++) {
+      if (strncasecmp(buf + i, "bytes", 5) == 0) {
+        *accept_ranges = 1;
+        break;
+      }
+    }
+  }
+  return len;
+}
+
+/* Find out the size of the remote file and whether the server supports range
+   requests */
+static int probe(bs_cache_fetch_t *fetch, const char *url)
+{
+  CURL *easy;
+  int accept_ranges = 0;
+  curl_off_t size = -1;
+  long code = 0;
+  char *effective_url = NULL;
+  int rc = -1;
+
+  if ((easy = curl_easy_init()) == NULL) {
+    return -1;
+  }
+  curl_easy_setopt(easy, CURLOPT_URL, url);
+  curl_easy_setopt(easy, CURLOPT_NOBODY, 1L);
+  curl_easy_setopt(easy, CURLOPT_FOLLOWLOCATION, 1L);
+  curl_easy_setopt(easy, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt(easy, CURLOPT_HEADERFUNCTION, probe_header_cb);
+  curl_easy_setopt(easy, CURLOPT_HEADERDATA, &accept_ranges);
+
+  if (curl_easy_perform(easy) != CURLE_OK ||
+      curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &code) != CURLE_OK ||
+      code != 200 ||
+      curl_easy_getinfo(easy, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &size) !=
+        CURLE_OK ||
+      size <= 0 || accept_ranges == 0 ||
+      curl_easy_getinfo(easy, CURLINFO_EFFECTIVE_URL, &effective_url) !=
+        CURLE_OK) {
+    goto done;
+  }
+
+  if ((fetch->url = strdup(effective_url != NULL ? effective_url : url)) ==
+      NULL) {
+    goto done;
+  }
+  fetch->size = size;
+  rc = 0;
+
+done:
+  curl_easy_cleanup(easy);
+  return rc;
+}
+
+static size_t conn_write_cb(char *buf, size_t size, size_t nmemb, void *user)
+{
+  conn_t *conn = (conn_t *)user;
+  bs_cache_fetch_t *fetch = conn->fetch;
+  piece_t *piece = &fetch->pieces[conn->piece];
+  uint64_t offset = piece->offset;
+  uint64_t len_max = piece->len;
+  size_t len = size * nmemb;
+  size_t done = 0;
+  ssize_t wlen;
+  long code = 0;
+
+  if (conn->written == 0) {
+    curl_easy_getinfo(conn->easy, CURLINFO_RESPONSE_CODE, &code);
+    if (code == 200 && fetch->whole_conn == NULL) {
+      // the server ignored the range and is sending the whole file, so take
+      // it from this connection (the fetch thread cancels the others)
+      bgpstream_log(BGPSTREAM_LOG_WARN,
+                    "%s ignored a range request, falling back to a single "
+                    "connection",
+                    fetch->url);
+      fetch->whole_conn = conn;
+    } else if (code != 206 || fetch->whole_conn != NULL) {
+      // probably a transient error (the piece will be retried), or a piece
+      // that is no longer needed
+      return 0;
+    }
+  }
+  if (fetch->whole_conn == conn) {
+    offset = 0;
+    len_max = fetch->size;
+  }
+  if (conn->written + len > len_max) {
+    conn->bad_response = 1;
+    return 0;
+  }
+
+  while (done < len) {
+    wlen = pwrite(fetch->fd, buf + done, len - done,
+                  offset + conn->written + done);
+    if (wlen < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return 0;
+    }
+    done += wlen;
+  }
+  conn->written += len;
+  return len;
+}
+
+static int conn_start(bs_cache_fetch_t *fetch, conn_t *conn, int piece_idx)
+{
+  piece_t *piece = &fetch->pieces[piece_idx];
+  char range[64];
+
+  snprintf(range, sizeof(range), "%" PRIu64 "-%" PRIu64, piece->offset,
+           piece->offset + piece->len - 1);
+
+  conn->piece = piece_idx;
+  conn->written = 0;
+  conn->bad_response = 0;
+
+  curl_easy_setopt(conn->easy, CURLOPT_RANGE, range);
+  if (curl_multi_add_handle(fetch->multi, conn->easy) != CURLM_OK) {
+    conn->piece = -1;
+    return -1;
+  }
+  piece->state = PIECE_INFLIGHT;
+  return 0;
+}
+
+/* Handle a finished transfer. Returns -1 if the piece can't be fetched */
+static int conn_finish(bs_cache_fetch_t *fetch, conn_t *conn, CURLcode result)
+{
+  piece_t *piece;
+  long code = 0;
+
+  if (conn->piece == -1) {
+    // cancelled after switching to a single connection
+    return 0;
+  }
+  piece = &fetch->pieces[conn->piece];
+  curl_easy_getinfo(conn->easy, CURLINFO_RESPONSE_CODE, &code);
+  curl_multi_remove_handle(fetch->multi, conn->easy);
+
+  if (fetch->whole_conn == conn) {
+    if (result != CURLE_OK || conn->bad_response != 0 ||
+        conn->written != fetch->size) {
+      bgpstream_log(BGPSTREAM_LOG_ERR, "Could not fetch %s", fetch->url);
+      conn->piece = -1;
+      return -1;
+    }
+    // no longer in flight, but feed_pipe still needs the byte count
+    conn->piece = -1;
+    return 0;
+  }
+
+  if (fetch->whole_conn != NULL) {
+    // this piece is no longer needed
+    conn->piece = -1;
+    return 0;
+  }
+
+  if (result == CURLE_OK && code == 206 && conn->bad_response == 0 &&
+      conn->written == piece->len) {
+    piece->state = PIECE_DONE;
+  } else if (conn->bad_response != 0 || ++piece->retries > PIECE_MAX_RETRIES) {
+    bgpstream_log(BGPSTREAM_LOG_ERR,
+                  "Could not fetch range %" PRIu64 "-%" PRIu64 " of %s",
+                  piece->offset, piece->offset + piece->len - 1, fetch->url);
+    conn->piece = -1;
+    return -1;
+  } else {
+    bgpstream_log(BGPSTREAM_LOG_WARN,
+                  "Retrying range %" PRIu64 "-%" PRIu64 " of %s (attempt %d)",
+                  piece->offset, piece->offset + piece->len - 1, fetch->url,
+                  piece->retries + 1);
+    piece->state = PIECE_PENDING;
+  }
+  conn->piece = -1;
+  return 0;
+}
+
+/* Copy data that is contiguous from the start of the file into the pipe,
+   without blocking. Returns -1 on error */
+static int feed_pipe(bs_cache_fetch_t *fetch)
+{
+  uint8_t buf[FEED_BUFLEN];
+  uint64_t avail;
+  ssize_t rlen, wlen;
+
+  fetch->pipe_full = 0;
+  if (fetch->whole_conn != NULL) {
+    // the file is being written in order
+    avail = fetch->whole_conn->written;
+  } else {
+    while (fetch->done_cnt < fetch->pieces_cnt &&
+           fetch->pieces[fetch->done_cnt].state == PIECE_DONE) {
+      fetch->done_cnt++;
+    }
+    avail = (fetch->done_cnt == fetch->pieces_cnt)
+              ? fetch->size
+              : fetch->pieces[fetch->done_cnt].offset;
+  }
+
+  while (fetch->fed < avail) {
+    rlen = avail - fetch->fed;
+    if (rlen > FEED_BUFLEN) {
+      rlen = FEED_BUFLEN;
+    }
+    if ((rlen = pread(fetch->fd, buf, rlen, fetch->fed)) <= 0) {
+      return -1;
+    }
+    if ((wlen = write(fetch->pipe_fds[1], buf, rlen)) < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        fetch->pipe_full = 1;
+        return 0;
+      }
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    fetch->fed += wlen;
+  }
+  return 0;
+}
+
+static int is_shutdown(bs_cache_fetch_t *fetch)
+{
+  int shutdown;
+  pthread_mutex_lock(&fetch->mutex);
+  shutdown = fetch->shutdown;
+  pthread_mutex_unlock(&fetch->mutex);
+  return shutdown;
+}
+
+static void *fetch_thread(void *user)
+{
+  bs_cache_fetch_t *fetch = (bs_cache_fetch_t *)user;
+  struct curl_waitfd waitfd;
+  sigset_t sigs;
+  CURLMsg *msg;
+  conn_t *conn;
+  int running, msgs_left;
+  int i, p;
+
+  // if the reader goes away we want EPIPE, not a signal
+  sigemptyset(&sigs);
+  sigaddset(&sigs, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+
+  fetch->status = -1;
+
+  while (is_shutdown(fetch) == 0) {
+    // hand pending pieces (in file order) to idle connections, unless the
+    // whole file is coming over one connection, in which case the others are
+    // cancelled
+    for (i = 0; i < fetch->conns_cnt; i++) {
+      conn = &fetch->conns[i];
+      if (fetch->whole_conn != NULL) {
+        if (conn != fetch->whole_conn && conn->piece != -1) {
+          curl_multi_remove_handle(fetch->multi, conn->easy);
+          conn->piece = -1;
+        }
+        continue;
+      }
+      if (conn->piece != -1) {
+        continue;
+      }
+      // retries first, then the next unassigned piece
+      for (p = fetch->done_cnt; p < fetch->next_piece; p++) {
+        if (fetch->pieces[p].state == PIECE_PENDING) {
+          break;
+        }
+      }
+      if (p == fetch->next_piece) {
+        if (fetch->next_piece == fetch->pieces_cnt) {
+          break;
+        }
+        fetch->next_piece++;
+      }
+      if (conn_start(fetch, conn, p) != 0) {
+        goto done;
+      }
+    }
+
+    if (feed_pipe(fetch) != 0) {
+      goto done;
+    }
+    if (fetch->fed == fetch->size) {
+      fetch->status = 0;
+      goto done;
+    }
+
+    if (curl_multi_perform(fetch->multi, &running) != CURLM_OK) {
+      goto done;
+    }
+    while ((msg = curl_multi_info_read(fetch->multi, &msgs_left)) != NULL) {
+      if (msg->msg != CURLMSG_DONE) {
+        continue;
+      }
+      curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&conn);
+      if (conn_finish(fetch, conn, msg->data.result) != 0) {
+        goto done;
+      }
+    }
+
+    // wake up when the reader has drained the pipe (if we are waiting on it)
+    waitfd.fd = fetch->pipe_fds[1];
+    waitfd.events = CURL_WAIT_POLLOUT;
+    waitfd.revents = 0;
+    if (curl_multi_wait(fetch->multi, &waitfd, fetch->pipe_full, WAIT_TIMEOUT_MS,
+                        NULL) != CURLM_OK) {
+      goto done;
+    }
+  }
+
+done:
+  // signal EOF to the reader
+  close(fetch->pipe_fds[1]);
+  fetch->pipe_fds[1] = -1;
+  return NULL;
+}
+
+bs_cache_fetch_t *bs_cache_fetch_create(const char *url, const char *path,
+                                        int conn_cnt)
+{
+  bs_cache_fetch_t *fetch = NULL;
+  uint64_t offset;
+  int i;
+
+  pthread_once(&curl_init_once, curl_init);
+
+  if ((fetch = malloc_zero(sizeof(bs_cache_fetch_t))) == NULL) {
+    return NULL;
+  }
+  fetch->fd = -1;
+  fetch->pipe_fds[0] = fetch->pipe_fds[1] = -1;
+  for (i = 0; i < MAX_CONN_CNT; i++) {
+    fetch->conns[i].piece = -1;
+  }
+
+  if (probe(fetch, url) != 0) {
+    // not an error, the caller will fall back to a sequential download
+    bgpstream_log(BGPSTREAM_LOG_FINE,
+                  "%s does not support range requests, not using parallel "
+                  "download",
+                  url);
+    goto err;
+  }
+
+  // split the file into pieces
+  fetch->pieces_cnt = (fetch->size + PIECE_LEN - 1) / PIECE_LEN;
+  if (fetch->pieces_cnt < 2) {
+    // not worth it
+    goto err;
+  }
+  if ((fetch->pieces = malloc_zero(sizeof(piece_t) * fetch->pieces_cnt)) ==
+      NULL) {
+    goto err;
+  }
+  for (i = 0, offset = 0; i < fetch->pieces_cnt; i++, offset += PIECE_LEN) {
+    fetch->pieces[i].offset = offset;
+    fetch->pieces[i].len =
+      (fetch->size - offset < PIECE_LEN) ? fetch->size - offset : PIECE_LEN;
+  }
+
+  // the file is written out of order, so reserve the whole thing up front
+  if ((fetch->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0 ||
+      ftruncate(fetch->fd, fetch->size) != 0) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "Could not create %s", path);
+    goto err;
+  }
+
+  if (pipe(fetch->pipe_fds) != 0 ||
+      fcntl(fetch->pipe_fds[1], F_SETFL,
+            fcntl(fetch->pipe_fds[1], F_GETFL) | O_NONBLOCK) != 0) {
+    goto err;
+  }
+  snprintf(fetch->read_path, sizeof(fetch->read_path), "/dev/fd/%d",
+           fetch->pipe_fds[0]);
+  // the reader opens the pipe by name, which needs /dev/fd (not POSIX)
+  if (access(fetch->read_path, R_OK) != 0) {
+    bgpstream_log(BGPSTREAM_LOG_FINE,
+                  "%s is not available, not using parallel download",
+                  fetch->read_path);
+    goto err;
+  }
+
+  if ((fetch->multi = curl_multi_init()) == NULL) {
+    goto err;
+  }
+  fetch->conns_cnt = conn_cnt < MAX_CONN_CNT ? conn_cnt : MAX_CONN_CNT;
+  if (fetch->conns_cnt > fetch->pieces_cnt) {
+    fetch->conns_cnt = fetch->pieces_cnt;
+  }
+  for (i = 0; i < fetch->conns_cnt; i++) {
+    conn_t *conn = &fetch->conns[i];
+    conn->fetch = fetch;
+    if ((conn->easy = curl_easy_init()) == NULL) {
+      goto err;
+    }
+    curl_easy_setopt(conn->easy, CURLOPT_URL, fetch->url);
+    curl_easy_setopt(conn->easy, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(conn->easy, CURLOPT_WRITEFUNCTION, conn_write_cb);
+    curl_easy_setopt(conn->easy, CURLOPT_WRITEDATA, conn);
+    curl_easy_setopt(conn->easy, CURLOPT_PRIVATE, conn);
+  }
+
+  pthread_mutex_init(&fetch->mutex, NULL);
+  if (pthread_create(&fetch->thread, NULL, fetch_thread, fetch) != 0) {
+    pthread_mutex_destroy(&fetch->mutex);
+    goto err;
+  }
+
+  bgpstream_log(BGPSTREAM_LOG_FINE,
+                "Fetching %s (%" PRIu64 " bytes) using %d connections", url,
+                fetch->size, fetch->conns_cnt);
+  return fetch;
+
+err:
+  // the thread was not started, so clean up here
+  for (i = 0; i < fetch->conns_cnt; i++) {
+    if (fetch->conns[i].easy != NULL) {
+      curl_easy_cleanup(fetch->conns[i].easy);
+    }
+  }
+  if (fetch->multi != NULL) {
+    curl_multi_cleanup(fetch->multi);
+  }
+  if (fetch->pipe_fds[0] != -1) {
+    close(fetch->pipe_fds[0]);
+    close(fetch->pipe_fds[1]);
+  }
+  if (fetch->fd != -1) {
+    close(fetch->fd);
+    unlink(path);
+  }
+  free(fetch->pieces);
+  free(fetch->url);
+  free(fetch);
+  return NULL;
+}
+
+const char *bs_cache_fetch_get_read_path(bs_cache_fetch_t *fetch)
+{
+  return fetch->read_path;
+}
+
+int bs_cache_fetch_finish(bs_cache_fetch_t *fetch)
+{
+  if (fetch->joined == 0) {
+    pthread_join(fetch->thread, NULL);
+    fetch->joined = 1;
+  }
+  return fetch->status;
+}
+
+void bs_cache_fetch_destroy(bs_cache_fetch_t *fetch)
+{
+  int i;
+
+  if (fetch == NULL) {
+    return;
+  }
+
+  // stop the thread. writes to the pipe never block, so it notices the flag
+  // within WAIT_TIMEOUT_MS even if the reader (which has its own descriptor
+  // for the pipe, opened via /dev/fd) has stopped reading
+  pthread_mutex_lock(&fetch->mutex);
+  fetch->shutdown = 1;
+  pthread_mutex_unlock(&fetch->mutex);
+  close(fetch->pipe_fds[0]);
+  bs_cache_fetch_finish(fetch);
+
+  for (i = 0; i < fetch->conns_cnt; i++) {
+    if (fetch->conns[i].piece != -1) {
+      curl_multi_remove_handle(fetch->multi, fetch->conns[i].easy);
+    }
+    curl_easy_cleanup(fetch->conns[i].easy);
+  }
+  curl_multi_cleanup(fetch->multi);
+
+  close(fetch->fd);
+  pthread_mutex_destroy(&fetch->mutex);
+  free(fetch->pieces);
+  free(fetch->url);
+  free(fetch);
+}
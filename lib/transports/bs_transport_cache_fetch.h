@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2018 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __BS_TRANSPORT_CACHE_FETCH_H
+#define __BS_TRANSPORT_CACHE_FETCH_H
+
+/** @file
+ *
+ * @brief Helper used by the cache transport to download a remote file into
+ * the cache using several concurrent HTTP range requests. The downloaded data
+ * is made available, in order, through a pipe as soon as it is contiguous.
+ */
+
+/** Opaque handle for an in-progress fetch */
+typedef struct bs_cache_fetch bs_cache_fetch_t;
+
+/** Start downloading the given URL into the given file
+ *
+ * @param url           URL of the remote file (must be HTTP or HTTPS)
+ * @param path          path of the local file to write to
+ * @param conn_cnt      maximum number of concurrent range requests
+ * @return pointer to a fetch handle if the download was started, NULL if the
+ * server does not support range requests, the platform has no /dev/fd, or an
+ * error occurred
+ *
+ * If NULL is returned, the caller should fall back to a sequential download.
+ */
+bs_cache_fetch_t *bs_cache_fetch_create(const char *url, const char *path,
+                                        int conn_cnt);
+
+/** Get a path that can be opened (e.g., using wandio) to read the file as it
+ * is being downloaded
+ *
+ * @param fetch         pointer to the fetch handle
+ * @return borrowed pointer to the path string
+ *
+ * Reads from the path block until the next contiguous bytes are available, and
+ * return EOF once the whole file has been delivered (or the fetch failed).
+ */
+const char *bs_cache_fetch_get_read_path(bs_cache_fetch_t *fetch);
+
+/** Wait for the download to complete
+ *
+ * @param fetch         pointer to the fetch handle
+ * @return 0 if the whole file was downloaded, -1 otherwise
+ */
+int bs_cache_fetch_finish(bs_cache_fetch_t *fetch);
+
+/** Stop the download (if it is still running) and free the handle
+ *
+ * @param fetch         pointer to the fetch handle
+ *
+ * The file being written to is not removed.
+ */
+void bs_cache_fetch_destroy(bs_cache_fetch_t *fetch);
+
+#endif /* __BS_TRANSPORT_CACHE_FETCH_H */
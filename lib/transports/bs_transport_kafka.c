@@ -29,6 +29,7 @@
 #include "bs_transport_kafka.h"
 #include "utils.h"
 #include <assert.h>
+#include <inttypes.h>
 #include <librdkafka/rdkafka.h>
 #include <string.h>
 #include <stdlib.h>
@@ -39,6 +40,13 @@
 
 #define POLL_TIMEOUT_MSEC 0
 
+// how long to wait for the brokers to look up offsets when partitions are
+// assigned
+#define OFFSET_LOOKUP_TIMEOUT_MSEC 10000
+
+// maximum number of messages to take from the consumer queue at once
+#define BATCH_MSGS_MAX 1024
+
 typedef struct state {
 
   // convenience local copies of attrs
@@ -46,12 +54,33 @@ typedef struct state {
   char *group;
   char *offset;
 
+  // time (in msec) to start consuming from (0 if unset)
+  int64_t timestamp_from;
+
+  // topic metadata refresh interval (in msec, 0 to use the rdkafka default)
+  uint64_t metadata_refresh;
+
   // rdkafka instance
   rd_kafka_t *rk;
 
   // topics
   rd_kafka_topic_partition_list_t *topics;
 
+  // consumer queue that batches of messages are taken from
+  rd_kafka_queue_t *queue;
+
+  // messages from the last batch, batch_idx is the next one to return
+  rd_kafka_message_t *batch[BATCH_MSGS_MAX];
+  ssize_t batch_cnt;
+  ssize_t batch_idx;
+
+  // number of bytes of batch[batch_idx] already returned (only non-zero when
+  // a message is too large to be returned by a single read)
+  size_t msg_offset;
+
+  // message currently lent to the caller by borrow (NULL if none)
+  rd_kafka_message_t *lent_msg;
+
   // is the client connected?
   int connected;
 
@@ -63,7 +92,6 @@ typedef struct state {
 static int parse_attrs(bgpstream_transport_t *transport)
 {
   char buf[1024];
-  uint64_t ts;
 
   // Topic Name (required)
   if (bgpstream_resource_get_attr(
@@ -82,9 +110,7 @@ static int parse_attrs(bgpstream_transport_t *transport)
   if (bgpstream_resource_get_attr(
         transport->res, BGPSTREAM_RESOURCE_ATTR_KAFKA_CONSUMER_GROUP) == NULL) {
     // generate a "random" group ID
-    ts = epoch_msec();
-    srand(ts);
-    snprintf(buf, sizeof(buf), "bgpstream-%"PRIx64"-%x", ts, rand());
+    bgpstream_resource_kafka_group_snprintf(buf, sizeof(buf));
     if ((STATE->group = strdup(buf)) == NULL) {
       return -1;
     }
@@ -112,10 +138,31 @@ static int parse_attrs(bgpstream_transport_t *transport)
     }
   }
 
+  // Start time (optional)
+  if (bgpstream_resource_get_attr(
+        transport->res, BGPSTREAM_RESOURCE_ATTR_KAFKA_TIMESTAMP_FROM) != NULL) {
+    STATE->timestamp_from =
+      strtoll(bgpstream_resource_get_attr(
+                transport->res, BGPSTREAM_RESOURCE_ATTR_KAFKA_TIMESTAMP_FROM),
+              NULL, 10) * 1000;
+  }
+
+  // Metadata refresh interval (optional)
+  if (bgpstream_resource_get_attr(
+        transport->res, BGPSTREAM_RESOURCE_ATTR_KAFKA_METADATA_REFRESH) !=
+      NULL) {
+    STATE->metadata_refresh =
+      strtoull(bgpstream_resource_get_attr(
+                 transport->res, BGPSTREAM_RESOURCE_ATTR_KAFKA_METADATA_REFRESH),
+               NULL, 10) * 1000;
+  }
+
   bgpstream_log(
     BGPSTREAM_LOG_FINE,
-    "Kafka transport: brokers: '%s', topic: '%s', group: '%s', offset: %s",
-    transport->res->uri, STATE->topic, STATE->group, STATE->offset);
+    "Kafka transport: brokers: '%s', topic: '%s', group: '%s', offset: %s, "
+    "from: %" PRIi64,
+    transport->res->uri, STATE->topic, STATE->group, STATE->offset,
+    STATE->timestamp_from / 1000);
   return 0;
 }
 
@@ -146,10 +193,86 @@ static void kafka_error_callback(rd_kafka_t *rk, int err, const char *reason,
   // TODO: handle other errors
 }
 
+/* Point the newly assigned partitions at the first message produced at or
+ * after timestamp_from, unless the group has already committed a later
+ * offset. If the lookup fails, the partitions are left alone, and so start
+ * from the committed or initial offset. */
+static void seek_to_timestamp(bgpstream_transport_t *transport,
+                              rd_kafka_topic_partition_list_t *partitions)
+{
+  rd_kafka_topic_partition_list_t *ts_offsets;
+  rd_kafka_resp_err_t err;
+  int64_t ts_offset, committed;
+  int i;
+
+  if ((ts_offsets = rd_kafka_topic_partition_list_copy(partitions)) == NULL) {
+    return;
+  }
+  for (i = 0; i < ts_offsets->cnt; i++) {
+    ts_offsets->elems[i].offset = STATE->timestamp_from;
+  }
+  if ((err = rd_kafka_offsets_for_times(STATE->rk, ts_offsets,
+                                        OFFSET_LOOKUP_TIMEOUT_MSEC)) != 0) {
+    bgpstream_log(BGPSTREAM_LOG_WARN,
+                  "Could not look up Kafka offsets for %" PRIi64 ": %s",
+                  STATE->timestamp_from / 1000, rd_kafka_err2str(err));
+    goto done;
+  }
+
+  // find out where the group got to
+  if (rd_kafka_committed(STATE->rk, partitions, OFFSET_LOOKUP_TIMEOUT_MSEC) !=
+      0) {
+    for (i = 0; i < partitions->cnt; i++) {
+      partitions->elems[i].offset = RD_KAFKA_OFFSET_INVALID;
+    }
+  }
+
+  // both lists have the partitions in the same order
+  for (i = 0; i < partitions->cnt; i++) {
+    if (ts_offsets->elems[i].err != 0) {
+      continue;
+    }
+    ts_offset = ts_offsets->elems[i].offset;
+    committed = partitions->elems[i].offset;
+    if (ts_offset == RD_KAFKA_OFFSET_END ||
+        (ts_offset >= 0 && (committed < 0 || ts_offset > committed))) {
+      // (END means that nothing has been produced since timestamp_from)
+      partitions->elems[i].offset = ts_offset;
+    }
+    bgpstream_log(BGPSTREAM_LOG_FINE,
+                  "Starting %s [%" PRId32 "] at offset %" PRId64,
+                  partitions->elems[i].topic, partitions->elems[i].partition,
+                  partitions->elems[i].offset);
+  }
+
+done:
+  rd_kafka_topic_partition_list_destroy(ts_offsets);
+}
+
+static void kafka_rebalance_callback(
+  rd_kafka_t *rk, rd_kafka_resp_err_t err,
+  rd_kafka_topic_partition_list_t *partitions, void *opaque)
+{
+  bgpstream_transport_t *transport = (bgpstream_transport_t *)opaque;
+
+  switch (err) {
+  case RD_KAFKA_RESP_ERR__ASSIGN_PARTITIONS:
+    seek_to_timestamp(transport, partitions);
+    rd_kafka_assign(rk, partitions);
+    break;
+
+  default:
+    // partitions revoked (or a rebalance error)
+    rd_kafka_assign(rk, NULL);
+    break;
+  }
+}
+
 static int init_kafka_config(bgpstream_transport_t *transport,
                              rd_kafka_conf_t *conf)
 {
   char errstr[512];
+  char buf[32];
 
   // Set the opaque pointer that will be passed to callbacks
   rd_kafka_conf_set_opaque(conf, transport);
@@ -157,6 +280,11 @@ static int init_kafka_config(bgpstream_transport_t *transport,
   // Set our error handler
   rd_kafka_conf_set_error_cb(conf, kafka_error_callback);
 
+  // Skip ahead to the requested start time as partitions are assigned
+  if (STATE->timestamp_from > 0) {
+    rd_kafka_conf_set_rebalance_cb(conf, kafka_rebalance_callback);
+  }
+
   // Configure the initial offset
   if (rd_kafka_conf_set(conf, "auto.offset.reset", STATE->offset, errstr,
                         sizeof(errstr)) != RD_KAFKA_CONF_OK) {
@@ -171,6 +299,16 @@ static int init_kafka_config(bgpstream_transport_t *transport,
     return -1;
   }
 
+  // Look for new topics (matching regex subscriptions) this often
+  if (STATE->metadata_refresh > 0) {
+    snprintf(buf, sizeof(buf), "%" PRIu64, STATE->metadata_refresh);
+    if (rd_kafka_conf_set(conf, "topic.metadata.refresh.interval.ms", buf,
+                          errstr, sizeof(errstr)) != RD_KAFKA_CONF_OK) {
+      bgpstream_log(BGPSTREAM_LOG_ERR, "Config Error: %s", errstr);
+      return -1;
+    }
+  }
+
   // Disable logging of connection close/idle timeouts caused by Kafka 0.9.x
   //   See https://github.com/edenhill/librdkafka/issues/437 for more details.
   // TODO: change this when librdkafka has better handling of idle disconnects
@@ -220,12 +358,15 @@ static int init_topic(bgpstream_transport_t *transport)
   return 0;
 }
 
+static int64_t kafka_borrow(bgpstream_transport_t *transport, uint8_t **buf);
+
 int bs_transport_kafka_create(bgpstream_transport_t *transport)
 {
   rd_kafka_conf_t *conf;
   char errstr[512];
 
   BS_TRANSPORT_SET_METHODS(kafka, transport);
+  transport->borrow = kafka_borrow;
 
   if ((transport->state = malloc_zero(sizeof(state_t))) == NULL) {
     return -1;
@@ -274,6 +415,11 @@ int bs_transport_kafka_create(bgpstream_transport_t *transport)
   // switch to consumer poll mode
   rd_kafka_poll_set_consumer(STATE->rk);
 
+  if ((STATE->queue = rd_kafka_queue_get_consumer(STATE->rk)) == NULL) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "Could not get Kafka consumer queue");
+    return -1;
+  }
+
   bgpstream_log(BGPSTREAM_LOG_FINE, "Kafka connected!");
   return 0;
 }
@@ -295,34 +441,138 @@ static int handle_err_msg(bgpstream_transport_t *transport,
   return -1;
 }
 
-int64_t bs_transport_kafka_read(bgpstream_transport_t *transport,
-                                uint8_t *buffer, int64_t len)
+static int fetch_batch(bgpstream_transport_t *transport)
 {
-  rd_kafka_message_t *rk_msg;
+  ssize_t cnt;
+
+  assert(STATE->batch_idx == STATE->batch_cnt);
 
-  // see if there is a message waiting for us
   // POLL_TIMEOUT_MSEC is set very low (0) since the transport should be
   // non-blocking
-  if ((rk_msg = rd_kafka_consumer_poll(STATE->rk, POLL_TIMEOUT_MSEC)) == NULL) {
-    return 0;
+  if ((cnt = rd_kafka_consume_batch_queue(STATE->queue, POLL_TIMEOUT_MSEC,
+                                          STATE->batch, BATCH_MSGS_MAX)) < 0) {
+    bgpstream_log(BGPSTREAM_LOG_ERR, "Could not consume from Kafka: %s",
+                  rd_kafka_err2str(rd_kafka_last_error()));
+    STATE->batch_cnt = STATE->batch_idx = 0;
+    return -1;
+  }
+  STATE->batch_cnt = cnt;
+  STATE->batch_idx = 0;
+  STATE->msg_offset = 0;
+  return 0;
+}
+
+static void release_lent_msg(bgpstream_transport_t *transport)
+{
+  if (STATE->lent_msg != NULL) {
+    rd_kafka_message_destroy(STATE->lent_msg);
+    STATE->lent_msg = NULL;
   }
-  if (rk_msg->err != 0) {
-    return handle_err_msg(transport, rk_msg);
+}
+
+static int64_t kafka_borrow(bgpstream_transport_t *transport, uint8_t **buf)
+{
+  rd_kafka_message_t *rk_msg;
+  int64_t len;
+  int fetched = 0;
+
+  // the caller is done with the previous message
+  release_lent_msg(transport);
+
+  while (1) {
+    if (STATE->batch_idx == STATE->batch_cnt) {
+      if (fetched != 0) {
+        return 0;
+      }
+      if (fetch_batch(transport) != 0) {
+        return -1;
+      }
+      fetched = 1;
+      if (STATE->batch_cnt == 0) {
+        return 0;
+      }
+    }
+
+    rk_msg = STATE->batch[STATE->batch_idx++];
+    if (rk_msg->err != 0) {
+      if (handle_err_msg(transport, rk_msg) != 0) {
+        return -1;
+      }
+      continue;
+    }
+
+    // hand over the (rest of the) payload, and hang on to the message until
+    // the caller comes back for more
+    STATE->lent_msg = rk_msg;
+    *buf = (uint8_t *)rk_msg->payload + STATE->msg_offset;
+    len = rk_msg->len - STATE->msg_offset;
+    STATE->msg_offset = 0;
+    return len;
   }
+}
 
-  // is the message too long?
-  // TODO: if this is really a problem (e.g., batches of MRT/BMP messages
-  // produced into a single Kafka message, then we can use a local buffer and
-  // split them up for the caller, but really the caller should have a large
-  // enough buffer.. so for now:
-  assert(rk_msg->len <= len);
+int64_t bs_transport_kafka_read(bgpstream_transport_t *transport,
+                                uint8_t *buffer, int64_t len)
+{
+  rd_kafka_message_t *rk_msg;
+  int64_t filled = 0;
+  size_t cpy;
+  int fetched = 0;
+
+  release_lent_msg(transport);
+
+  // pack as many whole messages into the buffer as will fit. the parser
+  // expects each message to start with its own (OpenBMP) header, so messages
+  // are only split across reads if they can't fit into an empty buffer.
+  while (filled < len) {
+    if (STATE->batch_idx == STATE->batch_cnt) {
+      // take at most one batch per read so that we never wait on kafka
+      if (fetched != 0) {
+        break;
+      }
+      if (fetch_batch(transport) != 0) {
+        return (filled > 0) ? filled : -1;
+      }
+      fetched = 1;
+      if (STATE->batch_cnt == 0) {
+        break;
+      }
+    }
 
-  // copy the message into the provided buffer
-  memcpy(buffer, rk_msg->payload, rk_msg->len);
-  len = rk_msg->len;
-  rd_kafka_message_destroy(rk_msg);
+    rk_msg = STATE->batch[STATE->batch_idx];
+    if (rk_msg->err != 0) {
+      if (filled > 0) {
+        // hand over what we have, the error will be seen by the next read
+        break;
+      }
+      STATE->batch_idx++;
+      if (handle_err_msg(transport, rk_msg) != 0) {
+        return -1;
+      }
+      // end of partition, there may be messages from other partitions
+      continue;
+    }
+
+    cpy = rk_msg->len - STATE->msg_offset;
+    if (cpy > (size_t)(len - filled)) {
+      if (filled > 0) {
+        break;
+      }
+      cpy = len;
+    }
+    memcpy(buffer + filled, (uint8_t *)rk_msg->payload + STATE->msg_offset,
+           cpy);
+    filled += cpy;
+    STATE->msg_offset += cpy;
+
+    if (STATE->msg_offset == rk_msg->len) {
+      rd_kafka_message_destroy(rk_msg);
+      STATE->batch_idx++;
+      STATE->msg_offset = 0;
+    }
+  }
 
-  return len;
+  return filled;
 }
 
 void bs_transport_kafka_destroy(bgpstream_transport_t *transport)
@@ -333,6 +583,17 @@ void bs_transport_kafka_destroy(bgpstream_transport_t *transport)
     return;
   }
 
+  // release any messages we haven't handed out yet
+  release_lent_msg(transport);
+  while (STATE->batch_idx < STATE->batch_cnt) {
+    rd_kafka_message_destroy(STATE->batch[STATE->batch_idx++]);
+  }
+
+  if (STATE->queue != NULL) {
+    rd_kafka_queue_destroy(STATE->queue);
+    STATE->queue = NULL;
+  }
+
   if (STATE->rk != NULL) {
     // TODO: consider committing offsets?
 
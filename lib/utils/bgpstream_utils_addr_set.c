@@ -31,38 +31,15 @@
 #include "utils.h"
 
 #include "bgpstream_utils_addr_set.h"
+#include "bgpstream_utils_u64_set_int.h"
 
 /* PRIVATE */
 
-#define STORAGE_HASH_VAL(arg) bgpstream_addr_storage_hash(&(arg))
-#define STORAGE_EQUAL_VAL(arg1, arg2)                                          \
-  bgpstream_addr_storage_equal(&(arg1), &(arg2))
-
-#define V4_HASH_VAL(arg) bgpstream_ipv4_addr_hash(&(arg))
-#define V4_EQUAL_VAL(arg1, arg2) bgpstream_ipv4_addr_equal(&(arg1), &(arg2))
-
 #define V6_HASH_VAL(arg) bgpstream_ipv6_addr_hash(&(arg))
 #define V6_EQUAL_VAL(arg1, arg2) bgpstream_ipv6_addr_equal(&(arg1), &(arg2))
 
-/* STORAGE */
-KHASH_INIT(bgpstream_addr_storage_set /* name */,
-           bgpstream_addr_storage_t /* khkey_t */, char /* khval_t */,
-           0 /* kh_is_set */, STORAGE_HASH_VAL /*__hash_func */,
-           STORAGE_EQUAL_VAL /* __hash_equal */);
-
-struct bgpstream_addr_storage_set {
-  khash_t(bgpstream_addr_storage_set) * hash;
-};
-
-/* IPv4 */
-KHASH_INIT(bgpstream_ipv4_addr_set /* name */,
-           bgpstream_ipv4_addr_t /* khkey_t */, char /* khval_t */,
-           0 /* kh_is_set */, V4_HASH_VAL /*__hash_func */,
-           V4_EQUAL_VAL /* __hash_equal */);
-
-struct bgpstream_ipv4_addr_set {
-  khash_t(bgpstream_ipv4_addr_set) * hash;
-};
+/* IPv4 addresses are stored directly as 64 bit keys */
+#define IPV4_ADDR_KEY(addr) ((uint64_t)(addr)->ipv4.s_addr)
 
 /* IPv6 */
 KHASH_INIT(bgpstream_ipv6_addr_set /* name */,
@@ -74,6 +51,17 @@ struct bgpstream_ipv6_addr_set {
   khash_t(bgpstream_ipv6_addr_set) * hash;
 };
 
+/* STORAGE */
+struct bgpstream_addr_storage_set {
+  bgpstream_u64_set_t *ipv4;
+  khash_t(bgpstream_ipv6_addr_set) * ipv6;
+};
+
+/* IPv4 */
+struct bgpstream_ipv4_addr_set {
+  bgpstream_u64_set_t *set;
+};
+
 /* PUBLIC FUNCTIONS */
 
 /* STORAGE */
@@ -82,12 +70,13 @@ bgpstream_addr_storage_set_t *bgpstream_addr_storage_set_create()
 {
   bgpstream_addr_storage_set_t *set;
 
-  if ((set = (bgpstream_addr_storage_set_t *)malloc(
+  if ((set = (bgpstream_addr_storage_set_t *)malloc_zero(
          sizeof(bgpstream_addr_storage_set_t))) == NULL) {
     return NULL;
   }
 
-  if ((set->hash = kh_init(bgpstream_addr_storage_set)) == NULL) {
+  if ((set->ipv4 = bgpstream_u64_set_create()) == NULL ||
+      (set->ipv6 = kh_init(bgpstream_ipv6_addr_set)) == NULL) {
     bgpstream_addr_storage_set_destroy(set);
     return NULL;
   }
@@ -100,9 +89,16 @@ int bgpstream_addr_storage_set_insert(bgpstream_addr_storage_set_t *set,
 {
   int khret;
   khiter_t k;
-  if ((k = kh_get(bgpstream_addr_storage_set, set->hash, *addr)) ==
-      kh_end(set->hash)) {
-    k = kh_put(bgpstream_addr_storage_set, set->hash, *addr, &khret);
+  if (addr->version == BGPSTREAM_ADDR_VERSION_IPV4) {
+    return bgpstream_u64_set_insert(set->ipv4, IPV4_ADDR_KEY(addr));
+  }
+  if ((k = kh_get(bgpstream_ipv6_addr_set, set->ipv6,
+                  *(bgpstream_ipv6_addr_t *)addr)) == kh_end(set->ipv6)) {
+    k = kh_put(bgpstream_ipv6_addr_set, set->ipv6,
+               *(bgpstream_ipv6_addr_t *)addr, &khret);
+    if (khret < 0) {
+      return -1;
+    }
     return 1;
   }
   return 0;
@@ -110,17 +106,22 @@ int bgpstream_addr_storage_set_insert(bgpstream_addr_storage_set_t *set,
 
 int bgpstream_addr_storage_set_size(bgpstream_addr_storage_set_t *set)
 {
-  return kh_size(set->hash);
+  return bgpstream_u64_set_size(set->ipv4) + kh_size(set->ipv6);
 }
 
 int bgpstream_addr_storage_set_merge(bgpstream_addr_storage_set_t *dst_set,
                                      bgpstream_addr_storage_set_t *src_set)
 {
+  int khret;
   khiter_t k;
-  for (k = kh_begin(src_set->hash); k != kh_end(src_set->hash); ++k) {
-    if (kh_exist(src_set->hash, k)) {
-      if (bgpstream_addr_storage_set_insert(dst_set,
-                                            &(kh_key(src_set->hash, k))) < 0) {
+  if (bgpstream_u64_set_merge(dst_set->ipv4, src_set->ipv4) != 0) {
+    return -1;
+  }
+  for (k = kh_begin(src_set->ipv6); k != kh_end(src_set->ipv6); ++k) {
+    if (kh_exist(src_set->ipv6, k)) {
+      kh_put(bgpstream_ipv6_addr_set, dst_set->ipv6, kh_key(src_set->ipv6, k),
+             &khret);
+      if (khret < 0) {
         return -1;
       }
     }
@@ -130,13 +131,17 @@ int bgpstream_addr_storage_set_merge(bgpstream_addr_storage_set_t *dst_set,
 
 void bgpstream_addr_storage_set_destroy(bgpstream_addr_storage_set_t *set)
 {
-  kh_destroy(bgpstream_addr_storage_set, set->hash);
+  bgpstream_u64_set_destroy(set->ipv4);
+  if (set->ipv6 != NULL) {
+    kh_destroy(bgpstream_ipv6_addr_set, set->ipv6);
+  }
   free(set);
 }
 
 void bgpstream_addr_storage_set_clear(bgpstream_addr_storage_set_t *set)
 {
-  kh_clear(bgpstream_addr_storage_set, set->hash);
+  bgpstream_u64_set_clear(set->ipv4);
+  kh_clear(bgpstream_ipv6_addr_set, set->ipv6);
 }
 
 /* IPv4 */
@@ -150,7 +155,7 @@ bgpstream_ipv4_addr_set_t *bgpstream_ipv4_addr_set_create()
     return NULL;
   }
 
-  if ((set->hash = kh_init(bgpstream_ipv4_addr_set)) == NULL) {
+  if ((set->set = bgpstream_u64_set_create()) == NULL) {
     bgpstream_ipv4_addr_set_destroy(set);
     return NULL;
   }
@@ -161,45 +166,29 @@ bgpstream_ipv4_addr_set_t *bgpstream_ipv4_addr_set_create()
 int bgpstream_ipv4_addr_set_insert(bgpstream_ipv4_addr_set_t *set,
                                    bgpstream_ipv4_addr_t *addr)
 {
-  int khret;
-  khiter_t k;
-  if ((k = kh_get(bgpstream_ipv4_addr_set, set->hash, *addr)) ==
-      kh_end(set->hash)) {
-    k = kh_put(bgpstream_ipv4_addr_set, set->hash, *addr, &khret);
-    return 1;
-  }
-  return 0;
+  return bgpstream_u64_set_insert(set->set, IPV4_ADDR_KEY(addr));
 }
 
 int bgpstream_ipv4_addr_set_size(bgpstream_ipv4_addr_set_t *set)
 {
-  return kh_size(set->hash);
+  return bgpstream_u64_set_size(set->set);
 }
 
 int bgpstream_ipv4_addr_set_merge(bgpstream_ipv4_addr_set_t *dst_set,
                                   bgpstream_ipv4_addr_set_t *src_set)
 {
-  khiter_t k;
-  for (k = kh_begin(src_set->hash); k != kh_end(src_set->hash); ++k) {
-    if (kh_exist(src_set->hash, k)) {
-      if (bgpstream_ipv4_addr_set_insert(dst_set, &(kh_key(src_set->hash, k))) <
-          0) {
-        return -1;
-      }
-    }
-  }
-  return 0;
+  return bgpstream_u64_set_merge(dst_set->set, src_set->set);
 }
 
 void bgpstream_ipv4_addr_set_destroy(bgpstream_ipv4_addr_set_t *set)
 {
-  kh_destroy(bgpstream_ipv4_addr_set, set->hash);
+  bgpstream_u64_set_destroy(set->set);
   free(set);
 }
 
 void bgpstream_ipv4_addr_set_clear(bgpstream_ipv4_addr_set_t *set)
 {
-  kh_clear(bgpstream_ipv4_addr_set, set->hash);
+  bgpstream_u64_set_clear(set->set);
 }
 
 /* IPv6 */
@@ -442,13 +442,36 @@ int bgpstream_as_path_populate_from_data_zc(bgpstream_as_path_t *path,
   return 0;
 }
 
-/* from http://burtleburtle.net/bob/hash/integer.html */
-static inline uint32_t mixbits(uint32_t a)
+/* MurmurHash64A, from https://github.com/aappleby/smhasher (public domain) */
+static inline uint64_t murmur64a(const uint8_t *data, size_t len)
 {
-  a = a ^ (a >> 4);
-  a = (a ^ 0xdeadbeef) + (a << 5);
-  a = a ^ (a >> 11);
-  return a;
+  const uint64_t m = 0xc6a4a7935bd1e995ULL;
+  const int r = 47;
+  uint64_t h = 0x8445d61a4e774912ULL ^ (len * m);
+  uint64_t k;
+
+  while (len >= sizeof(k)) {
+    memcpy(&k, data, sizeof(k));
+    k *= m;
+    k ^= k >> r;
+    k *= m;
+    h ^= k;
+    h *= m;
+    data += sizeof(k);
+    len -= sizeof(k);
+  }
+
+  if (len > 0) {
+    k = 0;
+    memcpy(&k, data, len);
+    h ^= k;
+    h *= m;
+  }
+
+  h ^= h >> r;
+  h *= m;
+  h ^= h >> r;
+  return h;
 }
 
 #if UINT_MAX == 0xffffffffu
@@ -458,19 +481,10 @@ unsigned long
 #endif
 bgpstream_as_path_hash(bgpstream_as_path_t *path)
 {
-  if (path->data_len > 0) {
-    /* put the peer (ish) hash into the top bits */
-    /* and put the origin hash into the bottom bits */
-    return mixbits(
-      ((bgpstream_as_path_seg_hash((bgpstream_as_path_seg_t *)path->data) &
-        0xFFFF)
-       << 8) |
-      (bgpstream_as_path_seg_hash(
-         (bgpstream_as_path_seg_t *)(path->data + path->origin_offset)) &
-       0xFFFF));
-  } else {
-    return 0;
-  }
+  /* hash every segment (not just the peer and origin) so that paths that
+     share endpoints do not all collide */
+  uint64_t h = murmur64a(path->data, path->data_len);
+  return (uint32_t)(h ^ (h >> 32));
 }
 
 inline int bgpstream_as_path_equal(bgpstream_as_path_t *path1,
@@ -27,8 +27,14 @@
 #include "config.h"
 
 #include <assert.h>
+#include <fcntl.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "khash.h"
 #include "utils.h"
@@ -37,6 +43,20 @@
 
 #include "bgpstream_utils_as_path_store.h"
 
+/* Size of each chunk of the path data arena (which holds both store path
+ * structures and path data, allocated separately). Must be able to hold the
+ * longest possible path (i.e., UINT16_MAX bytes); twice that keeps the space
+ * left unused at the end of a chunk small when paths are long */
+#define PATH_DATA_CHUNK_LEN (1 << 17)
+
+/* Snapshot file format */
+#define SNAPSHOT_MAGIC "BSAPSNAP"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_BYTE_ORDER 0x01020304
+#define SNAPSHOT_ALIGN 64
+#define SNAPSHOT_ALIGN_UP(len)                                                 \
+  (((len) + SNAPSHOT_ALIGN - 1) & ~((size_t)SNAPSHOT_ALIGN - 1))
+
 /* wrapper around an AS path */
 struct bgpstream_as_path_store_path {
 
@@ -50,20 +70,66 @@ struct bgpstream_as_path_store_path {
   bgpstream_as_path_t path;
 };
 
-/** A per-origin set of AS Paths */
+/** A set of AS Paths that share a hash */
 typedef struct pathset {
 
-  /** Array of AS Paths in the set */
-  bgpstream_as_path_store_path_t *paths;
+  /** Array of AS Paths in the set (the paths themselves live in the arena,
+      so pointers to them stay valid as the set grows) */
+  bgpstream_as_path_store_path_t **paths;
 
   /** Number of AS paths in the set */
   uint16_t paths_cnt;
 
+  /** Number of AS paths allocated in the array */
+  uint16_t paths_alloc_cnt;
+
 } __attribute__((packed)) pathset_t;
 
 KHASH_INIT(pathset, uint32_t, pathset_t, 1, kh_int_hash_func,
            kh_int_hash_equal);
 
+/** Header of a snapshot file. It is followed by the pathset table, the path
+ * table and the path data, each starting on a SNAPSHOT_ALIGN boundary. None
+ * of these contain pointers, so the file can be used wherever it is mapped */
+typedef struct snapshot_hdr {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+
+  uint32_t paths_cnt;
+  uint32_t pathsets_cnt;
+
+  /* number of buckets in the pathset table (a power of two) */
+  uint32_t buckets_cnt;
+  uint32_t pad;
+
+  uint64_t data_len;
+} snapshot_hdr_t;
+
+/** Bucket of the (linearly probed) pathset table of a snapshot. Empty
+ * buckets have no paths */
+typedef struct snapshot_pathset {
+  uint32_t path_hash;
+
+  /* index of the first path of the set in the path table */
+  uint32_t first_path;
+
+  uint32_t paths_cnt;
+} snapshot_pathset_t;
+
+/** Entry in the path table of a snapshot */
+typedef struct snapshot_path {
+  /* offset of the path in the path data */
+  uint64_t data_offset;
+
+  uint32_t idx;
+  uint16_t data_len;
+  uint16_t seg_cnt;
+  uint16_t origin_offset;
+  uint8_t is_core;
+  uint8_t pad[5];
+} snapshot_path_t;
+
 struct bgpstream_as_path_store {
 
   khash_t(pathset) * path_set;
@@ -71,6 +137,45 @@ struct bgpstream_as_path_store {
   /** The total number of paths in the store */
   uint32_t paths_cnt;
 
+  /** Append-only arena that holds every path (and its data) in the store
+      (paths are never removed, so there is no need to free them one by
+      one) */
+  uint8_t **data_chunks;
+  uint32_t data_chunks_cnt;
+
+  /** Number of bytes used in the last data chunk */
+  uint32_t data_chunk_used;
+
+  /** Read-only mapping of the snapshot file that the store was opened from
+      (NULL unless the store is a snapshot) */
+  void *map;
+  size_t map_len;
+
+  /** Tables within the mapping */
+  snapshot_pathset_t *map_pathsets;
+  uint32_t map_buckets_cnt;
+  snapshot_path_t *map_paths;
+  uint8_t *map_data;
+  uint64_t map_data_len;
+
+  /** Store paths that point into the mapping. They are all filled in when
+      the snapshot is opened, so that readers never write to the store */
+  bgpstream_as_path_store_path_t *map_spaths;
+
+  /** Shards of a concurrent store, selected by the top bits of the path
+      hash, and the locks that protect them (NULL unless the store was
+      created by bgpstream_as_path_store_create_concurrent) */
+  struct bgpstream_as_path_store **shards;
+  pthread_rwlock_t *shard_locks;
+  int shard_bits;
+
+  /** The concurrent store that this store is a shard of (if any). Paths are
+      indexed across the whole concurrent store */
+  struct bgpstream_as_path_store *parent;
+
+  /** The currently iterated shard */
+  int cur_shard;
+
   /** The currently iterated pathset */
   khiter_t cur_pathset;
 
@@ -78,38 +183,60 @@ struct bgpstream_as_path_store {
   int cur_path;
 };
 
-static void store_path_destroy(bgpstream_as_path_store_path_t *spath)
+#define SHARD_IDX(store, hash)                                                 \
+  (((store)->shard_bits == 0) ? 0 : (hash) >> (32 - (store)->shard_bits))
+
+static uint8_t *store_alloc(bgpstream_as_path_store_t *store, size_t len,
+                            size_t align)
 {
-  if (spath == NULL) {
-    return;
+  uint8_t **chunks;
+  uint8_t *data;
+
+  store->data_chunk_used = (store->data_chunk_used + align - 1) & ~(align - 1);
+  if (store->data_chunks_cnt == 0 ||
+      store->data_chunk_used + len > PATH_DATA_CHUNK_LEN) {
+    if ((chunks = realloc(store->data_chunks,
+                          sizeof(uint8_t *) * (store->data_chunks_cnt + 1))) ==
+        NULL) {
+      return NULL;
+    }
+    store->data_chunks = chunks;
+    if ((chunks[store->data_chunks_cnt] = malloc(PATH_DATA_CHUNK_LEN)) ==
+        NULL) {
+      return NULL;
+    }
+    store->data_chunks_cnt++;
+    store->data_chunk_used = 0;
   }
 
-  /* destroy the path's data */
-  assert(spath->path.data_alloc_len != UINT16_MAX);
-  free(spath->path.data);
-  spath->path.data = NULL;
-  spath->path.data_alloc_len = 0;
+  data =
+    store->data_chunks[store->data_chunks_cnt - 1] + store->data_chunk_used;
+  store->data_chunk_used += len;
+  return data;
 }
 
-int store_path_dup(bgpstream_as_path_store_path_t *dst,
-                   bgpstream_as_path_store_path_t *src)
+static bgpstream_as_path_store_path_t *
+store_path_dup(bgpstream_as_path_store_t *store,
+               bgpstream_as_path_store_path_t *src)
 {
+  bgpstream_as_path_store_path_t *dst;
+
+  if ((dst = (bgpstream_as_path_store_path_t *)store_alloc(
+         store, sizeof(*dst), sizeof(void *))) == NULL) {
+    return NULL;
+  }
   *dst = *src;
 
-  /* copy the path data */
-  dst->path.data_alloc_len = 0;
-  if ((dst->path.data = malloc(src->path.data_len)) == NULL) {
-    goto err;
+  /* copy the path data into the arena. the path does not own its data, so
+     mark it as borrowed (like a zero-copy path) */
+  if ((dst->path.data = store_alloc(store, src->path.data_len, 1)) == NULL) {
+    return NULL;
   }
-  dst->path.data_alloc_len = src->path.data_len;
+  dst->path.data_alloc_len = UINT16_MAX;
   dst->path.data_len = src->path.data_len;
   memcpy(dst->path.data, src->path.data, src->path.data_len);
 
-  return 0;
-
-err:
-  store_path_destroy(dst);
-  return -1;
+  return dst;
 }
 
 static inline int store_path_equal(bgpstream_as_path_store_path_t *sp1,
@@ -119,56 +246,203 @@ static inline int store_path_equal(bgpstream_as_path_store_path_t *sp1,
          bgpstream_as_path_equal(&sp1->path, &sp2->path);
 }
 
-static void pathset_destroy(pathset_t ps)
+/* Get the index of the given path within a set, or -1 if it is not there */
+static int pathset_find(pathset_t *ps, bgpstream_as_path_store_path_t *findme)
 {
   int i;
 
-  /* destroy each store path */
-  for (i = 0; i < ps.paths_cnt; i++) {
-    store_path_destroy(&ps.paths[i]);
+  /* since the hash covers the entire path, sets rarely hold more than one
+     path */
+  for (i = 0; i < ps->paths_cnt; i++) {
+    if (store_path_equal(ps->paths[i], findme) != 0) {
+      return i;
+    }
   }
+  return -1;
+}
 
-  /* destroy the array of paths */
+static void pathset_destroy(pathset_t ps)
+{
+  /* the paths are owned by the arena, so just destroy the array of
+     pointers */
   free(ps.paths);
   ps.paths = NULL;
   ps.paths_cnt = 0;
+  ps.paths_alloc_cnt = 0;
 }
 
 static uint16_t pathset_get_path_id(bgpstream_as_path_store_t *store,
                                     pathset_t *ps,
                                     bgpstream_as_path_store_path_t *findme)
 {
-  int i;
+  bgpstream_as_path_store_path_t **paths;
+  uint32_t alloc_cnt;
   uint32_t path_id;
+  int i;
 
   /* check if it is already in the set */
-  for (i = 0; i < ps->paths_cnt; i++) {
-    if (store_path_equal(&ps->paths[i], findme) != 0) {
-      return i;
-    }
+  if ((i = pathset_find(ps, findme)) >= 0) {
+    return i;
   }
 
-  findme->idx = store->paths_cnt++;
+  if (ps->paths_cnt == UINT16_MAX - 1) {
+    fprintf(stderr, "ERROR: Too many paths with the same hash\n");
+    return UINT16_MAX;
+  }
 
   /* need to append this path */
-  if ((ps->paths = realloc(ps->paths, sizeof(bgpstream_as_path_store_path_t) *
-                                        (ps->paths_cnt + 1))) == NULL) {
-    fprintf(stderr, "ERROR: Could not realloc paths\n");
-    return UINT16_MAX;
+  if (ps->paths_cnt == ps->paths_alloc_cnt) {
+    alloc_cnt = (ps->paths_alloc_cnt == 0) ? 1 : ps->paths_alloc_cnt * 2;
+    if (alloc_cnt > UINT16_MAX - 1) {
+      alloc_cnt = UINT16_MAX - 1;
+    }
+    if ((paths = realloc(ps->paths, sizeof(bgpstream_as_path_store_path_t *) *
+                                      alloc_cnt)) == NULL) {
+      fprintf(stderr, "ERROR: Could not realloc paths\n");
+      return UINT16_MAX;
+    }
+    ps->paths = paths;
+    ps->paths_alloc_cnt = alloc_cnt;
+  }
+
+  if (store->parent != NULL) {
+    /* shards of a concurrent store are locked independently, so the index
+       is shared between them */
+    findme->idx =
+      __atomic_fetch_add(&store->parent->paths_cnt, 1, __ATOMIC_RELAXED);
+  } else {
+    findme->idx = store->paths_cnt;
   }
-  if (store_path_dup(&ps->paths[ps->paths_cnt], findme) != 0) {
+  if ((ps->paths[ps->paths_cnt] = store_path_dup(store, findme)) == NULL) {
     fprintf(stderr, "ERROR: Could not create store path\n");
     return UINT16_MAX;
   }
+  store->paths_cnt++;
   path_id = ps->paths_cnt++;
-  assert(ps->paths_cnt <= UINT16_MAX);
 
   return path_id;
 }
 
+static snapshot_pathset_t *map_get_pathset(bgpstream_as_path_store_t *store,
+                                           uint32_t path_hash)
+{
+  uint32_t mask = store->map_buckets_cnt - 1;
+  uint32_t i, probes;
+
+  for (i = path_hash & mask, probes = 0;
+       store->map_pathsets[i].paths_cnt != 0 &&
+       probes < store->map_buckets_cnt;
+       i = (i + 1) & mask, probes++) {
+    if (store->map_pathsets[i].path_hash != path_hash) {
+      continue;
+    }
+    if ((uint64_t)store->map_pathsets[i].first_path +
+          store->map_pathsets[i].paths_cnt >
+        store->paths_cnt) {
+      fprintf(stderr, "ERROR: Corrupt pathset in AS path store snapshot\n");
+      return NULL;
+    }
+    return &store->map_pathsets[i];
+  }
+  return NULL;
+}
+
+static bgpstream_as_path_store_path_t *
+map_get_spath(bgpstream_as_path_store_t *store, uint32_t i)
+{
+  if (i >= store->paths_cnt) {
+    fprintf(stderr, "ERROR: Corrupt pathset in AS path store snapshot\n");
+    return NULL;
+  }
+  return &store->map_spaths[i];
+}
+
+/* Fill in the store paths of a snapshot, which point into the mapping.
+ * Returns -1 if a path lies outside the path data */
+static int map_fill_spaths(bgpstream_as_path_store_t *store)
+{
+  bgpstream_as_path_store_path_t *spath;
+  snapshot_path_t *mpath;
+  uint32_t i;
+
+  for (i = 0; i < store->paths_cnt; i++) {
+    spath = &store->map_spaths[i];
+    mpath = &store->map_paths[i];
+    if (mpath->data_offset > store->map_data_len ||
+        mpath->data_len > store->map_data_len - mpath->data_offset) {
+      return -1;
+    }
+    spath->is_core = mpath->is_core;
+    spath->idx = mpath->idx;
+    /* the mapped path data is borrowed (like a zero-copy path) */
+    spath->path.data = store->map_data + mpath->data_offset;
+    spath->path.data_len = mpath->data_len;
+    spath->path.seg_cnt = mpath->seg_cnt;
+    spath->path.origin_offset = mpath->origin_offset;
+    spath->path.data_alloc_len = UINT16_MAX;
+  }
+  return 0;
+}
+
+/* Find a path in a snapshot (which cannot be added to) */
+static int map_get_path_id(bgpstream_as_path_store_t *store,
+                           bgpstream_as_path_store_path_t *findme,
+                           bgpstream_as_path_store_path_id_t *id)
+{
+  snapshot_pathset_t *ps;
+  snapshot_path_t *mpath;
+  uint32_t i;
+
+  id->path_hash = bgpstream_as_path_hash(&findme->path);
+
+  if ((ps = map_get_pathset(store, id->path_hash)) != NULL) {
+    for (i = 0; i < ps->paths_cnt && i < UINT16_MAX; i++) {
+      mpath = &store->map_paths[ps->first_path + i];
+      if (mpath->is_core == findme->is_core &&
+          mpath->data_len == findme->path.data_len &&
+          memcmp(store->map_data + mpath->data_offset, findme->path.data,
+                 mpath->data_len) == 0) {
+        id->path_id = i;
+        return 0;
+      }
+    }
+  }
+
+  fprintf(stderr, "ERROR: Cannot add a path to a read-only store\n");
+  return -1;
+}
+
+static void map_iter_skip_empty(bgpstream_as_path_store_t *store)
+{
+  while (store->cur_pathset < store->map_buckets_cnt &&
+         store->map_pathsets[store->cur_pathset].paths_cnt == 0) {
+    store->cur_pathset++;
+  }
+}
+
+/* Write padding to bring a snapshot file up to the next section */
+static int snapshot_pad(FILE *fh, size_t *off)
+{
+  static const uint8_t zeros[SNAPSHOT_ALIGN] = {0};
+  size_t pad = SNAPSHOT_ALIGN_UP(*off) - *off;
+
+  if (pad > 0 && fwrite(zeros, 1, pad, fh) != pad) {
+    return -1;
+  }
+  *off += pad;
+  return 0;
+}
+
 /* ==================== PUBLIC FUNCTIONS ==================== */
 
 bgpstream_as_path_store_t *bgpstream_as_path_store_create()
+{
+  return bgpstream_as_path_store_create_sized(
+    BGPSTREAM_AS_PATH_STORE_DEFAULT_CAPACITY);
+}
+
+bgpstream_as_path_store_t *
+bgpstream_as_path_store_create_sized(uint32_t capacity)
 {
   bgpstream_as_path_store_t *store;
 
@@ -179,8 +453,53 @@ bgpstream_as_path_store_t *bgpstream_as_path_store_create()
   if ((store->path_set = kh_init(pathset)) == NULL) {
     goto err;
   }
-  /* pre-allocate to minimize resize events */
-  kh_resize(pathset, store->path_set, 1 << 24); /* 2^24 = 16.8M buckets */
+  /* pre-allocate enough buckets that the expected number of paths can be
+     added without resizing (khash resizes once the load factor reaches
+     __ac_HASH_UPPER) */
+  if (capacity > 0 &&
+      kh_resize(pathset, store->path_set,
+                (khint_t)(capacity / __ac_HASH_UPPER) + 1) != 0) {
+    goto err;
+  }
+
+  return store;
+
+err:
+  bgpstream_as_path_store_destroy(store);
+  return NULL;
+}
+
+bgpstream_as_path_store_t *
+bgpstream_as_path_store_create_concurrent(uint32_t capacity, int shards_cnt)
+{
+  bgpstream_as_path_store_t *store;
+  int i;
+
+  if ((store = malloc_zero(sizeof(bgpstream_as_path_store_t))) == NULL) {
+    return NULL;
+  }
+
+  /* round the number of shards up to a power of two */
+  while ((1 << store->shard_bits) < shards_cnt && store->shard_bits < 16) {
+    store->shard_bits++;
+  }
+  shards_cnt = 1 << store->shard_bits;
+
+  if ((store->shards = malloc_zero(sizeof(bgpstream_as_path_store_t *) *
+                                   shards_cnt)) == NULL ||
+      (store->shard_locks = malloc_zero(sizeof(pthread_rwlock_t) *
+                                        shards_cnt)) == NULL) {
+    goto err;
+  }
+  for (i = 0; i < shards_cnt; i++) {
+    if ((store->shards[i] =
+           bgpstream_as_path_store_create_sized(capacity / shards_cnt)) ==
+        NULL) {
+      goto err;
+    }
+    store->shards[i]->parent = store;
+    pthread_rwlock_init(&store->shard_locks[i], NULL);
+  }
 
   return store;
 
@@ -191,39 +510,371 @@ err:
 
 void bgpstream_as_path_store_destroy(bgpstream_as_path_store_t *store)
 {
+  int i;
+
   if (store == NULL) {
     return;
   }
 
+  if (store->shards != NULL) {
+    for (i = 0; i < (1 << store->shard_bits); i++) {
+      if (store->shards[i] != NULL) {
+        pthread_rwlock_destroy(&store->shard_locks[i]);
+      }
+      bgpstream_as_path_store_destroy(store->shards[i]);
+    }
+    free(store->shards);
+    store->shards = NULL;
+    free(store->shard_locks);
+    store->shard_locks = NULL;
+  }
+
   if (store->path_set != NULL) {
     kh_free_vals(pathset, store->path_set, pathset_destroy);
     kh_destroy(pathset, store->path_set);
     store->path_set = NULL;
   }
 
+  while (store->data_chunks_cnt > 0) {
+    free(store->data_chunks[--store->data_chunks_cnt]);
+  }
+  free(store->data_chunks);
+  store->data_chunks = NULL;
+
+  if (store->map != NULL) {
+    munmap(store->map, store->map_len);
+    store->map = NULL;
+  }
+  free(store->map_spaths);
+  store->map_spaths = NULL;
+
   free(store);
 }
 
 uint32_t bgpstream_as_path_store_get_size(bgpstream_as_path_store_t *store)
 {
+  if (store->shards != NULL) {
+    return __atomic_load_n(&store->paths_cnt, __ATOMIC_RELAXED);
+  }
   return store->paths_cnt;
 }
 
-static int get_path_id(bgpstream_as_path_store_t *store,
-                       bgpstream_as_path_store_path_t *findme,
-                       bgpstream_as_path_store_path_id_t *id)
+int bgpstream_as_path_store_write_snapshot(bgpstream_as_path_store_t *store,
+                                           const char *filename)
+{
+  snapshot_hdr_t hdr;
+  snapshot_pathset_t *buckets = NULL;
+  snapshot_pathset_t *ps = NULL;
+  snapshot_path_t mpath;
+  bgpstream_as_path_store_path_t *spath;
+  bgpstream_as_path_store_path_id_t id;
+  FILE *fh = NULL;
+  uint32_t first_path = 0;
+  uint32_t mask;
+  uint32_t i;
+  size_t off;
+  int rc = -1;
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, SNAPSHOT_MAGIC, sizeof(hdr.magic));
+  hdr.version = SNAPSHOT_VERSION;
+  hdr.byte_order = SNAPSHOT_BYTE_ORDER;
+
+  /* size the table to be at most half full */
+  hdr.buckets_cnt = 1;
+  while (hdr.buckets_cnt < UINT32_MAX / 2 &&
+         hdr.buckets_cnt / 2 < bgpstream_as_path_store_get_size(store)) {
+    hdr.buckets_cnt <<= 1;
+  }
+  if ((buckets = malloc_zero(sizeof(snapshot_pathset_t) * hdr.buckets_cnt)) ==
+      NULL) {
+    goto done;
+  }
+  mask = hdr.buckets_cnt - 1;
+
+  /* lay out the paths in iteration order, so that path IDs (the position of
+     each path within its set) are unchanged */
+  bgpstream_as_path_store_iter_first_path(store);
+  while (bgpstream_as_path_store_iter_has_more_path(store)) {
+    id = bgpstream_as_path_store_iter_get_path_id(store);
+    if ((spath = bgpstream_as_path_store_iter_get_path(store)) == NULL) {
+      goto done;
+    }
+    if (id.path_id == 0) {
+      for (i = id.path_hash & mask; buckets[i].paths_cnt != 0;
+           i = (i + 1) & mask)
+        ;
+      ps = &buckets[i];
+      ps->path_hash = id.path_hash;
+      ps->first_path = first_path;
+      hdr.pathsets_cnt++;
+    }
+    ps->paths_cnt++;
+    first_path++;
+    hdr.data_len += spath->path.data_len;
+    bgpstream_as_path_store_iter_next_path(store);
+  }
+  hdr.paths_cnt = first_path;
+
+  if ((fh = fopen(filename, "w")) == NULL) {
+    fprintf(stderr, "ERROR: Could not open %s for writing\n", filename);
+    goto done;
+  }
+
+  off = sizeof(hdr);
+  if (fwrite(&hdr, sizeof(hdr), 1, fh) != 1 || snapshot_pad(fh, &off) != 0 ||
+      fwrite(buckets, sizeof(snapshot_pathset_t), hdr.buckets_cnt, fh) !=
+        hdr.buckets_cnt) {
+    goto err;
+  }
+  off += sizeof(snapshot_pathset_t) * hdr.buckets_cnt;
+  if (snapshot_pad(fh, &off) != 0) {
+    goto err;
+  }
+
+  /* path table */
+  memset(&mpath, 0, sizeof(mpath));
+  bgpstream_as_path_store_iter_first_path(store);
+  while (bgpstream_as_path_store_iter_has_more_path(store)) {
+    spath = bgpstream_as_path_store_iter_get_path(store);
+    mpath.idx = spath->idx;
+    mpath.data_len = spath->path.data_len;
+    mpath.seg_cnt = spath->path.seg_cnt;
+    mpath.origin_offset = spath->path.origin_offset;
+    mpath.is_core = spath->is_core;
+    if (fwrite(&mpath, sizeof(mpath), 1, fh) != 1) {
+      goto err;
+    }
+    mpath.data_offset += spath->path.data_len;
+    bgpstream_as_path_store_iter_next_path(store);
+  }
+  off += sizeof(snapshot_path_t) * hdr.paths_cnt;
+  if (snapshot_pad(fh, &off) != 0) {
+    goto err;
+  }
+
+  /* path data */
+  bgpstream_as_path_store_iter_first_path(store);
+  while (bgpstream_as_path_store_iter_has_more_path(store)) {
+    spath = bgpstream_as_path_store_iter_get_path(store);
+    if (spath->path.data_len > 0 &&
+        fwrite(spath->path.data, spath->path.data_len, 1, fh) != 1) {
+      goto err;
+    }
+    bgpstream_as_path_store_iter_next_path(store);
+  }
+
+  rc = fclose(fh);
+  fh = NULL;
+  if (rc != 0) {
+    goto err;
+  }
+  goto done;
+
+err:
+  fprintf(stderr, "ERROR: Could not write AS path store snapshot to %s\n",
+          filename);
+  rc = -1;
+done:
+  if (fh != NULL) {
+    fclose(fh);
+  }
+  free(buckets);
+  return rc;
+}
+
+bgpstream_as_path_store_t *
+bgpstream_as_path_store_open_snapshot(const char *filename)
+{
+  bgpstream_as_path_store_t *store = NULL;
+  snapshot_hdr_t *hdr;
+  struct stat st;
+  void *map = MAP_FAILED;
+  uint64_t len;
+  int fd;
+
+  if ((fd = open(filename, O_RDONLY)) < 0) {
+    fprintf(stderr, "ERROR: Could not open %s\n", filename);
+    return NULL;
+  }
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(snapshot_hdr_t) ||
+      (map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) ==
+        MAP_FAILED) {
+    fprintf(stderr, "ERROR: Could not map %s\n", filename);
+    close(fd);
+    return NULL;
+  }
+  close(fd);
+
+  hdr = map;
+  if (memcmp(hdr->magic, SNAPSHOT_MAGIC, sizeof(hdr->magic)) != 0 ||
+      hdr->version != SNAPSHOT_VERSION ||
+      hdr->byte_order != SNAPSHOT_BYTE_ORDER) {
+    fprintf(stderr, "ERROR: %s is not a compatible AS path store snapshot\n",
+            filename);
+    goto err;
+  }
+  len = SNAPSHOT_ALIGN_UP(sizeof(snapshot_hdr_t)) +
+        SNAPSHOT_ALIGN_UP((uint64_t)hdr->buckets_cnt *
+                          sizeof(snapshot_pathset_t)) +
+        SNAPSHOT_ALIGN_UP((uint64_t)hdr->paths_cnt * sizeof(snapshot_path_t)) +
+        hdr->data_len;
+  if (hdr->buckets_cnt == 0 || (hdr->buckets_cnt & (hdr->buckets_cnt - 1)) ||
+      hdr->pathsets_cnt >= hdr->buckets_cnt || len > (uint64_t)st.st_size) {
+    fprintf(stderr, "ERROR: AS path store snapshot %s is corrupt\n",
+            filename);
+    goto err;
+  }
+
+  if ((store = malloc_zero(sizeof(bgpstream_as_path_store_t))) == NULL ||
+      (store->path_set = kh_init(pathset)) == NULL ||
+      (store->map_spaths = calloc(hdr->paths_cnt + 1,
+                                  sizeof(bgpstream_as_path_store_path_t))) ==
+        NULL) {
+    goto err;
+  }
+  store->paths_cnt = hdr->paths_cnt;
+  store->map_buckets_cnt = hdr->buckets_cnt;
+  store->map_pathsets =
+    (snapshot_pathset_t *)((uint8_t *)map +
+                           SNAPSHOT_ALIGN_UP(sizeof(snapshot_hdr_t)));
+  store->map_paths =
+    (snapshot_path_t *)((uint8_t *)store->map_pathsets +
+                        SNAPSHOT_ALIGN_UP((size_t)hdr->buckets_cnt *
+                                          sizeof(snapshot_pathset_t)));
+  store->map_data =
+    (uint8_t *)store->map_paths +
+    SNAPSHOT_ALIGN_UP((size_t)hdr->paths_cnt * sizeof(snapshot_path_t));
+  store->map_data_len = hdr->data_len;
+  if (map_fill_spaths(store) != 0) {
+    fprintf(stderr, "ERROR: AS path store snapshot %s is corrupt\n",
+            filename);
+    goto err;
+  }
+  store->map = map;
+  store->map_len = st.st_size;
+
+  return store;
+
+err:
+  bgpstream_as_path_store_destroy(store);
+  munmap(map, st.st_size);
+  return NULL;
+}
+
+void bgpstream_as_path_store_get_stats(bgpstream_as_path_store_t *store,
+                                       bgpstream_as_path_store_stats_t *stats)
+{
+  bgpstream_as_path_store_stats_t shard_stats;
+  khash_t(pathset) *h = store->path_set;
+  khint_t k, i, mask, step;
+  double probe_sum = 0;
+
+  memset(stats, 0, sizeof(*stats));
+  stats->paths_cnt = bgpstream_as_path_store_get_size(store);
+
+  if (store->shards != NULL) {
+    for (k = 0; k < (1 << store->shard_bits); k++) {
+      pthread_rwlock_rdlock(&store->shard_locks[k]);
+      bgpstream_as_path_store_get_stats(store->shards[k], &shard_stats);
+      pthread_rwlock_unlock(&store->shard_locks[k]);
+      stats->pathsets_cnt += shard_stats.pathsets_cnt;
+      stats->buckets_cnt += shard_stats.buckets_cnt;
+      probe_sum += shard_stats.avg_probe_len * shard_stats.pathsets_cnt;
+      if (shard_stats.max_probe_len > stats->max_probe_len) {
+        stats->max_probe_len = shard_stats.max_probe_len;
+      }
+      if (shard_stats.max_pathset_len > stats->max_pathset_len) {
+        stats->max_pathset_len = shard_stats.max_pathset_len;
+      }
+      stats->data_len += shard_stats.data_len;
+      stats->data_alloc_len += shard_stats.data_alloc_len;
+    }
+    if (stats->buckets_cnt > 0) {
+      stats->load_factor = (double)stats->pathsets_cnt / stats->buckets_cnt;
+    }
+    if (stats->pathsets_cnt > 0) {
+      stats->avg_probe_len = probe_sum / stats->pathsets_cnt;
+    }
+    return;
+  }
+
+  if (store->map != NULL) {
+    mask = store->map_buckets_cnt - 1;
+    for (k = 0; k < store->map_buckets_cnt; k++) {
+      if (store->map_pathsets[k].paths_cnt == 0) {
+        continue;
+      }
+      stats->pathsets_cnt++;
+      if (store->map_pathsets[k].paths_cnt > stats->max_pathset_len) {
+        stats->max_pathset_len = store->map_pathsets[k].paths_cnt;
+      }
+      /* linear probing */
+      step = (k - store->map_pathsets[k].path_hash) & mask;
+      probe_sum += step;
+      if (step > stats->max_probe_len) {
+        stats->max_probe_len = step;
+      }
+    }
+    stats->buckets_cnt = store->map_buckets_cnt;
+    stats->load_factor = (double)stats->pathsets_cnt / stats->buckets_cnt;
+    if (stats->pathsets_cnt > 0) {
+      stats->avg_probe_len = (double)probe_sum / stats->pathsets_cnt;
+    }
+    stats->data_len = stats->data_alloc_len = store->map_data_len;
+    return;
+  }
+
+  stats->pathsets_cnt = kh_size(h);
+  stats->buckets_cnt = kh_n_buckets(h);
+  if (stats->buckets_cnt > 0) {
+    stats->load_factor = (double)stats->pathsets_cnt / stats->buckets_cnt;
+  }
+  stats->data_alloc_len =
+    (uint64_t)store->data_chunks_cnt * PATH_DATA_CHUNK_LEN;
+
+  mask = kh_n_buckets(h) - 1;
+  for (k = kh_begin(h); k < kh_end(h); k++) {
+    if (!kh_exist(h, k)) {
+      continue;
+    }
+    if (kh_val(h, k).paths_cnt > stats->max_pathset_len) {
+      stats->max_pathset_len = kh_val(h, k).paths_cnt;
+    }
+    for (i = 0; i < kh_val(h, k).paths_cnt; i++) {
+      stats->data_len += kh_val(h, k).paths[i]->path.data_len;
+    }
+
+    /* replay the (quadratic) probe sequence that kh_get follows to find this
+       key */
+    step = 0;
+    for (i = kh_int_hash_func(kh_key(h, k)) & mask; i != k;
+         i = (i + (++step)) & mask)
+      ;
+    probe_sum += step;
+    if (step > stats->max_probe_len) {
+      stats->max_probe_len = step;
+    }
+  }
+  if (stats->pathsets_cnt > 0) {
+    stats->avg_probe_len = (double)probe_sum / stats->pathsets_cnt;
+  }
+}
+
+static int add_path(bgpstream_as_path_store_t *store,
+                    bgpstream_as_path_store_path_t *findme,
+                    bgpstream_as_path_store_path_id_t *id)
 {
   khiter_t k;
   int khret;
 
-  id->path_hash = bgpstream_as_path_hash(&findme->path);
-
   k = kh_put(pathset, store->path_set, id->path_hash, &khret);
   if (khret == 1) {
     /* just added this pathset */
     /* clear the pathset fields */
     kh_val(store->path_set, k).paths = NULL;
     kh_val(store->path_set, k).paths_cnt = 0;
+    kh_val(store->path_set, k).paths_alloc_cnt = 0;
   } else if (khret != 0) {
     fprintf(stderr, "ERROR: Could not add path set to the store\n");
     goto err;
@@ -242,6 +893,59 @@ err:
   return -1;
 }
 
+/* Look up (but do not add) a path. Returns 0 if it was found */
+static int find_path(bgpstream_as_path_store_t *store,
+                     bgpstream_as_path_store_path_t *findme,
+                     bgpstream_as_path_store_path_id_t *id)
+{
+  khiter_t k;
+  int i;
+
+  if ((k = kh_get(pathset, store->path_set, id->path_hash)) ==
+        kh_end(store->path_set) ||
+      (i = pathset_find(&kh_val(store->path_set, k), findme)) < 0) {
+    return -1;
+  }
+  id->path_id = i;
+  return 0;
+}
+
+static int get_path_id(bgpstream_as_path_store_t *store,
+                       bgpstream_as_path_store_path_t *findme,
+                       bgpstream_as_path_store_path_id_t *id)
+{
+  pthread_rwlock_t *lock;
+  bgpstream_as_path_store_t *shard;
+  int rc;
+
+  if (store->map != NULL) {
+    return map_get_path_id(store, findme, id);
+  }
+
+  id->path_hash = bgpstream_as_path_hash(&findme->path);
+
+  if (store->shards == NULL) {
+    return add_path(store, findme, id);
+  }
+
+  /* most paths have been seen before, so first look for the path while
+     sharing the shard with other readers, and only lock it exclusively if
+     the path needs to be added */
+  shard = store->shards[SHARD_IDX(store, id->path_hash)];
+  lock = &store->shard_locks[SHARD_IDX(store, id->path_hash)];
+  pthread_rwlock_rdlock(lock);
+  rc = find_path(shard, findme, id);
+  pthread_rwlock_unlock(lock);
+  if (rc == 0) {
+    return 0;
+  }
+
+  pthread_rwlock_wrlock(lock);
+  rc = add_path(shard, findme, id);
+  pthread_rwlock_unlock(lock);
+  return rc;
+}
+
 int bgpstream_as_path_store_get_path_id(bgpstream_as_path_store_t *store,
                                         bgpstream_as_path_t *path,
                                         uint32_t peer_asn,
@@ -299,8 +1003,34 @@ int bgpstream_as_path_store_insert_path(bgpstream_as_path_store_t *store,
   return get_path_id(store, &findme, id);
 }
 
+/* Move a concurrent store iterator to the next shard with paths (starting
+ * with the given one) */
+static void shard_iter_skip_empty(bgpstream_as_path_store_t *store, int i)
+{
+  for (store->cur_shard = i; store->cur_shard < (1 << store->shard_bits);
+       store->cur_shard++) {
+    bgpstream_as_path_store_iter_first_path(store->shards[store->cur_shard]);
+    if (bgpstream_as_path_store_iter_has_more_path(
+          store->shards[store->cur_shard])) {
+      break;
+    }
+  }
+}
+
 void bgpstream_as_path_store_iter_first_path(bgpstream_as_path_store_t *store)
 {
+  if (store->shards != NULL) {
+    shard_iter_skip_empty(store, 0);
+    return;
+  }
+
+  if (store->map != NULL) {
+    store->cur_pathset = 0;
+    store->cur_path = 0;
+    map_iter_skip_empty(store);
+    return;
+  }
+
   store->cur_pathset = kh_begin(store->path_set);
 
   while (!kh_exist(store->path_set, store->cur_pathset) &&
@@ -315,6 +1045,27 @@ void bgpstream_as_path_store_iter_next_path(bgpstream_as_path_store_t *store)
 {
   pathset_t *pathset;
 
+  if (store->shards != NULL) {
+    if (store->cur_shard < (1 << store->shard_bits)) {
+      bgpstream_as_path_store_iter_next_path(store->shards[store->cur_shard]);
+      if (!bgpstream_as_path_store_iter_has_more_path(
+            store->shards[store->cur_shard])) {
+        shard_iter_skip_empty(store, store->cur_shard + 1);
+      }
+    }
+    return;
+  }
+
+  if (store->map != NULL) {
+    if (store->cur_pathset < store->map_buckets_cnt &&
+        store->cur_path >= store->map_pathsets[store->cur_pathset].paths_cnt) {
+      store->cur_pathset++;
+      store->cur_path = 0;
+      map_iter_skip_empty(store);
+    }
+    return;
+  }
+
   if (store->cur_pathset >= kh_end(store->path_set)) {
     return;
   }
@@ -332,6 +1083,16 @@ void bgpstream_as_path_store_iter_next_path(bgpstream_as_path_store_t *store)
 
 int bgpstream_as_path_store_iter_has_more_path(bgpstream_as_path_store_t *store)
 {
+  if (store->shards != NULL) {
+    return store->cur_shard < (1 << store->shard_bits) &&
+           bgpstream_as_path_store_iter_has_more_path(
+             store->shards[store->cur_shard]);
+  }
+  if (store->map != NULL) {
+    return (store->cur_pathset < store->map_buckets_cnt) &&
+           (store->cur_path <
+            store->map_pathsets[store->cur_pathset].paths_cnt);
+  }
   return (store->cur_pathset < kh_end(store->path_set)) &&
          (store->cur_path <
           kh_val(store->path_set, store->cur_pathset).paths_cnt);
@@ -340,7 +1101,16 @@ int bgpstream_as_path_store_iter_has_more_path(bgpstream_as_path_store_t *store)
 bgpstream_as_path_store_path_t *
 bgpstream_as_path_store_iter_get_path(bgpstream_as_path_store_t *store)
 {
-  return &kh_val(store->path_set, store->cur_pathset).paths[store->cur_path++];
+  if (store->shards != NULL) {
+    return bgpstream_as_path_store_iter_get_path(
+      store->shards[store->cur_shard]);
+  }
+  if (store->map != NULL) {
+    return map_get_spath(store,
+                         store->map_pathsets[store->cur_pathset].first_path +
+                           store->cur_path++);
+  }
+  return kh_val(store->path_set, store->cur_pathset).paths[store->cur_path++];
 }
 
 bgpstream_as_path_store_path_id_t
@@ -348,7 +1118,16 @@ bgpstream_as_path_store_iter_get_path_id(bgpstream_as_path_store_t *store)
 {
   bgpstream_as_path_store_path_id_t id;
 
-  id.path_hash = kh_key(store->path_set, store->cur_pathset);
+  if (store->shards != NULL) {
+    return bgpstream_as_path_store_iter_get_path_id(
+      store->shards[store->cur_shard]);
+  }
+
+  if (store->map != NULL) {
+    id.path_hash = store->map_pathsets[store->cur_pathset].path_hash;
+  } else {
+    id.path_hash = kh_key(store->path_set, store->cur_pathset);
+  }
   id.path_id = store->cur_path;
 
   return id;
@@ -358,6 +1137,8 @@ bgpstream_as_path_store_path_t *
 bgpstream_as_path_store_get_store_path(bgpstream_as_path_store_t *store,
                                        bgpstream_as_path_store_path_id_t id)
 {
+  bgpstream_as_path_store_path_t *spath;
+  snapshot_pathset_t *ps;
   khiter_t k;
 
   /* special case for NULL path */
@@ -365,6 +1146,25 @@ bgpstream_as_path_store_get_store_path(bgpstream_as_path_store_t *store,
     return NULL;
   }
 
+  if (store->shards != NULL) {
+    /* store paths live in the arena, so the pointer stays valid after the
+       shard is unlocked */
+    pthread_rwlock_rdlock(&store->shard_locks[SHARD_IDX(store, id.path_hash)]);
+    spath = bgpstream_as_path_store_get_store_path(
+      store->shards[SHARD_IDX(store, id.path_hash)], id);
+    pthread_rwlock_unlock(
+      &store->shard_locks[SHARD_IDX(store, id.path_hash)]);
+    return spath;
+  }
+
+  if (store->map != NULL) {
+    if ((ps = map_get_pathset(store, id.path_hash)) == NULL ||
+        id.path_id >= ps->paths_cnt) {
+      return NULL;
+    }
+    return map_get_spath(store, ps->first_path + id.path_id);
+  }
+
   if ((k = kh_get(pathset, store->path_set, id.path_hash)) ==
       kh_end(store->path_set)) {
     return NULL;
@@ -374,7 +1174,7 @@ bgpstream_as_path_store_get_store_path(bgpstream_as_path_store_t *store,
     return NULL;
   }
 
-  return &kh_val(store->path_set, k).paths[id.path_id];
+  return kh_val(store->path_set, k).paths[id.path_id];
 }
 
 bgpstream_as_path_t *bgpstream_as_path_store_path_get_path(
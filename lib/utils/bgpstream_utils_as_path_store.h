@@ -43,6 +43,10 @@
  *
  * @{ */
 
+/** Number of paths that a store created by bgpstream_as_path_store_create can
+ * hold before its hash table needs to be resized */
+#define BGPSTREAM_AS_PATH_STORE_DEFAULT_CAPACITY 1024
+
 /* @} */
 
 /**
@@ -76,14 +80,47 @@ typedef struct bgpstream_as_path_store_path bgpstream_as_path_store_path_t;
  */
 typedef struct bgpstream_as_path_store_path_id {
 
-  /** An internal hash of the origin ASN segment of the path */
+  /** An internal hash of the path */
   uint32_t path_hash;
 
-  /** ID of the path within the origin pathset */
+  /** ID of the path within the set of paths that share its hash */
   uint16_t path_id;
 
 } __attribute__((packed)) bgpstream_as_path_store_path_id_t;
 
+/** Statistics about the hash table of a store */
+typedef struct bgpstream_as_path_store_stats {
+
+  /** Number of paths in the store */
+  uint32_t paths_cnt;
+
+  /** Number of distinct path hashes in the store (i.e., occupied buckets) */
+  uint32_t pathsets_cnt;
+
+  /** Number of buckets in the hash table */
+  uint32_t buckets_cnt;
+
+  /** Fraction of the buckets that are occupied */
+  double load_factor;
+
+  /** Average number of probes (beyond the first bucket) needed to find a
+      path hash */
+  double avg_probe_len;
+
+  /** Maximum number of probes needed to find a path hash */
+  uint32_t max_probe_len;
+
+  /** Maximum number of paths that share a hash */
+  uint16_t max_pathset_len;
+
+  /** Number of bytes of path data in the store */
+  uint64_t data_len;
+
+  /** Number of bytes allocated to hold paths and their data */
+  uint64_t data_alloc_len;
+
+} bgpstream_as_path_store_stats_t;
+
 /** Store path iterator structure */
 typedef struct bgpstream_as_path_store_path_iter {
 
@@ -108,9 +145,46 @@ typedef struct bgpstream_as_path_store_path_iter {
 /** Create a new AS Path Store
  *
  * @return pointer to the created store if successful, NULL otherwise
+ *
+ * The store is sized to hold BGPSTREAM_AS_PATH_STORE_DEFAULT_CAPACITY paths
+ * before it grows.
  */
 bgpstream_as_path_store_t *bgpstream_as_path_store_create();
 
+/** Create a new AS Path Store sized for the given number of paths
+ *
+ * @param capacity      number of paths the store is expected to hold
+ * @return pointer to the created store if successful, NULL otherwise
+ *
+ * The store grows as needed, but sizing it up front avoids rehashing when the
+ * number of paths is known (e.g., when deserializing a store).
+ */
+bgpstream_as_path_store_t *
+bgpstream_as_path_store_create_sized(uint32_t capacity);
+
+/** Create a new AS Path Store that can be used by several threads at once
+ *
+ * @param capacity      number of paths the store is expected to hold
+ * @param shards_cnt    number of shards to split the store into (rounded up
+ *                      to a power of two)
+ * @return pointer to the created store if successful, NULL otherwise
+ *
+ * The store is split into shards by path hash, each with its own lock.
+ * bgpstream_as_path_store_get_path_id, bgpstream_as_path_store_insert_path,
+ * bgpstream_as_path_store_get_store_path and bgpstream_as_path_store_get_size
+ * may be called concurrently. Looking up a path that is already in the store
+ * only takes a shared lock, so threads that mostly see known paths (e.g.,
+ * when decoding RIBs in parallel) rarely wait for each other. Store paths
+ * returned by the store remain valid until it is destroyed.
+ *
+ * Path IDs are the same as those a single-threaded store would assign
+ * (given the same order of insertion within each set of paths that share a
+ * hash). Iteration, stats and snapshots are also supported, but must not run
+ * concurrently with the addition of paths.
+ */
+bgpstream_as_path_store_t *
+bgpstream_as_path_store_create_concurrent(uint32_t capacity, int shards_cnt);
+
 /** Destroy the given AS Path Store
  *
  * @param store         pointer to the store to destroy
@@ -124,6 +198,47 @@ void bgpstream_as_path_store_destroy(bgpstream_as_path_store_t *store);
  */
 uint32_t bgpstream_as_path_store_get_size(bgpstream_as_path_store_t *store);
 
+/** Write a snapshot of the given store to a file
+ *
+ * @param store         pointer to the store
+ * @param filename      name of the file to write
+ * @return 0 if the snapshot was written successfully, -1 otherwise
+ *
+ * Snapshots are only portable between hosts with the same byte order. Path
+ * IDs are preserved, so IDs obtained from the store remain valid in a store
+ * opened from the snapshot.
+ *
+ * @note this uses the internal iterator of the store
+ */
+int bgpstream_as_path_store_write_snapshot(bgpstream_as_path_store_t *store,
+                                           const char *filename);
+
+/** Open a read-only store from a snapshot file
+ *
+ * @param filename      name of the snapshot file
+ * @return pointer to the store if successful, NULL otherwise
+ *
+ * The snapshot is memory-mapped (read-only and shared), so processes that
+ * open the same snapshot share one copy of the path data. Opening it fills in
+ * a small (per-process) structure for each path, after which the store may be
+ * read by several threads at once. The store supports the same lookup and iteration functions
+ * as any other, but paths cannot be added to it:
+ * bgpstream_as_path_store_get_path_id and bgpstream_as_path_store_insert_path
+ * fail for paths that are not already in the snapshot.
+ */
+bgpstream_as_path_store_t *
+bgpstream_as_path_store_open_snapshot(const char *filename);
+
+/** Get statistics about the hash table of the store
+ *
+ * @param store         pointer to the store
+ * @param[out] stats    pointer to a stats structure to fill
+ *
+ * This walks the entire table, so it should not be called often.
+ */
+void bgpstream_as_path_store_get_stats(bgpstream_as_path_store_t *store,
+                                       bgpstream_as_path_store_stats_t *stats);
+
 /** Directly add the given path to the store and return the path ID
  *
  * @param store         pointer to the store
@@ -28,269 +28,211 @@
 #include "bgpstream_utils_addr.h"
 #include "utils.h"
 #include <inttypes.h>
-#include <inttypes.h>
-#include <stdio.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
-/* static char buffer[INET6_ADDRSTRLEN]; */
+/* Number of pending intervals that may be added before they are merged into
+ * the sorted array (whatever the size of the array) */
+#define PENDING_MIN_CNT 1024
+
+typedef unsigned __int128 uint128_t;
 
+/* Intervals are inclusive, and the sorted arrays hold disjoint intervals
+ * (since prefixes are either nested or disjoint, each one is exactly a prefix
+ * that was added and is not covered by any other) */
 typedef struct struct_v4pfx_int_t {
   uint32_t start;
   uint32_t end;
-  struct struct_v4pfx_int_t *next;
 } v4pfx_int_t;
 
 typedef struct struct_v6pfx_int_t {
-  uint64_t start_ms;
-  uint64_t start_ls;
-  uint64_t end_ms;
-  uint64_t end_ls;
-  struct struct_v6pfx_int_t *next;
+  uint128_t start;
+  uint128_t end;
 } v6pfx_int_t;
 
-/* IP Counter Linked List */
+/* Sorted array of intervals, plus the intervals added since it was last
+ * sorted. Adding a prefix just appends it to the pending intervals, which are
+ * sorted and merged into the array in one pass (when the counter is queried,
+ * or when there are as many of them as there are sorted intervals), so
+ * adding n prefixes takes O(n log n) time overall. */
+#define PFX_INT_LIST(name, int_t)                                              \
+  typedef struct name {                                                        \
+    int_t *ints;                                                               \
+    size_t ints_cnt;                                                           \
+    size_t ints_alloc_cnt;                                                     \
+                                                                               \
+    int_t *pending;                                                            \
+    size_t pending_cnt;                                                        \
+    size_t pending_alloc_cnt;                                                  \
+  } name##_t
+
+PFX_INT_LIST(v4pfx_int_list, v4pfx_int_t);
+PFX_INT_LIST(v6pfx_int_list, v6pfx_int_t);
+
+/* IP Counter interval arrays */
 struct bgpstream_ip_counter {
-  v4pfx_int_t *v4list;
-  v6pfx_int_t *v6list;
+  v4pfx_int_list_t v4;
+  v6pfx_int_list_t v6;
 };
 
-/* static void */
-/* print_pfx_int_list(bgpstream_ip_counter_t *ipc) */
-/*  {  */
-/*    v4pfx_int_t *current4 = ipc->v4list; */
-/*    bgpstream_ipv4_addr_t ip4; */
-
-/*    ip4.version = BGPSTREAM_ADDR_VERSION_IPV4;  */
-/*    while(current4 != NULL)  */
-/*      {  */
-/*        ip4.ipv4.s_addr = htonl(current4->start);  */
-/*        bgpstream_addr_ntop(buffer, INET_ADDRSTRLEN, &ip4);  */
-/*        printf("IP space:\t%s\t", buffer);  */
-/*        ip4.ipv4.s_addr = htonl(current4->end);  */
-/*        bgpstream_addr_ntop(buffer, INET_ADDRSTRLEN, &ip4);  */
-/*        printf("%s\n", buffer);  */
-/*        current4 = current4->next;  */
-/*      } */
-
-/*    v6pfx_int_t *current6 = ipc->v6list;  */
-/*    bgpstream_ipv6_addr_t ip6; */
-/*    uint64_t tmp; */
-/*    ip6.version = BGPSTREAM_ADDR_VERSION_IPV6; */
-
-/*    while(current6 != NULL)  */
-/*      { */
-/*        tmp = htonll(current6->start_ms); */
-/*        memcpy(&ip6.ipv6.s6_addr[0], &tmp, sizeof(uint64_t)); */
-/*        tmp = htonll(current6->start_ls); */
-/*        memcpy(&ip6.ipv6.s6_addr[8], &tmp, sizeof(uint64_t)); */
-/*        bgpstream_addr_ntop(buffer, INET6_ADDRSTRLEN, &ip6);  */
-/*        printf("IP space:\t%s\t", buffer); */
-/*        tmp = htonll(current6->end_ms); */
-/*        memcpy(&ip6.ipv6.s6_addr[0], &tmp, sizeof(uint64_t)); */
-/*        tmp = htonll(current6->end_ls); */
-/*        memcpy(&ip6.ipv6.s6_addr[8],&tmp, sizeof(uint64_t)); */
-/*        bgpstream_addr_ntop(buffer, INET6_ADDRSTRLEN, &ip6);  */
-/*        printf("%s\n", buffer); */
-/*        current6 = current6->next;  */
-/*      } */
-/*  }  */
-
-static void one_step_merge4(v4pfx_int_t *pil)
+/* Make room for at least cnt elements in a resizable array */
+static int ensure_alloc(void **arr, size_t *alloc_cnt, size_t cnt,
+                        size_t elem_size)
 {
-  v4pfx_int_t *current = pil;
-  v4pfx_int_t *previous = pil;
-  if (current->next == NULL) {
-    return;
+  size_t new_cnt = (*alloc_cnt == 0) ? 64 : *alloc_cnt;
+  void *tmp;
+
+  if (cnt <= *alloc_cnt) {
+    return 0;
   }
-  current = current->next;
-
-  while (current != NULL) {
-    if (current->start <= previous->end) {
-      if (current->end > previous->end) {
-        previous->end = current->end;
-      }
-      previous->next = current->next;
-      free(current);
-      current = previous->next;
-    } else {
-      break;
-    }
+  while (new_cnt < cnt) {
+    new_cnt *= 2;
   }
+  if ((tmp = realloc(*arr, new_cnt * elem_size)) == NULL) {
+    fprintf(stderr, "ERROR: can't realloc IP counter intervals\n");
+    return -1;
+  }
+  *arr = tmp;
+  *alloc_cnt = new_cnt;
+  return 0;
 }
 
-static void one_step_merge6(v6pfx_int_t *pil)
+static int cmp_int4(const void *a, const void *b)
 {
-  v6pfx_int_t *current = pil;
-  v6pfx_int_t *previous = pil;
-  if (current->next == NULL) {
-    return;
-  }
-  current = current->next;
-
-  while (current != NULL) {
-
-    /* current->start <= previous->end */
-    if (current->start_ms < previous->end_ms ||
-        (current->start_ms == previous->end_ms &&
-         current->start_ls <= previous->end_ls)) {
-      /* current->end > previous->end */
-      if (current->end_ms > previous->end_ms ||
-          (current->end_ms == previous->end_ms &&
-           current->end_ls > previous->end_ls)) {
-        previous->end_ms = current->end_ms;
-        previous->end_ls = current->end_ls;
-      }
-      previous->next = current->next;
-      free(current);
-      current = previous->next;
-    } else {
-      break;
-    }
-  }
+  const v4pfx_int_t *ia = a, *ib = b;
+  return (ia->start > ib->start) - (ia->start < ib->start);
 }
 
-static int merge_in_sorted_queue4(v4pfx_int_t **pil, uint32_t start,
-                                  uint32_t end)
+static int cmp_int6(const void *a, const void *b)
 {
-  // create new v4pfx_int_t
-  v4pfx_int_t *p = NULL;
-  v4pfx_int_t *previous = *pil;
-  v4pfx_int_t *current = *pil;
-
-  while (current != NULL) {
-    if (start > current->end) {
-      previous = current;
-      current = current->next;
-      continue;
-    }
-    if (end < current->start) {
-      /* found a position where to insert  */
-      if ((p = (v4pfx_int_t *)malloc_zero(sizeof(v4pfx_int_t))) == NULL) {
-        fprintf(stderr, "ERROR: can't malloc v4pfx_int_t structure\n");
-        return -1;
-      }
-      p->start = start;
-      p->end = end;
-      p->next = NULL;
-      if (previous != current) {
-        previous->next = p;
-      } else {
-        *pil = p;
-      }
-      p->next = current;
-      return 0;
-    }
-    /* At this point S <= cE and E >= cS
-     * so we can merge them */
-    if (current->start > start) {
-      current->start = start;
-    }
-    if (current->end < end) {
-      current->end = end;
-    }
-    /* Now check from here on if there are other things
-     * to merge */
-    one_step_merge4(current);
-    return 0;
-  }
+  const v6pfx_int_t *ia = a, *ib = b;
+  return (ia->start > ib->start) - (ia->start < ib->start);
+}
 
-  /*   if here we didn't find a place where to insert the
-   * interval, it is either the first position or the last */
-  if ((p = (v4pfx_int_t *)malloc_zero(sizeof(v4pfx_int_t))) == NULL) {
-    fprintf(stderr, "ERROR: can't malloc v4pfx_int_t structure\n");
-    return -1;
-  }
-  p->start = start;
-  p->end = end;
-  p->next = NULL;
-  /* adding at the beginning of the queue */
-  if (previous == current) {
-    *pil = p;
-    return 0;
+/* Generates the functions that maintain an interval list:
+ *
+ * - normalize: sort the pending intervals and merge them into the array
+ * - append: add an interval to the pending intervals
+ * - lower_bound: find the first interval that ends at or after an address
+ */
+#define PFX_INT_LIST_FUNCS(v, list_t, int_t, addr_t)                           \
+  static int normalize##v(list_t *l)                                           \
+  {                                                                            \
+    int_t *out, *next;                                                         \
+    size_t out_cnt = 0, i = 0, j = 0;                                          \
+                                                                               \
+    if (l->pending_cnt == 0) {                                                 \
+      return 0;                                                                \
+    }                                                                          \
+    qsort(l->pending, l->pending_cnt, sizeof(int_t), cmp_int##v);              \
+    if ((out = malloc(sizeof(int_t) * (l->ints_cnt + l->pending_cnt))) ==      \
+        NULL) {                                                                \
+      fprintf(stderr, "ERROR: can't malloc IP counter intervals\n");           \
+      return -1;                                                               \
+    }                                                                          \
+                                                                               \
+    /* merge the two sorted arrays, combining overlapping intervals */         \
+    while (i < l->ints_cnt || j < l->pending_cnt) {                            \
+      if (j == l->pending_cnt ||                                               \
+          (i < l->ints_cnt && l->ints[i].start <= l->pending[j].start)) {      \
+        next = &l->ints[i++];                                                  \
+      } else {                                                                 \
+        next = &l->pending[j++];                                               \
+      }                                                                        \
+      if (out_cnt > 0 && next->start <= out[out_cnt - 1].end) {                \
+        if (next->end > out[out_cnt - 1].end) {                                \
+          out[out_cnt - 1].end = next->end;                                    \
+        }                                                                      \
+      } else {                                                                 \
+        out[out_cnt++] = *next;                                                \
+      }                                                                        \
+    }                                                                          \
+                                                                               \
+    free(l->ints);                                                             \
+    l->ints = out;                                                             \
+    l->ints_cnt = out_cnt;                                                     \
+    l->ints_alloc_cnt = l->ints_cnt + l->pending_cnt;                          \
+    l->pending_cnt = 0;                                                        \
+    return 0;                                                                  \
+  }                                                                            \
+                                                                               \
+  static int append##v(list_t *l, addr_t start, addr_t end)                    \
+  {                                                                            \
+    if ((l->pending_cnt >= PENDING_MIN_CNT &&                                  \
+         l->pending_cnt >= l->ints_cnt && normalize##v(l) != 0) ||             \
+        ensure_alloc((void **)&l->pending, &l->pending_alloc_cnt,              \
+                     l->pending_cnt + 1, sizeof(int_t)) != 0) {                \
+      return -1;                                                               \
+    }                                                                          \
+    l->pending[l->pending_cnt].start = start;                                  \
+    l->pending[l->pending_cnt].end = end;                                      \
+    l->pending_cnt++;                                                          \
+    return 0;                                                                  \
+  }                                                                            \
+                                                                               \
+  static size_t lower_bound##v(list_t *l, addr_t start)                        \
+  {                                                                            \
+    size_t lo = 0, hi = l->ints_cnt, mid;                                      \
+                                                                               \
+    while (lo < hi) {                                                          \
+      mid = lo + (hi - lo) / 2;                                                \
+      if (l->ints[mid].end < start) {                                          \
+        lo = mid + 1;                                                          \
+      } else {                                                                 \
+        hi = mid;                                                              \
+      }                                                                        \
+    }                                                                          \
+    return lo;                                                                 \
+  }                                                                            \
+                                                                               \
+  static void clear##v(list_t *l)                                              \
+  {                                                                            \
+    free(l->ints);                                                             \
+    free(l->pending);                                                          \
+    memset(l, 0, sizeof(*l));                                                  \
   }
-  // adding at the end of the queue
-  previous->next = p;
-  return 0;
+
+PFX_INT_LIST_FUNCS(4, v4pfx_int_list_t, v4pfx_int_t, uint32_t)
+PFX_INT_LIST_FUNCS(6, v6pfx_int_list_t, v6pfx_int_t, uint128_t)
+
+static void pfx_range4(bgpstream_ipv4_pfx_t *pfx, uint32_t *start,
+                       uint32_t *end)
+{
+  uint32_t mask = ~(((uint64_t)1 << (32 - pfx->mask_len)) - 1);
+
+  *start = ntohl(pfx->address.ipv4.s_addr) & mask;
+  *end = *start | ~mask;
 }
 
-static int merge_in_sorted_queue6(v6pfx_int_t **pil, uint64_t start_ms,
-                                  uint64_t start_ls, uint64_t end_ms,
-                                  uint64_t end_ls)
+static void pfx_range6(bgpstream_ipv6_pfx_t *pfx, uint128_t *start,
+                       uint128_t *end)
 {
-  // create new v4pfx_int_t
-  v6pfx_int_t *p = NULL;
-  v6pfx_int_t *previous = *pil;
-  v6pfx_int_t *current = *pil;
-
-  while (current != NULL) {
-    /* start > current->end */
-    if (start_ms > current->end_ms ||
-        (start_ms == current->end_ms && start_ls > current->end_ls)) {
-      previous = current;
-      current = current->next;
-      continue;
-    }
-    /* end < current->start */
-    if (end_ms < current->start_ms ||
-        (end_ms == current->start_ms && end_ls < current->start_ls)) {
-      /* found a position where to insert  */
-      if ((p = (v6pfx_int_t *)malloc_zero(sizeof(v6pfx_int_t))) == NULL) {
-        fprintf(stderr, "ERROR: can't malloc v6pfx_int_t structure\n");
-        return -1;
-      }
-      p->start_ms = start_ms;
-      p->start_ls = start_ls;
-      p->end_ms = end_ms;
-      p->end_ls = end_ls;
-      p->next = NULL;
-      if (previous != current) {
-        previous->next = p;
-      } else {
-        *pil = p;
-      }
-      p->next = current;
-      return 0;
-    }
-    /* At this point S <= cE and E >= cS
-     * so we can merge them */
-    /* current->start > start */
-    if (current->start_ms > start_ms ||
-        (current->start_ms == start_ms && current->start_ls > start_ls)) {
-      current->start_ms = start_ms;
-      current->start_ls = start_ls;
-    }
-    /* current->end < end */
-    if (current->end_ms < end_ms ||
-        (current->end_ms == end_ms && current->end_ls < end_ls)) {
-      current->end_ms = end_ms;
-      current->end_ls = end_ls;
-    }
-    /* Now check from here on if there are other things
-     * to merge */
-    one_step_merge6(current);
-    return 0;
-  }
+  uint128_t mask = (pfx->mask_len == 0) ? 0 : ~(uint128_t)0
+                                                 << (128 - pfx->mask_len);
+  uint64_t ms, ls;
+
+  memcpy(&ms, &pfx->address.ipv6.s6_addr[0], sizeof(ms));
+  memcpy(&ls, &pfx->address.ipv6.s6_addr[8], sizeof(ls));
+  *start = (((uint128_t)ntohll(ms) << 64) | ntohll(ls)) & mask;
+  *end = *start | ~mask;
+}
 
-  /*   if here we didn't find a place where to insert the
-   * interval, it is either the first position or the last */
-  if ((p = (v6pfx_int_t *)malloc_zero(sizeof(v6pfx_int_t))) == NULL) {
-    fprintf(stderr, "ERROR: can't malloc v6pfx_int_t structure\n");
-    return -1;
-  }
-  p->start_ms = start_ms;
-  p->start_ls = start_ls;
-  p->end_ms = end_ms;
-  p->end_ls = end_ls;
-  p->next = NULL;
-  /* adding at the beginning of the queue */
-  if (previous == current) {
-    *pil = p;
-    return 0;
+/* Number of /64s in [start, end], not counting the first one if it was
+ * already counted as the last /64 of the previous interval */
+static uint64_t count_64s(uint128_t start, uint128_t end, int *have_last,
+                          uint64_t *last)
+{
+  uint64_t start_ms = start >> 64;
+  uint64_t end_ms = end >> 64;
+  uint64_t cnt = end_ms - start_ms + 1;
+
+  if (*have_last && *last == start_ms) {
+    cnt--;
   }
-  // adding at the end of the queue
-  previous->next = p;
-  return 0;
+  *have_last = 1;
+  *last = end_ms;
+  return cnt;
 }
 
 bgpstream_ip_counter_t *bgpstream_ip_counter_create()
@@ -301,222 +243,104 @@ bgpstream_ip_counter_t *bgpstream_ip_counter_create()
     fprintf(stderr, "ERROR: can't malloc bgpstream_ip_counter_t structure\n");
     return NULL;
   }
-  ipc->v4list = NULL;
-  ipc->v6list = NULL;
   return ipc;
 }
 
 int bgpstream_ip_counter_add(bgpstream_ip_counter_t *ipc, bgpstream_pfx_t *pfx)
 {
-  uint32_t start;
-  uint32_t end;
-  uint32_t mask;
-  unsigned char *tmp;
-  uint64_t start_ms = 0;
-  uint64_t start_ls = 0;
-  uint64_t end_ms = 0;
-  uint64_t end_ls = 0;
-  uint64_t mask_ms;
-  uint64_t mask_ls;
+  uint32_t start4, end4;
+  uint128_t start6, end6;
 
   if (pfx->address.version == BGPSTREAM_ADDR_VERSION_IPV4) {
-    mask = ~(((uint64_t)1 << (32 - pfx->mask_len)) - 1);
-    start = ntohl(((bgpstream_ipv4_pfx_t *)pfx)->address.ipv4.s_addr);
-    start = start & mask;
-    end = start | (~mask);
-    return merge_in_sorted_queue4(&ipc->v4list, start, end);
-  } else {
-    if (pfx->address.version == BGPSTREAM_ADDR_VERSION_IPV6) {
-      tmp = &((bgpstream_ipv6_pfx_t *)pfx)->address.ipv6.s6_addr[0];
-      start_ms = ntohll(*((uint64_t *)tmp));
-      tmp = &((bgpstream_ipv6_pfx_t *)pfx)->address.ipv6.s6_addr[8];
-      start_ls = ntohll(*((uint64_t *)tmp));
-      /* printf("+++++++++  %"PRIu64" %"PRIu64"\n", start_ms, start_ls); */
-      if (pfx->mask_len > 64) {
-        /* len_ms = 0 */
-        mask_ms = ~((uint64_t)0);
-        /* len_ls = 64 - (pfx->mask_len - 64); */
-        mask_ls = ~(((uint64_t)1 << (64 - (pfx->mask_len - 64))) - 1);
-      } else {
-        /* len_ms = 64 - pfx->mask_len; */
-        mask_ms = ~(((uint64_t)1 << (64 - pfx->mask_len)) - 1);
-        /* len_ls = 64; */
-        /* mask_ls = ~( ((uint64_t)1 << 64) - 1); */
-        mask_ls = 0;
-      }
-
-      /* printf("MASKS:  %"PRIu64" %"PRIu64"\n", mask_ms, mask_ls); */
-
-      /* most significant */
-      start_ms = start_ms & mask_ms;
-      end_ms = start_ms | (~mask_ms);
-      /* printf("MS:  %"PRIu64" %"PRIu64"\n", start_ms, end_ms); */
-
-      /* least significant */
-      start_ls = start_ls & mask_ls;
-      end_ls = start_ls | (~mask_ls);
-      /* printf("LS:  %"PRIu64" %"PRIu64"\n", start_ls, end_ls); */
-
-      return merge_in_sorted_queue6(&ipc->v6list, start_ms, start_ls, end_ms,
-                                    end_ls);
+    pfx_range4((bgpstream_ipv4_pfx_t *)pfx, &start4, &end4);
+    return append4(&ipc->v4, start4, end4);
+  } else if (pfx->address.version == BGPSTREAM_ADDR_VERSION_IPV6) {
+    pfx_range6((bgpstream_ipv6_pfx_t *)pfx, &start6, &end6);
+    return append6(&ipc->v6, start6, end6);
+  }
+  return 0;
+}
+
+int bgpstream_ip_counter_add_batch(bgpstream_ip_counter_t *ipc,
+                                   bgpstream_pfx_storage_t *pfxs, int pfxs_cnt)
+{
+  int i;
+
+  for (i = 0; i < pfxs_cnt; i++) {
+    if (bgpstream_ip_counter_add(ipc, (bgpstream_pfx_t *)&pfxs[i]) != 0) {
+      return -1;
     }
   }
-  /* print_pfx_int_list(ipc); */
+  /* sort and merge the whole batch now, rather than at the first query */
+  if (normalize4(&ipc->v4) != 0 || normalize6(&ipc->v6) != 0) {
+    return -1;
+  }
   return 0;
 }
 
-uint32_t bgpstream_ip_counter_is_overlapping4(bgpstream_ip_counter_t *ipc,
-                                              bgpstream_ipv4_pfx_t *pfx,
-                                              uint8_t *more_specific)
+static uint64_t overlap4(bgpstream_ip_counter_t *ipc, bgpstream_ipv4_pfx_t *pfx,
+                         uint8_t *more_specific)
 {
-  v4pfx_int_t *current = ipc->v4list;
-  uint32_t start = 0;
-  uint32_t end = 0;
-  uint32_t len = 0;
-  uint32_t pfx_size;
-  uint32_t overlap_count = 0;
+  v4pfx_int_t *cur;
+  uint32_t start, end;
+  uint32_t int_start, int_end;
+  uint64_t overlap_count = 0;
+  size_t i;
+
   *more_specific = 0;
-  len = 32 - pfx->mask_len;
-  start = ntohl(pfx->address.ipv4.s_addr);
-  start = (start >> len) << len;
-  end = 0;
-  end = ~end;
-  end = (end >> len) << len;
-  end = start | (~end);
-  pfx_size = end - start + 1;
-  /* intersection endpoints */
-  uint32_t int_start;
-  uint32_t int_end;
-  while (current != NULL) {
-    if (current->start > end) {
-      break;
-    }
-    if (current->end < start) {
-      current = current->next;
-      continue;
-    }
-    /* there is some overlap
-     * max(start) and min(end) */
-    int_start = current->start;
-    int_end = current->end;
-    if (current->start < start) {
-      int_start = start;
-    }
-    if (current->end > end) {
-      int_end = end;
-    }
-    if ((int_end - int_start + 1) == pfx_size) {
+  if (normalize4(&ipc->v4) != 0) {
+    return 0;
+  }
+  pfx_range4(pfx, &start, &end);
+
+  for (i = lower_bound4(&ipc->v4, start);
+       i < ipc->v4.ints_cnt && ipc->v4.ints[i].start <= end; i++) {
+    cur = &ipc->v4.ints[i];
+    /* max(start) and min(end) */
+    int_start = (cur->start < start) ? start : cur->start;
+    int_end = (cur->end > end) ? end : cur->end;
+    if (int_start == start && int_end == end) {
       *more_specific = 1;
     }
-    overlap_count += int_end - int_start + 1;
-    current = current->next;
+    overlap_count += (uint64_t)(int_end - int_start) + 1;
   }
   return overlap_count;
 }
 
+uint32_t bgpstream_ip_counter_is_overlapping4(bgpstream_ip_counter_t *ipc,
+                                              bgpstream_ipv4_pfx_t *pfx,
+                                              uint8_t *more_specific)
+{
+  return overlap4(ipc, pfx, more_specific);
+}
+
 uint64_t bgpstream_ip_counter_is_overlapping6(bgpstream_ip_counter_t *ipc,
                                               bgpstream_ipv6_pfx_t *pfx,
                                               uint8_t *more_specific)
 {
-  v6pfx_int_t *current = ipc->v6list;
-  v6pfx_int_t *previous = ipc->v6list;
-
-  uint64_t start_ms = 0;
-  uint64_t start_ls = 0;
-  uint64_t end_ms = 0;
-  uint64_t end_ls = 0;
-  uint64_t mask_ms;
-  uint64_t mask_ls;
-  unsigned char *tmp;
+  v6pfx_int_t *cur;
+  uint128_t start, end;
+  uint128_t int_start, int_end;
   uint64_t overlap_count = 0;
-  uint64_t pfx_size;
-  *more_specific = 0;
+  uint64_t last = 0;
+  int have_last = 0;
+  size_t i;
 
-  tmp = &(pfx->address.ipv6.s6_addr[0]);
-  start_ms = ntohll(*((uint64_t *)tmp));
-  tmp = &(pfx->address.ipv6.s6_addr[8]);
-  start_ls = ntohll(*((uint64_t *)tmp));
-
-  /* printf("+++++++++  %"PRIu64" %"PRIu64"\n", start_ms, start_ls); */
-  if (pfx->mask_len > 64) {
-    /* len_ms = 0 */
-    mask_ms = ~((uint64_t)0);
-    /* len_ls = 64 - (pfx->mask_len - 64); */
-    mask_ls = ~(((uint64_t)1 << (64 - (pfx->mask_len - 64))) - 1);
-  } else {
-    /* len_ms = 64 - pfx->mask_len; */
-    mask_ms = ~(((uint64_t)1 << (64 - pfx->mask_len)) - 1);
-    /* len_ls = 64; */
-    /* mask_ls = ~( ((uint64_t)1 << 64) - 1); */
-    mask_ls = 0;
+  *more_specific = 0;
+  if (normalize6(&ipc->v6) != 0) {
+    return 0;
   }
-
-  /* printf("MASKS:  %"PRIu64" %"PRIu64"\n", mask_ms, mask_ls); */
-
-  /* most significant */
-  start_ms = start_ms & mask_ms;
-  end_ms = start_ms | (~mask_ms);
-  /* printf("MS:  %"PRIu64" %"PRIu64"\n", start_ms, end_ms); */
-
-  /* least significant */
-  start_ls = start_ls & mask_ls;
-  end_ls = start_ls | (~mask_ls);
-  /* printf("LS:  %"PRIu64" %"PRIu64"\n", start_ls, end_ls); */
-
-  pfx_size = end_ms - start_ms + 1;
-
-  /* intersection endpoints
-   * (only most significant)*/
-  uint64_t int_start_ms;
-  uint64_t int_end_ms;
-
-  while (current != NULL) {
-    /* current->start > end */
-    if (current->start_ms > end_ms ||
-        (current->start_ms == end_ms && current->start_ls > end_ls)) {
-      break;
-    }
-    /* current->end < start */
-    if (current->end_ms < start_ms ||
-        (current->end_ms == start_ms && current->end_ms < start_ls)) {
-      previous = current;
-      current = current->next;
-      continue;
-    }
-    /* there is some overlap
-     * max(start) and min(end) */
-    int_start_ms = current->start_ms;
-    int_end_ms = current->end_ms;
-    /* int_start_ls = current->start_ls; */
-    /* int_end_ls = current->end_ls; */
-    /* current->start < start */
-    if (current->start_ms < start_ms ||
-        (current->start_ms == start_ms && current->start_ms < start_ls)) {
-      int_start_ms = start_ms;
-      /* int_start_ls = start_ls; */
-    }
-    /* current->end > end */
-    if (current->end_ms > end_ms ||
-        (current->end_ms == end_ms && current->end_ls > end_ls)) {
-      int_end_ms = end_ms;
-      /* int_end_ls = end_ls; */
-    }
-    if (previous != current) {
-      if (current->start_ms != previous->start_ms ||
-          current->end_ms != previous->end_ms) {
-        if ((int_end_ms - int_start_ms + 1) == pfx_size) {
-          *more_specific = 1;
-        }
-        overlap_count += int_end_ms - int_start_ms + 1;
-      }
-    } else {
-      if ((int_end_ms - int_start_ms + 1) == pfx_size) {
-        *more_specific = 1;
-      }
-      overlap_count += int_end_ms - int_start_ms + 1;
+  pfx_range6(pfx, &start, &end);
+
+  for (i = lower_bound6(&ipc->v6, start);
+       i < ipc->v6.ints_cnt && ipc->v6.ints[i].start <= end; i++) {
+    cur = &ipc->v6.ints[i];
+    int_start = (cur->start < start) ? start : cur->start;
+    int_end = (cur->end > end) ? end : cur->end;
+    if (int_start == start && int_end == end) {
+      *more_specific = 1;
     }
-    previous = current;
-    current = current->next;
+    overlap_count += count_64s(int_start, int_end, &have_last, &last);
   }
   return overlap_count;
 }
@@ -527,13 +351,10 @@ uint64_t bgpstream_ip_counter_is_overlapping(bgpstream_ip_counter_t *ipc,
 {
   *more_specific = 0;
   if (pfx->address.version == BGPSTREAM_ADDR_VERSION_IPV4) {
-    return bgpstream_ip_counter_is_overlapping4(
-      ipc, (bgpstream_ipv4_pfx_t *)pfx, more_specific);
-  } else {
-    if (pfx->address.version == BGPSTREAM_ADDR_VERSION_IPV6) {
-      return bgpstream_ip_counter_is_overlapping6(
-        ipc, (bgpstream_ipv6_pfx_t *)pfx, more_specific);
-    }
+    return overlap4(ipc, (bgpstream_ipv4_pfx_t *)pfx, more_specific);
+  } else if (pfx->address.version == BGPSTREAM_ADDR_VERSION_IPV6) {
+    return bgpstream_ip_counter_is_overlapping6(
+      ipc, (bgpstream_ipv6_pfx_t *)pfx, more_specific);
   }
   return 0;
 }
@@ -542,33 +363,25 @@ uint64_t bgpstream_ip_counter_get_ipcount(bgpstream_ip_counter_t *ipc,
                                           bgpstream_addr_version_t v)
 {
   uint64_t ip_count = 0;
-
-  v4pfx_int_t *current4 = ipc->v4list;
-  v6pfx_int_t *current6 = ipc->v6list;
-  v6pfx_int_t *previous6 = ipc->v6list;
+  uint64_t last = 0;
+  int have_last = 0;
+  size_t i;
 
   if (v == BGPSTREAM_ADDR_VERSION_IPV4) {
-    while (current4 != NULL) {
-      ip_count += (current4->end - current4->start) + 1;
-      current4 = current4->next;
+    if (normalize4(&ipc->v4) != 0) {
+      return 0;
     }
-  } else {
-    if (v == BGPSTREAM_ADDR_VERSION_IPV6) {
-      while (current6 != NULL) {
-
-        if (previous6 != current6) {
-          /* add a new /64 to the count if the previous one
-           * was different (it could have been a /64+ */
-          if (current6->start_ms != previous6->start_ms ||
-              current6->end_ms != previous6->end_ms) {
-            ip_count += (current6->end_ms - current6->start_ms) + 1;
-          }
-        } else { /* if it is the first interval, than we always add it */
-          ip_count += (current6->end_ms - current6->start_ms) + 1;
-        }
-        previous6 = current6;
-        current6 = current6->next;
-      }
+    for (i = 0; i < ipc->v4.ints_cnt; i++) {
+      ip_count += (uint64_t)(ipc->v4.ints[i].end - ipc->v4.ints[i].start) + 1;
+    }
+  } else if (v == BGPSTREAM_ADDR_VERSION_IPV6) {
+    if (normalize6(&ipc->v6) != 0) {
+      return 0;
+    }
+    /* count unique /64s (two intervals longer than /64 may share one) */
+    for (i = 0; i < ipc->v6.ints_cnt; i++) {
+      ip_count += count_64s(ipc->v6.ints[i].start, ipc->v6.ints[i].end,
+                            &have_last, &last);
     }
   }
   return ip_count;
@@ -576,24 +389,8 @@ uint64_t bgpstream_ip_counter_get_ipcount(bgpstream_ip_counter_t *ipc,
 
 void bgpstream_ip_counter_clear(bgpstream_ip_counter_t *ipc)
 {
-  v4pfx_int_t *current4 = ipc->v4list;
-  v4pfx_int_t *tmp4 = ipc->v4list;
-  v6pfx_int_t *current6 = ipc->v6list;
-  v6pfx_int_t *tmp6 = ipc->v6list;
-
-  while (tmp4 != NULL) {
-    current4 = tmp4;
-    tmp4 = tmp4->next;
-    free(current4);
-  }
-  ipc->v4list = NULL;
-
-  while (tmp6 != NULL) {
-    current6 = tmp6;
-    tmp6 = tmp6->next;
-    free(current6);
-  }
-  ipc->v6list = NULL;
+  clear4(&ipc->v4);
+  clear6(&ipc->v6);
 }
 
 void bgpstream_ip_counter_destroy(bgpstream_ip_counter_t *ipc)
@@ -69,6 +69,19 @@ bgpstream_ip_counter_t *bgpstream_ip_counter_create();
  */
 int bgpstream_ip_counter_add(bgpstream_ip_counter_t *ipc, bgpstream_pfx_t *pfx);
 
+/** Add an array of prefixes to the IP Counter
+ *
+ * @param counter      pointer to the IP Counter
+ * @param pfxs         array of prefixes to insert in IP Counter
+ * @param pfxs_cnt     number of prefixes in the array
+ * @return             0 if the prefixes were added correctly, -1 otherwise
+ *
+ * This is equivalent to adding each prefix in turn, but sorts and merges the
+ * whole batch at once (in O(n log n) time) rather than at the next query.
+ */
+int bgpstream_ip_counter_add_batch(bgpstream_ip_counter_t *ipc,
+                                   bgpstream_pfx_storage_t *pfxs, int pfxs_cnt);
+
 /** Get the number of unique IPs in the IP Counter
  *
  * @param counter        pointer to the IP Counter
@@ -41,13 +41,18 @@
 
 #include "khash.h" /* << kroundup32 */
 #include <assert.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <netdb.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 #include "bgpstream_utils_patricia.h"
 #include "bgpstream_utils_pfx.h"
@@ -58,47 +63,95 @@
 
 #define BGPSTREAM_PATRICIA_MAXBITS 128
 
-#define BIT_TEST(f, b) ((f) & (b))
+/* Nodes are allocated from an arena (one per address version) in chunks of
+ * 2^NODE_CHUNK_BITS nodes, and refer to each other by their 32-bit index in
+ * the arena. Chunks are never moved, so node pointers handed out by the API
+ * stay valid until the node is removed. */
+#define NODE_CHUNK_BITS 12
+#define NODE_CHUNK_LEN (1 << NODE_CHUNK_BITS)
+#define NODE_CHUNK_MASK (NODE_CHUNK_LEN - 1)
 
-static int comp_with_mask(void *addr, void *dest, u_int mask)
-{
+/* Index used for a missing child, parent or head */
+#define NODE_NONE UINT32_MAX
 
-  if (/* mask/8 == 0 || */ memcmp(addr, dest, mask / 8) == 0) {
-    int n = mask / 8;
-    int m = ((-1) << (8 - (mask % 8)));
+/* Snapshot file identification */
+#define SNAPSHOT_MAGIC "BSPTSNAP"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_BYTE_ORDER 0x01020304
 
-    if (mask % 8 == 0 || (((u_char *)addr)[n] & m) == (((u_char *)dest)[n] & m))
-      return (1);
-  }
-  return (0);
-}
+/* Alignment of each section of a snapshot file (a cache line) */
+#define SNAPSHOT_ALIGN 64
+#define SNAPSHOT_ALIGN_UP(x) (((x) + SNAPSHOT_ALIGN - 1) & ~(SNAPSHOT_ALIGN - 1))
 
 struct bgpstream_patricia_node {
 
-  /* flag if this node used */
-  u_int bit;
+  /* pointer to user data */
+  void *user;
 
-  /* who we are in patricia tree */
-  bgpstream_pfx_storage_t prefix;
+  /* our index in the arena */
+  uint32_t idx;
 
   /* left and right children */
-  bgpstream_patricia_node_t *l;
-  bgpstream_patricia_node_t *r;
+  uint32_t l;
+  uint32_t r;
 
   /* parent node */
-  bgpstream_patricia_node_t *parent;
+  uint32_t parent;
 
-  /* pointer to user data */
-  void *user;
+  /* flag if this node used */
+  uint8_t bit;
+
+  /* address version of the tree the node is in (even if it is a glue node) */
+  uint8_t version;
+
+  /* who we are in patricia tree. IPv4 nodes are only allocated enough space
+   * for the v4 member. Glue nodes have an UNKNOWN address version. */
+  union {
+    bgpstream_ipv4_pfx_t v4;
+    bgpstream_ipv6_pfx_t v6;
+  } prefix;
 };
 
+/* Size of a node with the given prefix type (padded so that nodes in a chunk
+ * stay aligned) */
+#define NODE_SIZE(pfx_type)                                                    \
+  ((offsetof(bgpstream_patricia_node_t, prefix) + sizeof(pfx_type) +          \
+    sizeof(void *) - 1) &                                                      \
+   ~(sizeof(void *) - 1))
+
+#define NODE_PFX(node) ((bgpstream_pfx_t *)&(node)->prefix)
+
+#define NODE_IS_GLUE(node)                                                     \
+  (NODE_PFX(node)->address.version == BGPSTREAM_ADDR_VERSION_UNKNOWN)
+
+#define NODE_IDX(node) ((node) == NULL ? NODE_NONE : (node)->idx)
+
+typedef struct node_arena {
+
+  /* size (in bytes) of each node */
+  size_t node_size;
+
+  /* chunks of NODE_CHUNK_LEN nodes */
+  uint8_t **chunks;
+  uint32_t chunks_cnt;
+
+  /* number of nodes carved from the chunks so far (including free ones) */
+  uint32_t used;
+
+  /* list of removed nodes, linked through their l index */
+  uint32_t free_head;
+
+} node_arena_t;
+
 struct bgpstream_patricia_tree {
 
   /* IPv4 tree */
-  bgpstream_patricia_node_t *head4;
+  uint32_t head4;
+  node_arena_t arena4;
 
   /* IPv6 tree */
-  bgpstream_patricia_node_t *head6;
+  uint32_t head6;
+  node_arena_t arena6;
 
   /* Number of nodes per tree */
   uint64_t ipv4_active_nodes;
@@ -107,8 +160,37 @@ struct bgpstream_patricia_tree {
   /** Pointer to a function that destroys the user structure
    *  in the bgpstream_patricia_node_t structure */
   bgpstream_patricia_tree_destroy_user_t *node_user_destructor;
+
+  /* Read-only mapping of the snapshot file the tree was opened from (NULL
+   * unless the tree is a snapshot), which the arena chunks point into */
+  void *map;
+  size_t map_len;
+
+  /* Payload slots of the IPv4 and IPv6 nodes of a snapshot (indexed like
+   * the nodes), and the size of each slot */
+  uint8_t *payload4;
+  uint8_t *payload6;
+  size_t payload_len;
 };
 
+/** Header of a snapshot file. It is followed by the IPv4 nodes, the IPv6
+ * nodes, the IPv4 payload slots and the IPv6 payload slots, each starting
+ * on a SNAPSHOT_ALIGN boundary. Nodes are stored in pre-order, exactly as
+ * they are laid out in memory (with NULL user pointers). */
+typedef struct snapshot_hdr {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+
+  /* per address version (IPv4, IPv6) */
+  uint32_t node_size[2];
+  uint32_t node_cnt[2];
+  uint32_t head[2];
+  uint64_t pfx_cnt[2];
+
+  uint64_t payload_len;
+} snapshot_hdr_t;
+
 /** Data structure containing a list of pointers to Patricia Tree nodes
  *  that are returned as the result of a computation */
 struct bgpstream_patricia_tree_result_set {
@@ -122,20 +204,188 @@ struct bgpstream_patricia_tree_result_set {
   int _alloc_size;
 };
 
+/* Number of longest-prefix-match lookups that a batch lookup interleaves */
+#define LPM_GROUP_LEN 16
+
+/** An address as a 128-bit integer in host byte order (IPv4 addresses use
+ * the top 32 bits), so that bits are tested and compared with integer ops */
+typedef struct pfx_key {
+  uint64_t hi;
+  uint64_t lo;
+} pfx_key_t;
+
+/** State of a single longest-prefix-match lookup */
+typedef struct lpm_state {
+
+  /* what we are looking for */
+  pfx_key_t key;
+  uint8_t bitlen;
+
+  /* next node to visit (NULL once the lookup is done) */
+  bgpstream_patricia_node_t *node;
+
+  /* most specific match so far */
+  bgpstream_patricia_node_t *best;
+
+} lpm_state_t;
+
 /* ======================= UTILITY FUNCTIONS ======================= */
 
-static unsigned char *bgpstream_pfx_get_first_byte(bgpstream_pfx_t *pfx)
+static inline void addr_key(bgpstream_addr_version_t v,
+                            bgpstream_ip_addr_t *addr, pfx_key_t *key)
 {
-  switch (pfx->address.version) {
+  uint32_t *w;
+
+  switch (v) {
   case BGPSTREAM_ADDR_VERSION_IPV4:
-    return (unsigned char *)&((bgpstream_ipv4_pfx_t *)pfx)->address.ipv4.s_addr;
+    key->hi = (uint64_t)ntohl(((bgpstream_ipv4_addr_t *)addr)->ipv4.s_addr)
+              << 32;
+    key->lo = 0;
+    break;
   case BGPSTREAM_ADDR_VERSION_IPV6:
-    return (unsigned char *)&((bgpstream_ipv6_pfx_t *)pfx)
-      ->address.ipv6.s6_addr[0];
+    w = (uint32_t *)&((bgpstream_ipv6_addr_t *)addr)->ipv6.s6_addr[0];
+    key->hi = ((uint64_t)ntohl(w[0]) << 32) | ntohl(w[1]);
+    key->lo = ((uint64_t)ntohl(w[2]) << 32) | ntohl(w[3]);
+    break;
   default:
     assert(0);
   }
-  return NULL;
+}
+
+static inline void pfx_key(bgpstream_addr_version_t v, bgpstream_pfx_t *pfx,
+                           pfx_key_t *key)
+{
+  addr_key(v, &pfx->address, key);
+}
+
+/* Is the given bit of the key set? (bit 0 is the most significant) */
+static inline int key_bit(const pfx_key_t *key, uint8_t bit)
+{
+  if (bit < 64) {
+    return (key->hi >> (63 - bit)) & 1;
+  }
+  if (bit < BGPSTREAM_PATRICIA_MAXBITS) {
+    return (key->lo >> (127 - bit)) & 1;
+  }
+  return 0;
+}
+
+/* Find the first bit that differs between two keys */
+static inline uint8_t key_differ_bit(const pfx_key_t *a, const pfx_key_t *b)
+{
+  uint64_t x;
+
+  if ((x = a->hi ^ b->hi) != 0) {
+    return __builtin_clzll(x);
+  }
+  if ((x = a->lo ^ b->lo) != 0) {
+    return 64 + __builtin_clzll(x);
+  }
+  return BGPSTREAM_PATRICIA_MAXBITS;
+}
+
+/* ======================= NODE ARENA FUNCTIONS ======================= */
+
+static void node_arena_init(node_arena_t *arena, size_t node_size)
+{
+  arena->node_size = node_size;
+  arena->chunks = NULL;
+  arena->chunks_cnt = 0;
+  arena->used = 0;
+  arena->free_head = NODE_NONE;
+}
+
+static inline bgpstream_patricia_node_t *node_arena_get(const node_arena_t *arena,
+                                                        uint32_t idx)
+{
+  if (idx == NODE_NONE) {
+    return NULL;
+  }
+  return (bgpstream_patricia_node_t *)(arena->chunks[idx >> NODE_CHUNK_BITS] +
+                                       (size_t)(idx & NODE_CHUNK_MASK) *
+                                         arena->node_size);
+}
+
+static bgpstream_patricia_node_t *node_arena_alloc(node_arena_t *arena)
+{
+  bgpstream_patricia_node_t *node;
+  uint32_t idx;
+  uint8_t **chunks;
+
+  if (arena->free_head != NODE_NONE) {
+    // reuse a removed node
+    idx = arena->free_head;
+    node = node_arena_get(arena, idx);
+    arena->free_head = node->l;
+  } else {
+    if ((arena->used >> NODE_CHUNK_BITS) == arena->chunks_cnt) {
+      // all chunks are full (NODE_NONE is not a valid index)
+      if (arena->used == (NODE_NONE & ~NODE_CHUNK_MASK)) {
+        return NULL;
+      }
+      if ((chunks = realloc(arena->chunks, sizeof(uint8_t *) *
+                                             (arena->chunks_cnt + 1))) ==
+          NULL) {
+        return NULL;
+      }
+      arena->chunks = chunks;
+      if ((arena->chunks[arena->chunks_cnt] =
+             malloc(NODE_CHUNK_LEN * arena->node_size)) == NULL) {
+        return NULL;
+      }
+      arena->chunks_cnt++;
+    }
+    idx = arena->used++;
+    node = node_arena_get(arena, idx);
+  }
+
+  memset(node, 0, arena->node_size);
+  node->idx = idx;
+  node->l = NODE_NONE;
+  node->r = NODE_NONE;
+  node->parent = NODE_NONE;
+  return node;
+}
+
+static void node_arena_free(node_arena_t *arena,
+                            bgpstream_patricia_node_t *node)
+{
+  node->user = NULL;
+  NODE_PFX(node)->address.version = BGPSTREAM_ADDR_VERSION_UNKNOWN;
+  node->l = arena->free_head;
+  arena->free_head = node->idx;
+}
+
+/* Forget all nodes, but keep the chunks around to be reused */
+static void node_arena_clear(node_arena_t *arena,
+                             bgpstream_patricia_tree_destroy_user_t *destructor)
+{
+  bgpstream_patricia_node_t *node;
+  uint32_t idx;
+
+  // only the user data needs to be visited (and removed nodes have none)
+  if (destructor != NULL) {
+    for (idx = 0; idx < arena->used; idx++) {
+      node = node_arena_get(arena, idx);
+      if (node->user != NULL) {
+        destructor(node->user);
+      }
+    }
+  }
+
+  arena->used = 0;
+  arena->free_head = NODE_NONE;
+}
+
+static void node_arena_destroy(node_arena_t *arena)
+{
+  uint32_t i;
+
+  for (i = 0; i < arena->chunks_cnt; i++) {
+    free(arena->chunks[i]);
+  }
+  free(arena->chunks);
+  node_arena_init(arena, arena->node_size);
 }
 
 /* ======================= RESULT SET FUNCTIONS  ======================= */
@@ -170,6 +420,21 @@ static void bgpstream_patricia_tree_result_set_clear(
 
 /* ======================= PATRICIA NODE FUNCTIONS ======================= */
 
+static inline node_arena_t *
+bgpstream_patricia_get_arena(const bgpstream_patricia_tree_t *pt,
+                             bgpstream_addr_version_t v)
+{
+  return (node_arena_t *)(v == BGPSTREAM_ADDR_VERSION_IPV4 ? &pt->arena4
+                                                           : &pt->arena6);
+}
+
+#define NODE_GET(pt, node, field)                                              \
+  node_arena_get(bgpstream_patricia_get_arena((pt), (node)->version),         \
+                 (node)->field)
+#define NODE_L(pt, node) NODE_GET(pt, node, l)
+#define NODE_R(pt, node) NODE_GET(pt, node, r)
+#define NODE_PARENT(pt, node) NODE_GET(pt, node, parent)
+
 static bgpstream_patricia_node_t *
 bgpstream_patricia_node_create(bgpstream_patricia_tree_t *pt,
                                bgpstream_pfx_t *pfx)
@@ -180,7 +445,8 @@ bgpstream_patricia_node_create(bgpstream_patricia_tree_t *pt,
   assert(pfx->mask_len <= BGPSTREAM_PATRICIA_MAXBITS);
   assert(pfx->address.version != BGPSTREAM_ADDR_VERSION_UNKNOWN);
 
-  if ((node = malloc_zero(sizeof(bgpstream_patricia_node_t))) == NULL) {
+  if ((node = node_arena_alloc(
+         bgpstream_patricia_get_arena(pt, pfx->address.version))) == NULL) {
     return NULL;
   }
 
@@ -190,42 +456,45 @@ bgpstream_patricia_node_create(bgpstream_patricia_tree_t *pt,
     pt->ipv6_active_nodes++;
   }
 
-  bgpstream_pfx_copy((bgpstream_pfx_t*)&node->prefix, pfx);
+  bgpstream_pfx_copy(NODE_PFX(node), pfx);
 
-  node->parent = NULL;
+  node->version = pfx->address.version;
   node->bit = pfx->mask_len;
-  node->l = NULL;
-  node->r = NULL;
-  node->user = NULL;
   return node;
 }
 
-static bgpstream_patricia_node_t *bgpstream_patricia_gluenode_create()
+static bgpstream_patricia_node_t *
+bgpstream_patricia_gluenode_create(bgpstream_patricia_tree_t *pt,
+                                   bgpstream_addr_version_t v)
 {
   bgpstream_patricia_node_t *node;
 
-  if ((node = malloc_zero(sizeof(bgpstream_patricia_node_t))) == NULL) {
+  if ((node = node_arena_alloc(bgpstream_patricia_get_arena(pt, v))) == NULL) {
     return NULL;
   }
-  node->prefix.address.version = BGPSTREAM_ADDR_VERSION_UNKNOWN;
-  node->parent = NULL;
+  NODE_PFX(node)->address.version = BGPSTREAM_ADDR_VERSION_UNKNOWN;
+  node->version = v;
   node->bit = 0;
-  node->l = NULL;
-  node->r = NULL;
   return node;
 }
 
+static void bgpstream_patricia_node_destroy(bgpstream_patricia_tree_t *pt,
+                                            bgpstream_patricia_node_t *node)
+{
+  node_arena_free(bgpstream_patricia_get_arena(pt, node->version), node);
+}
+
 /* ======================= PATRICIA TREE FUNCTIONS ======================= */
 
 static bgpstream_patricia_node_t *
-bgpstream_patricia_get_head(bgpstream_patricia_tree_t *pt,
+bgpstream_patricia_get_head(const bgpstream_patricia_tree_t *pt,
                             bgpstream_addr_version_t v)
 {
   switch (v) {
   case BGPSTREAM_ADDR_VERSION_IPV4:
-    return pt->head4;
+    return node_arena_get(&pt->arena4, pt->head4);
   case BGPSTREAM_ADDR_VERSION_IPV6:
-    return pt->head6;
+    return node_arena_get(&pt->arena6, pt->head6);
   default:
     assert(0);
   }
@@ -238,10 +507,10 @@ static void bgpstream_patricia_set_head(bgpstream_patricia_tree_t *pt,
 {
   switch (v) {
   case BGPSTREAM_ADDR_VERSION_IPV4:
-    pt->head4 = n;
+    pt->head4 = NODE_IDX(n);
     break;
   case BGPSTREAM_ADDR_VERSION_IPV6:
-    pt->head6 = n;
+    pt->head6 = NODE_IDX(n);
     break;
   default:
     assert(0);
@@ -249,7 +518,8 @@ static void bgpstream_patricia_set_head(bgpstream_patricia_tree_t *pt,
 }
 
 static uint64_t
-bgpstream_patricia_tree_count_subnets(bgpstream_patricia_node_t *node,
+bgpstream_patricia_tree_count_subnets(bgpstream_patricia_tree_t *pt,
+                                      bgpstream_patricia_node_t *node,
                                       uint64_t subnet_size)
 {
   if (node == NULL) {
@@ -258,15 +528,17 @@ bgpstream_patricia_tree_count_subnets(bgpstream_patricia_node_t *node,
   /* if the node is a glue node, then the /subnet_size subnets are the sum of
    * the
    * /24 subnets contained in its left and right subtrees */
-  if (node->prefix.address.version == BGPSTREAM_ADDR_VERSION_UNKNOWN) {
+  if (NODE_IS_GLUE(node)) {
     /* if the glue node is already a /subnet_size, then just return 1 (even
      * though
      * the subnetworks below could be a non complete /subnet_size */
     if (node->bit >= subnet_size) {
       return 1;
     } else {
-      return bgpstream_patricia_tree_count_subnets(node->l, subnet_size) +
-             bgpstream_patricia_tree_count_subnets(node->r, subnet_size);
+      return bgpstream_patricia_tree_count_subnets(pt, NODE_L(pt, node),
+                                                   subnet_size) +
+             bgpstream_patricia_tree_count_subnets(pt, NODE_R(pt, node),
+                                                   subnet_size);
     }
   } else {
     /* otherwise we just count the subnet for the given network and return
@@ -274,10 +546,10 @@ bgpstream_patricia_tree_count_subnets(bgpstream_patricia_node_t *node,
      * point is covered */
 
     /* compute how many /subnet_size are in this prefix */
-    if (node->prefix.mask_len >= subnet_size) {
+    if (NODE_PFX(node)->mask_len >= subnet_size) {
       return 1;
     } else {
-      uint8_t diff = subnet_size - node->prefix.mask_len;
+      uint8_t diff = subnet_size - NODE_PFX(node)->mask_len;
       if (diff == 64) {
         return UINT64_MAX;
       } else {
@@ -289,8 +561,8 @@ bgpstream_patricia_tree_count_subnets(bgpstream_patricia_node_t *node,
 
 /* depth pecifies how many "children" to explore for each node */
 static int bgpstream_patricia_tree_add_more_specifics(
-  bgpstream_patricia_tree_result_set_t *set, bgpstream_patricia_node_t *node,
-  const uint8_t depth)
+  bgpstream_patricia_tree_t *pt, bgpstream_patricia_tree_result_set_t *set,
+  bgpstream_patricia_node_t *node, const uint8_t depth)
 {
   if (node == NULL || depth == 0) {
     return 0;
@@ -298,7 +570,7 @@ static int bgpstream_patricia_tree_add_more_specifics(
   uint8_t d = depth;
   /* if it is a node containing a real prefix, then copy the address to a new
    * result node */
-  if (node->prefix.address.version != BGPSTREAM_ADDR_VERSION_UNKNOWN) {
+  if (!NODE_IS_GLUE(node)) {
     if (bgpstream_patricia_tree_result_set_add_node(set, node) != 0) {
       return -1;
     }
@@ -306,10 +578,12 @@ static int bgpstream_patricia_tree_add_more_specifics(
   }
 
   /* using pre-order R - Left - Right */
-  if (bgpstream_patricia_tree_add_more_specifics(set, node->l, d) != 0) {
+  if (bgpstream_patricia_tree_add_more_specifics(pt, set, NODE_L(pt, node),
+                                                 d) != 0) {
     return -1;
   }
-  if (bgpstream_patricia_tree_add_more_specifics(set, node->r, d) != 0) {
+  if (bgpstream_patricia_tree_add_more_specifics(pt, set, NODE_R(pt, node),
+                                                 d) != 0) {
     return -1;
   }
   return 0;
@@ -317,8 +591,8 @@ static int bgpstream_patricia_tree_add_more_specifics(
 
 /* depth pecifies how many "children" to explore for each node */
 static int bgpstream_patricia_tree_add_less_specifics(
-  bgpstream_patricia_tree_result_set_t *set, bgpstream_patricia_node_t *node,
-  const uint8_t depth)
+  bgpstream_patricia_tree_t *pt, bgpstream_patricia_tree_result_set_t *set,
+  bgpstream_patricia_node_t *node, const uint8_t depth)
 {
   if (node == NULL) {
     return 0;
@@ -327,28 +601,30 @@ static int bgpstream_patricia_tree_add_less_specifics(
   while (node != NULL && d > 0) {
     /* if it is a node containing a real prefix, then copy the address to a new
      * result node */
-    if (node->prefix.address.version != BGPSTREAM_ADDR_VERSION_UNKNOWN) {
+    if (!NODE_IS_GLUE(node)) {
       if (bgpstream_patricia_tree_result_set_add_node(set, node) != 0) {
         return -1;
       }
       d--;
     }
-    node = node->parent;
+    node = NODE_PARENT(pt, node);
   }
   return 0;
 }
 
 static int
-bgpstream_patricia_tree_find_more_specific(bgpstream_patricia_node_t *node)
+bgpstream_patricia_tree_find_more_specific(bgpstream_patricia_tree_t *pt,
+                                           bgpstream_patricia_node_t *node)
 {
   if (node == NULL) {
     return 0;
   }
   /* if it is a node containing a glue node, then we have to search for other
    * cases */
-  if (node->prefix.address.version == BGPSTREAM_ADDR_VERSION_UNKNOWN) {
-    if (bgpstream_patricia_tree_find_more_specific(node->l) == 0) {
-      if (bgpstream_patricia_tree_find_more_specific(node->r) == 0) {
+  if (NODE_IS_GLUE(node)) {
+    if (bgpstream_patricia_tree_find_more_specific(pt, NODE_L(pt, node)) == 0) {
+      if (bgpstream_patricia_tree_find_more_specific(pt, NODE_R(pt, node)) ==
+          0) {
         return 0;
       }
     }
@@ -357,19 +633,20 @@ bgpstream_patricia_tree_find_more_specific(bgpstream_patricia_node_t *node)
   return 1;
 }
 
-static void bgpstream_patricia_tree_merge_tree(bgpstream_patricia_tree_t *dst,
-                                               bgpstream_patricia_node_t *node)
+static void bgpstream_patricia_tree_merge_tree(
+  bgpstream_patricia_tree_t *dst, const bgpstream_patricia_tree_t *src,
+  bgpstream_patricia_node_t *node)
 {
   if (node == NULL) {
     return;
   }
   /* Add the current node, if it is not a glue node */
-  if (node->prefix.address.version != BGPSTREAM_ADDR_VERSION_UNKNOWN) {
-    bgpstream_patricia_tree_insert(dst, (bgpstream_pfx_t *)&node->prefix);
+  if (!NODE_IS_GLUE(node)) {
+    bgpstream_patricia_tree_insert(dst, NODE_PFX(node));
   }
   /* Recursively add left and right node */
-  bgpstream_patricia_tree_merge_tree(dst, node->l);
-  bgpstream_patricia_tree_merge_tree(dst, node->r);
+  bgpstream_patricia_tree_merge_tree(dst, src, NODE_L(src, node));
+  bgpstream_patricia_tree_merge_tree(dst, src, NODE_R(src, node));
 }
 
 static void bgpstream_patricia_tree_walk_tree(
@@ -381,14 +658,14 @@ static void bgpstream_patricia_tree_walk_tree(
   }
 
   /* In order traversal: Left - Node - Right */
-  bgpstream_patricia_node_t *l = node->l;
-  bgpstream_patricia_node_t *r = node->r;
+  bgpstream_patricia_node_t *l = NODE_L(pt, node);
+  bgpstream_patricia_node_t *r = NODE_R(pt, node);
 
   /* Left */
   bgpstream_patricia_tree_walk_tree(pt, l, fun, data);
 
   /* Node */
-  if (node->prefix.address.version != BGPSTREAM_ADDR_VERSION_UNKNOWN) {
+  if (!NODE_IS_GLUE(node)) {
     fun(pt, node, data);
   }
 
@@ -396,40 +673,306 @@ static void bgpstream_patricia_tree_walk_tree(
   bgpstream_patricia_tree_walk_tree(pt, r, fun, data);
 }
 
-static void bgpstream_patricia_tree_print_tree(bgpstream_patricia_node_t *node)
+static void bgpstream_patricia_tree_print_tree(bgpstream_patricia_tree_t *pt,
+                                               bgpstream_patricia_node_t *node)
 {
   if (node == NULL) {
     return;
   }
-  bgpstream_patricia_tree_print_tree(node->l);
+  bgpstream_patricia_tree_print_tree(pt, NODE_L(pt, node));
 
   char buffer[1024];
 
   /* if node is not a glue node, print the prefix */
-  if (node->prefix.address.version != BGPSTREAM_ADDR_VERSION_UNKNOWN) {
-    memset(buffer, ' ', sizeof(char) * node->prefix.mask_len);
-    bgpstream_pfx_snprintf(buffer + node->prefix.mask_len, 1024,
-                           (bgpstream_pfx_t *)&node->prefix);
+  if (!NODE_IS_GLUE(node)) {
+    memset(buffer, ' ', sizeof(char) * NODE_PFX(node)->mask_len);
+    bgpstream_pfx_snprintf(buffer + NODE_PFX(node)->mask_len, 1024,
+                           NODE_PFX(node));
     fprintf(stdout, "%s\n", buffer);
   }
 
-  bgpstream_patricia_tree_print_tree(node->r);
+  bgpstream_patricia_tree_print_tree(pt, NODE_R(pt, node));
+}
+
+static inline void lpm_init(bgpstream_patricia_tree_t *pt, lpm_state_t *lpm,
+                            bgpstream_addr_version_t v,
+                            bgpstream_ip_addr_t *addr, uint8_t bitlen)
+{
+  addr_key(v, addr, &lpm->key);
+  lpm->bitlen = bitlen;
+  lpm->best = NULL;
+  if ((lpm->node = bgpstream_patricia_get_head(pt, v)) != NULL) {
+    __builtin_prefetch(lpm->node);
+  }
+}
+
+/* Visit the next node of a longest-prefix-match lookup, and prefetch the one
+ * after it. Returns 0 once the lookup is done. */
+static inline int lpm_step(bgpstream_patricia_tree_t *pt, lpm_state_t *lpm)
+{
+  bgpstream_patricia_node_t *node = lpm->node;
+  pfx_key_t node_key;
+
+  if (node->bit > lpm->bitlen) {
+    goto done;
+  }
+  if (!NODE_IS_GLUE(node)) {
+    pfx_key(node->version, NODE_PFX(node), &node_key);
+    if (key_differ_bit(&lpm->key, &node_key) < node->bit) {
+      /* nothing below here can match either */
+      goto done;
+    }
+    lpm->best = node;
+  }
+  if (node->bit == lpm->bitlen) {
+    goto done;
+  }
+
+  lpm->node = key_bit(&lpm->key, node->bit) ? NODE_R(pt, node)
+                                            : NODE_L(pt, node);
+  if (lpm->node == NULL) {
+    return 0;
+  }
+  __builtin_prefetch(lpm->node);
+  return 1;
+
+done:
+  lpm->node = NULL;
+  return 0;
+}
+
+/* Run a group of lookups, taking one step of each in turn so that the cache
+ * misses of each walk overlap with the work done on the others */
+static void lpm_run(bgpstream_patricia_tree_t *pt, lpm_state_t *lpms, int cnt)
+{
+  int active = cnt;
+  int i;
+
+  while (active > 0) {
+    active = 0;
+    for (i = 0; i < cnt; i++) {
+      if (lpms[i].node != NULL && lpm_step(pt, &lpms[i]) != 0) {
+        active++;
+      }
+    }
+  }
+}
+
+/* Get the node with the greatest (address, mask length) of a tree, which is
+ * always a leaf at the end of its rightmost path */
+static bgpstream_patricia_node_t *
+bgpstream_patricia_get_last(bgpstream_patricia_tree_t *pt,
+                            bgpstream_addr_version_t v)
+{
+  bgpstream_patricia_node_t *node = bgpstream_patricia_get_head(pt, v);
+
+  if (node == NULL) {
+    return NULL;
+  }
+  while (node->l != NODE_NONE || node->r != NODE_NONE) {
+    node = (node->r != NODE_NONE) ? NODE_R(pt, node) : NODE_L(pt, node);
+  }
+  return node;
+}
+
+/* Compare two prefixes by address, then by mask length */
+static inline int pfx_key_cmp(const pfx_key_t *a, uint8_t a_len,
+                              const pfx_key_t *b, uint8_t b_len)
+{
+  if (a->hi != b->hi) {
+    return (a->hi < b->hi) ? -1 : 1;
+  }
+  if (a->lo != b->lo) {
+    return (a->lo < b->lo) ? -1 : 1;
+  }
+  return (int)a_len - (int)b_len;
+}
+
+/* Write padding to bring a snapshot file up to the next section */
+static int snapshot_pad(FILE *fh, size_t *off)
+{
+  static const uint8_t zeros[SNAPSHOT_ALIGN] = {0};
+  size_t pad = SNAPSHOT_ALIGN_UP(*off) - *off;
+
+  if (pad > 0 && fwrite(zeros, 1, pad, fh) != pad) {
+    return -1;
+  }
+  *off += pad;
+  return 0;
+}
+
+/* Number the nodes of a tree in pre-order. Fills order (new index -> node)
+ * and returns the number of nodes, or -1 if an error occurred. */
+static int64_t snapshot_order(bgpstream_patricia_tree_t *pt,
+                              bgpstream_addr_version_t v, uint32_t **order_p)
+{
+  node_arena_t *arena = bgpstream_patricia_get_arena(pt, v);
+  bgpstream_patricia_node_t *node = bgpstream_patricia_get_head(pt, v);
+  uint32_t stack[BGPSTREAM_PATRICIA_MAX_DEPTH + 1];
+  uint32_t *order;
+  int64_t cnt = 0;
+  int sp = 0;
+
+  if ((*order_p = order = malloc(sizeof(uint32_t) * (arena->used + 1))) ==
+      NULL) {
+    return -1;
+  }
+  if (node != NULL) {
+    stack[sp++] = node->idx;
+  }
+  while (sp > 0) {
+    node = node_arena_get(arena, stack[--sp]);
+    order[cnt++] = node->idx;
+    if (node->r != NODE_NONE) {
+      stack[sp++] = node->r;
+    }
+    if (node->l != NODE_NONE) {
+      stack[sp++] = node->l;
+    }
+  }
+  return cnt;
+}
+
+/* Write the nodes of a tree (in the given order, renumbered to match) */
+static int snapshot_write_nodes(bgpstream_patricia_tree_t *pt,
+                                bgpstream_addr_version_t v, FILE *fh,
+                                uint32_t *order, uint32_t cnt, size_t *off)
+{
+  node_arena_t *arena = bgpstream_patricia_get_arena(pt, v);
+  bgpstream_patricia_node_t *node;
+  bgpstream_patricia_node_t *copy = NULL;
+  uint32_t *renum = NULL;
+  uint32_t i;
+  int rc = -1;
+
+  if ((renum = malloc(sizeof(uint32_t) * (arena->used + 1))) == NULL ||
+      (copy = malloc(arena->node_size)) == NULL) {
+    goto done;
+  }
+  for (i = 0; i < cnt; i++) {
+    renum[order[i]] = i;
+  }
+
+#define RENUM(idx) (((idx) == NODE_NONE) ? NODE_NONE : renum[(idx)])
+  for (i = 0; i < cnt; i++) {
+    node = node_arena_get(arena, order[i]);
+    memcpy(copy, node, arena->node_size);
+    copy->user = NULL;
+    copy->idx = i;
+    copy->l = RENUM(node->l);
+    copy->r = RENUM(node->r);
+    copy->parent = RENUM(node->parent);
+    if (fwrite(copy, arena->node_size, 1, fh) != 1) {
+      goto done;
+    }
+  }
+#undef RENUM
+
+  *off += (size_t)cnt * arena->node_size;
+  rc = snapshot_pad(fh, off);
+
+done:
+  free(renum);
+  free(copy);
+  return rc;
+}
+
+/* Write the payload slots of the nodes of a tree (in the given order) */
+static int
+snapshot_write_payloads(bgpstream_patricia_tree_t *pt,
+                        bgpstream_addr_version_t v, FILE *fh, uint32_t *order,
+                        uint32_t cnt, size_t payload_len,
+                        bgpstream_patricia_tree_write_user_t *write_user,
+                        void *data, size_t *off)
+{
+  node_arena_t *arena = bgpstream_patricia_get_arena(pt, v);
+  bgpstream_patricia_node_t *node;
+  uint8_t *slot;
+  uint32_t i;
+  int rc = -1;
+
+  if (payload_len == 0) {
+    return 0;
+  }
+  if ((slot = malloc(payload_len)) == NULL) {
+    return -1;
+  }
+  for (i = 0; i < cnt; i++) {
+    node = node_arena_get(arena, order[i]);
+    memset(slot, 0, payload_len);
+    if (!NODE_IS_GLUE(node) && node->user != NULL && write_user != NULL &&
+        write_user(node->user, slot, payload_len, data) != 0) {
+      goto done;
+    }
+    if (fwrite(slot, payload_len, 1, fh) != 1) {
+      goto done;
+    }
+  }
+
+  *off += (size_t)cnt * payload_len;
+  rc = snapshot_pad(fh, off);
+
+done:
+  free(slot);
+  return rc;
+}
+
+/* Point an arena at nodes in a snapshot mapping */
+static int snapshot_map_arena(node_arena_t *arena, uint8_t *nodes,
+                              uint32_t cnt)
+{
+  uint32_t i;
+
+  arena->chunks_cnt = (cnt + NODE_CHUNK_LEN - 1) / NODE_CHUNK_LEN;
+  if (arena->chunks_cnt > 0 &&
+      (arena->chunks = malloc(sizeof(uint8_t *) * arena->chunks_cnt)) ==
+        NULL) {
+    return -1;
+  }
+  for (i = 0; i < arena->chunks_cnt; i++) {
+    arena->chunks[i] = nodes + (size_t)i * NODE_CHUNK_LEN * arena->node_size;
+  }
+  arena->used = cnt;
+  return 0;
 }
 
-static void
-bgpstream_patricia_tree_destroy_tree(bgpstream_patricia_tree_t *pt,
-                                     bgpstream_patricia_node_t *head)
+/* Check that the nodes of a snapshot arena form a tree (in pre-order) rooted
+ * at index 0, so that a corrupt file cannot make us index outside the
+ * mapping, loop forever, or overflow a traversal stack. Children must come
+ * after their parent and have a longer bit length. */
+static int snapshot_check_arena(node_arena_t *arena,
+                                bgpstream_addr_version_t v, uint8_t max_bits)
 {
-  if (head != NULL) {
-    bgpstream_patricia_node_t *l = head->l;
-    bgpstream_patricia_node_t *r = head->r;
-    bgpstream_patricia_tree_destroy_tree(pt, l);
-    bgpstream_patricia_tree_destroy_tree(pt, r);
-    if (head->user != NULL && pt->node_user_destructor != NULL) {
-      pt->node_user_destructor(head->user);
+  bgpstream_patricia_node_t *node, *child;
+  uint32_t children[2];
+  uint32_t i;
+  int j;
+
+  for (i = 0; i < arena->used; i++) {
+    node = node_arena_get(arena, i);
+    if (node->idx != i || node->version != v || node->bit > max_bits ||
+        (!NODE_IS_GLUE(node) && (NODE_PFX(node)->address.version != v ||
+                                 NODE_PFX(node)->mask_len != node->bit)) ||
+        (i == 0 && node->parent != NODE_NONE) ||
+        (i > 0 && (node->parent == NODE_NONE || node->parent >= i))) {
+      return -1;
+    }
+    children[0] = node->l;
+    children[1] = node->r;
+    for (j = 0; j < 2; j++) {
+      if (children[j] == NODE_NONE) {
+        continue;
+      }
+      if (children[j] <= i || children[j] >= arena->used) {
+        return -1;
+      }
+      child = node_arena_get(arena, children[j]);
+      if (child->parent != i || child->bit <= node->bit) {
+        return -1;
+      }
     }
-    free(head);
   }
+  return 0;
 }
 
 /* ======================= PUBLIC API FUNCTIONS ======================= */
@@ -501,7 +1044,7 @@ void bgpstream_patricia_tree_result_set_print(
   bgpstream_patricia_node_t *next;
   char buffer[1024];
   while ((next = bgpstream_patricia_tree_result_set_next(set)) != NULL) {
-    bgpstream_pfx_snprintf(buffer, 1024, (bgpstream_pfx_t *)&next->prefix);
+    bgpstream_pfx_snprintf(buffer, 1024, NODE_PFX(next));
     fprintf(stdout, "%s\n", buffer);
   }
 }
@@ -513,100 +1056,36 @@ bgpstream_patricia_tree_t *bgpstream_patricia_tree_create(
   if ((pt = malloc_zero(sizeof(bgpstream_patricia_tree_t))) == NULL) {
     return NULL;
   }
-  pt->head4 = NULL;
-  pt->head6 = NULL;
+  pt->head4 = NODE_NONE;
+  node_arena_init(&pt->arena4, NODE_SIZE(bgpstream_ipv4_pfx_t));
+  pt->head6 = NODE_NONE;
+  node_arena_init(&pt->arena6, NODE_SIZE(bgpstream_ipv6_pfx_t));
   pt->ipv4_active_nodes = 0;
   pt->ipv6_active_nodes = 0;
   pt->node_user_destructor = bspt_user_destructor;
   return pt;
 }
 
-bgpstream_patricia_node_t *
-bgpstream_patricia_tree_insert(bgpstream_patricia_tree_t *pt,
-                               bgpstream_pfx_t *pfx)
+/* Insert a prefix into a non-empty tree, given the node that its search
+ * stopped at (i.e., the node with the longest common prefix with pfx) */
+static bgpstream_patricia_node_t *
+bgpstream_patricia_insert_at(bgpstream_patricia_tree_t *pt,
+                             bgpstream_pfx_t *pfx, pfx_key_t *key,
+                             bgpstream_patricia_node_t *node_it)
 {
-  assert(pt);
-  assert(pfx);
-  assert(pfx->mask_len <= BGPSTREAM_PATRICIA_MAXBITS);
-  assert(pfx->address.version != BGPSTREAM_ADDR_VERSION_UNKNOWN);
-
-  /* DEBUG   char buffer[1024];
-   * bgpstream_pfx_snprintf(buffer, 1024, pfx); */
-
-  bgpstream_patricia_node_t *new_node = NULL;
   bgpstream_addr_version_t v = pfx->address.version;
-
-  /* if Patricia Tree is empty, then insert new node */
-  if (bgpstream_patricia_get_head(pt, v) == NULL) {
-    if ((new_node = bgpstream_patricia_node_create(pt, pfx)) == NULL) {
-      fprintf(stderr, "Error creating pt node\n");
-      return NULL;
-    }
-    /* attach first node in Tree */
-    bgpstream_patricia_set_head(pt, v, new_node);
-    /* DEBUG       fprintf(stderr, "Adding %s to HEAD\n", buffer); */
-    return new_node;
-  }
-
-  /* Prepare data for Patricia Tree navigation */
-
-  bgpstream_patricia_node_t *node_it = bgpstream_patricia_get_head(pt, v);
-
+  bgpstream_patricia_node_t *new_node = NULL;
   uint8_t bitlen = pfx->mask_len;
-  unsigned char *addr = bgpstream_pfx_get_first_byte(pfx);
-
-  /* navigate Patricia Tree till we:
-   * - reach the end of the tree (i.e. next node_it is null)
-   * - the current node has the same mask length (or greater) and
-   *   it contains a valid prefix (i.e. it is not a glue node)
-   * */
-  while (node_it->bit < bitlen ||
-         node_it->prefix.address.version == BGPSTREAM_ADDR_VERSION_UNKNOWN) {
-    if (node_it->bit < BGPSTREAM_PATRICIA_MAXBITS &&
-        BIT_TEST(addr[node_it->bit >> 3], 0x80 >> (node_it->bit & 0x07))) {
-      /* no more nodes on the right, exit from loop */
-      if (node_it->r == NULL) {
-        break;
-      }
-      /* patricia_lookup: take right at node->bit */
-      node_it = node_it->r;
-    } else {
-      /* no more nodes on the left, exit from loop */
-      if (node_it->l == NULL) {
-        break;
-      }
-      /* patricia_lookup: take left at node->bit */
-      node_it = node_it->l;
-    }
-    assert(node_it);
-  }
 
   /*  node_it->prefix is the prefix we stopped at */
-  unsigned char *test_addr =
-    bgpstream_pfx_get_first_byte((bgpstream_pfx_t *)&node_it->prefix);
+  pfx_key_t test_key;
+  pfx_key(v, NODE_PFX(node_it), &test_key);
 
   /* find the first bit different */
   uint8_t check_bit;
   uint8_t differ_bit;
-  int i, j, r;
   check_bit = (node_it->bit < bitlen) ? node_it->bit : bitlen;
-  differ_bit = 0;
-  for (i = 0; i * 8 < check_bit; i++) {
-    if ((r = (addr[i] ^ test_addr[i])) == 0) {
-      differ_bit = (i + 1) * 8;
-      continue;
-    }
-    /* I know the better way, but for now */
-    for (j = 0; j < 8; j++) {
-      if (BIT_TEST(r, (0x80 >> j))) {
-        break;
-      }
-    }
-    /* must be found */
-    assert(j < 8);
-    differ_bit = i * 8 + j;
-    break;
-  }
+  differ_bit = key_differ_bit(key, &test_key);
 
   if (differ_bit > check_bit) {
     differ_bit = check_bit;
@@ -616,23 +1095,23 @@ bgpstream_patricia_tree_insert(bgpstream_patricia_tree_t *pt,
   bgpstream_patricia_node_t *glue_node;
 
   /* go back up till we find the right parent **I.E.??** */
-  parent = node_it->parent;
+  parent = NODE_PARENT(pt, node_it);
   while (parent && parent->bit >= differ_bit) {
     node_it = parent;
-    parent = node_it->parent;
+    parent = NODE_PARENT(pt, node_it);
   }
 
   if (differ_bit == bitlen && node_it->bit == bitlen) {
     /* check the node contains a valid prefix,
      * i.e. it is not a glue node */
-    if (node_it->prefix.address.version != BGPSTREAM_ADDR_VERSION_UNKNOWN) {
+    if (!NODE_IS_GLUE(node_it)) {
       /* Exact node found */
       /* DEBUG  fprintf(stderr, "Prefix %s already in tree\n", buffer); */
       return node_it;
     }
     /* otherwise replace the info in the glue node with proper
      * prefix information and increment the right counter*/
-    node_it->prefix = *((bgpstream_pfx_storage_t *)pfx);
+    bgpstream_pfx_copy(NODE_PFX(node_it), pfx);
     if (pfx->address.version == BGPSTREAM_ADDR_VERSION_IPV4) {
       pt->ipv4_active_nodes++;
     } else {
@@ -653,14 +1132,13 @@ bgpstream_patricia_tree_insert(bgpstream_patricia_tree_t *pt,
   /* Insert the new node in the Patricia Tree: CHILD */
   if (node_it->bit == differ_bit) {
     /* appending the new node as a child of node_it */
-    new_node->parent = node_it;
-    if (node_it->bit < BGPSTREAM_PATRICIA_MAXBITS &&
-        BIT_TEST(addr[node_it->bit >> 3], 0x80 >> (node_it->bit & 0x07))) {
-      assert(node_it->r == NULL);
-      node_it->r = new_node;
+    new_node->parent = node_it->idx;
+    if (key_bit(key, node_it->bit)) {
+      assert(node_it->r == NODE_NONE);
+      node_it->r = new_node->idx;
     } else {
-      assert(node_it->l == NULL);
-      node_it->l = new_node;
+      assert(node_it->l == NODE_NONE);
+      node_it->l = new_node->idx;
     }
     /* patricia_lookup: new_node #2 (child) */
     /* DEBUG  fprintf(stderr, "Adding %s as a CHILD node\n", buffer); */
@@ -670,24 +1148,23 @@ bgpstream_patricia_tree_insert(bgpstream_patricia_tree_t *pt,
   /* Insert the new node in the Patricia Tree: PARENT */
   if (bitlen == differ_bit) {
     /* attaching the new node as a parent of node_it */
-    if (bitlen < BGPSTREAM_PATRICIA_MAXBITS &&
-        BIT_TEST(test_addr[bitlen >> 3], 0x80 >> (bitlen & 0x07))) {
-      new_node->r = node_it;
+    if (key_bit(&test_key, bitlen)) {
+      new_node->r = node_it->idx;
     } else {
-      new_node->l = node_it;
+      new_node->l = node_it->idx;
     }
     new_node->parent = node_it->parent;
-    if (node_it->parent == NULL) {
+    if ((parent = NODE_PARENT(pt, node_it)) == NULL) {
       assert(bgpstream_patricia_get_head(pt, v) == node_it);
       bgpstream_patricia_set_head(pt, v, new_node);
     } else {
-      if (node_it->parent->r == node_it) {
-        node_it->parent->r = new_node;
+      if (parent->r == node_it->idx) {
+        parent->r = new_node->idx;
       } else {
-        node_it->parent->l = new_node;
+        parent->l = new_node->idx;
       }
     }
-    node_it->parent = new_node;
+    node_it->parent = new_node->idx;
     /* patricia_lookup: new_node #3 (parent) */
     /* DEBUG fprintf(stderr, "Adding %s as a PARENT node\n", buffer); */
     return new_node;
@@ -695,32 +1172,34 @@ bgpstream_patricia_tree_insert(bgpstream_patricia_tree_t *pt,
     /* Insert the new node in the Patricia Tree: CREATE A GLUE NODE AND APPEND
      * TO IT*/
 
-    glue_node = bgpstream_patricia_gluenode_create();
+    if ((glue_node = bgpstream_patricia_gluenode_create(pt, v)) == NULL) {
+      fprintf(stderr, "Error creating pt glue node\n");
+      return NULL;
+    }
 
     glue_node->bit = differ_bit;
     glue_node->parent = node_it->parent;
 
-    if (differ_bit < BGPSTREAM_PATRICIA_MAXBITS &&
-        BIT_TEST(addr[differ_bit >> 3], 0x80 >> (differ_bit & 0x07))) {
-      glue_node->r = new_node;
-      glue_node->l = node_it;
+    if (key_bit(key, differ_bit)) {
+      glue_node->r = new_node->idx;
+      glue_node->l = node_it->idx;
     } else {
-      glue_node->r = node_it;
-      glue_node->l = new_node;
+      glue_node->r = node_it->idx;
+      glue_node->l = new_node->idx;
     }
-    new_node->parent = glue_node;
+    new_node->parent = glue_node->idx;
 
-    if (node_it->parent == NULL) {
+    if ((parent = NODE_PARENT(pt, node_it)) == NULL) {
       assert(bgpstream_patricia_get_head(pt, v) == node_it);
       bgpstream_patricia_set_head(pt, v, glue_node);
     } else {
-      if (node_it->parent->r == node_it) {
-        node_it->parent->r = glue_node;
+      if (parent->r == node_it->idx) {
+        parent->r = glue_node->idx;
       } else {
-        node_it->parent->l = glue_node;
+        parent->l = glue_node->idx;
       }
     }
-    node_it->parent = glue_node;
+    node_it->parent = glue_node->idx;
     /* "patricia_lookup: new_node #4 (glue+node) */
     /* DEBUG fprintf(stderr, "Adding %s as a CHILD of a NEW GLUE node\n",
      * buffer); */
@@ -731,6 +1210,128 @@ bgpstream_patricia_tree_insert(bgpstream_patricia_tree_t *pt,
   return new_node;
 }
 
+bgpstream_patricia_node_t *
+bgpstream_patricia_tree_insert(bgpstream_patricia_tree_t *pt,
+                               bgpstream_pfx_t *pfx)
+{
+  assert(pt);
+  assert(pfx);
+  assert(pfx->mask_len <= BGPSTREAM_PATRICIA_MAXBITS);
+  assert(pfx->address.version != BGPSTREAM_ADDR_VERSION_UNKNOWN);
+
+  /* snapshots are read-only */
+  if (pt->map != NULL) {
+    return NULL;
+  }
+
+  /* DEBUG   char buffer[1024];
+   * bgpstream_pfx_snprintf(buffer, 1024, pfx); */
+
+  bgpstream_patricia_node_t *new_node = NULL;
+  bgpstream_addr_version_t v = pfx->address.version;
+
+  /* if Patricia Tree is empty, then insert new node */
+  if (bgpstream_patricia_get_head(pt, v) == NULL) {
+    if ((new_node = bgpstream_patricia_node_create(pt, pfx)) == NULL) {
+      fprintf(stderr, "Error creating pt node\n");
+      return NULL;
+    }
+    /* attach first node in Tree */
+    bgpstream_patricia_set_head(pt, v, new_node);
+    /* DEBUG       fprintf(stderr, "Adding %s to HEAD\n", buffer); */
+    return new_node;
+  }
+
+  /* Prepare data for Patricia Tree navigation */
+
+  bgpstream_patricia_node_t *node_it = bgpstream_patricia_get_head(pt, v);
+  bgpstream_patricia_node_t *next;
+
+  uint8_t bitlen = pfx->mask_len;
+  pfx_key_t key;
+  pfx_key(v, pfx, &key);
+
+  /* navigate Patricia Tree till we:
+   * - reach the end of the tree (i.e. next node_it is null)
+   * - the current node has the same mask length (or greater) and
+   *   it contains a valid prefix (i.e. it is not a glue node)
+   * */
+  while (node_it->bit < bitlen || NODE_IS_GLUE(node_it)) {
+    if (key_bit(&key, node_it->bit)) {
+      /* patricia_lookup: take right at node->bit */
+      next = NODE_R(pt, node_it);
+    } else {
+      /* patricia_lookup: take left at node->bit */
+      next = NODE_L(pt, node_it);
+    }
+    /* no more nodes on this side, exit from loop */
+    if (next == NULL) {
+      break;
+    }
+    node_it = next;
+  }
+
+  return bgpstream_patricia_insert_at(pt, pfx, &key, node_it);
+}
+
+int bgpstream_patricia_tree_bulk_insert(bgpstream_patricia_tree_t *pt,
+                                        bgpstream_pfx_storage_t *pfxs,
+                                        int cnt)
+{
+  /* the greatest prefix in each (IPv4, IPv6) tree so far */
+  bgpstream_patricia_node_t *last[2] = {NULL, NULL};
+  pfx_key_t last_key[2];
+  int last_init[2] = {0, 0};
+  bgpstream_patricia_node_t *node;
+  bgpstream_pfx_t *pfx;
+  pfx_key_t key;
+  int i, vi;
+
+  /* snapshots are read-only */
+  if (pt->map != NULL) {
+    return -1;
+  }
+
+  for (i = 0; i < cnt; i++) {
+    pfx = (bgpstream_pfx_t *)&pfxs[i];
+    assert(pfx->address.version != BGPSTREAM_ADDR_VERSION_UNKNOWN);
+    vi = (pfx->address.version == BGPSTREAM_ADDR_VERSION_IPV6);
+    pfx_key(pfx->address.version, pfx, &key);
+
+    if (last_init[vi] == 0) {
+      if ((last[vi] = bgpstream_patricia_get_last(pt, pfx->address.version)) !=
+          NULL) {
+        pfx_key(pfx->address.version, NODE_PFX(last[vi]), &last_key[vi]);
+      }
+      last_init[vi] = 1;
+    }
+
+    if (last[vi] != NULL &&
+        pfx_key_cmp(&key, pfx->mask_len, &last_key[vi], last[vi]->bit) <= 0) {
+      /* out of order (or a duplicate), so search for it the slow way */
+      if (bgpstream_patricia_tree_insert(pt, pfx) == NULL) {
+        return -1;
+      }
+      continue;
+    }
+
+    /* the greatest prefix so far shares the longest common prefix with this
+     * one, so rather than searching from the head, start from there */
+    if (last[vi] == NULL) {
+      node = bgpstream_patricia_tree_insert(pt, pfx);
+    } else {
+      node = bgpstream_patricia_insert_at(pt, pfx, &key, last[vi]);
+    }
+    if (node == NULL) {
+      return -1;
+    }
+    last[vi] = node;
+    last_key[vi] = key;
+  }
+
+  return 0;
+}
+
 void *bgpstream_patricia_tree_get_user(bgpstream_patricia_node_t *node)
 {
   return node->user;
@@ -740,7 +1341,7 @@ int bgpstream_patricia_tree_set_user(bgpstream_patricia_tree_t *pt,
                                      bgpstream_patricia_node_t *node,
                                      void *user)
 {
-  if (node->user == user) {
+  if (node->user == user || pt->map != NULL) {
     return 0;
   }
   if (node->user != NULL && pt->node_user_destructor != NULL) {
@@ -754,20 +1355,24 @@ uint8_t
 bgpstream_patricia_tree_get_pfx_overlap_info(bgpstream_patricia_tree_t *pt,
                                              bgpstream_pfx_t *pfx)
 {
+  bgpstream_patricia_tree_iter_t iter;
+  uint8_t mask = 0;
 
-  bgpstream_patricia_node_t *n = bgpstream_patricia_tree_search_exact(pt, pfx);
-  if (n != NULL) {
-    return bgpstream_patricia_tree_get_node_overlap_info(pt, n) |
-           BGPSTREAM_PATRICIA_EXACT_MATCH;
-  } else {
-    /* we basically simulate an insertion, to understand whether the prefix
-     * would overlap or not */
-    n = bgpstream_patricia_tree_insert(pt, pfx);
-    uint8_t mask = bgpstream_patricia_tree_get_node_overlap_info(pt, n);
-    bgpstream_patricia_tree_remove_node(pt, n);
-    return mask & (~BGPSTREAM_PATRICIA_EXACT_MATCH);
+  if (bgpstream_patricia_tree_search_exact(pt, pfx) != NULL) {
+    mask |= BGPSTREAM_PATRICIA_EXACT_MATCH;
   }
-  return 0;
+
+  bgpstream_patricia_tree_iter_less_specifics(&iter, pt, pfx);
+  if (bgpstream_patricia_tree_iter_next(&iter) != NULL) {
+    mask |= BGPSTREAM_PATRICIA_LESS_SPECIFICS;
+  }
+
+  bgpstream_patricia_tree_iter_more_specifics(&iter, pt, pfx);
+  if (bgpstream_patricia_tree_iter_next(&iter) != NULL) {
+    mask |= BGPSTREAM_PATRICIA_MORE_SPECIFICS;
+  }
+
+  return mask;
 }
 
 void bgpstream_patricia_tree_remove(bgpstream_patricia_tree_t *pt,
@@ -781,22 +1386,22 @@ void bgpstream_patricia_tree_remove_node(bgpstream_patricia_tree_t *pt,
                                          bgpstream_patricia_node_t *node)
 {
   assert(pt);
-  if (node == NULL) {
+  if (node == NULL || pt->map != NULL) {
     return;
   }
 
-  bgpstream_addr_version_t v = node->prefix.address.version;
+  bgpstream_addr_version_t v = node->version;
   bgpstream_patricia_node_t *parent;
+  bgpstream_patricia_node_t *grandparent;
   bgpstream_patricia_node_t *child;
 
   uint64_t *num_active_node = &pt->ipv4_active_nodes;
-  ;
-  if (node->prefix.address.version == BGPSTREAM_ADDR_VERSION_IPV6) {
+  if (v == BGPSTREAM_ADDR_VERSION_IPV6) {
     num_active_node = &pt->ipv6_active_nodes;
   }
 
   /* we do not allow for explicit removal of glue nodes */
-  if (v == BGPSTREAM_ADDR_VERSION_UNKNOWN) {
+  if (NODE_IS_GLUE(node)) {
     return;
   }
 
@@ -808,24 +1413,20 @@ void bgpstream_patricia_tree_remove_node(bgpstream_patricia_tree_t *pt,
   }
 
   /* if node has both children */
-  if (node->r != NULL && node->l != NULL) {
+  if (node->r != NODE_NONE && node->l != NODE_NONE) {
     /* if it is a glue node, there is nothing to remove,
      * if it is node with a valid prefix, then it becomes a glue node
      */
-    if (node->prefix.address.version != BGPSTREAM_ADDR_VERSION_UNKNOWN) {
-      node->prefix.address.version = BGPSTREAM_ADDR_VERSION_UNKNOWN;
-    }
-    /* node data remains, unless we decide to pass a destroy function somewehere
-     */
-    /* node->user = NULL; */
+    NODE_PFX(node)->address.version = BGPSTREAM_ADDR_VERSION_UNKNOWN;
+    (*num_active_node) = (*num_active_node) - 1;
     /* DEBUG fprintf(stderr, "Removing node with both children\n"); */
     return;
   }
 
   /* if node has no children */
-  if (node->r == NULL && node->l == NULL) {
-    parent = node->parent;
-    free(node);
+  if (node->r == NODE_NONE && node->l == NODE_NONE) {
+    parent = NODE_PARENT(pt, node);
+    bgpstream_patricia_node_destroy(pt, node);
     (*num_active_node) = (*num_active_node) - 1;
 
     /* removing head of tree */
@@ -837,17 +1438,17 @@ void bgpstream_patricia_tree_remove_node(bgpstream_patricia_tree_t *pt,
     }
 
     /* check if the node was the right or the left child */
-    if (parent->r == node) {
-      parent->r = NULL;
-      child = parent->l;
+    if (parent->r == node->idx) {
+      parent->r = NODE_NONE;
+      child = NODE_L(pt, parent);
     } else {
-      assert(parent->l == node);
-      parent->l = NULL;
-      child = parent->r;
+      assert(parent->l == node->idx);
+      parent->l = NODE_NONE;
+      child = NODE_R(pt, parent);
     }
 
     /* if the current parent was a valid prefix, return */
-    if (parent->prefix.address.version != BGPSTREAM_ADDR_VERSION_UNKNOWN) {
+    if (!NODE_IS_GLUE(parent)) {
       /* DEBUG fprintf(stderr, "Removing node with no children\n"); */
       return;
     }
@@ -855,37 +1456,36 @@ void bgpstream_patricia_tree_remove_node(bgpstream_patricia_tree_t *pt,
     /* otherwise it makes no sense to have a glue node
      * with only one child, the parent has to be removed */
 
-    if (parent->parent ==
+    if ((grandparent = NODE_PARENT(pt, parent)) ==
         NULL) { /* if the parent parent is the head, then attach
                  * the only child directly */
       assert(parent == bgpstream_patricia_get_head(pt, v));
       bgpstream_patricia_set_head(pt, v, child);
     } else {
-      if (parent->parent->r == parent) { /* if the parent is a right child */
-        parent->parent->r = child;
+      if (grandparent->r == parent->idx) { /* if the parent is a right child */
+        grandparent->r = child->idx;
       } else { /* if the parent is a left child */
-        assert(parent->parent->l == parent);
-        parent->parent->l = child;
+        assert(grandparent->l == parent->idx);
+        grandparent->l = child->idx;
       }
     }
     /* the child parent, is now the grand-parent */
     child->parent = parent->parent;
-    free(parent);
+    bgpstream_patricia_node_destroy(pt, parent);
     return;
   }
 
   /* if node has only one child */
-  if (node->r) {
-    child = node->r;
+  if (node->r != NODE_NONE) {
+    child = NODE_R(pt, node);
   } else {
-    assert(node->l);
-    child = node->l;
+    child = NODE_L(pt, node);
   }
   /* the child parent, is now the grand-parent */
-  parent = node->parent;
-  child->parent = parent;
+  parent = NODE_PARENT(pt, node);
+  child->parent = node->parent;
 
-  free(node);
+  bgpstream_patricia_node_destroy(pt, node);
   (*num_active_node) = (*num_active_node) - 1;
 
   if (parent == NULL) { /* if the parent is the head, then attach
@@ -895,11 +1495,11 @@ void bgpstream_patricia_tree_remove_node(bgpstream_patricia_tree_t *pt,
     return;
   } else {
     /* attach child node to the correct parent child pointer */
-    if (parent->r == node) { /* if node was a right child */
-      parent->r = child;
+    if (parent->r == node->idx) { /* if node was a right child */
+      parent->r = child->idx;
     } else { /* if node was a left child */
-      assert(parent->l == node);
-      parent->l = child;
+      assert(parent->l == node->idx);
+      parent->l = child->idx;
     }
   }
 }
@@ -922,15 +1522,17 @@ bgpstream_patricia_tree_search_exact(bgpstream_patricia_tree_t *pt,
 
   bgpstream_patricia_node_t *node_it = bgpstream_patricia_get_head(pt, v);
   uint8_t bitlen = pfx->mask_len;
-  unsigned char *addr = bgpstream_pfx_get_first_byte(pfx);
+  pfx_key_t key;
+  pfx_key_t node_key;
+  pfx_key(v, pfx, &key);
 
   while (node_it->bit < bitlen) {
-    if (BIT_TEST(addr[node_it->bit >> 3], 0x80 >> (node_it->bit & 0x07))) {
+    if (key_bit(&key, node_it->bit)) {
       /* patricia_lookup: take right at node->bit */
-      node_it = node_it->r;
+      node_it = NODE_R(pt, node_it);
     } else {
       /* patricia_lookup: take left at node->bit */
-      node_it = node_it->l;
+      node_it = NODE_L(pt, node_it);
     }
     if (node_it == NULL) {
       return NULL;
@@ -939,23 +1541,79 @@ bgpstream_patricia_tree_search_exact(bgpstream_patricia_tree_t *pt,
 
   /* if we passed the right mask, or if we stopped at a glue node, then
    * no exact match found */
-  if (node_it->bit > bitlen ||
-      node_it->prefix.address.version == BGPSTREAM_ADDR_VERSION_UNKNOWN) {
+  if (node_it->bit > bitlen || NODE_IS_GLUE(node_it)) {
     return NULL;
   }
 
   assert(node_it->bit == bitlen);
-  /* compare the prefixes bit by bit
-   * TODO: consider replacing with bgpstream_pfx_storage_equal */
-  if (comp_with_mask(
-        bgpstream_pfx_get_first_byte((bgpstream_pfx_t *)&node_it->prefix),
-        bgpstream_pfx_get_first_byte(pfx), bitlen)) {
+  /* compare the first bitlen bits of the prefixes */
+  pfx_key(v, NODE_PFX(node_it), &node_key);
+  if (key_differ_bit(&key, &node_key) >= bitlen) {
     /* exact match found */
     return node_it;
   }
   return NULL;
 }
 
+bgpstream_patricia_node_t *
+bgpstream_patricia_tree_search_best(bgpstream_patricia_tree_t *pt,
+                                    bgpstream_pfx_t *pfx)
+{
+  lpm_state_t lpm;
+
+  assert(pfx->address.version != BGPSTREAM_ADDR_VERSION_UNKNOWN);
+
+  lpm_init(pt, &lpm, pfx->address.version, &pfx->address, pfx->mask_len);
+  while (lpm.node != NULL && lpm_step(pt, &lpm) != 0)
+    ;
+  return lpm.best;
+}
+
+void bgpstream_patricia_tree_search_best_batch(
+  bgpstream_patricia_tree_t *pt, bgpstream_pfx_t **pfxs, int cnt,
+  bgpstream_patricia_node_t **nodes)
+{
+  lpm_state_t lpms[LPM_GROUP_LEN];
+  int i, j, group_cnt;
+
+  for (i = 0; i < cnt; i += LPM_GROUP_LEN) {
+    group_cnt = (cnt - i < LPM_GROUP_LEN) ? cnt - i : LPM_GROUP_LEN;
+    for (j = 0; j < group_cnt; j++) {
+      assert(pfxs[i + j]->address.version != BGPSTREAM_ADDR_VERSION_UNKNOWN);
+      lpm_init(pt, &lpms[j], pfxs[i + j]->address.version,
+               &pfxs[i + j]->address, pfxs[i + j]->mask_len);
+    }
+    lpm_run(pt, lpms, group_cnt);
+    for (j = 0; j < group_cnt; j++) {
+      nodes[i + j] = lpms[j].best;
+    }
+  }
+}
+
+void bgpstream_patricia_tree_search_addr_batch(
+  bgpstream_patricia_tree_t *pt, bgpstream_addr_storage_t *addrs, int cnt,
+  bgpstream_patricia_node_t **nodes)
+{
+  lpm_state_t lpms[LPM_GROUP_LEN];
+  int i, j, group_cnt;
+
+  for (i = 0; i < cnt; i += LPM_GROUP_LEN) {
+    group_cnt = (cnt - i < LPM_GROUP_LEN) ? cnt - i : LPM_GROUP_LEN;
+    for (j = 0; j < group_cnt; j++) {
+      assert(addrs[i + j].version != BGPSTREAM_ADDR_VERSION_UNKNOWN);
+      lpm_init(pt, &lpms[j], addrs[i + j].version,
+               (bgpstream_ip_addr_t *)&addrs[i + j],
+               addrs[i + j].version == BGPSTREAM_ADDR_VERSION_IPV4
+                 ? 32
+                 : BGPSTREAM_PATRICIA_MAXBITS);
+    }
+    lpm_run(pt, lpms, group_cnt);
+    for (j = 0; j < group_cnt; j++) {
+      nodes[i + j] = lpms[j].best;
+    }
+  }
+}
+
 uint64_t bgpstream_patricia_prefix_count(bgpstream_patricia_tree_t *pt,
                                          bgpstream_addr_version_t v)
 {
@@ -972,12 +1630,14 @@ uint64_t bgpstream_patricia_prefix_count(bgpstream_patricia_tree_t *pt,
 
 uint64_t bgpstream_patricia_tree_count_24subnets(bgpstream_patricia_tree_t *pt)
 {
-  return bgpstream_patricia_tree_count_subnets(pt->head4, 24);
+  return bgpstream_patricia_tree_count_subnets(
+    pt, bgpstream_patricia_get_head(pt, BGPSTREAM_ADDR_VERSION_IPV4), 24);
 }
 
 uint64_t bgpstream_patricia_tree_count_64subnets(bgpstream_patricia_tree_t *pt)
 {
-  return bgpstream_patricia_tree_count_subnets(pt->head6, 64);
+  return bgpstream_patricia_tree_count_subnets(
+    pt, bgpstream_patricia_get_head(pt, BGPSTREAM_ADDR_VERSION_IPV6), 64);
 }
 
 int bgpstream_patricia_tree_get_more_specifics(
@@ -988,11 +1648,11 @@ int bgpstream_patricia_tree_get_more_specifics(
 
   if (node != NULL) { /* we do not return the node itself */
     if (bgpstream_patricia_tree_add_more_specifics(
-          results, node->l, BGPSTREAM_PATRICIA_MAXBITS + 1) != 0) {
+          pt, results, NODE_L(pt, node), BGPSTREAM_PATRICIA_MAXBITS + 1) != 0) {
       return -1;
     }
     if (bgpstream_patricia_tree_add_more_specifics(
-          results, node->r, BGPSTREAM_PATRICIA_MAXBITS + 1) != 0) {
+          pt, results, NODE_R(pt, node), BGPSTREAM_PATRICIA_MAXBITS + 1) != 0) {
       return -1;
     }
   }
@@ -1009,7 +1669,8 @@ int bgpstream_patricia_tree_get_mincovering_prefix(
     return 0;
   }
   /* we do not return the node itself (that's why we pass the parent node) */
-  return bgpstream_patricia_tree_add_less_specifics(results, node->parent, 1);
+  return bgpstream_patricia_tree_add_less_specifics(pt, results,
+                                                    NODE_PARENT(pt, node), 1);
 }
 
 int bgpstream_patricia_tree_get_less_specifics(
@@ -1023,7 +1684,7 @@ int bgpstream_patricia_tree_get_less_specifics(
   }
   /* we do not return the node itself (that's why we pass the parent node) */
   return bgpstream_patricia_tree_add_less_specifics(
-    results, node->parent, BGPSTREAM_PATRICIA_MAXBITS + 1);
+    pt, results, NODE_PARENT(pt, node), BGPSTREAM_PATRICIA_MAXBITS + 1);
 }
 
 int bgpstream_patricia_tree_get_minimum_coverage(
@@ -1033,7 +1694,161 @@ int bgpstream_patricia_tree_get_minimum_coverage(
   bgpstream_patricia_tree_result_set_clear(results);
   bgpstream_patricia_node_t *head = bgpstream_patricia_get_head(pt, v);
   /* we stop at the first layer, hence depth = 1 */
-  return bgpstream_patricia_tree_add_more_specifics(results, head, 1);
+  return bgpstream_patricia_tree_add_more_specifics(pt, results, head, 1);
+}
+
+void bgpstream_patricia_tree_iter_more_specifics(
+  bgpstream_patricia_tree_iter_t *iter, bgpstream_patricia_tree_t *pt,
+  bgpstream_pfx_t *pfx)
+{
+  assert(pfx->address.version != BGPSTREAM_ADDR_VERSION_UNKNOWN);
+
+  bgpstream_addr_version_t v = pfx->address.version;
+  bgpstream_patricia_node_t *node = bgpstream_patricia_get_head(pt, v);
+  bgpstream_patricia_node_t *leaf;
+  pfx_key_t key;
+  pfx_key_t leaf_key;
+
+  iter->pt = pt;
+  iter->version = v;
+  iter->bitlen = pfx->mask_len;
+  iter->up = 0;
+  iter->sp = 0;
+
+  pfx_key(v, pfx, &key);
+
+  /* find the root of the subtree that would contain the prefix */
+  while (node != NULL && node->bit < pfx->mask_len) {
+    node = key_bit(&key, node->bit) ? NODE_R(pt, node) : NODE_L(pt, node);
+  }
+  if (node == NULL) {
+    return;
+  }
+
+  /* all nodes in the subtree share their first node->bit bits, so compare
+   * with any leaf (glue nodes never are) to see if they are within pfx */
+  leaf = node;
+  while (leaf->l != NODE_NONE || leaf->r != NODE_NONE) {
+    leaf = (leaf->l != NODE_NONE) ? NODE_L(pt, leaf) : NODE_R(pt, leaf);
+  }
+  pfx_key(v, NODE_PFX(leaf), &leaf_key);
+  if (key_differ_bit(&key, &leaf_key) < pfx->mask_len) {
+    return;
+  }
+
+  iter->stack[iter->sp++] = node->idx;
+}
+
+void bgpstream_patricia_tree_iter_less_specifics(
+  bgpstream_patricia_tree_iter_t *iter, bgpstream_patricia_tree_t *pt,
+  bgpstream_pfx_t *pfx)
+{
+  assert(pfx->address.version != BGPSTREAM_ADDR_VERSION_UNKNOWN);
+
+  bgpstream_addr_version_t v = pfx->address.version;
+  bgpstream_patricia_node_t *node = bgpstream_patricia_get_head(pt, v);
+  pfx_key_t key;
+  pfx_key_t node_key;
+
+  iter->pt = pt;
+  iter->version = v;
+  iter->bitlen = pfx->mask_len;
+  iter->up = 1;
+  iter->sp = 0;
+
+  pfx_key(v, pfx, &key);
+
+  /* find the most specific prefix that covers pfx (its less specifics are
+   * then all of its non-glue ancestors) */
+  while (node != NULL && node->bit < pfx->mask_len) {
+    if (!NODE_IS_GLUE(node)) {
+      pfx_key(v, NODE_PFX(node), &node_key);
+      if (key_differ_bit(&key, &node_key) < node->bit) {
+        /* nothing below here can cover pfx either */
+        break;
+      }
+      iter->stack[0] = node->idx;
+      iter->sp = 1;
+    }
+    node = key_bit(&key, node->bit) ? NODE_R(pt, node) : NODE_L(pt, node);
+  }
+}
+
+bgpstream_patricia_node_t *
+bgpstream_patricia_tree_iter_next(bgpstream_patricia_tree_iter_t *iter)
+{
+  bgpstream_patricia_tree_t *pt = iter->pt;
+  node_arena_t *arena = bgpstream_patricia_get_arena(pt, iter->version);
+  bgpstream_patricia_node_t *node;
+  bgpstream_patricia_node_t *parent;
+
+  if (iter->up != 0) {
+    if (iter->sp == 0) {
+      return NULL;
+    }
+    node = node_arena_get(arena, iter->stack[0]);
+    /* move on to the closest non-glue ancestor */
+    parent = NODE_PARENT(pt, node);
+    while (parent != NULL && NODE_IS_GLUE(parent)) {
+      parent = NODE_PARENT(pt, parent);
+    }
+    if (parent == NULL) {
+      iter->sp = 0;
+    } else {
+      iter->stack[0] = parent->idx;
+    }
+    return node;
+  }
+
+  /* pre-order walk of the subtree: Node - Left - Right */
+  while (iter->sp > 0) {
+    node = node_arena_get(arena, iter->stack[--iter->sp]);
+    if (node->r != NODE_NONE) {
+      iter->stack[iter->sp++] = node->r;
+    }
+    if (node->l != NODE_NONE) {
+      iter->stack[iter->sp++] = node->l;
+    }
+    /* skip glue nodes, and the query prefix itself */
+    if (!NODE_IS_GLUE(node) && node->bit != iter->bitlen) {
+      return node;
+    }
+  }
+  return NULL;
+}
+
+int bgpstream_patricia_tree_visit_more_specifics(
+  bgpstream_patricia_tree_t *pt, bgpstream_pfx_t *pfx,
+  bgpstream_patricia_tree_visit_node_t *fun, void *data)
+{
+  bgpstream_patricia_tree_iter_t iter;
+  bgpstream_patricia_node_t *node;
+  int rc;
+
+  bgpstream_patricia_tree_iter_more_specifics(&iter, pt, pfx);
+  while ((node = bgpstream_patricia_tree_iter_next(&iter)) != NULL) {
+    if ((rc = fun(pt, node, data)) != 0) {
+      return rc;
+    }
+  }
+  return 0;
+}
+
+int bgpstream_patricia_tree_visit_less_specifics(
+  bgpstream_patricia_tree_t *pt, bgpstream_pfx_t *pfx,
+  bgpstream_patricia_tree_visit_node_t *fun, void *data)
+{
+  bgpstream_patricia_tree_iter_t iter;
+  bgpstream_patricia_node_t *node;
+  int rc;
+
+  bgpstream_patricia_tree_iter_less_specifics(&iter, pt, pfx);
+  while ((node = bgpstream_patricia_tree_iter_next(&iter)) != NULL) {
+    if ((rc = fun(pt, node, data)) != 0) {
+      return rc;
+    }
+  }
+  return 0;
 }
 
 uint8_t
@@ -1042,23 +1857,25 @@ bgpstream_patricia_tree_get_node_overlap_info(bgpstream_patricia_tree_t *pt,
 {
   uint8_t mask = BGPSTREAM_PATRICIA_EXACT_MATCH;
 
-  bgpstream_patricia_node_t *node_it = node->parent;
+  bgpstream_patricia_node_t *node_it = NODE_PARENT(pt, node);
   while (node_it != NULL) {
-    if (node_it->prefix.address.version != BGPSTREAM_ADDR_VERSION_UNKNOWN) {
+    if (!NODE_IS_GLUE(node_it)) {
       /* one more specific found */
       mask = mask | BGPSTREAM_PATRICIA_LESS_SPECIFICS;
       break;
     }
-    node_it = node_it->parent;
+    node_it = NODE_PARENT(pt, node_it);
   }
 
   node_it = node;
   if (node_it != NULL) { /* we do not consider the node itself */
     /* if one of the subtree return 1 we can avoid the other */
-    if (bgpstream_patricia_tree_find_more_specific(node->l) == 1) {
+    if (bgpstream_patricia_tree_find_more_specific(pt, NODE_L(pt, node)) ==
+        1) {
       mask = mask | BGPSTREAM_PATRICIA_MORE_SPECIFICS;
     } else {
-      if (bgpstream_patricia_tree_find_more_specific(node->r) == 1) {
+      if (bgpstream_patricia_tree_find_more_specific(pt, NODE_R(pt, node)) ==
+          1) {
         mask = mask | BGPSTREAM_PATRICIA_MORE_SPECIFICS;
       }
     }
@@ -1074,52 +1891,252 @@ void bgpstream_patricia_tree_merge(bgpstream_patricia_tree_t *dst,
     return;
   }
   /* Merge IPv4 */
-  bgpstream_patricia_tree_merge_tree(dst, src->head4);
+  bgpstream_patricia_tree_merge_tree(
+    dst, src, bgpstream_patricia_get_head(src, BGPSTREAM_ADDR_VERSION_IPV4));
   /* Merge IPv6 */
-  bgpstream_patricia_tree_merge_tree(dst, src->head6);
+  bgpstream_patricia_tree_merge_tree(
+    dst, src, bgpstream_patricia_get_head(src, BGPSTREAM_ADDR_VERSION_IPV6));
 }
 
 void bgpstream_patricia_tree_walk(bgpstream_patricia_tree_t *pt,
                                   bgpstream_patricia_tree_process_node_t *fun,
                                   void *data)
 {
-  bgpstream_patricia_tree_walk_tree(pt, pt->head4, fun, data);
-  bgpstream_patricia_tree_walk_tree(pt, pt->head6, fun, data);
+  bgpstream_patricia_tree_walk_tree(
+    pt, bgpstream_patricia_get_head(pt, BGPSTREAM_ADDR_VERSION_IPV4), fun,
+    data);
+  bgpstream_patricia_tree_walk_tree(
+    pt, bgpstream_patricia_get_head(pt, BGPSTREAM_ADDR_VERSION_IPV6), fun,
+    data);
 }
 
 void bgpstream_patricia_tree_print(bgpstream_patricia_tree_t *pt)
 {
-  bgpstream_patricia_tree_print_tree(pt->head4);
-  bgpstream_patricia_tree_print_tree(pt->head6);
+  bgpstream_patricia_tree_print_tree(
+    pt, bgpstream_patricia_get_head(pt, BGPSTREAM_ADDR_VERSION_IPV4));
+  bgpstream_patricia_tree_print_tree(
+    pt, bgpstream_patricia_get_head(pt, BGPSTREAM_ADDR_VERSION_IPV6));
 }
 
 bgpstream_pfx_t *
 bgpstream_patricia_tree_get_pfx(bgpstream_patricia_node_t *node)
 {
   assert(node);
-  if (node->prefix.address.version != BGPSTREAM_ADDR_VERSION_UNKNOWN) {
-    return (bgpstream_pfx_t *)&node->prefix;
+  if (!NODE_IS_GLUE(node)) {
+    return NODE_PFX(node);
+  }
+  return NULL;
+}
+
+int bgpstream_patricia_tree_write_snapshot(
+  bgpstream_patricia_tree_t *pt, const char *filename, size_t payload_len,
+  bgpstream_patricia_tree_write_user_t *write_user, void *data)
+{
+  static const bgpstream_addr_version_t versions[] = {
+    BGPSTREAM_ADDR_VERSION_IPV4, BGPSTREAM_ADDR_VERSION_IPV6};
+  snapshot_hdr_t hdr;
+  uint32_t *order[2] = {NULL, NULL};
+  int64_t cnt;
+  FILE *fh = NULL;
+  size_t off = 0;
+  int i;
+  int rc = -1;
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, SNAPSHOT_MAGIC, sizeof(hdr.magic));
+  hdr.version = SNAPSHOT_VERSION;
+  hdr.byte_order = SNAPSHOT_BYTE_ORDER;
+  hdr.payload_len = payload_len;
+
+  for (i = 0; i < 2; i++) {
+    if ((cnt = snapshot_order(pt, versions[i], &order[i])) < 0) {
+      goto done;
+    }
+    hdr.node_size[i] = bgpstream_patricia_get_arena(pt, versions[i])->node_size;
+    hdr.node_cnt[i] = cnt;
+    hdr.head[i] = (cnt > 0) ? 0 : NODE_NONE;
+    hdr.pfx_cnt[i] = bgpstream_patricia_prefix_count(pt, versions[i]);
+  }
+
+  if ((fh = fopen(filename, "w")) == NULL) {
+    fprintf(stderr, "Error: could not open %s for writing\n", filename);
+    goto done;
+  }
+
+  if (fwrite(&hdr, sizeof(hdr), 1, fh) != 1) {
+    goto err;
+  }
+  off = sizeof(hdr);
+  if (snapshot_pad(fh, &off) != 0) {
+    goto err;
+  }
+  for (i = 0; i < 2; i++) {
+    if (snapshot_write_nodes(pt, versions[i], fh, order[i], hdr.node_cnt[i],
+                             &off) != 0) {
+      goto err;
+    }
+  }
+  for (i = 0; i < 2; i++) {
+    if (snapshot_write_payloads(pt, versions[i], fh, order[i],
+                                hdr.node_cnt[i], payload_len, write_user, data,
+                                &off) != 0) {
+      goto err;
+    }
   }
+
+  if (fclose(fh) != 0) {
+    fh = NULL;
+    goto err;
+  }
+  fh = NULL;
+  rc = 0;
+  goto done;
+
+err:
+  fprintf(stderr, "Error: could not write patricia tree snapshot to %s\n",
+          filename);
+done:
+  if (fh != NULL) {
+    fclose(fh);
+  }
+  free(order[0]);
+  free(order[1]);
+  return rc;
+}
+
+bgpstream_patricia_tree_t *
+bgpstream_patricia_tree_open_snapshot(const char *filename)
+{
+  bgpstream_patricia_tree_t *pt = NULL;
+  snapshot_hdr_t *hdr;
+  struct stat st;
+  void *map = MAP_FAILED;
+  size_t off[4];
+  size_t len;
+  int fd;
+  int i;
+
+  if ((fd = open(filename, O_RDONLY)) < 0) {
+    fprintf(stderr, "Error: could not open %s\n", filename);
+    return NULL;
+  }
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(snapshot_hdr_t) ||
+      (map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) ==
+        MAP_FAILED) {
+    fprintf(stderr, "Error: could not map %s\n", filename);
+    close(fd);
+    return NULL;
+  }
+  close(fd);
+
+  hdr = map;
+  if (memcmp(hdr->magic, SNAPSHOT_MAGIC, sizeof(hdr->magic)) != 0 ||
+      hdr->version != SNAPSHOT_VERSION ||
+      hdr->byte_order != SNAPSHOT_BYTE_ORDER ||
+      hdr->node_size[0] != NODE_SIZE(bgpstream_ipv4_pfx_t) ||
+      hdr->node_size[1] != NODE_SIZE(bgpstream_ipv6_pfx_t)) {
+    fprintf(stderr, "Error: %s is not a compatible patricia tree snapshot\n",
+            filename);
+    goto err;
+  }
+
+  /* find (and bounds-check) each section. the payload length is checked
+   * first so that the section sizes cannot overflow */
+  len = SNAPSHOT_ALIGN_UP(sizeof(snapshot_hdr_t));
+  for (i = 0; i < 4 && hdr->payload_len <= (size_t)st.st_size; i++) {
+    off[i] = len;
+    len += SNAPSHOT_ALIGN_UP((size_t)hdr->node_cnt[i % 2] *
+                             (i < 2 ? hdr->node_size[i] : hdr->payload_len));
+  }
+  if (hdr->payload_len > (size_t)st.st_size || len > (size_t)st.st_size ||
+      hdr->head[0] != (hdr->node_cnt[0] > 0 ? 0 : NODE_NONE) ||
+      hdr->head[1] != (hdr->node_cnt[1] > 0 ? 0 : NODE_NONE)) {
+    fprintf(stderr, "Error: patricia tree snapshot %s is corrupt\n",
+            filename);
+    goto err;
+  }
+
+  if ((pt = bgpstream_patricia_tree_create(NULL)) == NULL ||
+      snapshot_map_arena(&pt->arena4, (uint8_t *)map + off[0],
+                         hdr->node_cnt[0]) != 0 ||
+      snapshot_map_arena(&pt->arena6, (uint8_t *)map + off[1],
+                         hdr->node_cnt[1]) != 0) {
+    goto err;
+  }
+  if (hdr->pfx_cnt[0] > hdr->node_cnt[0] ||
+      hdr->pfx_cnt[1] > hdr->node_cnt[1] ||
+      snapshot_check_arena(&pt->arena4, BGPSTREAM_ADDR_VERSION_IPV4, 32) != 0 ||
+      snapshot_check_arena(&pt->arena6, BGPSTREAM_ADDR_VERSION_IPV6, 128) !=
+        0) {
+    fprintf(stderr, "Error: patricia tree snapshot %s is corrupt\n",
+            filename);
+    goto err;
+  }
+  pt->head4 = hdr->head[0];
+  pt->head6 = hdr->head[1];
+  pt->ipv4_active_nodes = hdr->pfx_cnt[0];
+  pt->ipv6_active_nodes = hdr->pfx_cnt[1];
+  pt->payload_len = hdr->payload_len;
+  pt->payload4 = (uint8_t *)map + off[2];
+  pt->payload6 = (uint8_t *)map + off[3];
+  pt->map = map;
+  pt->map_len = st.st_size;
+
+  return pt;
+
+err:
+  if (pt != NULL) {
+    free(pt->arena4.chunks);
+    free(pt->arena6.chunks);
+    free(pt);
+  }
+  munmap(map, st.st_size);
   return NULL;
 }
 
+void *bgpstream_patricia_tree_get_payload(bgpstream_patricia_tree_t *pt,
+                                          bgpstream_patricia_node_t *node)
+{
+  if (pt->map == NULL || pt->payload_len == 0) {
+    return NULL;
+  }
+  return ((node->version == BGPSTREAM_ADDR_VERSION_IPV4) ? pt->payload4
+                                                         : pt->payload6) +
+         (size_t)node->idx * pt->payload_len;
+}
+
 void bgpstream_patricia_tree_clear(bgpstream_patricia_tree_t *pt)
 {
   assert(pt);
 
-  bgpstream_patricia_tree_destroy_tree(pt, pt->head4);
+  /* snapshots are read-only */
+  if (pt->map != NULL) {
+    return;
+  }
+
+  node_arena_clear(&pt->arena4, pt->node_user_destructor);
   pt->ipv4_active_nodes = 0;
-  pt->head4 = NULL;
+  pt->head4 = NODE_NONE;
 
-  bgpstream_patricia_tree_destroy_tree(pt, pt->head6);
+  node_arena_clear(&pt->arena6, pt->node_user_destructor);
   pt->ipv6_active_nodes = 0;
-  pt->head6 = NULL;
+  pt->head6 = NODE_NONE;
 }
 
 void bgpstream_patricia_tree_destroy(bgpstream_patricia_tree_t *pt)
 {
+  if (pt != NULL && pt->map != NULL) {
+    /* the arena chunks are part of the mapping */
+    free(pt->arena4.chunks);
+    free(pt->arena6.chunks);
+    munmap(pt->map, pt->map_len);
+    free(pt);
+    return;
+  }
   if (pt != NULL) {
     bgpstream_patricia_tree_clear(pt);
+    node_arena_destroy(&pt->arena4);
+    node_arena_destroy(&pt->arena6);
     free(pt);
   }
 }
@@ -49,6 +49,10 @@
 #define BGPSTREAM_PATRICIA_EXACT_MATCH 0b0010
 #define BGPSTREAM_PATRICIA_MORE_SPECIFICS 0b0001
 
+/** Maximum depth of a Patricia Tree (one level per bit of an IPv6 address,
+ * plus the root) */
+#define BGPSTREAM_PATRICIA_MAX_DEPTH 129
+
 /**
  * @name Opaque Data Structures
  *
@@ -87,6 +91,54 @@ typedef void(bgpstream_patricia_tree_destroy_user_t)(void *user);
 typedef void(bgpstream_patricia_tree_process_node_t)(
   bgpstream_patricia_tree_t *pt, bgpstream_patricia_node_t *node, void *data);
 
+/** Callback for writing the user structure associated with a patricia tree
+ *  node into its payload slot of a snapshot
+ *
+ * @param user      user pointer of the node
+ * @param slot      pointer to the (zeroed) payload slot to fill
+ * @param slot_len  size of the payload slot
+ * @param data      user pointer passed to the snapshot function
+ * @return 0 if the slot was written successfully, -1 otherwise
+ */
+typedef int(bgpstream_patricia_tree_write_user_t)(void *user, void *slot,
+                                                  size_t slot_len,
+                                                  void *data);
+
+/** Callback for visiting the nodes found by a patricia tree query
+ *
+ * @param pt      pointer to the patricia tree
+ * @param node    pointer to the node
+ * @param data    user pointer passed to the visit function
+ * @return 0 to continue visiting nodes, any other value to stop (which is
+ *         then returned by the visit function)
+ */
+typedef int(bgpstream_patricia_tree_visit_node_t)(
+  bgpstream_patricia_tree_t *pt, bgpstream_patricia_node_t *node, void *data);
+
+/** Iterator over the nodes found by a patricia tree query
+ *
+ * Iterators do not allocate any memory, so they are best declared on the
+ * stack. The tree must not be modified while an iterator is in use. All
+ * fields are private.
+ */
+typedef struct bgpstream_patricia_tree_iter {
+
+  /* tree (and address version) being iterated over */
+  bgpstream_patricia_tree_t *pt;
+  uint8_t version;
+
+  /* mask length of the query prefix */
+  uint8_t bitlen;
+
+  /* are we walking up (less specifics) rather than down the tree? */
+  uint8_t up;
+
+  /* nodes still to visit */
+  int sp;
+  uint32_t stack[BGPSTREAM_PATRICIA_MAX_DEPTH + 1];
+
+} bgpstream_patricia_tree_iter_t;
+
 /** @} */
 
 /**
@@ -154,12 +206,29 @@ bgpstream_patricia_tree_t *bgpstream_patricia_tree_create(
  * @param pt           pointer to the patricia tree to lookup in
  * @param pfx          pointer to the prefix to insert
  * @return a pointer to the prefix in the Patricia Tree, or NULL if an error
- * occurred
+ * occurred or the tree was opened from a snapshot
  */
 bgpstream_patricia_node_t *
 bgpstream_patricia_tree_insert(bgpstream_patricia_tree_t *pt,
                                bgpstream_pfx_t *pfx);
 
+/** Insert an array of prefixes
+ *
+ * @param pt           pointer to the patricia tree to insert into
+ * @param pfxs         array of prefixes to insert
+ * @param cnt          number of prefixes in the array
+ * @return 0 if the prefixes were inserted successfully, -1 otherwise (always
+ * for a tree opened from a snapshot)
+ *
+ * When the prefixes (of each address version) are sorted by address and then
+ * by mask length, and are all greater than those already in the tree (e.g.,
+ * when bulk-loading an empty tree), this takes linear time since no prefix
+ * needs to be searched for. Other prefixes are inserted as usual.
+ */
+int bgpstream_patricia_tree_bulk_insert(bgpstream_patricia_tree_t *pt,
+                                        bgpstream_pfx_storage_t *pfxs,
+                                        int cnt);
+
 /** Get the user pointer associated with the node
  *
  * @param node        pointer to a node
@@ -173,7 +242,8 @@ void *bgpstream_patricia_tree_get_user(bgpstream_patricia_node_t *node);
  * @param node         pointer to a node
  * @param user         user pointer to associate with the view structure
  * @return 1 if a new user pointer is set, 0 if the user pointer was already
- *         set to the address provided.
+ *         set to the address provided, or if the tree was opened from a
+ *         snapshot (which is left unchanged)
  */
 int bgpstream_patricia_tree_set_user(bgpstream_patricia_tree_t *pt,
                                      bgpstream_patricia_node_t *node,
@@ -191,6 +261,8 @@ void bgpstream_patricia_tree_merge(bgpstream_patricia_tree_t *dst,
  *
  * @param pt           pointer to the patricia tree to lookup in
  * @param pfx          pointer to the prefix to remove
+ *
+ * Does nothing if the tree was opened from a snapshot.
  */
 void bgpstream_patricia_tree_remove(bgpstream_patricia_tree_t *pt,
                                     bgpstream_pfx_t *pfx);
@@ -199,6 +271,8 @@ void bgpstream_patricia_tree_remove(bgpstream_patricia_tree_t *pt,
  *
  * @param pt           pointer to the patricia tree to lookup in
  * @param node         pointer to the node to remove
+ *
+ * Does nothing if the tree was opened from a snapshot.
  */
 void bgpstream_patricia_tree_remove_node(bgpstream_patricia_tree_t *pt,
                                          bgpstream_patricia_node_t *node);
@@ -214,6 +288,50 @@ bgpstream_patricia_node_t *
 bgpstream_patricia_tree_search_exact(bgpstream_patricia_tree_t *pt,
                                      bgpstream_pfx_t *pfx);
 
+/** Find the most specific prefix in the Patricia Tree that contains the given
+ * prefix (i.e., a longest prefix match)
+ *
+ * @param pt           pointer to the patricia tree to lookup in
+ * @param pfx          pointer to the prefix to search for
+ * @return a pointer to the matching node (which may be for pfx itself), or
+ * NULL if no prefix in the tree contains pfx
+ */
+bgpstream_patricia_node_t *
+bgpstream_patricia_tree_search_best(bgpstream_patricia_tree_t *pt,
+                                    bgpstream_pfx_t *pfx);
+
+/** Find the most specific prefix in the Patricia Tree that contains each of
+ * the given prefixes
+ *
+ * @param pt           pointer to the patricia tree to lookup in
+ * @param pfxs         array of pointers to the prefixes to search for
+ * @param cnt          number of prefixes in the array
+ * @param nodes        array of (at least cnt) node pointers to fill with the
+ *                     result for each prefix (NULL if there is no match)
+ *
+ * Gives the same results as calling bgpstream_patricia_tree_search_best for
+ * each prefix, but interleaves the lookups (and prefetches the nodes they
+ * will visit next), which is much faster for large trees.
+ */
+void bgpstream_patricia_tree_search_best_batch(
+  bgpstream_patricia_tree_t *pt, bgpstream_pfx_t **pfxs, int cnt,
+  bgpstream_patricia_node_t **nodes);
+
+/** Find the most specific prefix in the Patricia Tree that contains each of
+ * the given addresses
+ *
+ * @param pt           pointer to the patricia tree to lookup in
+ * @param addrs        array of addresses to search for
+ * @param cnt          number of addresses in the array
+ * @param nodes        array of (at least cnt) node pointers to fill with the
+ *                     result for each address (NULL if there is no match)
+ *
+ * See bgpstream_patricia_tree_search_best_batch.
+ */
+void bgpstream_patricia_tree_search_addr_batch(
+  bgpstream_patricia_tree_t *pt, bgpstream_addr_storage_t *addrs, int cnt,
+  bgpstream_patricia_node_t **nodes);
+
 /** Count the number of prefixes in the Patricia Tree
  *
  * @param pt         pointer to the patricia tree
@@ -268,6 +386,69 @@ int bgpstream_patricia_tree_get_less_specifics(
   bgpstream_patricia_tree_t *pt, bgpstream_patricia_node_t *node,
   bgpstream_patricia_tree_result_set_t *results);
 
+/** Start iterating over the prefixes in the tree that are more specific than
+ * the given prefix (in pre-order, i.e., each prefix comes before its more
+ * specifics)
+ *
+ * @param iter         pointer to the iterator to initialize
+ * @param pt           pointer to the patricia tree
+ * @param pfx          pointer to the prefix (which need not be in the tree)
+ *
+ * The prefix itself is never returned. The tree is not modified.
+ */
+void bgpstream_patricia_tree_iter_more_specifics(
+  bgpstream_patricia_tree_iter_t *iter, bgpstream_patricia_tree_t *pt,
+  bgpstream_pfx_t *pfx);
+
+/** Start iterating over the prefixes in the tree that are less specific than
+ * the given prefix (from the most to the least specific)
+ *
+ * @param iter         pointer to the iterator to initialize
+ * @param pt           pointer to the patricia tree
+ * @param pfx          pointer to the prefix (which need not be in the tree)
+ *
+ * The prefix itself is never returned. The tree is not modified.
+ */
+void bgpstream_patricia_tree_iter_less_specifics(
+  bgpstream_patricia_tree_iter_t *iter, bgpstream_patricia_tree_t *pt,
+  bgpstream_pfx_t *pfx);
+
+/** Get the next node from an iterator
+ *
+ * @param iter         pointer to the iterator
+ * @return a pointer to the next node, or NULL if there are no more
+ */
+bgpstream_patricia_node_t *
+bgpstream_patricia_tree_iter_next(bgpstream_patricia_tree_iter_t *iter);
+
+/** Visit the prefixes in the tree that are more specific than the given
+ * prefix (in the same order as bgpstream_patricia_tree_iter_more_specifics)
+ *
+ * @param pt           pointer to the patricia tree
+ * @param pfx          pointer to the prefix (which need not be in the tree)
+ * @param fun          function to call for each node
+ * @param data         user pointer to pass to fun
+ * @return 0 if all nodes were visited, otherwise the value returned by the
+ *         call to fun that stopped the visit
+ */
+int bgpstream_patricia_tree_visit_more_specifics(
+  bgpstream_patricia_tree_t *pt, bgpstream_pfx_t *pfx,
+  bgpstream_patricia_tree_visit_node_t *fun, void *data);
+
+/** Visit the prefixes in the tree that are less specific than the given
+ * prefix (in the same order as bgpstream_patricia_tree_iter_less_specifics)
+ *
+ * @param pt           pointer to the patricia tree
+ * @param pfx          pointer to the prefix (which need not be in the tree)
+ * @param fun          function to call for each node
+ * @param data         user pointer to pass to fun
+ * @return 0 if all nodes were visited, otherwise the value returned by the
+ *         call to fun that stopped the visit
+ */
+int bgpstream_patricia_tree_visit_less_specifics(
+  bgpstream_patricia_tree_t *pt, bgpstream_pfx_t *pfx,
+  bgpstream_patricia_tree_visit_node_t *fun, void *data);
+
 /** Return minimum coverage (the minimum list of prefixes in the Patricia Tree
  * that
  *  cover the entire IP space)
@@ -294,9 +475,10 @@ bgpstream_patricia_tree_get_node_overlap_info(bgpstream_patricia_tree_t *pt,
                                               bgpstream_patricia_node_t *node);
 
 /** Check whether a prefix would overlap with the prefixes already in the tree
+ * (without modifying the tree)
  *
  * @param pt           pointer to the patricia tree
- * @param node         pointer to the prefix to check
+ * @param pfx          pointer to the prefix to check
  * @return a mask: all zeroes if no overlap, 1 on first bit if more specifics
  * are present
  *                 1 on the second bit if less specifics are present
@@ -332,9 +514,54 @@ void bgpstream_patricia_tree_walk(bgpstream_patricia_tree_t *pt,
  */
 void bgpstream_patricia_tree_print(bgpstream_patricia_tree_t *pt);
 
+/** Write a snapshot of the given Patricia Tree to a file
+ *
+ * @param pt           pointer to the patricia tree
+ * @param filename     name of the file to write
+ * @param payload_len  size of the payload slot to store for each node (may be
+ *                     0 if no user data needs to be stored)
+ * @param write_user   function to fill the payload slot of each node that
+ *                     has a user pointer (may be NULL)
+ * @param data         user pointer to pass to write_user
+ * @return 0 if the snapshot was written successfully, -1 otherwise
+ *
+ * Snapshots are only portable between hosts with the same byte order and
+ * node layout.
+ */
+int bgpstream_patricia_tree_write_snapshot(
+  bgpstream_patricia_tree_t *pt, const char *filename, size_t payload_len,
+  bgpstream_patricia_tree_write_user_t *write_user, void *data);
+
+/** Open a Patricia Tree from a snapshot file
+ *
+ * @param filename     name of the snapshot file
+ * @return a pointer to the patricia tree, or NULL if an error occurred
+ *
+ * The snapshot is memory-mapped (read-only and shared), so the memory is
+ * shared with other processes that have it open. Opening it only checks that
+ * the nodes form a valid tree (one pass over them, with no allocations). The
+ * tree cannot be modified: inserts return NULL (or -1), and removes, set_user
+ * and clear do nothing. User data is only available through
+ * bgpstream_patricia_tree_get_payload.
+ */
+bgpstream_patricia_tree_t *
+bgpstream_patricia_tree_open_snapshot(const char *filename);
+
+/** Get the payload slot of a node of a tree opened from a snapshot
+ *
+ * @param pt           pointer to the patricia tree
+ * @param node         pointer to the node
+ * @return a pointer to the (read-only) payload slot of the node, or NULL if
+ * the tree is not a snapshot or has no payloads
+ */
+void *bgpstream_patricia_tree_get_payload(bgpstream_patricia_tree_t *pt,
+                                          bgpstream_patricia_node_t *node);
+
 /** Clear the given Patricia Tree (i.e. remove all prefixes)
  *
  * @param pt           pointer to the patricia tree to clear
+ *
+ * Does nothing if the tree was opened from a snapshot.
  */
 void bgpstream_patricia_tree_clear(bgpstream_patricia_tree_t *pt);
 
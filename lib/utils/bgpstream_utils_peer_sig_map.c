@@ -26,6 +26,7 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "khash.h"
 #include "utils.h"
@@ -68,28 +69,92 @@ int bgpstream_peer_sig_map_set(bgpstream_peer_sig_map_t *map,
                                bgpstream_addr_storage_t *peer_ip_addr,
                                uint32_t peer_asnumber);
 
-/** Map from peer signature to peer ID */
+/** Number of signatures in each arena chunk */
+#define SIG_CHUNK_LEN 256
+
+/** Map from peer signature to peer ID (keys point into the arena) */
 KHASH_INIT(bgpstream_peer_sig_id_map, bgpstream_peer_sig_t *,
            bgpstream_peer_id_t, 1, bgpstream_peer_sig_hash,
            bgpstream_peer_sig_equal);
 
-/** Map from peer ID to signature */
-KHASH_INIT(bgpstream_peer_id_sig_map, bgpstream_peer_id_t,
-           bgpstream_peer_sig_t *, 1, kh_int_hash_func, kh_int_hash_equal);
-
 /** Structure representing an instance of a Peer Signature Map */
 struct bgpstream_peer_sig_map {
   khash_t(bgpstream_peer_sig_id_map) * ps_id;
-  khash_t(bgpstream_peer_id_sig_map) * id_ps;
+
+  /** Map from peer ID to signature (dense, indexed by peer ID) */
+  bgpstream_peer_sig_t **id_ps;
+  int id_ps_alloc_cnt;
+
+  /** Arena of fixed-size chunks that signatures are stored in (so that
+      pointers to them remain valid as the map grows) */
+  bgpstream_peer_sig_t **sig_chunks;
+  int sig_chunks_cnt;
+  int sig_chunks_alloc_cnt;
+
+  /** Number of signatures in use in the arena */
+  int sigs_cnt;
+
   bgpstream_peer_id_t v4_next_id;
   bgpstream_peer_id_t v6_next_id;
 };
 
 /* PRIVATE FUNCTIONS (static) */
 
-static void sig_free(bgpstream_peer_sig_t *sig)
+/* Copy the given signature into the arena */
+static bgpstream_peer_sig_t *sig_alloc(bgpstream_peer_sig_map_t *map,
+                                       bgpstream_peer_sig_t *ps)
 {
-  free(sig);
+  bgpstream_peer_sig_t *new_ps;
+  int chunk = map->sigs_cnt / SIG_CHUNK_LEN;
+
+  if (chunk == map->sig_chunks_cnt) {
+    if (map->sig_chunks_cnt == map->sig_chunks_alloc_cnt) {
+      bgpstream_peer_sig_t **chunks;
+      int alloc_cnt =
+        map->sig_chunks_alloc_cnt == 0 ? 1 : map->sig_chunks_alloc_cnt * 2;
+      if ((chunks = realloc(map->sig_chunks,
+                            sizeof(bgpstream_peer_sig_t *) * alloc_cnt)) ==
+          NULL) {
+        return NULL;
+      }
+      map->sig_chunks = chunks;
+      map->sig_chunks_alloc_cnt = alloc_cnt;
+    }
+    if ((map->sig_chunks[chunk] =
+           malloc(sizeof(bgpstream_peer_sig_t) * SIG_CHUNK_LEN)) == NULL) {
+      return NULL;
+    }
+    map->sig_chunks_cnt++;
+  }
+
+  new_ps = &map->sig_chunks[chunk][map->sigs_cnt % SIG_CHUNK_LEN];
+  memcpy(new_ps, ps, sizeof(bgpstream_peer_sig_t));
+  map->sigs_cnt++;
+  return new_ps;
+}
+
+/* Make sure the ID to signature array has a slot for the given ID */
+static int id_ps_ensure(bgpstream_peer_sig_map_t *map, bgpstream_peer_id_t id)
+{
+  bgpstream_peer_sig_t **id_ps;
+  int alloc_cnt = map->id_ps_alloc_cnt == 0 ? SIG_CHUNK_LEN
+                                            : map->id_ps_alloc_cnt;
+
+  if (id < map->id_ps_alloc_cnt) {
+    return 0;
+  }
+  while (alloc_cnt <= id) {
+    alloc_cnt *= 2;
+  }
+  if ((id_ps = realloc(map->id_ps, sizeof(bgpstream_peer_sig_t *) *
+                                     alloc_cnt)) == NULL) {
+    return -1;
+  }
+  memset(&id_ps[map->id_ps_alloc_cnt], 0,
+         sizeof(bgpstream_peer_sig_t *) * (alloc_cnt - map->id_ps_alloc_cnt));
+  map->id_ps = id_ps;
+  map->id_ps_alloc_cnt = alloc_cnt;
+  return 0;
 }
 
 static bgpstream_peer_id_t
@@ -98,46 +163,66 @@ bgpstream_peer_sig_map_set_and_get_ps(bgpstream_peer_sig_map_t *map,
 {
   khiter_t k;
   int khret;
-  bgpstream_peer_id_t new_id;
+  bgpstream_peer_id_t *next_id;
+  bgpstream_peer_sig_t *new_ps;
 
-  if ((k = kh_get(bgpstream_peer_sig_id_map, map->ps_id, ps)) ==
+  if ((k = kh_get(bgpstream_peer_sig_id_map, map->ps_id, ps)) !=
       kh_end(map->ps_id)) {
-    /* was not already in the map */
-    /* what ID should we use? */
-    if (map->v4_next_id >= IPV6_ID_OFFSET) {
-      /* v4 peers are in v6 range */
-      /* regardless of the version, use the v6 id */
-      new_id = map->v6_next_id++;
-    } else if (ps->peer_ip_addr.version == BGPSTREAM_ADDR_VERSION_IPV6) {
-      assert(map->v4_next_id < IPV6_ID_OFFSET);
-      new_id = map->v6_next_id++;
-    } else {
-      new_id = map->v4_next_id++;
-    }
-
-    /* insert into both maps */
-    k = kh_put(bgpstream_peer_sig_id_map, map->ps_id, ps, &khret);
-    kh_value(map->ps_id, k) = new_id;
-    k = kh_put(bgpstream_peer_id_sig_map, map->id_ps, new_id, &khret);
-    kh_value(map->id_ps, k) = ps;
+    /* already exists, and ps is borrowed so there is nothing to free */
+    return kh_value(map->ps_id, k);
+  }
 
-    return new_id;
+  /* was not already in the map */
+  /* what ID should we use? */
+  if (map->v4_next_id >= IPV6_ID_OFFSET) {
+    /* v4 peers are in v6 range */
+    /* regardless of the version, use the v6 id */
+    next_id = &map->v6_next_id;
+  } else if (ps->peer_ip_addr.version == BGPSTREAM_ADDR_VERSION_IPV6) {
+    assert(map->v4_next_id < IPV6_ID_OFFSET);
+    next_id = &map->v6_next_id;
   } else {
-    /* already exists... */
-    free(ps); /* it was mallocd for us...*/
-    return kh_value(map->ps_id, k);
+    next_id = &map->v4_next_id;
   }
-  return 0;
+  if (*next_id == 0) {
+    /* all peer IDs are in use */
+    return 0;
+  }
+
+  /* take a copy of the signature and insert it into both maps */
+  if (id_ps_ensure(map, *next_id) != 0 ||
+      (new_ps = sig_alloc(map, ps)) == NULL) {
+    return 0;
+  }
+  k = kh_put(bgpstream_peer_sig_id_map, map->ps_id, new_ps, &khret);
+  if (khret < 0) {
+    map->sigs_cnt--;
+    return 0;
+  }
+  kh_value(map->ps_id, k) = *next_id;
+  map->id_ps[*next_id] = new_ps;
+
+  return (*next_id)++;
 }
 
 /* PROTECTED FUNCTIONS (_int.h) */
 
 khint64_t bgpstream_peer_sig_hash(bgpstream_peer_sig_t *ps)
 {
+  uint64_t s6[2];
+  uint64_t h;
+
   /* assuming that the number of peers that have the same ip and belong to two
    * different collectors is low (in this specific case there will be a
    * collision in terms of hash). */
-  return bgpstream_addr_storage_hash(&ps->peer_ip_addr);
+  if (ps->peer_ip_addr.version != BGPSTREAM_ADDR_VERSION_IPV6) {
+    return bgpstream_addr_storage_hash(&ps->peer_ip_addr);
+  }
+  /* the generic IPv6 hash only uses the first 32 bits of the address, but
+   * peers at an IXP share the /64 of its peering LAN, so fold in every bit */
+  memcpy(s6, &ps->peer_ip_addr.ipv6.s6_addr[0], sizeof(s6));
+  h = (s6[0] * 0x9e3779b97f4a7c15ULL) ^ s6[1];
+  return __ac_Wang_hash((khint32_t)(h ^ (h >> 32)));
 }
 
 /** @note we do not need to take into account the peer AS number
@@ -164,10 +249,6 @@ bgpstream_peer_sig_map_t *bgpstream_peer_sig_map_create()
     goto err;
   }
 
-  if ((map->id_ps = kh_init(bgpstream_peer_id_sig_map)) == NULL) {
-    goto err;
-  }
-
   map->v4_next_id = IPV4_ID_OFFSET;
   map->v6_next_id = IPV6_ID_OFFSET;
 
@@ -182,20 +263,17 @@ bgpstream_peer_id_t bgpstream_peer_sig_map_get_id(
   bgpstream_peer_sig_map_t *map, char *collector_str,
   bgpstream_ip_addr_t *peer_ip_addr, uint32_t peer_asnumber)
 {
-  bgpstream_peer_sig_t *new_ps;
-  if ((new_ps = malloc(sizeof(bgpstream_peer_sig_t))) == NULL) {
-    return -1;
-  }
+  bgpstream_peer_sig_t ps;
 
-  new_ps->peer_ip_addr.version = peer_ip_addr->version;
+  ps.peer_ip_addr.version = peer_ip_addr->version;
   switch (peer_ip_addr->version) {
   case BGPSTREAM_ADDR_VERSION_IPV4:
-    memcpy(&new_ps->peer_ip_addr.ipv4.s_addr,
+    memcpy(&ps.peer_ip_addr.ipv4.s_addr,
            &((bgpstream_ipv4_addr_t *)peer_ip_addr)->ipv4.s_addr,
            sizeof(uint32_t));
     break;
   case BGPSTREAM_ADDR_VERSION_IPV6:
-    memcpy(&new_ps->peer_ip_addr.ipv6.s6_addr,
+    memcpy(&ps.peer_ip_addr.ipv6.s6_addr,
            &((bgpstream_ipv6_addr_t *)peer_ip_addr)->ipv6.s6_addr,
            sizeof(uint8_t) * 16);
     break;
@@ -204,52 +282,61 @@ bgpstream_peer_id_t bgpstream_peer_sig_map_get_id(
     assert(0);
   }
 
-  strcpy(new_ps->collector_str, collector_str);
-  new_ps->peer_asnumber = peer_asnumber;
+  strcpy(ps.collector_str, collector_str);
+  ps.peer_asnumber = peer_asnumber;
 
-  return bgpstream_peer_sig_map_set_and_get_ps(map, new_ps);
+  return bgpstream_peer_sig_map_set_and_get_ps(map, &ps);
+}
+
+bgpstream_peer_id_t
+bgpstream_peer_sig_map_get_id_from_sig(bgpstream_peer_sig_map_t *map,
+                                       bgpstream_peer_sig_t *ps)
+{
+  return bgpstream_peer_sig_map_set_and_get_ps(map, ps);
 }
 
 bgpstream_peer_sig_t *
 bgpstream_peer_sig_map_get_sig(bgpstream_peer_sig_map_t *map,
                                bgpstream_peer_id_t id)
 {
-  bgpstream_peer_sig_t *ps = NULL;
-  khiter_t k;
-  if ((k = kh_get(bgpstream_peer_id_sig_map, map->id_ps, id)) !=
-      kh_end(map->id_ps)) {
-    ps = kh_value(map->id_ps, k);
+  if (id >= map->id_ps_alloc_cnt) {
+    return NULL;
   }
-  return ps;
+  return map->id_ps[id];
 }
 
 int bgpstream_peer_sig_map_get_size(bgpstream_peer_sig_map_t *map)
 {
-  assert(kh_size(map->id_ps) == kh_size(map->ps_id));
-  return kh_size(map->id_ps);
+  assert(map->sigs_cnt == kh_size(map->ps_id));
+  return kh_size(map->ps_id);
 }
 
 void bgpstream_peer_sig_map_destroy(bgpstream_peer_sig_map_t *map)
 {
+  int i;
   if (map != NULL) {
     if (map->ps_id != NULL) {
       kh_destroy(bgpstream_peer_sig_id_map, map->ps_id);
       map->ps_id = NULL;
     }
-    if (map->id_ps != NULL) {
-      /* only call free vals on ONE map, they are shared */
-      kh_free_vals(bgpstream_peer_id_sig_map, map->id_ps, sig_free);
-      kh_destroy(bgpstream_peer_id_sig_map, map->id_ps);
-      map->id_ps = NULL;
+    free(map->id_ps);
+    map->id_ps = NULL;
+    for (i = 0; i < map->sig_chunks_cnt; i++) {
+      free(map->sig_chunks[i]);
     }
+    free(map->sig_chunks);
+    map->sig_chunks = NULL;
     free(map);
   }
 }
 
 void bgpstream_peer_sig_map_clear(bgpstream_peer_sig_map_t *map)
 {
-  /* only call free vals on ONE map, they are shared */
-  kh_free_vals(bgpstream_peer_id_sig_map, map->id_ps, sig_free);
-  kh_clear(bgpstream_peer_id_sig_map, map->id_ps);
+  /* the arena chunks and the ID array are kept for reuse */
   kh_clear(bgpstream_peer_sig_id_map, map->ps_id);
+  if (map->id_ps != NULL) {
+    memset(map->id_ps, 0,
+           sizeof(bgpstream_peer_sig_t *) * map->id_ps_alloc_cnt);
+  }
+  map->sigs_cnt = 0;
 }
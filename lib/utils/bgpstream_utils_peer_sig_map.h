@@ -97,6 +97,20 @@ bgpstream_peer_id_t bgpstream_peer_sig_map_get_id(
   bgpstream_peer_sig_map_t *map, char *collector_str,
   bgpstream_ip_addr_t *peer_ip_addr, uint32_t peer_asnumber);
 
+/** Get (or set and get) the peer ID for the given peer signature
+ *
+ * @param map            pointer to the peer sig map to query
+ * @param ps             borrowed pointer to the peer signature to look up
+ * @return the peer ID for this peer signature, 0 if an error occurred
+ *
+ * The signature is only read (and may be on the caller's stack); the map
+ * takes its own copy if the peer has not been seen before. Unlike
+ * bgpstream_peer_sig_map_get_id, no copy is made when the peer already exists.
+ */
+bgpstream_peer_id_t
+bgpstream_peer_sig_map_get_id_from_sig(bgpstream_peer_sig_map_t *map,
+                                       bgpstream_peer_sig_t *ps);
+
 /** Get the peer signature for the given peer ID
  *
  * @param map           pointer to the peer sig map to query
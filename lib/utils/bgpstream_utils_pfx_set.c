@@ -31,34 +31,12 @@
 #include "utils.h"
 
 #include "bgpstream_utils_pfx_set.h"
+#include "bgpstream_utils_u64_set_int.h"
 
-/** set of unique IP prefixes
- *  this structure maintains a set of unique
- *  prefixes (ipv4 and ipv6 prefixes, both hashed
- *  using a int64 type)
- */
-KHASH_INIT(bgpstream_pfx_storage_set /* name */,
-           bgpstream_pfx_storage_t /* khkey_t */, char /* khval_t */,
-           0 /* kh_is_set */, bgpstream_pfx_storage_hash_val /*__hash_func */,
-           bgpstream_pfx_storage_equal_val /* __hash_equal */);
-
-struct bgpstream_pfx_storage_set {
-  khash_t(bgpstream_pfx_storage_set) * hash;
-  uint64_t ipv4_size;
-  uint64_t ipv6_size;
-};
-
-/* ipv4 specific set */
-
-KHASH_INIT(bgpstream_ipv4_pfx_set /* name */,
-           bgpstream_ipv4_pfx_t /* khkey_t */, char /* khval_t */,
-           0 /* kh_is_set */,
-           bgpstream_ipv4_pfx_storage_hash_val /*__hash_func */,
-           bgpstream_ipv4_pfx_storage_equal_val /* __hash_equal */);
-
-struct bgpstream_ipv4_pfx_set {
-  khash_t(bgpstream_ipv4_pfx_set) * hash;
-};
+/* An IPv4 prefix fits in 40 bits, so the IPv4 sets pack the address and mask
+ * length into a 64 bit key rather than hashing whole prefix structures */
+#define IPV4_PFX_KEY(pfx)                                                      \
+  (((uint64_t)(pfx)->address.ipv4.s_addr << 8) | (pfx)->mask_len)
 
 /* ipv6 specific set */
 
@@ -72,23 +50,38 @@ struct bgpstream_ipv6_pfx_set {
   khash_t(bgpstream_ipv6_pfx_set) * hash;
 };
 
+/** set of unique IP prefixes
+ *  this structure maintains a set of unique
+ *  prefixes (ipv4 prefixes packed into 64 bit
+ *  keys, ipv6 prefixes hashed using a int64 type)
+ */
+struct bgpstream_pfx_storage_set {
+  bgpstream_u64_set_t *ipv4;
+  khash_t(bgpstream_ipv6_pfx_set) * ipv6;
+};
+
+/* ipv4 specific set */
+
+struct bgpstream_ipv4_pfx_set {
+  bgpstream_u64_set_t *set;
+};
+
 /* STORAGE */
 
 bgpstream_pfx_storage_set_t *bgpstream_pfx_storage_set_create()
 {
   bgpstream_pfx_storage_set_t *set;
 
-  if ((set = (bgpstream_pfx_storage_set_t *)malloc(
+  if ((set = (bgpstream_pfx_storage_set_t *)malloc_zero(
          sizeof(bgpstream_pfx_storage_set_t))) == NULL) {
     return NULL;
   }
 
-  if ((set->hash = kh_init(bgpstream_pfx_storage_set)) == NULL) {
+  if ((set->ipv4 = bgpstream_u64_set_create()) == NULL ||
+      (set->ipv6 = kh_init(bgpstream_ipv6_pfx_set)) == NULL) {
     bgpstream_pfx_storage_set_destroy(set);
     return NULL;
   }
-  set->ipv4_size = 0;
-  set->ipv6_size = 0;
   return set;
 }
 
@@ -97,13 +90,15 @@ int bgpstream_pfx_storage_set_insert(bgpstream_pfx_storage_set_t *set,
 {
   int khret;
   khiter_t k;
-  if ((k = kh_get(bgpstream_pfx_storage_set, set->hash, *pfx)) ==
-      kh_end(set->hash)) {
-    k = kh_put(bgpstream_pfx_storage_set, set->hash, *pfx, &khret);
-    if (pfx->address.version == BGPSTREAM_ADDR_VERSION_IPV4) {
-      set->ipv4_size++;
-    } else {
-      set->ipv6_size++;
+  if (pfx->address.version == BGPSTREAM_ADDR_VERSION_IPV4) {
+    return bgpstream_u64_set_insert(set->ipv4, IPV4_PFX_KEY(pfx));
+  }
+  if ((k = kh_get(bgpstream_ipv6_pfx_set, set->ipv6,
+                  *(bgpstream_ipv6_pfx_t *)pfx)) == kh_end(set->ipv6)) {
+    k = kh_put(bgpstream_ipv6_pfx_set, set->ipv6, *(bgpstream_ipv6_pfx_t *)pfx,
+               &khret);
+    if (khret < 0) {
+      return -1;
     }
     return 1;
   }
@@ -114,8 +109,11 @@ int bgpstream_pfx_storage_set_exists(bgpstream_pfx_storage_set_t *set,
                                      bgpstream_pfx_storage_t *pfx)
 {
   khiter_t k;
-  if ((k = kh_get(bgpstream_pfx_storage_set, set->hash, *pfx)) ==
-      kh_end(set->hash)) {
+  if (pfx->address.version == BGPSTREAM_ADDR_VERSION_IPV4) {
+    return bgpstream_u64_set_exists(set->ipv4, IPV4_PFX_KEY(pfx));
+  }
+  if ((k = kh_get(bgpstream_ipv6_pfx_set, set->ipv6,
+                  *(bgpstream_ipv6_pfx_t *)pfx)) == kh_end(set->ipv6)) {
     return 0;
   }
   return 1;
@@ -123,7 +121,7 @@ int bgpstream_pfx_storage_set_exists(bgpstream_pfx_storage_set_t *set,
 
 int bgpstream_pfx_storage_set_size(bgpstream_pfx_storage_set_t *set)
 {
-  return kh_size(set->hash);
+  return bgpstream_u64_set_size(set->ipv4) + kh_size(set->ipv6);
 }
 
 int bgpstream_pfx_storage_set_version_size(bgpstream_pfx_storage_set_t *set,
@@ -131,9 +129,9 @@ int bgpstream_pfx_storage_set_version_size(bgpstream_pfx_storage_set_t *set,
 {
   switch (v) {
   case BGPSTREAM_ADDR_VERSION_IPV4:
-    return set->ipv4_size;
+    return bgpstream_u64_set_size(set->ipv4);
   case BGPSTREAM_ADDR_VERSION_IPV6:
-    return set->ipv6_size;
+    return kh_size(set->ipv6);
   default:
     return -1;
   }
@@ -142,11 +140,16 @@ int bgpstream_pfx_storage_set_version_size(bgpstream_pfx_storage_set_t *set,
 int bgpstream_pfx_storage_set_merge(bgpstream_pfx_storage_set_t *dst_set,
                                     bgpstream_pfx_storage_set_t *src_set)
 {
+  int khret;
   khiter_t k;
-  for (k = kh_begin(src_set->hash); k != kh_end(src_set->hash); ++k) {
-    if (kh_exist(src_set->hash, k)) {
-      if (bgpstream_pfx_storage_set_insert(dst_set,
-                                           &(kh_key(src_set->hash, k))) < 0) {
+  if (bgpstream_u64_set_merge(dst_set->ipv4, src_set->ipv4) != 0) {
+    return -1;
+  }
+  for (k = kh_begin(src_set->ipv6); k != kh_end(src_set->ipv6); ++k) {
+    if (kh_exist(src_set->ipv6, k)) {
+      kh_put(bgpstream_ipv6_pfx_set, dst_set->ipv6, kh_key(src_set->ipv6, k),
+             &khret);
+      if (khret < 0) {
         return -1;
       }
     }
@@ -156,15 +159,17 @@ int bgpstream_pfx_storage_set_merge(bgpstream_pfx_storage_set_t *dst_set,
 
 void bgpstream_pfx_storage_set_destroy(bgpstream_pfx_storage_set_t *set)
 {
-  kh_destroy(bgpstream_pfx_storage_set, set->hash);
+  bgpstream_u64_set_destroy(set->ipv4);
+  if (set->ipv6 != NULL) {
+    kh_destroy(bgpstream_ipv6_pfx_set, set->ipv6);
+  }
   free(set);
 }
 
 void bgpstream_pfx_storage_set_clear(bgpstream_pfx_storage_set_t *set)
 {
-  kh_clear(bgpstream_pfx_storage_set, set->hash);
-  set->ipv4_size = 0;
-  set->ipv6_size = 0;
+  bgpstream_u64_set_clear(set->ipv4);
+  kh_clear(bgpstream_ipv6_pfx_set, set->ipv6);
 }
 
 /* IPv4 */
@@ -178,7 +183,7 @@ bgpstream_ipv4_pfx_set_t *bgpstream_ipv4_pfx_set_create()
     return NULL;
   }
 
-  if ((set->hash = kh_init(bgpstream_ipv4_pfx_set)) == NULL) {
+  if ((set->set = bgpstream_u64_set_create()) == NULL) {
     bgpstream_ipv4_pfx_set_destroy(set);
     return NULL;
   }
@@ -189,56 +194,35 @@ bgpstream_ipv4_pfx_set_t *bgpstream_ipv4_pfx_set_create()
 int bgpstream_ipv4_pfx_set_insert(bgpstream_ipv4_pfx_set_t *set,
                                   bgpstream_ipv4_pfx_t *pfx)
 {
-  int khret;
-  khiter_t k;
-  if ((k = kh_get(bgpstream_ipv4_pfx_set, set->hash, *pfx)) ==
-      kh_end(set->hash)) {
-    k = kh_put(bgpstream_ipv4_pfx_set, set->hash, *pfx, &khret);
-    return 1;
-  }
-  return 0;
+  return bgpstream_u64_set_insert(set->set, IPV4_PFX_KEY(pfx));
 }
 
 int bgpstream_ipv4_pfx_set_exists(bgpstream_ipv4_pfx_set_t *set,
                                   bgpstream_ipv4_pfx_t *pfx)
 {
-  khiter_t k;
-  if ((k = kh_get(bgpstream_ipv4_pfx_set, set->hash, *pfx)) ==
-      kh_end(set->hash)) {
-    return 0;
-  }
-  return 1;
+  return bgpstream_u64_set_exists(set->set, IPV4_PFX_KEY(pfx));
 }
 
 int bgpstream_ipv4_pfx_set_size(bgpstream_ipv4_pfx_set_t *set)
 {
-  return kh_size(set->hash);
+  return bgpstream_u64_set_size(set->set);
 }
 
 int bgpstream_ipv4_pfx_set_merge(bgpstream_ipv4_pfx_set_t *dst_set,
                                  bgpstream_ipv4_pfx_set_t *src_set)
 {
-  khiter_t k;
-  for (k = kh_begin(src_set->hash); k != kh_end(src_set->hash); ++k) {
-    if (kh_exist(src_set->hash, k)) {
-      if (bgpstream_ipv4_pfx_set_insert(dst_set, &(kh_key(src_set->hash, k))) <
-          0) {
-        return -1;
-      }
-    }
-  }
-  return 0;
+  return bgpstream_u64_set_merge(dst_set->set, src_set->set);
 }
 
 void bgpstream_ipv4_pfx_set_destroy(bgpstream_ipv4_pfx_set_t *set)
 {
-  kh_destroy(bgpstream_ipv4_pfx_set, set->hash);
+  bgpstream_u64_set_destroy(set->set);
   free(set);
 }
 
 void bgpstream_ipv4_pfx_set_clear(bgpstream_ipv4_pfx_set_t *set)
 {
-  kh_clear(bgpstream_ipv4_pfx_set, set->hash);
+  bgpstream_u64_set_clear(set->set);
 }
 
 /* IPv6 */
@@ -0,0 +1,283 @@
+/*
+ * Copyright (C) 2016 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "bgpstream_utils_u64_set_int.h"
+
+/* Number of slots whose control bytes are scanned together */
+#define GROUP_LEN 16
+
+/* Control byte of an empty slot (full slots hold 7 bits of the hash) */
+#define CTRL_EMPTY 0x80
+
+/* The table is resized once it is 7/8 full */
+#define MAX_LOAD(capacity) ((capacity) - (capacity) / 8)
+
+struct bgpstream_u64_set {
+
+  /** One control byte per slot */
+  uint8_t *ctrl;
+
+  /** One key per slot */
+  uint64_t *keys;
+
+  /** Number of slots (0 or a power of two no smaller than GROUP_LEN) */
+  uint64_t capacity;
+
+  /** Number of keys in the set */
+  uint64_t size;
+};
+
+/* 64 bit finalizer from MurmurHash3: keys are typically addresses with
+ * clustered high bits and all-zero low bits, so they need a full mix */
+static inline uint64_t hash_key(uint64_t key)
+{
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdULL;
+  key ^= key >> 33;
+  key *= 0xc4ceb9fe1a85ec53ULL;
+  key ^= key >> 33;
+  return key;
+}
+
+/* Bitmask of the slots in the group at ctrl whose control byte is b */
+static inline uint32_t group_match(uint8_t *ctrl, uint8_t b)
+{
+#ifdef __SSE2__
+  __m128i group = _mm_loadu_si128((__m128i *)ctrl);
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(b)));
+#else
+  uint32_t mask = 0;
+  int i;
+  for (i = 0; i < GROUP_LEN; i++) {
+    if (ctrl[i] == b) {
+      mask |= 1 << i;
+    }
+  }
+  return mask;
+#endif
+}
+
+/* Find the slot to insert a key that is known not to be in the table (the
+ * set has no removal, so this is the first empty slot on the probe path) */
+static uint64_t find_empty(bgpstream_u64_set_t *set, uint64_t hash)
+{
+  uint64_t groups_mask = (set->capacity / GROUP_LEN) - 1;
+  uint64_t g = (hash >> 7) & groups_mask;
+  uint64_t step = 0;
+  uint32_t empty;
+
+  while (1) {
+    if ((empty = group_match(&set->ctrl[g * GROUP_LEN], CTRL_EMPTY)) != 0) {
+      return g * GROUP_LEN + __builtin_ctz(empty);
+    }
+    /* triangular probing visits every group of a power-of-two table */
+    step++;
+    g = (g + step) & groups_mask;
+  }
+}
+
+static int resize(bgpstream_u64_set_t *set, uint64_t capacity)
+{
+  uint8_t *old_ctrl = set->ctrl;
+  uint64_t *old_keys = set->keys;
+  uint64_t old_capacity = set->capacity;
+  uint64_t i, slot;
+
+  if ((set->ctrl = malloc(capacity)) == NULL) {
+    set->ctrl = old_ctrl;
+    return -1;
+  }
+  if ((set->keys = malloc(sizeof(uint64_t) * capacity)) == NULL) {
+    free(set->ctrl);
+    set->ctrl = old_ctrl;
+    set->keys = old_keys;
+    return -1;
+  }
+  memset(set->ctrl, CTRL_EMPTY, capacity);
+  set->capacity = capacity;
+
+  for (i = 0; i < old_capacity; i++) {
+    if (old_ctrl[i] != CTRL_EMPTY) {
+      uint64_t hash = hash_key(old_keys[i]);
+      slot = find_empty(set, hash);
+      set->ctrl[slot] = hash & 0x7f;
+      set->keys[slot] = old_keys[i];
+    }
+  }
+
+  free(old_ctrl);
+  free(old_keys);
+  return 0;
+}
+
+/* PUBLIC FUNCTIONS */
+
+bgpstream_u64_set_t *bgpstream_u64_set_create()
+{
+  return calloc(1, sizeof(bgpstream_u64_set_t));
+}
+
+int bgpstream_u64_set_insert(bgpstream_u64_set_t *set, uint64_t key)
+{
+  uint64_t hash = hash_key(key);
+  uint8_t h2 = hash & 0x7f;
+  uint64_t groups_mask, g, step = 0, slot;
+  uint32_t match, empty;
+  uint8_t *ctrl;
+
+  if (set->capacity != 0) {
+    groups_mask = (set->capacity / GROUP_LEN) - 1;
+    g = (hash >> 7) & groups_mask;
+    while (1) {
+      ctrl = &set->ctrl[g * GROUP_LEN];
+      match = group_match(ctrl, h2);
+      while (match != 0) {
+        if (set->keys[g * GROUP_LEN + __builtin_ctz(match)] == key) {
+          return 0;
+        }
+        match &= match - 1;
+      }
+      if ((empty = group_match(ctrl, CTRL_EMPTY)) != 0) {
+        break;
+      }
+      step++;
+      g = (g + step) & groups_mask;
+    }
+    if (set->size < MAX_LOAD(set->capacity)) {
+      slot = g * GROUP_LEN + __builtin_ctz(empty);
+      goto insert;
+    }
+  }
+
+  /* not found, and the table is full (or not allocated yet) */
+  if (resize(set, set->capacity == 0 ? GROUP_LEN : set->capacity * 2) != 0) {
+    fprintf(stderr, "ERROR: Could not grow 64 bit key set\n");
+    return -1;
+  }
+  slot = find_empty(set, hash);
+
+insert:
+  set->ctrl[slot] = h2;
+  set->keys[slot] = key;
+  set->size++;
+  return 1;
+}
+
+int bgpstream_u64_set_exists(bgpstream_u64_set_t *set, uint64_t key)
+{
+  uint64_t hash = hash_key(key);
+  uint8_t h2 = hash & 0x7f;
+  uint64_t groups_mask, g, step = 0;
+  uint32_t match;
+  uint8_t *ctrl;
+
+  if (set->capacity == 0) {
+    return 0;
+  }
+  groups_mask = (set->capacity / GROUP_LEN) - 1;
+  g = (hash >> 7) & groups_mask;
+  while (1) {
+    ctrl = &set->ctrl[g * GROUP_LEN];
+    match = group_match(ctrl, h2);
+    while (match != 0) {
+      if (set->keys[g * GROUP_LEN + __builtin_ctz(match)] == key) {
+        return 1;
+      }
+      match &= match - 1;
+    }
+    if (group_match(ctrl, CTRL_EMPTY) != 0) {
+      return 0;
+    }
+    step++;
+    g = (g + step) & groups_mask;
+  }
+}
+
+uint64_t bgpstream_u64_set_size(bgpstream_u64_set_t *set)
+{
+  return set->size;
+}
+
+int bgpstream_u64_set_reserve(bgpstream_u64_set_t *set, uint64_t cnt)
+{
+  uint64_t capacity = GROUP_LEN;
+
+  while (MAX_LOAD(capacity) < cnt) {
+    capacity *= 2;
+  }
+  if (capacity <= set->capacity) {
+    return 0;
+  }
+  return resize(set, capacity);
+}
+
+int bgpstream_u64_set_merge(bgpstream_u64_set_t *dst_set,
+                            bgpstream_u64_set_t *src_set)
+{
+  uint64_t i;
+
+  /* the sets usually overlap heavily, so only reserve for the larger one */
+  if (bgpstream_u64_set_reserve(dst_set, dst_set->size > src_set->size
+                                           ? dst_set->size
+                                           : src_set->size) != 0) {
+    return -1;
+  }
+  for (i = 0; i < src_set->capacity; i++) {
+    if (src_set->ctrl[i] != CTRL_EMPTY &&
+        bgpstream_u64_set_insert(dst_set, src_set->keys[i]) < 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+void bgpstream_u64_set_destroy(bgpstream_u64_set_t *set)
+{
+  if (set == NULL) {
+    return;
+  }
+  free(set->ctrl);
+  free(set->keys);
+  free(set);
+}
+
+void bgpstream_u64_set_clear(bgpstream_u64_set_t *set)
+{
+  if (set->capacity != 0) {
+    memset(set->ctrl, CTRL_EMPTY, set->capacity);
+  }
+  set->size = 0;
+}
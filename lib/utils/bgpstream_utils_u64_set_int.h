@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2016 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __BGPSTREAM_UTILS_U64_SET_INT_H
+#define __BGPSTREAM_UTILS_U64_SET_INT_H
+
+#include <stdint.h>
+
+/** @file
+ *
+ * @brief Header file that exposes the private interface of the 64 bit key
+ * set used by the IPv4 fast paths of the prefix and address sets
+ *
+ * The set is an open-addressing hash table in the style of a Swiss table: a
+ * byte of control metadata is kept per slot (7 bits of the key's hash, or an
+ * "empty" marker), and lookups scan a group of 16 control bytes at a time
+ * (with SSE2 when available) before touching any key.
+ *
+ */
+
+/**
+ * @name Private Opaque Data Structures
+ *
+ * @{ */
+
+/** Opaque structure containing a 64 bit key set instance */
+typedef struct bgpstream_u64_set bgpstream_u64_set_t;
+
+/** @} */
+
+/**
+ * @name Private API Functions
+ *
+ * @{ */
+
+/** Create a new 64 bit key set instance
+ *
+ * @return a pointer to the structure, or NULL if an error occurred
+ */
+bgpstream_u64_set_t *bgpstream_u64_set_create();
+
+/** Insert a key into the given set
+ *
+ * @param set           pointer to the set
+ * @param key           key to insert in the set
+ * @return 1 if the key was inserted, 0 if it already existed, -1 if an error
+ * occurred
+ */
+int bgpstream_u64_set_insert(bgpstream_u64_set_t *set, uint64_t key);
+
+/** Check whether a key exists in the set
+ *
+ * @param set           pointer to the set
+ * @param key           key to look for
+ * @return 0 if the key is not in the set, 1 if it is in the set
+ */
+int bgpstream_u64_set_exists(bgpstream_u64_set_t *set, uint64_t key);
+
+/** Get the number of keys in the given set
+ *
+ * @param set           pointer to the set
+ * @return the number of keys in the set
+ */
+uint64_t bgpstream_u64_set_size(bgpstream_u64_set_t *set);
+
+/** Make room for the given number of keys without further rehashing
+ *
+ * @param set           pointer to the set
+ * @param cnt           number of keys the set should be able to hold
+ * @return 0 if the set was resized successfully, -1 otherwise
+ */
+int bgpstream_u64_set_reserve(bgpstream_u64_set_t *set, uint64_t cnt);
+
+/** Merge two sets
+ *
+ * @param dst_set       pointer to the set to merge src into
+ * @param src_set       pointer to the set to merge into dst
+ * @return 0 if the sets were merged successfully, -1 otherwise
+ *
+ * The destination set is grown once up front and the source keys are then
+ * inserted in bulk by scanning the source table.
+ */
+int bgpstream_u64_set_merge(bgpstream_u64_set_t *dst_set,
+                            bgpstream_u64_set_t *src_set);
+
+/** Destroy the given set
+ *
+ * @param set           pointer to the set to destroy
+ */
+void bgpstream_u64_set_destroy(bgpstream_u64_set_t *set);
+
+/** Empty the set (the table memory is kept for reuse)
+ *
+ * @param set           pointer to the set to clear
+ */
+void bgpstream_u64_set_clear(bgpstream_u64_set_t *set);
+
+/** @} */
+
+#endif /* __BGPSTREAM_UTILS_U64_SET_INT_H */
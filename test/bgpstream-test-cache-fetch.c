@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) 2015 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "bgpstream_test.h"
+#include "bgpstream_test_http.h"
+#include "bs_transport_cache_fetch.h"
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Size of the file served (several range requests worth, and not a multiple
+   of the range size) */
+#define FILE_LEN (18 * 1024 * 1024 + 12345)
+
+#define CACHE_FILE "cache_fetch_test.tmp"
+
+/* Size of each write made by the server */
+#define SEND_LEN (64 * 1024)
+
+/* ---------- HTTP server ---------- */
+
+static uint8_t *file_data;
+
+// does the server say it supports ranges (in the HEAD response)?
+static int srv_advertise_ranges;
+
+// does the server honor range requests (or send the whole file)?
+static int srv_honor_ranges;
+
+// delay (in usec) after each SEND_LEN bytes, to limit the bandwidth of each
+// connection
+static int srv_throttle;
+
+static void serve_file(int fd, const char *req)
+{
+  char hdr[512];
+  uint64_t first = 0, last = FILE_LEN - 1;
+  const char *range;
+  int partial = 0;
+  int head = (strncmp(req, "HEAD ", 5) == 0);
+  size_t len;
+
+  if (head == 0 && srv_honor_ranges != 0 &&
+      (range = strstr(req, "\r\nRange: bytes=")) != NULL &&
+      sscanf(range + strlen("\r\nRange: bytes="), "%" SCNu64 "-%" SCNu64,
+             &first, &last) == 2 &&
+      first <= last && last < FILE_LEN) {
+    partial = 1;
+  }
+
+  if (partial != 0) {
+    snprintf(hdr, sizeof(hdr),
+             "HTTP/1.1 206 Partial Content\r\n"
+             "Content-Length: %" PRIu64 "\r\n"
+             "Content-Range: bytes %" PRIu64 "-%" PRIu64 "/%d\r\n"
+             "Connection: close\r\n\r\n",
+             last - first + 1, first, last, FILE_LEN);
+  } else {
+    first = 0;
+    last = FILE_LEN - 1;
+    snprintf(hdr, sizeof(hdr),
+             "HTTP/1.1 200 OK\r\n"
+             "Content-Length: %d\r\n"
+             "%s"
+             "Connection: close\r\n\r\n",
+             FILE_LEN,
+             srv_advertise_ranges != 0 ? "Accept-Ranges: bytes\r\n" : "");
+  }
+  if (test_http_send(fd, hdr, strlen(hdr)) != 0 || head != 0) {
+    return;
+  }
+
+  while (first <= last) {
+    len = (last - first + 1 < SEND_LEN) ? last - first + 1 : SEND_LEN;
+    if (test_http_send(fd, file_data + first, len) != 0) {
+      break;
+    }
+    first += len;
+    if (srv_throttle > 0) {
+      usleep(srv_throttle);
+    }
+  }
+}
+
+static int server_start()
+{
+  uint64_t state = 42;
+  int i;
+
+  if ((file_data = malloc(FILE_LEN)) == NULL) {
+    return -1;
+  }
+  for (i = 0; i < FILE_LEN; i++) {
+    file_data[i] = bench_rand(&state);
+  }
+  return test_http_start(serve_file);
+}
+
+static void server_stop()
+{
+  test_http_stop();
+  free(file_data);
+}
+
+/* ---------- tests ---------- */
+
+/* Fetch the file, and check that both the data read from the fetch and the
+   cache file match what was served. Returns 1 if the data matched, 0 if the
+   parallel download was not used, and -1 if the data did not match */
+static int fetch(int conn_cnt)
+{
+  bs_cache_fetch_t *fetch;
+  char url[64];
+  uint8_t *buf;
+  size_t len = 0;
+  ssize_t rlen;
+  int fd;
+  int rc = -1;
+
+  snprintf(url, sizeof(url), "http://127.0.0.1:%d/file", test_http_port);
+  if ((fetch = bs_cache_fetch_create(url, CACHE_FILE, conn_cnt)) == NULL) {
+    return 0;
+  }
+  if ((buf = malloc(FILE_LEN + 1)) == NULL) {
+    bs_cache_fetch_destroy(fetch);
+    return -1;
+  }
+
+  // read the data as it arrives
+  if ((fd = open(bs_cache_fetch_get_read_path(fetch), O_RDONLY)) < 0) {
+    goto done;
+  }
+  while ((rlen = read(fd, buf + len, FILE_LEN + 1 - len)) > 0) {
+    len += rlen;
+  }
+  close(fd);
+  if (bs_cache_fetch_finish(fetch) != 0 || len != FILE_LEN ||
+      memcmp(buf, file_data, FILE_LEN) != 0) {
+    goto done;
+  }
+
+  // and then the cache file
+  len = 0;
+  if ((fd = open(CACHE_FILE, O_RDONLY)) < 0) {
+    goto done;
+  }
+  while ((rlen = read(fd, buf + len, FILE_LEN + 1 - len)) > 0) {
+    len += rlen;
+  }
+  close(fd);
+  if (len == FILE_LEN && memcmp(buf, file_data, FILE_LEN) == 0) {
+    rc = 1;
+  }
+
+done:
+  bs_cache_fetch_destroy(fetch);
+  free(buf);
+  unlink(CACHE_FILE);
+  return rc;
+}
+
+int test_cache_fetch()
+{
+  srv_throttle = 0;
+
+  srv_advertise_ranges = 1;
+  srv_honor_ranges = 1;
+  CHECK("Parallel fetch (1 connection)", fetch(1) == 1);
+  CHECK("Parallel fetch (4 connections)", fetch(4) == 1);
+
+  // some servers advertise ranges, but then ignore the Range header
+  srv_honor_ranges = 0;
+  CHECK("Parallel fetch (ranges ignored)", fetch(4) == 1);
+
+  srv_advertise_ranges = 0;
+  CHECK("Parallel fetch (ranges not supported)", fetch(4) == 0);
+
+  return 0;
+}
+
+int bench_cache_fetch()
+{
+  struct timespec start;
+  int conn_cnts[] = {1, 2, 4, 8};
+  int i;
+
+  // every connection is limited to about 32 MB/s
+  srv_throttle = 2000;
+  srv_advertise_ranges = 1;
+  srv_honor_ranges = 1;
+
+  for (i = 0; i < (int)(sizeof(conn_cnts) / sizeof(conn_cnts[0])); i++) {
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    CHECK("Parallel fetch benchmark", fetch(conn_cnts[i]) == 1);
+    fprintf(stderr, "   fetch %d bytes using %d connection(s): %.3fs\n",
+            FILE_LEN, conn_cnts[i], bench_elapsed(&start));
+  }
+
+  return 0;
+}
+
+int main()
+{
+  CHECK_SECTION("Start HTTP server", server_start() == 0);
+  CHECK_SECTION("Cache parallel fetch", test_cache_fetch() == 0);
+  CHECK_SECTION("Cache parallel fetch Benchmark", bench_cache_fetch() == 0);
+  server_stop();
+  return 0;
+}
@@ -0,0 +1,487 @@
+/*
+ * Copyright (C) 2016 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "bgpstream_test.h"
+#include "bgpstream_utils_as_path_store.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Number of (distinct) paths added to the test store */
+#define TEST_PATH_CNT 20000
+
+/* Longest test path (in hops) */
+#define TEST_PATH_MAX_HOPS 20
+
+/* Number of hops in a path that takes (nearly) UINT16_MAX bytes */
+#define LONG_PATH_HOPS (UINT16_MAX / sizeof(bgpstream_as_path_seg_asn_t))
+
+/* Number of longest possible paths to add, each of which fills more than
+   half an arena chunk */
+#define LONG_PATH_CNT 5
+
+/* Number of threads sharing the concurrent store */
+#define THREAD_CNT 8
+
+/* Number of paths each thread adds to the concurrent store. Each thread
+   shares half of its paths with the previous thread, and half with the
+   next */
+#define THREAD_PATH_CNT 4000
+#define THREAD_PATH_STEP (THREAD_PATH_CNT / 2)
+#define THREAD_DISTINCT_PATH_CNT                                               \
+  (THREAD_PATH_STEP * (THREAD_CNT - 1) + THREAD_PATH_CNT)
+
+/* Fill buf with the segments of a (deterministic) path with the given number
+   of hops. The first hop is unique to each n. Returns the length of the path
+   data */
+static uint16_t test_path(uint32_t n, int hops, uint8_t *buf)
+{
+  bgpstream_as_path_seg_asn_t seg;
+  uint64_t state = n;
+  int i;
+
+  seg.type = BGPSTREAM_AS_PATH_SEG_ASN;
+  for (i = 0; i < hops; i++) {
+    seg.asn = (i == 0) ? n : 1 + bench_rand(&state) % 400000;
+    memcpy(buf + i * sizeof(seg), &seg, sizeof(seg));
+  }
+  return hops * sizeof(seg);
+}
+
+/* Number of hops of the n-th test path */
+static int test_path_hops(uint32_t n)
+{
+  if (n % (TEST_PATH_CNT / LONG_PATH_CNT) == 0) {
+    return LONG_PATH_HOPS;
+  }
+  return 1 + n % TEST_PATH_MAX_HOPS;
+}
+
+/* Check that the store path with the given ID holds exactly the given data */
+static int check_path(bgpstream_as_path_store_t *store,
+                      bgpstream_as_path_store_path_id_t id, uint8_t *data,
+                      uint16_t len, int is_core)
+{
+  bgpstream_as_path_store_path_t *spath;
+  bgpstream_as_path_t *path;
+  uint8_t *spath_data;
+
+  if ((spath = bgpstream_as_path_store_get_store_path(store, id)) == NULL ||
+      bgpstream_as_path_store_path_is_core(spath) != is_core ||
+      bgpstream_as_path_store_path_get_idx(spath) >=
+        bgpstream_as_path_store_get_size(store)) {
+    return 0;
+  }
+  path = bgpstream_as_path_store_path_get_int_path(spath);
+  return bgpstream_as_path_get_data(path, &spath_data) == len &&
+         memcmp(spath_data, data, len) == 0;
+}
+
+static int test_as_path_store()
+{
+  bgpstream_as_path_store_t *store;
+  bgpstream_as_path_store_path_id_t *ids;
+  bgpstream_as_path_store_path_id_t id;
+  bgpstream_as_path_store_stats_t stats;
+  uint8_t *buf;
+  uint64_t data_len = 0;
+  uint16_t len;
+  int matched = 0;
+  int i;
+
+  CHECK("Allocate test paths",
+        (ids = malloc(sizeof(*ids) * TEST_PATH_CNT)) != NULL &&
+          (buf = malloc(UINT16_MAX)) != NULL);
+
+  /* start small, so that the table grows as well */
+  CHECK("Create AS Path Store",
+        (store = bgpstream_as_path_store_create_sized(16)) != NULL);
+
+  /* a mix of short paths and paths long enough that consecutive ones cannot
+     share an arena chunk, so the arena rolls over with paths that are about
+     to straddle the end of a chunk */
+  for (i = 0; i < TEST_PATH_CNT; i++) {
+    len = test_path(i, test_path_hops(i), buf);
+    if (bgpstream_as_path_store_insert_path(store, buf, len, 0, &ids[i]) != 0) {
+      break;
+    }
+    data_len += len;
+  }
+  CHECK("Insert paths into AS Path Store", i == TEST_PATH_CNT);
+  CHECK("AS Path Store size",
+        bgpstream_as_path_store_get_size(store) == TEST_PATH_CNT);
+
+  for (i = 0; i < TEST_PATH_CNT; i++) {
+    len = test_path(i, test_path_hops(i), buf);
+    matched += check_path(store, ids[i], buf, len, 0);
+  }
+  CHECK("AS Path Store path contents", matched == TEST_PATH_CNT);
+
+  /* adding a path again gives the same ID */
+  matched = 0;
+  for (i = 0; i < TEST_PATH_CNT; i++) {
+    len = test_path(i, test_path_hops(i), buf);
+    if (bgpstream_as_path_store_insert_path(store, buf, len, 0, &id) == 0 &&
+        id.path_hash == ids[i].path_hash && id.path_id == ids[i].path_id) {
+      matched++;
+    }
+  }
+  CHECK("AS Path Store IDs of known paths", matched == TEST_PATH_CNT);
+  CHECK("AS Path Store size (after re-insert)",
+        bgpstream_as_path_store_get_size(store) == TEST_PATH_CNT);
+
+  bgpstream_as_path_store_get_stats(store, &stats);
+  CHECK("AS Path Store stats (paths)",
+        stats.paths_cnt == TEST_PATH_CNT && stats.pathsets_cnt > 0 &&
+          stats.pathsets_cnt <= stats.paths_cnt &&
+          stats.max_pathset_len >= 1 &&
+          stats.max_pathset_len <= stats.paths_cnt);
+  CHECK("AS Path Store stats (table)",
+        stats.buckets_cnt >= stats.pathsets_cnt &&
+          stats.load_factor ==
+            (double)stats.pathsets_cnt / stats.buckets_cnt &&
+          stats.avg_probe_len <= stats.max_probe_len &&
+          stats.max_probe_len < stats.buckets_cnt);
+  CHECK("AS Path Store stats (data)",
+        stats.data_len == data_len &&
+          stats.data_alloc_len >=
+            data_len + (uint64_t)LONG_PATH_CNT * UINT16_MAX / 2);
+
+  bgpstream_as_path_store_destroy(store);
+  free(ids);
+  free(buf);
+  return 0;
+}
+
+static int test_as_path_store_snapshot()
+{
+  bgpstream_as_path_store_t *store;
+  bgpstream_as_path_store_t *snap;
+  bgpstream_as_path_store_path_id_t *ids;
+  bgpstream_as_path_store_path_id_t id;
+  bgpstream_as_path_store_path_t *spath;
+  bgpstream_as_path_store_stats_t stats, snap_stats;
+  char filename[] = "/tmp/bgpstream-test-as-path-store-XXXXXX";
+  uint32_t *idxs;
+  uint8_t *seen;
+  uint8_t *buf;
+  uint16_t len;
+  struct stat st;
+  int matched = 0;
+  int fd;
+  int i;
+
+  CHECK("Allocate test paths",
+        (ids = malloc(sizeof(*ids) * TEST_PATH_CNT)) != NULL &&
+          (idxs = malloc(sizeof(*idxs) * TEST_PATH_CNT)) != NULL &&
+          (seen = calloc(TEST_PATH_CNT, 1)) != NULL &&
+          (buf = malloc(UINT16_MAX)) != NULL);
+  CHECK("Create AS Path Store",
+        (store = bgpstream_as_path_store_create()) != NULL);
+
+  /* some of the paths are core paths */
+  for (i = 0; i < TEST_PATH_CNT; i++) {
+    len = test_path(i, test_path_hops(i), buf);
+    if (bgpstream_as_path_store_insert_path(store, buf, len, i % 7 == 0,
+                                            &ids[i]) != 0 ||
+        (spath = bgpstream_as_path_store_get_store_path(store, ids[i])) ==
+          NULL) {
+      break;
+    }
+    idxs[i] = bgpstream_as_path_store_path_get_idx(spath);
+  }
+  CHECK("Insert paths into AS Path Store", i == TEST_PATH_CNT);
+
+  CHECK("Create snapshot file", (fd = mkstemp(filename)) >= 0);
+  close(fd);
+  CHECK("Write AS Path Store snapshot",
+        bgpstream_as_path_store_write_snapshot(store, filename) == 0);
+  CHECK("Open AS Path Store snapshot",
+        (snap = bgpstream_as_path_store_open_snapshot(filename)) != NULL);
+  CHECK("AS Path Store snapshot size",
+        bgpstream_as_path_store_get_size(snap) == TEST_PATH_CNT);
+
+  /* every ID obtained from the store finds the same path in the snapshot,
+     and looking the path up in the snapshot gives the same ID */
+  for (i = 0; i < TEST_PATH_CNT; i++) {
+    len = test_path(i, test_path_hops(i), buf);
+    if (check_path(snap, ids[i], buf, len, i % 7 == 0) != 0 &&
+        bgpstream_as_path_store_path_get_idx(
+          bgpstream_as_path_store_get_store_path(snap, ids[i])) == idxs[i] &&
+        bgpstream_as_path_store_insert_path(snap, buf, len, i % 7 == 0,
+                                            &id) == 0 &&
+        id.path_hash == ids[i].path_hash && id.path_id == ids[i].path_id) {
+      matched++;
+    }
+  }
+  CHECK("AS Path Store snapshot paths and IDs", matched == TEST_PATH_CNT);
+
+  /* iteration visits every path once */
+  matched = 0;
+  for (bgpstream_as_path_store_iter_first_path(snap);
+       bgpstream_as_path_store_iter_has_more_path(snap);
+       bgpstream_as_path_store_iter_next_path(snap)) {
+    id = bgpstream_as_path_store_iter_get_path_id(snap);
+    spath = bgpstream_as_path_store_iter_get_path(snap);
+    if (spath == NULL ||
+        bgpstream_as_path_store_get_store_path(snap, id) != spath ||
+        bgpstream_as_path_store_path_get_idx(spath) >= TEST_PATH_CNT ||
+        seen[bgpstream_as_path_store_path_get_idx(spath)]++ != 0) {
+      break;
+    }
+    matched++;
+  }
+  CHECK("AS Path Store snapshot iteration", matched == TEST_PATH_CNT);
+
+  bgpstream_as_path_store_get_stats(store, &stats);
+  bgpstream_as_path_store_get_stats(snap, &snap_stats);
+  CHECK("AS Path Store snapshot stats",
+        snap_stats.paths_cnt == stats.paths_cnt &&
+          snap_stats.pathsets_cnt == stats.pathsets_cnt &&
+          snap_stats.max_pathset_len == stats.max_pathset_len &&
+          snap_stats.data_len == stats.data_len);
+
+  len = test_path(TEST_PATH_CNT, 3, buf);
+  CHECK("AS Path Store snapshot is read-only",
+        bgpstream_as_path_store_insert_path(snap, buf, len, 0, &id) != 0 &&
+          bgpstream_as_path_store_get_size(snap) == TEST_PATH_CNT);
+  bgpstream_as_path_store_destroy(snap);
+
+  CHECK("AS Path Store truncated snapshot",
+        stat(filename, &st) == 0 && truncate(filename, st.st_size - 1) == 0 &&
+          bgpstream_as_path_store_open_snapshot(filename) == NULL);
+  unlink(filename);
+
+  bgpstream_as_path_store_destroy(store);
+  free(ids);
+  free(idxs);
+  free(seen);
+  free(buf);
+  return 0;
+}
+
+typedef struct thread_state {
+  bgpstream_as_path_store_t *store;
+  int thread_id;
+
+  /* IDs (and store paths) of the paths added by this thread, indexed by the
+     path number (minus the first path number of the thread) */
+  bgpstream_as_path_store_path_id_t ids[THREAD_PATH_CNT];
+  bgpstream_as_path_store_path_t *spaths[THREAD_PATH_CNT];
+
+  /* number of paths whose ID (or path) matched on the second pass */
+  int matched;
+
+  /* number of errors */
+  int errors;
+
+  uint8_t buf[UINT16_MAX];
+} thread_state_t;
+
+/* Add the paths of a thread to the store. Every thread walks its paths
+   from a different starting point, so that the threads contend for the
+   same paths at different times */
+static void *thread_add(void *user)
+{
+  thread_state_t *ts = user;
+  uint32_t first = ts->thread_id * THREAD_PATH_STEP;
+  uint16_t len;
+  int i, j;
+
+  for (j = 0; j < THREAD_PATH_CNT; j++) {
+    i = (j + ts->thread_id * 397) % THREAD_PATH_CNT;
+    len = test_path(first + i, test_path_hops(first + i), ts->buf);
+    if (bgpstream_as_path_store_insert_path(ts->store, ts->buf, len, 0,
+                                            &ts->ids[i]) != 0 ||
+        (ts->spaths[i] = bgpstream_as_path_store_get_store_path(
+           ts->store, ts->ids[i])) == NULL) {
+      ts->errors++;
+    }
+  }
+  return NULL;
+}
+
+/* Look up the paths of a thread again (in the opposite order), and check
+   that they have the same IDs and store paths as when they were added */
+static void *thread_lookup(void *user)
+{
+  thread_state_t *ts = user;
+  uint32_t first = ts->thread_id * THREAD_PATH_STEP;
+  bgpstream_as_path_store_path_id_t id;
+  uint16_t len;
+  int i;
+
+  ts->matched = 0;
+  for (i = THREAD_PATH_CNT - 1; i >= 0; i--) {
+    len = test_path(first + i, test_path_hops(first + i), ts->buf);
+    if (bgpstream_as_path_store_insert_path(ts->store, ts->buf, len, 0,
+                                            &id) == 0 &&
+        id.path_hash == ts->ids[i].path_hash &&
+        id.path_id == ts->ids[i].path_id &&
+        check_path(ts->store, id, ts->buf, len, 0) != 0 &&
+        (ts->spaths[i] == NULL || bgpstream_as_path_store_get_store_path(
+                                    ts->store, id) == ts->spaths[i])) {
+      ts->matched++;
+    }
+  }
+  return NULL;
+}
+
+/* Run a function on every thread state, in parallel. Returns the number of
+   threads that could not be run */
+static int run_threads(void *(*func)(void *), thread_state_t *tss)
+{
+  pthread_t threads[THREAD_CNT];
+  int failed = 0;
+  int i;
+
+  for (i = 0; i < THREAD_CNT; i++) {
+    if (pthread_create(&threads[i], NULL, func, &tss[i]) != 0) {
+      func(&tss[i]);
+      threads[i] = pthread_self();
+      failed++;
+    }
+  }
+  for (i = 0; i < THREAD_CNT; i++) {
+    if (pthread_equal(threads[i], pthread_self()) == 0) {
+      pthread_join(threads[i], NULL);
+    }
+  }
+  return failed;
+}
+
+static int test_as_path_store_concurrent()
+{
+  bgpstream_as_path_store_t *store;
+  bgpstream_as_path_store_t *snap;
+  bgpstream_as_path_store_path_id_t *id;
+  thread_state_t *tss;
+  char filename[] = "/tmp/bgpstream-test-as-path-store-XXXXXX";
+  uint32_t idx;
+  uint8_t *seen;
+  int matched = 0;
+  int errors = 0;
+  int fd;
+  int i, t;
+
+  CHECK("Allocate thread states",
+        (tss = calloc(THREAD_CNT, sizeof(*tss))) != NULL &&
+          (seen = calloc(THREAD_DISTINCT_PATH_CNT, 1)) != NULL);
+
+  /* start small, so that the shards grow while threads use them */
+  CHECK("Create concurrent AS Path Store",
+        (store = bgpstream_as_path_store_create_concurrent(16, 4)) != NULL);
+  for (t = 0; t < THREAD_CNT; t++) {
+    tss[t].store = store;
+    tss[t].thread_id = t;
+  }
+
+  CHECK("Add overlapping paths from several threads",
+        run_threads(thread_add, tss) == 0);
+  for (t = 0; t < THREAD_CNT; t++) {
+    errors += tss[t].errors;
+  }
+  CHECK("Concurrent AS Path Store adds", errors == 0);
+  CHECK("Concurrent AS Path Store size",
+        bgpstream_as_path_store_get_size(store) == THREAD_DISTINCT_PATH_CNT);
+
+  /* paths shared by neighbouring threads must have been given the same ID
+     by both, and every path must have a distinct index */
+  for (t = 0; t < THREAD_CNT; t++) {
+    for (i = 0; i < THREAD_PATH_CNT; i++) {
+      if (t > 0 && i < THREAD_PATH_STEP) {
+        id = &tss[t - 1].ids[i + THREAD_PATH_STEP];
+        if (id->path_hash == tss[t].ids[i].path_hash &&
+            id->path_id == tss[t].ids[i].path_id &&
+            tss[t - 1].spaths[i + THREAD_PATH_STEP] == tss[t].spaths[i]) {
+          matched++;
+        }
+        continue;
+      }
+      idx = bgpstream_as_path_store_path_get_idx(tss[t].spaths[i]);
+      if (idx < THREAD_DISTINCT_PATH_CNT && seen[idx]++ == 0) {
+        matched++;
+      }
+    }
+  }
+  CHECK("Concurrent AS Path Store IDs and indices",
+        matched == THREAD_CNT * THREAD_PATH_CNT);
+
+  /* the IDs (and store paths) stay the same while other threads look up
+     paths */
+  CHECK("Look up paths from several threads",
+        run_threads(thread_lookup, tss) == 0);
+  matched = 0;
+  for (t = 0; t < THREAD_CNT; t++) {
+    matched += tss[t].matched;
+  }
+  CHECK("Concurrent AS Path Store lookups",
+        matched == THREAD_CNT * THREAD_PATH_CNT &&
+          bgpstream_as_path_store_get_size(store) ==
+            THREAD_DISTINCT_PATH_CNT);
+
+  /* a snapshot of the concurrent store keeps the IDs, and can be read by
+     several threads at once */
+  CHECK("Create snapshot file", (fd = mkstemp(filename)) >= 0);
+  close(fd);
+  CHECK("Write concurrent AS Path Store snapshot",
+        bgpstream_as_path_store_write_snapshot(store, filename) == 0);
+  CHECK("Open concurrent AS Path Store snapshot",
+        (snap = bgpstream_as_path_store_open_snapshot(filename)) != NULL);
+  unlink(filename);
+  for (t = 0; t < THREAD_CNT; t++) {
+    tss[t].store = snap;
+    memset(tss[t].spaths, 0, sizeof(tss[t].spaths));
+  }
+  CHECK("Look up paths in the snapshot from several threads",
+        run_threads(thread_lookup, tss) == 0);
+  matched = 0;
+  for (t = 0; t < THREAD_CNT; t++) {
+    matched += tss[t].matched;
+  }
+  CHECK("Concurrent AS Path Store snapshot lookups",
+        matched == THREAD_CNT * THREAD_PATH_CNT);
+
+  bgpstream_as_path_store_destroy(snap);
+  bgpstream_as_path_store_destroy(store);
+  free(tss);
+  free(seen);
+  return 0;
+}
+
+int main()
+{
+  CHECK_SECTION("AS Path Store", test_as_path_store() == 0);
+  CHECK_SECTION("AS Path Store snapshots",
+                test_as_path_store_snapshot() == 0);
+  CHECK_SECTION("Concurrent AS Path Store",
+                test_as_path_store_concurrent() == 0);
+  return 0;
+}
@@ -0,0 +1,209 @@
+/*
+ * Copyright (C) 2016 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "bgpstream_test.h"
+
+#include <arpa/inet.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define IPV4_TEST_PFX_A "192.0.43.0/24"
+#define IPV4_TEST_PFX_B "130.217.0.0/16"
+#define IPV4_TEST_PFX_B_CHILD "130.217.250.0/24"
+#define IPV4_TEST_PFX_B_ADJ "130.218.0.0/16"
+#define IPV4_TEST_PFX_OVERLAP "130.216.0.0/14"
+#define IPV4_TEST_IP_CNT (256 + 65536 * 2)
+
+#define IPV6_TEST_PFX_A "2001:500:88::/48"
+#define IPV6_TEST_PFX_A_CHILD "2001:500:88:beef::/64"
+#define IPV6_TEST_PFX_B "2001:48d0:101:501:beef::/96"
+#define IPV6_TEST_PFX_B_SIBLING "2001:48d0:101:501:cafe::/96"
+#define IPV6_TEST_64_CNT 65537
+
+/* Sizes of the benchmark prefix sets (roughly a full table each) */
+#define BENCH_IPV4_PFX_CNT 1000000
+#define BENCH_IPV6_PFX_CNT 200000
+
+/* Number of overlap queries to run in the benchmark */
+#define BENCH_QUERY_CNT 1000000
+
+static int add_pfx(bgpstream_ip_counter_t *ipc, const char *str)
+{
+  bgpstream_pfx_storage_t pfx;
+  if (bgpstream_str2pfx(str, &pfx) == NULL) {
+    return -1;
+  }
+  return bgpstream_ip_counter_add(ipc, (bgpstream_pfx_t *)&pfx);
+}
+
+static uint64_t overlap(bgpstream_ip_counter_t *ipc, const char *str,
+                        uint8_t *more_specific)
+{
+  bgpstream_pfx_storage_t pfx;
+  if (bgpstream_str2pfx(str, &pfx) == NULL) {
+    return UINT64_MAX;
+  }
+  return bgpstream_ip_counter_is_overlapping(ipc, (bgpstream_pfx_t *)&pfx,
+                                             more_specific);
+}
+
+static int test_ip_counter()
+{
+  bgpstream_ip_counter_t *ipc;
+  uint8_t more_specific;
+
+  CHECK("Create IP Counter", (ipc = bgpstream_ip_counter_create()) != NULL);
+
+  /* IPv4 */
+  CHECK("IP Counter add IPv4 prefixes",
+        add_pfx(ipc, IPV4_TEST_PFX_A) == 0 &&
+          add_pfx(ipc, IPV4_TEST_PFX_B) == 0 &&
+          add_pfx(ipc, IPV4_TEST_PFX_B_CHILD) == 0 &&
+          add_pfx(ipc, IPV4_TEST_PFX_B_ADJ) == 0);
+
+  CHECK("IP Counter IPv4 count",
+        bgpstream_ip_counter_get_ipcount(ipc, BGPSTREAM_ADDR_VERSION_IPV4) ==
+          IPV4_TEST_IP_CNT);
+
+  CHECK("IP Counter IPv4 more specific",
+        overlap(ipc, IPV4_TEST_PFX_B_CHILD, &more_specific) == 256 &&
+          more_specific == 1);
+
+  CHECK("IP Counter IPv4 overlap",
+        overlap(ipc, IPV4_TEST_PFX_OVERLAP, &more_specific) == 65536 * 2 &&
+          more_specific == 0);
+
+  /* IPv6 */
+  CHECK("IP Counter add IPv6 prefixes",
+        add_pfx(ipc, IPV6_TEST_PFX_A) == 0 &&
+          add_pfx(ipc, IPV6_TEST_PFX_A_CHILD) == 0 &&
+          add_pfx(ipc, IPV6_TEST_PFX_B) == 0 &&
+          add_pfx(ipc, IPV6_TEST_PFX_B_SIBLING) == 0);
+
+  CHECK("IP Counter IPv6 /64 count",
+        bgpstream_ip_counter_get_ipcount(ipc, BGPSTREAM_ADDR_VERSION_IPV6) ==
+          IPV6_TEST_64_CNT);
+
+  CHECK("IP Counter IPv6 more specific",
+        overlap(ipc, IPV6_TEST_PFX_A_CHILD, &more_specific) == 1 &&
+          more_specific == 1);
+
+  CHECK("IP Counter IPv6 partial overlap",
+        overlap(ipc, "2001:48d0:101:501::/64", &more_specific) == 1 &&
+          more_specific == 0);
+
+  CHECK("IP Counter IPv4 count unchanged",
+        bgpstream_ip_counter_get_ipcount(ipc, BGPSTREAM_ADDR_VERSION_IPV4) ==
+          IPV4_TEST_IP_CNT);
+
+  bgpstream_ip_counter_clear(ipc);
+  CHECK("IP Counter clear",
+        bgpstream_ip_counter_get_ipcount(ipc, BGPSTREAM_ADDR_VERSION_IPV4) ==
+            0 &&
+          bgpstream_ip_counter_get_ipcount(ipc, BGPSTREAM_ADDR_VERSION_IPV6) ==
+            0);
+
+  bgpstream_ip_counter_destroy(ipc);
+  return 0;
+}
+
+static int bench_ip_counter()
+{
+  bgpstream_ip_counter_t *ipc, *batch;
+  bgpstream_pfx_storage_t *pfxs, pfx;
+  int cnt = BENCH_IPV4_PFX_CNT + BENCH_IPV6_PFX_CNT;
+  struct timespec start;
+  uint64_t state = 1;
+  uint64_t overlapping = 0;
+  uint8_t more_specific;
+  int i;
+
+  CHECK("Allocate benchmark prefixes",
+        (pfxs = malloc(sizeof(bgpstream_pfx_storage_t) * cnt)) != NULL);
+  for (i = 0; i < BENCH_IPV4_PFX_CNT; i++) {
+    bench_pfx(&state, BGPSTREAM_ADDR_VERSION_IPV4, &pfxs[i]);
+  }
+  for (; i < cnt; i++) {
+    bench_pfx(&state, BGPSTREAM_ADDR_VERSION_IPV6, &pfxs[i]);
+  }
+
+  CHECK("Create IP Counters", (ipc = bgpstream_ip_counter_create()) != NULL &&
+                                (batch = bgpstream_ip_counter_create()) != NULL);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (i = 0; i < cnt; i++) {
+    if (bgpstream_ip_counter_add(ipc, (bgpstream_pfx_t *)&pfxs[i]) != 0) {
+      break;
+    }
+  }
+  bgpstream_ip_counter_get_ipcount(ipc, BGPSTREAM_ADDR_VERSION_IPV4);
+  bgpstream_ip_counter_get_ipcount(ipc, BGPSTREAM_ADDR_VERSION_IPV6);
+  fprintf(stderr, "   add %d prefixes: %.3fs\n", cnt, bench_elapsed(&start));
+  CHECK("IP Counter benchmark add", i == cnt);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  CHECK("IP Counter benchmark add batch",
+        bgpstream_ip_counter_add_batch(batch, pfxs, cnt) == 0);
+  fprintf(stderr, "   add batch of %d prefixes: %.3fs\n", cnt,
+          bench_elapsed(&start));
+
+  CHECK("IP Counter benchmark counts match",
+        bgpstream_ip_counter_get_ipcount(ipc, BGPSTREAM_ADDR_VERSION_IPV4) ==
+            bgpstream_ip_counter_get_ipcount(batch,
+                                             BGPSTREAM_ADDR_VERSION_IPV4) &&
+          bgpstream_ip_counter_get_ipcount(ipc, BGPSTREAM_ADDR_VERSION_IPV6) ==
+            bgpstream_ip_counter_get_ipcount(batch,
+                                             BGPSTREAM_ADDR_VERSION_IPV6));
+
+  state = 2;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (i = 0; i < BENCH_QUERY_CNT; i++) {
+    bench_pfx(&state, (i % 5) == 0 ? BGPSTREAM_ADDR_VERSION_IPV6
+                                   : BGPSTREAM_ADDR_VERSION_IPV4,
+              &pfx);
+    if (bgpstream_ip_counter_is_overlapping(batch, (bgpstream_pfx_t *)&pfx,
+                                            &more_specific) != 0) {
+      overlapping++;
+    }
+  }
+  fprintf(stderr, "   %d overlap queries: %.3fs (%" PRIu64 " overlapping)\n",
+          BENCH_QUERY_CNT, bench_elapsed(&start), overlapping);
+
+  free(pfxs);
+  bgpstream_ip_counter_destroy(batch);
+  bgpstream_ip_counter_destroy(ipc);
+  return 0;
+}
+
+int main()
+{
+  CHECK_SECTION("IP Counter", test_ip_counter() == 0);
+  CHECK_SECTION("IP Counter Benchmark", bench_ip_counter() == 0);
+  return 0;
+}
@@ -33,6 +33,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -53,13 +54,44 @@ char buffer[BUFFER_LEN];
 #define IPV6_TEST_64_CNT 65537
 #define IPV6_TEST_PFX_CNT 4
 
+#define IPV4_TEST_PFX_ABSENT "130.217.240.0/20"
+
+/* Number of random prefixes (per address version) in the snapshot test */
+#define SNAP_TEST_PFX_CNT 5000
+
+/* Size of the payload slot of each node in the snapshot test */
+#define SNAP_TEST_PAYLOAD_LEN (2 * sizeof(uint64_t))
+
+/* Offset of the l index of the first (root) IPv4 node of a snapshot: the
+   header takes one 64-byte section, and the node starts with the user
+   pointer and its own index */
+#define SNAP_TEST_ROOT_L_OFF (64 + sizeof(void *) + sizeof(uint32_t))
+
+/* Sizes of the benchmark trees (roughly a full table each) */
+#define BENCH_IPV4_PFX_CNT 1000000
+#define BENCH_IPV6_PFX_CNT 200000
+
+/* Number of addresses to look up in the longest-prefix-match benchmark */
+#define BENCH_LPM_ADDR_CNT 1000000
+#define BENCH_LPM_BATCH_LEN 1000
+static bgpstream_patricia_node_t *batch_nodes[BENCH_LPM_BATCH_LEN];
+
+/* Count visited nodes, and stop after the second one */
+static int visit_count(bgpstream_patricia_tree_t *pt,
+                       bgpstream_patricia_node_t *node, void *data)
+{
+  return ++(*(int *)data) == 2;
+}
+
 int test_patricia()
 {
   bgpstream_patricia_tree_t *pt;
   bgpstream_patricia_tree_result_set_t *res;
+  bgpstream_patricia_tree_iter_t iter;
   bgpstream_patricia_node_t *node;
   bgpstream_pfx_storage_t pfx;
   bgpstream_pfx_t *pfxp;
+  int visited = 0;
 
   /* Create a Patricia Tree */
   CHECK("Create Patricia Tree",
@@ -170,14 +202,441 @@ int test_patricia()
             (bgpstream_pfx_t *)pfxp,
             (bgpstream_pfx_t *)bgpstream_str2pfx(IPV4_TEST_PFX_B, &pfx)) != 0);
 
+  /* Queries for prefixes that are not in the tree */
+  CHECK("Patricia Tree v4 iterate less specifics of absent pfx",
+        (bgpstream_patricia_tree_iter_less_specifics(
+           &iter, pt, (bgpstream_pfx_t *)bgpstream_str2pfx(
+                        IPV4_TEST_PFX_ABSENT, &pfx)),
+         (node = bgpstream_patricia_tree_iter_next(&iter)) != NULL) &&
+          bgpstream_pfx_equal(
+            bgpstream_patricia_tree_get_pfx(node),
+            (bgpstream_pfx_t *)bgpstream_str2pfx(IPV4_TEST_PFX_B, &pfx)) != 0 &&
+          bgpstream_patricia_tree_iter_next(&iter) == NULL);
+
+  CHECK("Patricia Tree v4 iterate more specifics of absent pfx",
+        (bgpstream_patricia_tree_iter_more_specifics(
+           &iter, pt, (bgpstream_pfx_t *)bgpstream_str2pfx(
+                        IPV4_TEST_PFX_ABSENT, &pfx)),
+         (node = bgpstream_patricia_tree_iter_next(&iter)) != NULL) &&
+          bgpstream_pfx_equal(bgpstream_patricia_tree_get_pfx(node),
+                              (bgpstream_pfx_t *)bgpstream_str2pfx(
+                                IPV4_TEST_PFX_B_CHILD, &pfx)) != 0 &&
+          bgpstream_patricia_tree_iter_next(&iter) == NULL);
+
+  CHECK("Patricia Tree v6 visit more specifics (stop early)",
+        bgpstream_patricia_tree_visit_more_specifics(
+          pt, (bgpstream_pfx_t *)bgpstream_str2pfx("2001::/16", &pfx),
+          visit_count, &visited) == 1 &&
+          visited == 2);
+
+  CHECK("Patricia Tree overlap info does not modify the tree",
+        bgpstream_patricia_tree_get_pfx_overlap_info(
+          pt, (bgpstream_pfx_t *)bgpstream_str2pfx(IPV4_TEST_PFX_ABSENT,
+                                                   &pfx)) ==
+            (BGPSTREAM_PATRICIA_LESS_SPECIFICS |
+             BGPSTREAM_PATRICIA_MORE_SPECIFICS) &&
+          bgpstream_patricia_prefix_count(pt, BGPSTREAM_ADDR_VERSION_IPV4) ==
+            IPV4_TEST_PFX_CNT);
+
   bgpstream_patricia_tree_destroy(pt);
   bgpstream_patricia_tree_result_set_destroy(&res);
 
   return 0;
 }
 
+/* Fill the payload slot of a node from its user value */
+static int snap_write_user(void *user, void *slot, size_t slot_len,
+                           void *data)
+{
+  uint64_t *payload = slot;
+
+  if (slot_len != SNAP_TEST_PAYLOAD_LEN) {
+    return -1;
+  }
+  payload[0] = *(uint64_t *)user;
+  payload[1] = ~payload[0];
+  return 0;
+}
+
+/* Check the payload of a snapshot node against the user value of the same
+   prefix in the original tree (nodes without a user value have a zeroed
+   slot) */
+static int snap_check_payload(bgpstream_patricia_tree_t *pt,
+                              bgpstream_patricia_tree_t *snap,
+                              bgpstream_pfx_t *pfx)
+{
+  bgpstream_patricia_node_t *node, *snap_node;
+  uint64_t *payload;
+  uint64_t *user;
+
+  if ((node = bgpstream_patricia_tree_search_exact(pt, pfx)) == NULL ||
+      (snap_node = bgpstream_patricia_tree_search_exact(snap, pfx)) == NULL ||
+      (payload = bgpstream_patricia_tree_get_payload(snap, snap_node)) ==
+        NULL ||
+      bgpstream_patricia_tree_get_user(snap_node) != NULL) {
+    return 0;
+  }
+  if ((user = bgpstream_patricia_tree_get_user(node)) == NULL) {
+    return payload[0] == 0 && payload[1] == 0;
+  }
+  return payload[0] == *user && payload[1] == ~*user;
+}
+
+/* Overwrite 4 bytes of a snapshot file, and check that it can no longer be
+   opened. The file is restored afterwards */
+static int snap_check_corrupt(const char *filename, off_t off, uint32_t val)
+{
+  bgpstream_patricia_tree_t *snap;
+  uint32_t orig;
+  int fd;
+  int rc;
+
+  if ((fd = open(filename, O_RDWR)) < 0 ||
+      pread(fd, &orig, sizeof(orig), off) != sizeof(orig) ||
+      pwrite(fd, &val, sizeof(val), off) != sizeof(val)) {
+    return 0;
+  }
+  if ((snap = bgpstream_patricia_tree_open_snapshot(filename)) != NULL) {
+    bgpstream_patricia_tree_destroy(snap);
+  }
+  rc = (snap == NULL) &&
+       pwrite(fd, &orig, sizeof(orig), off) == sizeof(orig);
+  close(fd);
+  return rc;
+}
+
+int test_patricia_snapshot()
+{
+  static const bgpstream_addr_version_t versions[] = {
+    BGPSTREAM_ADDR_VERSION_IPV4, BGPSTREAM_ADDR_VERSION_IPV6};
+  bgpstream_patricia_tree_t *pt;
+  bgpstream_patricia_tree_t *snap;
+  bgpstream_patricia_node_t *node = NULL;
+  bgpstream_pfx_storage_t *pfxs;
+  bgpstream_pfx_storage_t pfx;
+  char filename[] = "/tmp/bgpstream-test-patricia-XXXXXX";
+  uint64_t *vals;
+  uint64_t state = 44;
+  struct stat st;
+  int matched = 0;
+  int fd;
+  int i, j;
+
+  CHECK("Allocate snapshot test prefixes",
+        (pfxs = malloc(sizeof(*pfxs) * SNAP_TEST_PFX_CNT * 2)) != NULL &&
+          (vals = malloc(sizeof(*vals) * SNAP_TEST_PFX_CNT * 2)) != NULL);
+  CHECK("Create Patricia Tree",
+        (pt = bgpstream_patricia_tree_create(NULL)) != NULL);
+
+  /* random prefixes of both versions, half of them with a user value */
+  for (j = 0; j < 2; j++) {
+    for (i = j * SNAP_TEST_PFX_CNT; i < (j + 1) * SNAP_TEST_PFX_CNT; i++) {
+      bench_pfx(&state, versions[j], &pfxs[i]);
+      vals[i] = i + 1;
+      if ((node = bgpstream_patricia_tree_insert(
+             pt, (bgpstream_pfx_t *)&pfxs[i])) == NULL) {
+        break;
+      }
+      if (i % 2 == 0) {
+        bgpstream_patricia_tree_set_user(pt, node, &vals[i]);
+      }
+    }
+    CHECK("Insert into Patricia Tree (snapshot)",
+          i == (j + 1) * SNAP_TEST_PFX_CNT);
+  }
+  CHECK("Patricia Tree payload of a tree that is not a snapshot",
+        node != NULL && bgpstream_patricia_tree_get_payload(pt, node) == NULL);
+
+  CHECK("Create snapshot file", (fd = mkstemp(filename)) >= 0);
+  close(fd);
+  CHECK("Write Patricia Tree snapshot with payloads",
+        bgpstream_patricia_tree_write_snapshot(pt, filename,
+                                               SNAP_TEST_PAYLOAD_LEN,
+                                               snap_write_user, NULL) == 0);
+  CHECK("Open Patricia Tree snapshot with payloads",
+        (snap = bgpstream_patricia_tree_open_snapshot(filename)) != NULL);
+
+  CHECK("Patricia Tree snapshot v4 count",
+        bgpstream_patricia_prefix_count(snap, BGPSTREAM_ADDR_VERSION_IPV4) ==
+          bgpstream_patricia_prefix_count(pt, BGPSTREAM_ADDR_VERSION_IPV4));
+  CHECK("Patricia Tree snapshot v6 count",
+        bgpstream_patricia_prefix_count(snap, BGPSTREAM_ADDR_VERSION_IPV6) ==
+          bgpstream_patricia_prefix_count(pt, BGPSTREAM_ADDR_VERSION_IPV6));
+  CHECK("Patricia Tree snapshot /64 count",
+        bgpstream_patricia_tree_count_64subnets(snap) ==
+          bgpstream_patricia_tree_count_64subnets(pt));
+
+  for (i = 0; i < SNAP_TEST_PFX_CNT * 2; i++) {
+    matched += snap_check_payload(pt, snap, (bgpstream_pfx_t *)&pfxs[i]);
+  }
+  CHECK("Patricia Tree snapshot payloads", matched == SNAP_TEST_PFX_CNT * 2);
+
+  bgpstream_patricia_tree_remove(snap, (bgpstream_pfx_t *)&pfxs[0]);
+  bgpstream_patricia_tree_clear(snap);
+  CHECK("Patricia Tree snapshot is read-only",
+        bgpstream_patricia_tree_insert(snap, (bgpstream_pfx_t *)&pfxs[0]) ==
+            NULL &&
+          bgpstream_patricia_tree_bulk_insert(snap, pfxs, 1) == -1 &&
+          bgpstream_patricia_prefix_count(snap, BGPSTREAM_ADDR_VERSION_IPV4) ==
+            bgpstream_patricia_prefix_count(pt, BGPSTREAM_ADDR_VERSION_IPV4));
+
+  CHECK("Patricia Tree snapshot v6 overlap info",
+        bgpstream_patricia_tree_get_pfx_overlap_info(
+          snap, (bgpstream_pfx_t *)&pfxs[SNAP_TEST_PFX_CNT]) ==
+          bgpstream_patricia_tree_get_pfx_overlap_info(
+            pt, (bgpstream_pfx_t *)&pfxs[SNAP_TEST_PFX_CNT]));
+  /* longest prefix match of a /64 inside each IPv6 prefix */
+  matched = 0;
+  for (i = SNAP_TEST_PFX_CNT; i < SNAP_TEST_PFX_CNT * 2; i++) {
+    pfx = pfxs[i];
+    pfx.mask_len = 64;
+    pfx.address.ipv6.s6_addr[7] = 1;
+    if ((node = bgpstream_patricia_tree_search_best(
+           snap, (bgpstream_pfx_t *)&pfx)) != NULL &&
+        bgpstream_pfx_equal(bgpstream_patricia_tree_get_pfx(node),
+                            bgpstream_patricia_tree_get_pfx(
+                              bgpstream_patricia_tree_search_best(
+                                pt, (bgpstream_pfx_t *)&pfx))) != 0) {
+      matched++;
+    }
+  }
+  CHECK("Patricia Tree snapshot v6 search best",
+        matched == SNAP_TEST_PFX_CNT);
+  bgpstream_patricia_tree_destroy(snap);
+
+  /* corrupt snapshots must be rejected */
+  CHECK("Patricia Tree snapshot with child index out of range",
+        snap_check_corrupt(filename, SNAP_TEST_ROOT_L_OFF, 0xfffffff0) == 1);
+  CHECK("Patricia Tree snapshot with a loop",
+        snap_check_corrupt(filename, SNAP_TEST_ROOT_L_OFF, 0) == 1);
+  CHECK("Patricia Tree snapshot restored",
+        (snap = bgpstream_patricia_tree_open_snapshot(filename)) != NULL);
+  bgpstream_patricia_tree_destroy(snap);
+  CHECK("Patricia Tree truncated snapshot",
+        stat(filename, &st) == 0 && truncate(filename, st.st_size - 1) == 0 &&
+          bgpstream_patricia_tree_open_snapshot(filename) == NULL);
+  unlink(filename);
+
+  bgpstream_patricia_tree_destroy(pt);
+  free(pfxs);
+  free(vals);
+  return 0;
+}
+
+static int bench_version(bgpstream_addr_version_t v, int cnt)
+{
+  bgpstream_patricia_tree_t *pt;
+  bgpstream_pfx_storage_t pfx;
+  struct timespec start;
+  uint64_t state;
+  int found = 0;
+  int i;
+
+  CHECK("Create Patricia Tree",
+        (pt = bgpstream_patricia_tree_create(NULL)) != NULL);
+
+  state = v;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (i = 0; i < cnt; i++) {
+    bench_pfx(&state, v, &pfx);
+    if (bgpstream_patricia_tree_insert(pt, (bgpstream_pfx_t *)&pfx) == NULL) {
+      break;
+    }
+  }
+  fprintf(stderr, "   insert %d prefixes: %.3fs\n", cnt,
+          bench_elapsed(&start));
+  CHECK("Patricia Tree benchmark insert", i == cnt);
+
+  state = v;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (i = 0; i < cnt; i++) {
+    bench_pfx(&state, v, &pfx);
+    if (bgpstream_patricia_tree_search_exact(pt, (bgpstream_pfx_t *)&pfx) !=
+        NULL) {
+      found++;
+    }
+  }
+  fprintf(stderr, "   search %d prefixes: %.3fs\n", cnt,
+          bench_elapsed(&start));
+  CHECK("Patricia Tree benchmark search exact", found == cnt);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  bgpstream_patricia_tree_destroy(pt);
+  fprintf(stderr, "   destroy: %.3fs\n", bench_elapsed(&start));
+
+  return 0;
+}
+
+static int bench_lpm()
+{
+  bgpstream_patricia_tree_t *pt;
+  bgpstream_pfx_storage_t pfx;
+  bgpstream_addr_storage_t *addrs;
+  bgpstream_patricia_node_t **nodes;
+  struct timespec start;
+  uint64_t state = 42;
+  int matched = 0;
+  int mismatched = 0;
+  int i;
+
+  CHECK("Create Patricia Tree",
+        (pt = bgpstream_patricia_tree_create(NULL)) != NULL);
+  for (i = 0; i < BENCH_IPV4_PFX_CNT; i++) {
+    bench_pfx(&state, BGPSTREAM_ADDR_VERSION_IPV4, &pfx);
+    bgpstream_patricia_tree_insert(pt, (bgpstream_pfx_t *)&pfx);
+  }
+
+  CHECK("Allocate lookup arrays",
+        (addrs = malloc(sizeof(*addrs) * BENCH_LPM_ADDR_CNT)) != NULL &&
+          (nodes = malloc(sizeof(*nodes) * BENCH_LPM_ADDR_CNT)) != NULL);
+  for (i = 0; i < BENCH_LPM_ADDR_CNT; i++) {
+    addrs[i].version = BGPSTREAM_ADDR_VERSION_IPV4;
+    addrs[i].ipv4.s_addr = htonl(bench_rand(&state));
+  }
+
+  pfx.mask_len = 32;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (i = 0; i < BENCH_LPM_ADDR_CNT; i++) {
+    bgpstream_addr_copy((bgpstream_ip_addr_t *)&pfx.address,
+                        (bgpstream_ip_addr_t *)&addrs[i]);
+    if ((nodes[i] = bgpstream_patricia_tree_search_best(
+           pt, (bgpstream_pfx_t *)&pfx)) != NULL) {
+      matched++;
+    }
+  }
+  fprintf(stderr, "   lookup %d addresses one at a time: %.3fs (%d matched)\n",
+          BENCH_LPM_ADDR_CNT, bench_elapsed(&start), matched);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (i = 0; i < BENCH_LPM_ADDR_CNT; i += BENCH_LPM_BATCH_LEN) {
+    bgpstream_patricia_tree_search_addr_batch(
+      pt, &addrs[i], BENCH_LPM_BATCH_LEN, batch_nodes);
+    mismatched += memcmp(batch_nodes, &nodes[i], sizeof(batch_nodes)) != 0;
+  }
+  fprintf(stderr, "   lookup %d addresses in batches of %d: %.3fs\n",
+          BENCH_LPM_ADDR_CNT, BENCH_LPM_BATCH_LEN, bench_elapsed(&start));
+  CHECK("Patricia Tree batch lookup matches single lookups", mismatched == 0);
+
+  free(addrs);
+  free(nodes);
+  bgpstream_patricia_tree_destroy(pt);
+  return 0;
+}
+
+static int bench_pfx_cmp(const void *a, const void *b)
+{
+  const bgpstream_pfx_storage_t *pa = a, *pb = b;
+  uint32_t aa = ntohl(pa->address.ipv4.s_addr);
+  uint32_t ba = ntohl(pb->address.ipv4.s_addr);
+
+  if (aa != ba) {
+    return (aa < ba) ? -1 : 1;
+  }
+  return (int)pa->mask_len - (int)pb->mask_len;
+}
+
+static int bench_bulk()
+{
+  bgpstream_patricia_tree_t *pt;
+  bgpstream_patricia_tree_t *snap;
+  bgpstream_pfx_storage_t *pfxs;
+  struct timespec start;
+  char filename[] = "/tmp/bgpstream-test-patricia-XXXXXX";
+  uint64_t state = 43;
+  uint64_t cnt;
+  int found = 0;
+  int fd;
+  int i;
+
+  CHECK("Allocate prefix array",
+        (pfxs = malloc(sizeof(*pfxs) * BENCH_IPV4_PFX_CNT)) != NULL);
+  for (i = 0; i < BENCH_IPV4_PFX_CNT; i++) {
+    bench_pfx(&state, BGPSTREAM_ADDR_VERSION_IPV4, &pfxs[i]);
+  }
+  qsort(pfxs, BENCH_IPV4_PFX_CNT, sizeof(*pfxs), bench_pfx_cmp);
+
+  CHECK("Create Patricia Tree",
+        (pt = bgpstream_patricia_tree_create(NULL)) != NULL);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (i = 0; i < BENCH_IPV4_PFX_CNT; i++) {
+    bgpstream_patricia_tree_insert(pt, (bgpstream_pfx_t *)&pfxs[i]);
+  }
+  fprintf(stderr, "   insert %d sorted prefixes: %.3fs\n", BENCH_IPV4_PFX_CNT,
+          bench_elapsed(&start));
+  cnt = bgpstream_patricia_prefix_count(pt, BGPSTREAM_ADDR_VERSION_IPV4);
+  bgpstream_patricia_tree_destroy(pt);
+
+  CHECK("Create Patricia Tree",
+        (pt = bgpstream_patricia_tree_create(NULL)) != NULL);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  CHECK("Patricia Tree bulk insert",
+        bgpstream_patricia_tree_bulk_insert(pt, pfxs, BENCH_IPV4_PFX_CNT) ==
+          0);
+  fprintf(stderr, "   bulk insert %d sorted prefixes: %.3fs\n",
+          BENCH_IPV4_PFX_CNT, bench_elapsed(&start));
+  CHECK("Patricia Tree bulk insert count",
+        bgpstream_patricia_prefix_count(pt, BGPSTREAM_ADDR_VERSION_IPV4) ==
+          cnt);
+
+  CHECK("Create snapshot file", (fd = mkstemp(filename)) >= 0);
+  close(fd);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  CHECK("Write Patricia Tree snapshot",
+        bgpstream_patricia_tree_write_snapshot(pt, filename, 0, NULL, NULL) ==
+          0);
+  fprintf(stderr, "   write snapshot: %.3fs\n", bench_elapsed(&start));
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  CHECK("Open Patricia Tree snapshot",
+        (snap = bgpstream_patricia_tree_open_snapshot(filename)) != NULL);
+  fprintf(stderr, "   open snapshot: %.6fs\n", bench_elapsed(&start));
+  unlink(filename);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (i = 0; i < BENCH_IPV4_PFX_CNT; i++) {
+    if (bgpstream_patricia_tree_search_exact(
+          snap, (bgpstream_pfx_t *)&pfxs[i]) != NULL) {
+      found++;
+    }
+  }
+  fprintf(stderr, "   search %d prefixes in snapshot: %.3fs\n",
+          BENCH_IPV4_PFX_CNT, bench_elapsed(&start));
+  CHECK("Patricia Tree snapshot search exact",
+        found == BENCH_IPV4_PFX_CNT &&
+          bgpstream_patricia_prefix_count(snap, BGPSTREAM_ADDR_VERSION_IPV4) ==
+            cnt);
+
+  free(pfxs);
+  bgpstream_patricia_tree_destroy(snap);
+  bgpstream_patricia_tree_destroy(pt);
+  return 0;
+}
+
+int bench_patricia()
+{
+  fprintf(stderr, " * IPv4:\n");
+  if (bench_version(BGPSTREAM_ADDR_VERSION_IPV4, BENCH_IPV4_PFX_CNT) != 0) {
+    return -1;
+  }
+  fprintf(stderr, " * IPv6:\n");
+  if (bench_version(BGPSTREAM_ADDR_VERSION_IPV6, BENCH_IPV6_PFX_CNT) != 0) {
+    return -1;
+  }
+  fprintf(stderr, " * IPv4 longest prefix match:\n");
+  if (bench_lpm() != 0) {
+    return -1;
+  }
+  fprintf(stderr, " * IPv4 bulk load and snapshot:\n");
+  if (bench_bulk() != 0) {
+    return -1;
+  }
+  return 0;
+}
+
 int main()
 {
   CHECK_SECTION("Patricia Tree", test_patricia() == 0);
+  CHECK_SECTION("Patricia Tree snapshots", test_patricia_snapshot() == 0);
+  CHECK_SECTION("Patricia Tree Benchmark", bench_patricia() == 0);
   return 0;
 }
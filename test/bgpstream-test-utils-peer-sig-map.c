@@ -0,0 +1,242 @@
+/*
+ * Copyright (C) 2016 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "bgpstream_test.h"
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Number of peers added to the test map (enough that both the signature
+   arena and the ID index grow several times) */
+#define TEST_PEER_CNT 2000
+
+/* Number of collectors the test peers are spread over */
+#define TEST_COLLECTOR_CNT 4
+
+/* Number of distinct peer IDs a map can hand out */
+#define MAX_PEER_CNT UINT16_MAX
+
+/* Number of peers, and of lookups, in the benchmark */
+#define BENCH_PEER_CNT 1000
+#define BENCH_LOOKUP_CNT 10000000
+
+/* Fill in the (deterministic) signature of the n-th test peer. Every third
+   peer is an IPv6 peer */
+static void test_peer(uint32_t n, bgpstream_peer_sig_t *ps)
+{
+  memset(ps, 0, sizeof(*ps));
+  snprintf(ps->collector_str, sizeof(ps->collector_str), "rrc%02d",
+           n % TEST_COLLECTOR_CNT);
+  if (n % 3 == 0) {
+    ps->peer_ip_addr.version = BGPSTREAM_ADDR_VERSION_IPV6;
+    ps->peer_ip_addr.ipv6.s6_addr[0] = 0x20;
+    ps->peer_ip_addr.ipv6.s6_addr[1] = 0x01;
+    ps->peer_ip_addr.ipv6.s6_addr[2] = 0x0d;
+    ps->peer_ip_addr.ipv6.s6_addr[3] = 0xb8;
+    memcpy(&ps->peer_ip_addr.ipv6.s6_addr[12], &n, sizeof(n));
+  } else {
+    ps->peer_ip_addr.version = BGPSTREAM_ADDR_VERSION_IPV4;
+    ps->peer_ip_addr.ipv4.s_addr = htonl(0x0a000000 | n);
+  }
+  ps->peer_asnumber = 64512 + n;
+}
+
+/* Get the ID of the n-th test peer, using the public get_id function */
+static bgpstream_peer_id_t get_id(bgpstream_peer_sig_map_t *map, uint32_t n)
+{
+  bgpstream_peer_sig_t ps;
+
+  test_peer(n, &ps);
+  return bgpstream_peer_sig_map_get_id(map, ps.collector_str,
+                                       (bgpstream_ip_addr_t *)&ps.peer_ip_addr,
+                                       ps.peer_asnumber);
+}
+
+/* Check that a signature from the map matches the n-th test peer */
+static int sig_matches(bgpstream_peer_sig_t *ps, uint32_t n)
+{
+  bgpstream_peer_sig_t expected;
+
+  test_peer(n, &expected);
+  return ps != NULL &&
+         strcmp(ps->collector_str, expected.collector_str) == 0 &&
+         bgpstream_addr_storage_equal(&ps->peer_ip_addr,
+                                      &expected.peer_ip_addr) != 0 &&
+         ps->peer_asnumber == expected.peer_asnumber;
+}
+
+static int test_peer_sig_map()
+{
+  bgpstream_peer_sig_map_t *map;
+  bgpstream_peer_id_t ids[TEST_PEER_CNT];
+  bgpstream_peer_sig_t *sigs[TEST_PEER_CNT];
+  bgpstream_peer_sig_t ps;
+  bgpstream_peer_id_t id;
+  uint8_t *seen;
+  int matched = 0;
+  int i;
+
+  CHECK("Create peer sig map",
+        (map = bgpstream_peer_sig_map_create()) != NULL &&
+          (seen = calloc(MAX_PEER_CNT + 1, 1)) != NULL);
+
+  /* keep the signature pointers handed out as the map grows */
+  for (i = 0; i < TEST_PEER_CNT; i++) {
+    if ((ids[i] = get_id(map, i)) == 0 ||
+        (sigs[i] = bgpstream_peer_sig_map_get_sig(map, ids[i])) == NULL) {
+      break;
+    }
+  }
+  CHECK("Add peers to peer sig map", i == TEST_PEER_CNT);
+  CHECK("Peer sig map size",
+        bgpstream_peer_sig_map_get_size(map) == TEST_PEER_CNT);
+
+  /* IDs are distinct and dense, and neither they nor the signatures move
+     once assigned */
+  for (i = 0; i < TEST_PEER_CNT; i++) {
+    test_peer(i, &ps);
+    if (ids[i] <= TEST_PEER_CNT && seen[ids[i]]++ == 0 &&
+        get_id(map, i) == ids[i] &&
+        bgpstream_peer_sig_map_get_id_from_sig(map, &ps) == ids[i] &&
+        bgpstream_peer_sig_map_get_sig(map, ids[i]) == sigs[i] &&
+        sig_matches(sigs[i], i) != 0) {
+      matched++;
+    }
+  }
+  CHECK("Peer sig map IDs and signatures are stable", matched == TEST_PEER_CNT);
+  CHECK("Peer sig map lookups do not add peers",
+        bgpstream_peer_sig_map_get_size(map) == TEST_PEER_CNT);
+
+  CHECK("Peer sig map unknown IDs",
+        bgpstream_peer_sig_map_get_sig(map, 0) == NULL &&
+          bgpstream_peer_sig_map_get_sig(map, TEST_PEER_CNT + 1) == NULL &&
+          bgpstream_peer_sig_map_get_sig(map, MAX_PEER_CNT) == NULL);
+
+  /* the AS number is not part of the key, but the collector is */
+  test_peer(0, &ps);
+  ps.peer_asnumber++;
+  CHECK("Peer sig map ignores the AS number",
+        bgpstream_peer_sig_map_get_id_from_sig(map, &ps) == ids[0]);
+  strcpy(ps.collector_str, "route-views2");
+  CHECK("Peer sig map keys on the collector",
+        (id = bgpstream_peer_sig_map_get_id_from_sig(map, &ps)) != 0 &&
+          id != ids[0] &&
+          bgpstream_peer_sig_map_get_size(map) == TEST_PEER_CNT + 1);
+
+  /* a cleared map forgets every peer, but can be filled again */
+  bgpstream_peer_sig_map_clear(map);
+  CHECK("Clear peer sig map",
+        bgpstream_peer_sig_map_get_size(map) == 0 &&
+          bgpstream_peer_sig_map_get_sig(map, ids[0]) == NULL);
+  matched = 0;
+  for (i = 0; i < TEST_PEER_CNT; i++) {
+    if ((id = get_id(map, i)) != 0 &&
+        sig_matches(bgpstream_peer_sig_map_get_sig(map, id), i) != 0) {
+      matched++;
+    }
+  }
+  CHECK("Refill peer sig map",
+        matched == TEST_PEER_CNT &&
+          bgpstream_peer_sig_map_get_size(map) == TEST_PEER_CNT);
+  bgpstream_peer_sig_map_destroy(map);
+
+  /* once every ID is in use, new peers get the error ID, and the existing
+     ones are left alone */
+  CHECK("Create peer sig map",
+        (map = bgpstream_peer_sig_map_create()) != NULL);
+  for (i = 0; i < MAX_PEER_CNT; i++) {
+    if (get_id(map, i) == 0) {
+      break;
+    }
+  }
+  CHECK("Fill peer sig map", i == MAX_PEER_CNT);
+  CHECK("Peer sig map out of IDs",
+        get_id(map, MAX_PEER_CNT) == 0 &&
+          bgpstream_peer_sig_map_get_size(map) == MAX_PEER_CNT &&
+          (id = get_id(map, 0)) != 0 &&
+          sig_matches(bgpstream_peer_sig_map_get_sig(map, id), 0) != 0);
+  bgpstream_peer_sig_map_destroy(map);
+
+  free(seen);
+  return 0;
+}
+
+static int bench_peer_sig_map()
+{
+  bgpstream_peer_sig_map_t *map;
+  bgpstream_peer_sig_t peers[BENCH_PEER_CNT];
+  bgpstream_peer_id_t ids[BENCH_PEER_CNT];
+  struct timespec start;
+  uint64_t sum = 0;
+  int i;
+
+  CHECK("Create peer sig map",
+        (map = bgpstream_peer_sig_map_create()) != NULL);
+  for (i = 0; i < BENCH_PEER_CNT; i++) {
+    test_peer(i, &peers[i]);
+    ids[i] = get_id(map, i);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (i = 0; i < BENCH_LOOKUP_CNT; i++) {
+    sum += bgpstream_peer_sig_map_get_id(
+      map, peers[i % BENCH_PEER_CNT].collector_str,
+      (bgpstream_ip_addr_t *)&peers[i % BENCH_PEER_CNT].peer_ip_addr,
+      peers[i % BENCH_PEER_CNT].peer_asnumber);
+  }
+  fprintf(stderr, "   get_id %d times over %d peers: %.3fs\n",
+          BENCH_LOOKUP_CNT, BENCH_PEER_CNT, bench_elapsed(&start));
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (i = 0; i < BENCH_LOOKUP_CNT; i++) {
+    sum += bgpstream_peer_sig_map_get_id_from_sig(map,
+                                                  &peers[i % BENCH_PEER_CNT]);
+  }
+  fprintf(stderr, "   get_id_from_sig %d times over %d peers: %.3fs\n",
+          BENCH_LOOKUP_CNT, BENCH_PEER_CNT, bench_elapsed(&start));
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (i = 0; i < BENCH_LOOKUP_CNT; i++) {
+    sum += bgpstream_peer_sig_map_get_sig(map, ids[i % BENCH_PEER_CNT])
+             ->peer_asnumber;
+  }
+  fprintf(stderr, "   get_sig %d times over %d peers: %.3fs\n",
+          BENCH_LOOKUP_CNT, BENCH_PEER_CNT, bench_elapsed(&start));
+
+  CHECK("Peer sig map benchmark lookups", sum > 0);
+  bgpstream_peer_sig_map_destroy(map);
+  return 0;
+}
+
+int main()
+{
+  CHECK_SECTION("Peer Signature Map", test_peer_sig_map() == 0);
+  CHECK_SECTION("Peer Signature Map Benchmark", bench_peer_sig_map() == 0);
+  return 0;
+}
@@ -184,10 +184,105 @@ int test_prefixes_ipv6()
   return 0;
 }
 
+#define PFX_SET_BULK_CNT 100000
+
+int test_prefix_sets()
+{
+  bgpstream_pfx_storage_set_t *set, *set2;
+  bgpstream_ipv4_pfx_set_t *set4, *set4_2;
+  bgpstream_pfx_storage_t a, b, c;
+  bgpstream_ipv4_pfx_t pfx4;
+  int i;
+
+  bgpstream_str2pfx(IPV4_TEST_PFX_B, &a);
+  bgpstream_str2pfx(IPV4_TEST_PFX_B_CHILD, &b);
+  bgpstream_str2pfx(IPV6_TEST_PFX_A, &c);
+
+  /* STORAGE */
+  CHECK("Prefix storage set create",
+        (set = bgpstream_pfx_storage_set_create()) != NULL &&
+          (set2 = bgpstream_pfx_storage_set_create()) != NULL);
+
+  CHECK("Prefix storage set insert",
+        bgpstream_pfx_storage_set_insert(set, &a) == 1 &&
+          bgpstream_pfx_storage_set_insert(set, &a) == 0 &&
+          bgpstream_pfx_storage_set_insert(set, &c) == 1 &&
+          bgpstream_pfx_storage_set_insert(set, &c) == 0);
+
+  CHECK("Prefix storage set exists",
+        bgpstream_pfx_storage_set_exists(set, &a) == 1 &&
+          bgpstream_pfx_storage_set_exists(set, &b) == 0 &&
+          bgpstream_pfx_storage_set_exists(set, &c) == 1);
+
+  bgpstream_pfx_storage_set_insert(set2, &a);
+  bgpstream_pfx_storage_set_insert(set2, &b);
+  CHECK("Prefix storage set merge",
+        bgpstream_pfx_storage_set_merge(set, set2) == 0 &&
+          bgpstream_pfx_storage_set_size(set) == 3 &&
+          bgpstream_pfx_storage_set_version_size(
+            set, BGPSTREAM_ADDR_VERSION_IPV4) == 2 &&
+          bgpstream_pfx_storage_set_version_size(
+            set, BGPSTREAM_ADDR_VERSION_IPV6) == 1);
+
+  bgpstream_pfx_storage_set_clear(set);
+  CHECK("Prefix storage set clear",
+        bgpstream_pfx_storage_set_size(set) == 0 &&
+          bgpstream_pfx_storage_set_exists(set, &a) == 0);
+
+  bgpstream_pfx_storage_set_destroy(set);
+  bgpstream_pfx_storage_set_destroy(set2);
+
+  /* IPv4 */
+  CHECK("IPv4 prefix set create",
+        (set4 = bgpstream_ipv4_pfx_set_create()) != NULL &&
+          (set4_2 = bgpstream_ipv4_pfx_set_create()) != NULL);
+
+  /* same address, different mask lengths */
+  memset(&pfx4, 0, sizeof(pfx4));
+  pfx4.address.version = BGPSTREAM_ADDR_VERSION_IPV4;
+  for (i = 0; i < PFX_SET_BULK_CNT; i++) {
+    pfx4.address.ipv4.s_addr = htonl(0x0a000000 | (i << 8));
+    pfx4.mask_len = 24;
+    if (bgpstream_ipv4_pfx_set_insert(set4, &pfx4) != 1) {
+      break;
+    }
+    pfx4.mask_len = 23;
+    if (bgpstream_ipv4_pfx_set_insert(set4_2, &pfx4) != 1) {
+      break;
+    }
+  }
+  CHECK("IPv4 prefix set bulk insert",
+        i == PFX_SET_BULK_CNT &&
+          bgpstream_ipv4_pfx_set_size(set4) == PFX_SET_BULK_CNT);
+
+  pfx4.address.ipv4.s_addr = htonl(0x0a000000);
+  pfx4.mask_len = 24;
+  CHECK("IPv4 prefix set exists",
+        bgpstream_ipv4_pfx_set_exists(set4, &pfx4) == 1 &&
+          bgpstream_ipv4_pfx_set_insert(set4, &pfx4) == 0);
+  pfx4.mask_len = 22;
+  CHECK("IPv4 prefix set exists (mask length)",
+        bgpstream_ipv4_pfx_set_exists(set4, &pfx4) == 0);
+
+  CHECK("IPv4 prefix set merge",
+        bgpstream_ipv4_pfx_set_merge(set4, set4_2) == 0 &&
+          bgpstream_ipv4_pfx_set_merge(set4, set4_2) == 0 &&
+          bgpstream_ipv4_pfx_set_size(set4) == PFX_SET_BULK_CNT * 2);
+
+  bgpstream_ipv4_pfx_set_clear(set4);
+  CHECK("IPv4 prefix set clear", bgpstream_ipv4_pfx_set_size(set4) == 0);
+
+  bgpstream_ipv4_pfx_set_destroy(set4);
+  bgpstream_ipv4_pfx_set_destroy(set4_2);
+
+  return 0;
+}
+
 int main()
 {
   CHECK_SECTION("IPv4 prefixes", test_prefixes_ipv4() == 0);
   CHECK_SECTION("IPv6 prefixes", test_prefixes_ipv6() == 0);
+  CHECK_SECTION("Prefix sets", test_prefix_sets() == 0);
 
   return 0;
 }
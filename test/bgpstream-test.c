@@ -28,13 +28,24 @@
 
 #include "utils.h"
 
+#include <signal.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <wandio.h>
+#ifdef WITH_DATA_INTERFACE_SQLITE
+#include <sqlite3.h>
+#endif
+#ifdef WITH_DATA_INTERFACE_BROKER
+#include "bgpstream_test_http.h"
+#include <stdlib.h>
+#endif
 
 #define singlefile_RECORDS 537347
 #define csvfile_RECORDS 559424
 #define sqlite_RECORDS 538308
+#define localdir_RECORDS 559424
 #define broker_RECORDS 2153
 
 bgpstream_t *bs;
@@ -111,6 +122,35 @@ int test_singlefile()
   return 0;
 }
 
+int test_singlefile_readahead()
+{
+  SETUP;
+
+  CHECK_SET_INTERFACE(singlefile);
+
+  CHECK("get option (rib-file)",
+        (option = bgpstream_get_data_interface_option_by_name(
+           bs, di_id, "rib-file")) != NULL);
+  CHECK("set option (rib-file)",
+        bgpstream_set_data_interface_option(bs, option,
+                                            "routeviews.route-views.jinx.ribs.1427846400.bz2") == 0);
+
+  CHECK("get option (upd-file)",
+        (option = bgpstream_get_data_interface_option_by_name(
+           bs, di_id, "upd-file")) != NULL);
+  CHECK("set option (upd-file)",
+        bgpstream_set_data_interface_option(bs, option,
+                                            "ris.rrc06.updates.1427846400.gz") == 0);
+
+  // smaller than the parser buffer so that partial chunks are exercised
+  bgpstream_set_readahead(bs, 256 * 1024);
+
+  RUN(singlefile);
+
+  TEARDOWN;
+  return 0;
+}
+
 int test_csvfile()
 {
   SETUP;
@@ -130,6 +170,266 @@ int test_csvfile()
   return 0;
 }
 
+int test_csvfile_mirror()
+{
+  SETUP;
+
+  CHECK_SET_INTERFACE(csvfile);
+
+  CHECK("get option (csv-file)",
+        (option = bgpstream_get_data_interface_option_by_name(
+           bs, di_id, "csv-file")) != NULL);
+  bgpstream_set_data_interface_option(bs, option, "csv_mirror_test.csv");
+
+  bgpstream_add_filter(bs, BGPSTREAM_FILTER_TYPE_COLLECTOR, "rrc06");
+
+  // the remote URLs don't resolve, so every file must come from the mirror
+  CHECK("add mirror",
+        bgpstream_add_mirror(bs, "http://mirror.bgpstream.invalid/archive/",
+                             ".") == 0);
+
+  RUN(csvfile);
+
+  TEARDOWN;
+  return 0;
+}
+
+#define CSV_RESUME_FILE "csv_resume_test.csv"
+
+/* The rows appended to the CSV file while the stream is running must be longer
+   than the rows already processed, so that skipping the processed part twice
+   would lose data */
+static const char *csv_resume_rows[] = {
+  "ris.rrc06.updates.1427846400.gz,ris,updates,rrc06,1427846400,300,"
+  "1430438400\n",
+  "routeviews.route-views.jinx.updates.1427846400.bz2,routeviews,updates,"
+  "route-views.jinx,1427846400,900,1430438401\n",
+  "ris.rrc06.updates.1427846400.gz,ris,updates,rrc06,1427846400,300,"
+  "1430438402\n",
+};
+
+static int csv_resume_write(const char *mode, int first, int last)
+{
+  FILE *fh;
+  int i;
+
+  if ((fh = fopen(CSV_RESUME_FILE, mode)) == NULL) {
+    return -1;
+  }
+  for (i = first; i <= last; i++) {
+    fputs(csv_resume_rows[i], fh);
+  }
+  fclose(fh);
+  return 0;
+}
+
+/* Count the valid records in the stream, calling append (if set) once the
+   first record has been read */
+static int csv_resume_count(int (*append)())
+{
+  int ret;
+  int counter = 0;
+
+  SETUP;
+  CHECK_SET_INTERFACE(csvfile);
+  CHECK("get option (csv-file)",
+        (option = bgpstream_get_data_interface_option_by_name(
+           bs, di_id, "csv-file")) != NULL);
+  bgpstream_set_data_interface_option(bs, option, CSV_RESUME_FILE);
+
+  CHECK("stream start (csvfile resume)", bgpstream_start(bs) == 0);
+  while ((ret = bgpstream_get_next_record(bs, &rec)) > 0) {
+    if (rec->status == BGPSTREAM_RECORD_STATUS_VALID_RECORD) {
+      counter++;
+    }
+    // the first file is still being read, so the CSV file is only read again
+    // (from the offset reached so far) once it is done
+    if (append != NULL && append() != 0) {
+      return -1;
+    }
+    append = NULL;
+  }
+  CHECK("final return code (csvfile resume)", ret == 0);
+
+  TEARDOWN;
+  return counter;
+}
+
+static int csv_resume_append()
+{
+  return csv_resume_write("a", 1, 2);
+}
+
+int test_csvfile_resume()
+{
+  int expected;
+  int counter;
+
+  // every row at once
+  CHECK("write CSV file (all rows)", csv_resume_write("w", 0, 2) == 0);
+  CHECK("read CSV file (all rows)", (expected = csv_resume_count(NULL)) > 0);
+
+  // the first row, then the others once the stream has started
+  CHECK("write CSV file (first row)", csv_resume_write("w", 0, 0) == 0);
+  counter = csv_resume_count(csv_resume_append);
+  unlink(CSV_RESUME_FILE);
+
+  CHECK("read appended rows (csvfile resume)", counter == expected);
+
+  return 0;
+}
+
+#define SILENT_STREAM_CSV "silent_stream_test.csv"
+#define SILENT_STREAM_FILE "silent_stream_test.mrt"
+
+/* Read the updates dump alongside a stream (a resource with no duration) that
+   never has any data, and count the records until the dump has been read. If
+   the merged stream waits for the silent one, the alarm fails the test */
+static int silent_stream_count(uint32_t skew, int expected)
+{
+  FILE *fh;
+  int counter = 0;
+
+  CHECK("create silent stream", (fh = fopen(SILENT_STREAM_FILE, "w")) != NULL);
+  fclose(fh);
+  CHECK("write CSV file (silent stream)",
+        (fh = fopen(SILENT_STREAM_CSV, "w")) != NULL);
+  fputs(csv_resume_rows[0], fh);
+  fputs(SILENT_STREAM_FILE ",ris,updates,rrc00,1427846400,0,1430438400\n", fh);
+  fclose(fh);
+
+  SETUP;
+  CHECK_SET_INTERFACE(csvfile);
+  CHECK("get option (csv-file)",
+        (option = bgpstream_get_data_interface_option_by_name(
+           bs, di_id, "csv-file")) != NULL);
+  bgpstream_set_data_interface_option(bs, option, SILENT_STREAM_CSV);
+  bgpstream_set_max_skew(bs, skew);
+
+  CHECK("stream start (silent stream)", bgpstream_start(bs) == 0);
+  // the silent stream never ends, so stop once the dump has been read
+  alarm(60);
+  while (counter < expected && bgpstream_get_next_record(bs, &rec) > 0) {
+    if (rec->status == BGPSTREAM_RECORD_STATUS_VALID_RECORD) {
+      counter++;
+    }
+  }
+  alarm(0);
+  TEARDOWN;
+
+  unlink(SILENT_STREAM_CSV);
+  unlink(SILENT_STREAM_FILE);
+  return counter;
+}
+
+int test_silent_stream()
+{
+  int expected;
+
+  CHECK("write CSV file (dump only)", csv_resume_write("w", 0, 0) == 0);
+  expected = csv_resume_count(NULL);
+  unlink(CSV_RESUME_FILE);
+  CHECK("read dump (silent stream)", expected > 0);
+
+  // with strict ordering (no skew) the merged stream waits for the silent
+  // one, so only a skew lets the dump through
+  CHECK("read past silent stream (skew)",
+        silent_stream_count(60, expected) == expected);
+  CHECK("read past silent stream (short skew)",
+        silent_stream_count(1, expected) == expected);
+
+  return 0;
+}
+
+#define HANDOVER_UPD_FILE "ris.rrc06.updates.1427846400.gz"
+
+static void handover_alarm(int sig)
+{
+  // only here to interrupt the wait for new live data
+}
+
+/* Reads the updates dump once with the singlefile interface, then hands over
+   to the csvfile interface, which reads the same dump (under a different
+   collector name). Only the records of the watermark second (the newest one
+   of the dump) may be delivered again */
+int test_handover()
+{
+  struct sigaction sa;
+  int ret;
+  int total = 0;
+  int seam = 0;
+  int counter = 0;
+  int repeated = 0;
+  uint32_t watermark = 0;
+
+  // reference: the dump on its own
+  SETUP;
+  CHECK_SET_INTERFACE(singlefile);
+  CHECK("get option (upd-file)",
+        (option = bgpstream_get_data_interface_option_by_name(
+           bs, di_id, "upd-file")) != NULL);
+  bgpstream_set_data_interface_option(bs, option, HANDOVER_UPD_FILE);
+  CHECK("stream start (handover reference)", bgpstream_start(bs) == 0);
+  while ((ret = bgpstream_get_next_record(bs, &rec)) > 0) {
+    total++;
+    if (rec->time_sec > watermark) {
+      watermark = rec->time_sec;
+      seam = 0;
+    }
+    if (rec->time_sec == watermark) {
+      seam++;
+    }
+  }
+  CHECK("final return code (handover reference)", ret == 0);
+  CHECK("read records (handover reference)", total > 0 && seam > 0);
+  TEARDOWN;
+
+  // the same dump through a historical and then a live interface
+  CHECK("write CSV file (handover)", csv_resume_write("w", 0, 0) == 0);
+  SETUP;
+  CHECK_SET_INTERFACE(singlefile);
+  CHECK("get option (upd-file)",
+        (option = bgpstream_get_data_interface_option_by_name(
+           bs, di_id, "upd-file")) != NULL);
+  bgpstream_set_data_interface_option(bs, option, HANDOVER_UPD_FILE);
+  CHECK("get data interface ID (csvfile)",
+        (di_id = bgpstream_get_data_interface_id_by_name(bs, "csvfile")) !=
+          0);
+  CHECK("set live data interface",
+        bgpstream_set_live_data_interface(bs, di_id) == 0);
+  CHECK("get option (csv-file)",
+        (option = bgpstream_get_data_interface_option_by_name(
+           bs, di_id, "csv-file")) != NULL);
+  bgpstream_set_data_interface_option(bs, option, CSV_RESUME_FILE);
+
+  // once the live interface runs dry the stream waits for new data, so let an
+  // alarm interrupt the wait (which ends the stream)
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = handover_alarm;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGALRM, &sa, NULL);
+
+  CHECK("stream start (handover)", bgpstream_start(bs) == 0);
+  alarm(5);
+  while ((ret = bgpstream_get_next_record(bs, &rec)) > 0) {
+    alarm(5);
+    if (++counter > total && rec->time_sec != watermark) {
+      repeated++;
+    }
+  }
+  alarm(0);
+  signal(SIGALRM, SIG_DFL);
+  unlink(CSV_RESUME_FILE);
+  CHECK("final return code (handover)", ret == 0);
+  TEARDOWN;
+
+  CHECK("no records older than the watermark repeated (handover)",
+        repeated == 0);
+  CHECK("watermark second repeated (handover)", counter == total + seam);
+
+  return 0;
+}
+
 int test_sqlite()
 {
   SETUP;
@@ -149,6 +449,216 @@ int test_sqlite()
   return 0;
 }
 
+#ifdef WITH_DATA_INTERFACE_SQLITE
+#define SQLITE_WINDOWS_DB "sqlite_windows_test.db"
+
+/* Three hours of files, one per hour: two RIBs of the same collector (the
+   second one is inside the RIB period of the first) and then an updates
+   dump. The RIB dumps are stood in for by an updates file, the records are
+   parsed the same way */
+static const char *sqlite_windows_sql =
+  "CREATE TABLE collectors (id integer PRIMARY KEY, project text, name text);"
+  "CREATE TABLE bgp_types (id integer PRIMARY KEY, name text);"
+  "CREATE TABLE time_span (collector_id integer, bgp_type_id integer,"
+  "  time_span integer, PRIMARY KEY(collector_id, bgp_type_id));"
+  "CREATE TABLE bgp_data (collector_id integer, type_id integer,"
+  "  file_time timestamp, file_path text, ts timestamp,"
+  "  PRIMARY KEY(collector_id, type_id, file_time));"
+  "INSERT INTO collectors VALUES (1, 'ris', 'rrc06');"
+  "INSERT INTO collectors VALUES (2, 'routeviews', 'route-views.jinx');"
+  "INSERT INTO bgp_types VALUES (1, 'ribs');"
+  "INSERT INTO bgp_types VALUES (2, 'updates');"
+  "INSERT INTO time_span VALUES (1, 1, 300);"
+  "INSERT INTO time_span VALUES (2, 2, 900);"
+  "INSERT INTO bgp_data VALUES (1, 1, 1427846400,"
+  "  'ris.rrc06.updates.1427846400.gz', 1000);"
+  "INSERT INTO bgp_data VALUES (1, 1, 1427850000,"
+  "  'ris.rrc06.updates.1427846400.gz', 1000);"
+  "INSERT INTO bgp_data VALUES (2, 2, 1427853600,"
+  "  'routeviews.route-views.jinx.updates.1427846400.bz2', 1000);";
+
+static int sqlite_windows_count(const char *window_size)
+{
+  int ret;
+  int counter = 0;
+
+  SETUP;
+  CHECK_SET_INTERFACE(sqlite);
+  CHECK("get option (db-file)",
+        (option = bgpstream_get_data_interface_option_by_name(
+           bs, di_id, "db-file")) != NULL);
+  bgpstream_set_data_interface_option(bs, option, SQLITE_WINDOWS_DB);
+  CHECK("get option (window-size)",
+        (option = bgpstream_get_data_interface_option_by_name(
+           bs, di_id, "window-size")) != NULL);
+  CHECK("set option (window-size)",
+        bgpstream_set_data_interface_option(bs, option, window_size) == 0);
+
+  // only the first of the two RIBs is wanted
+  bgpstream_add_rib_period_filter(bs, 86400);
+
+  CHECK("stream start (sqlite windows)", bgpstream_start(bs) == 0);
+  while ((ret = bgpstream_get_next_record(bs, &rec)) > 0) {
+    if (rec->status == BGPSTREAM_RECORD_STATUS_VALID_RECORD) {
+      counter++;
+    }
+  }
+  CHECK("final return code (sqlite windows)", ret == 0);
+
+  TEARDOWN;
+  return counter;
+}
+
+int test_sqlite_windows()
+{
+  sqlite3 *db;
+  int expected;
+  int counter;
+
+  unlink(SQLITE_WINDOWS_DB);
+  CHECK("create database (sqlite windows)",
+        sqlite3_open(SQLITE_WINDOWS_DB, &db) == SQLITE_OK &&
+          sqlite3_exec(db, sqlite_windows_sql, NULL, NULL, NULL) ==
+            SQLITE_OK);
+  sqlite3_close(db);
+
+  // every file in a single window
+  CHECK("read single window (sqlite windows)",
+        (expected = sqlite_windows_count("86400")) > 0);
+
+  // one file per window, the second window is filtered out entirely
+  counter = sqlite_windows_count("3600");
+  unlink(SQLITE_WINDOWS_DB);
+
+  CHECK("read past filtered window (sqlite windows)", counter == expected);
+
+  return 0;
+}
+#endif
+
+int test_localdir()
+{
+  SETUP;
+
+  CHECK_SET_INTERFACE(localdir);
+
+  CHECK("get option (dir)",
+        (option = bgpstream_get_data_interface_option_by_name(
+           bs, di_id, "dir")) != NULL);
+  bgpstream_set_data_interface_option(bs, option, ".");
+
+  // the test dumps are named <project>.<collector>.<type>.<time>.<ext>
+  const char *pattern = "%P.%C.%T.%s.*";
+  CHECK("get option (pattern)",
+        (option = bgpstream_get_data_interface_option_by_name(
+           bs, di_id, "pattern")) != NULL);
+  CHECK("set option (pattern)",
+        bgpstream_set_data_interface_option(bs, option, pattern) == 0);
+
+  // same files as the csvfile test
+  bgpstream_add_filter(bs, BGPSTREAM_FILTER_TYPE_COLLECTOR, "rrc06");
+
+  RUN(localdir);
+
+  TEARDOWN;
+  return 0;
+}
+
+#define LOCALDIR_WINDOWS_DIR "localdir_windows_test"
+
+/* Same layout as the sqlite windows test: two RIBs an hour apart (the second
+   one inside the RIB period) and then an updates dump */
+static const char *localdir_windows_links[][2] = {
+  {"ris.rrc06.ribs.1427846400.gz", "../ris.rrc06.updates.1427846400.gz"},
+  {"ris.rrc06.ribs.1427850000.gz", "../ris.rrc06.updates.1427846400.gz"},
+  {"routeviews.route-views.jinx.updates.1427853600.bz2",
+   "../routeviews.route-views.jinx.updates.1427846400.bz2"},
+};
+
+#define LOCALDIR_WINDOWS_CNT                                                   \
+  (sizeof(localdir_windows_links) / sizeof(localdir_windows_links[0]))
+
+static int localdir_windows_count(const char *window_size)
+{
+  const char *pattern = "%P.%C.%T.%s.*";
+  int ret;
+  int counter = 0;
+
+  SETUP;
+  CHECK_SET_INTERFACE(localdir);
+  CHECK("get option (dir)",
+        (option = bgpstream_get_data_interface_option_by_name(
+           bs, di_id, "dir")) != NULL);
+  bgpstream_set_data_interface_option(bs, option, LOCALDIR_WINDOWS_DIR);
+  CHECK("get option (pattern)",
+        (option = bgpstream_get_data_interface_option_by_name(
+           bs, di_id, "pattern")) != NULL);
+  CHECK("set option (pattern)",
+        bgpstream_set_data_interface_option(bs, option, pattern) == 0);
+  CHECK("get option (window-size)",
+        (option = bgpstream_get_data_interface_option_by_name(
+           bs, di_id, "window-size")) != NULL);
+  CHECK("set option (window-size)",
+        bgpstream_set_data_interface_option(bs, option, window_size) == 0);
+
+  // only the first of the two RIBs is wanted
+  bgpstream_add_rib_period_filter(bs, 86400);
+
+  CHECK("stream start (localdir windows)", bgpstream_start(bs) == 0);
+  while ((ret = bgpstream_get_next_record(bs, &rec)) > 0) {
+    if (rec->status == BGPSTREAM_RECORD_STATUS_VALID_RECORD) {
+      counter++;
+    }
+  }
+  CHECK("final return code (localdir windows)", ret == 0);
+
+  TEARDOWN;
+  return counter;
+}
+
+static void localdir_windows_cleanup()
+{
+  char path[1024];
+  unsigned int i;
+
+  for (i = 0; i < LOCALDIR_WINDOWS_CNT; i++) {
+    snprintf(path, sizeof(path), LOCALDIR_WINDOWS_DIR "/%s",
+             localdir_windows_links[i][0]);
+    unlink(path);
+  }
+  rmdir(LOCALDIR_WINDOWS_DIR);
+}
+
+int test_localdir_windows()
+{
+  char path[1024];
+  int expected;
+  int counter;
+  unsigned int i;
+
+  localdir_windows_cleanup();
+  CHECK("create directory (localdir windows)",
+        mkdir(LOCALDIR_WINDOWS_DIR, 0755) == 0);
+  for (i = 0; i < LOCALDIR_WINDOWS_CNT; i++) {
+    snprintf(path, sizeof(path), LOCALDIR_WINDOWS_DIR "/%s",
+             localdir_windows_links[i][0]);
+    CHECK("create link (localdir windows)",
+          symlink(localdir_windows_links[i][1], path) == 0);
+  }
+
+  // every file in a single window
+  CHECK("read single window (localdir windows)",
+        (expected = localdir_windows_count("86400")) > 0);
+
+  // one file per window, the second window is filtered out entirely
+  counter = localdir_windows_count("3600");
+  localdir_windows_cleanup();
+
+  CHECK("read past filtered window (localdir windows)", counter == expected);
+
+  return 0;
+}
+
 #ifdef WITH_DATA_INTERFACE_BROKER
 int test_broker()
 {
@@ -175,26 +685,234 @@ int test_broker()
 }
 #endif
 
+#if defined(WITH_DATA_INTERFACE_BROKER) &&                                     \
+  defined(WITH_DATA_INTERFACE_CSVFILE)
+/* A broker on the loopback interface. It serves the test dumps as two
+   windows of files (the second one found using minInitialTime), and then an
+   empty window */
+static const char *local_broker_windows[][2] = {
+  {"0",
+   "{\"urlType\": \"simple\", "
+   "\"url\": \"ris.rrc06.updates.1427846400.gz\", \"project\": \"ris\", "
+   "\"collector\": \"rrc06\", \"type\": \"updates\", "
+   "\"initialTime\": 1427846400, \"duration\": 300}"},
+  {"1427846700",
+   "{\"urlType\": \"simple\", "
+   "\"url\": \"routeviews.route-views.jinx.updates.1427846400.bz2\", "
+   "\"project\": \"routeviews\", \"collector\": \"route-views.jinx\", "
+   "\"type\": \"updates\", \"initialTime\": 1427846700, "
+   "\"duration\": 900}"},
+};
+
+#define LOCAL_BROKER_CHUNK_LEN 16
+
+// delay (in usec) before each response
+static int local_broker_latency;
+
+static int local_broker_requests;
+
+static void local_broker_serve(int fd, const char *req)
+{
+  char body[1024];
+  char hdr[128];
+  const char *files = "";
+  const char *min_time;
+  size_t len, off;
+  unsigned int i;
+
+  __sync_fetch_and_add(&local_broker_requests, 1);
+
+  min_time = strstr(req, "minInitialTime=");
+  for (i = 0; i < sizeof(local_broker_windows) / sizeof(local_broker_windows[0]);
+       i++) {
+    if ((min_time == NULL && i == 0) ||
+        (min_time != NULL &&
+         strtoul(min_time + strlen("minInitialTime="), NULL, 10) ==
+           strtoul(local_broker_windows[i][0], NULL, 10))) {
+      files = local_broker_windows[i][1];
+    }
+  }
+  len = snprintf(body, sizeof(body),
+                 "{\"time\": 1427850000, \"type\": \"data\", "
+                 "\"error\": null, \"queryParameters\": {}, "
+                 "\"data\": {\"dumpFiles\": [%s]}}",
+                 files);
+  snprintf(hdr, sizeof(hdr),
+           "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
+           "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+           len);
+
+  if (local_broker_latency > 0) {
+    usleep(local_broker_latency);
+  }
+  if (test_http_send(fd, hdr, strlen(hdr)) != 0) {
+    return;
+  }
+  // in small pieces, so that files are parsed from partial responses
+  for (off = 0; off < len; off += LOCAL_BROKER_CHUNK_LEN) {
+    if (test_http_send(fd, body + off,
+                       (len - off < LOCAL_BROKER_CHUNK_LEN)
+                         ? len - off
+                         : LOCAL_BROKER_CHUNK_LEN) != 0) {
+      return;
+    }
+    usleep(100);
+  }
+}
+
+/* Count the records read from the local broker (or, if csv_file is set,
+   from the same files listed in a CSV file) */
+static int local_broker_count(const char *csv_file)
+{
+  char url[64];
+  int ret;
+  int counter = 0;
+
+  SETUP;
+  if (csv_file != NULL) {
+    CHECK_SET_INTERFACE(csvfile);
+    CHECK("get option (csv-file)",
+          (option = bgpstream_get_data_interface_option_by_name(
+             bs, di_id, "csv-file")) != NULL);
+    bgpstream_set_data_interface_option(bs, option, csv_file);
+  } else {
+    CHECK_SET_INTERFACE(broker);
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d", test_http_port);
+    CHECK("get option (url)",
+          (option = bgpstream_get_data_interface_option_by_name(
+             bs, di_id, "url")) != NULL);
+    CHECK("set option (url)",
+          bgpstream_set_data_interface_option(bs, option, url) == 0);
+  }
+  bgpstream_add_interval_filter(bs, 1427846400, 1427850000);
+
+  CHECK("stream start (local broker)", bgpstream_start(bs) == 0);
+  while ((ret = bgpstream_get_next_record(bs, &rec)) > 0) {
+    if (rec->status == BGPSTREAM_RECORD_STATUS_VALID_RECORD) {
+      counter++;
+    }
+  }
+  CHECK("final return code (local broker)", ret == 0);
+
+  TEARDOWN;
+  return counter;
+}
+
+int test_broker_local()
+{
+  int expected;
+  int counter;
+
+  // the same files, from a CSV file
+  CHECK("write CSV file (local broker)", csv_resume_write("w", 0, 1) == 0);
+  expected = local_broker_count(CSV_RESUME_FILE);
+  unlink(CSV_RESUME_FILE);
+  CHECK("read reference records (local broker)", expected > 0);
+
+  CHECK("start HTTP server (local broker)",
+        test_http_start(local_broker_serve) == 0);
+
+  local_broker_latency = 0;
+  local_broker_requests = 0;
+  counter = local_broker_count(NULL);
+  CHECK("read records (local broker)", counter == expected);
+  CHECK("broker requests (local broker)", local_broker_requests == 3);
+
+  test_http_stop();
+  return 0;
+}
+
+/* With a slow broker, all but the first request should be hidden behind the
+   reading of the previous window. This takes a while, so it is only run if
+   BGPSTREAM_TEST_BENCH is set */
+int bench_broker_local()
+{
+  struct timespec start;
+  double base_time, latency_time;
+  int expected;
+  int counter;
+
+  CHECK("start HTTP server (local broker)",
+        test_http_start(local_broker_serve) == 0);
+
+  local_broker_latency = 0;
+  local_broker_requests = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  expected = local_broker_count(NULL);
+  base_time = bench_elapsed(&start);
+
+  local_broker_latency = 200000;
+  local_broker_requests = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  counter = local_broker_count(NULL);
+  latency_time = bench_elapsed(&start);
+  CHECK("read records with broker latency (local broker)", counter == expected);
+  fprintf(stderr,
+          "   %d records from %d windows: %.3fs, %.3fs with %dms broker "
+          "latency (%.3fs if requests were not overlapped)\n",
+          counter, local_broker_requests, base_time, latency_time,
+          local_broker_latency / 1000,
+          base_time + local_broker_requests * local_broker_latency / 1e6);
+
+  test_http_stop();
+  return 0;
+}
+#endif
+
 int main()
 {
   CHECK_SECTION("BGPStream", test_bgpstream() == 0);
 
 #ifdef WITH_DATA_INTERFACE_SINGLEFILE
   CHECK_SECTION("singlefile data interface", test_singlefile() == 0);
+  CHECK_SECTION("singlefile data interface (read-ahead)",
+                test_singlefile_readahead() == 0);
 #else
   SKIPPED_SECTION("singlefile data interface");
+  SKIPPED_SECTION("singlefile data interface (read-ahead)");
 #endif
 
 #ifdef WITH_DATA_INTERFACE_CSVFILE
   CHECK_SECTION("csvfile data interface", test_csvfile() == 0);
+  CHECK_SECTION("csvfile data interface (local mirror)",
+                test_csvfile_mirror() == 0);
+  CHECK_SECTION("csvfile data interface (resume)",
+                test_csvfile_resume() == 0);
 #else
   SKIPPED_SECTION("csvfile data interface");
+  SKIPPED_SECTION("csvfile data interface (local mirror)");
+  SKIPPED_SECTION("csvfile data interface (resume)");
+#endif
+
+#ifdef WITH_DATA_INTERFACE_CSVFILE
+  CHECK_SECTION("merging with a silent stream", test_silent_stream() == 0);
+#else
+  SKIPPED_SECTION("merging with a silent stream");
+#endif
+
+#if defined(WITH_DATA_INTERFACE_SINGLEFILE) &&                                 \
+  defined(WITH_DATA_INTERFACE_CSVFILE)
+  CHECK_SECTION("historical to live hand-over", test_handover() == 0);
+#else
+  SKIPPED_SECTION("historical to live hand-over");
 #endif
 
 #ifdef WITH_DATA_INTERFACE_SQLITE
   CHECK_SECTION("sqlite data interface", test_sqlite() == 0);
+  CHECK_SECTION("sqlite data interface (filtered window)",
+                test_sqlite_windows() == 0);
 #else
   SKIPPED_SECTION("sqlite data interface");
+  SKIPPED_SECTION("sqlite data interface (filtered window)");
+#endif
+
+#ifdef WITH_DATA_INTERFACE_LOCALDIR
+  CHECK_SECTION("localdir data interface", test_localdir() == 0);
+  CHECK_SECTION("localdir data interface (filtered window)",
+                test_localdir_windows() == 0);
+#else
+  SKIPPED_SECTION("localdir data interface");
+  SKIPPED_SECTION("localdir data interface (filtered window)");
 #endif
 
 #ifdef WITH_DATA_INTERFACE_BROKER
@@ -203,5 +921,19 @@ int main()
   SKIPPED_SECTION("broker data interface");
 #endif
 
+#if defined(WITH_DATA_INTERFACE_BROKER) &&                                     \
+  defined(WITH_DATA_INTERFACE_CSVFILE)
+  CHECK_SECTION("broker data interface (local)", test_broker_local() == 0);
+  if (getenv("BGPSTREAM_TEST_BENCH") != NULL) {
+    CHECK_SECTION("broker data interface (local) Benchmark",
+                  bench_broker_local() == 0);
+  } else {
+    SKIPPED_SECTION("broker data interface (local) Benchmark");
+  }
+#else
+  SKIPPED_SECTION("broker data interface (local)");
+  SKIPPED_SECTION("broker data interface (local) Benchmark");
+#endif
+
   return 0;
 }
@@ -27,6 +27,11 @@
 #include "bgpstream.h"
 #include "config.h"
 
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
 #define CHECK_MSG(name, err_msg, check)                                        \
   do {                                                                         \
     if (!(check)) {                                                            \
@@ -70,3 +75,43 @@
   do {                                                                         \
     fprintf(stderr, name ": SKIPPED\n");                                       \
   } while (0)
+
+/* Helpers shared by the benchmarks */
+
+static inline uint32_t bench_rand(uint64_t *state)
+{
+  *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+  return *state >> 32;
+}
+
+/* Generate a (deterministic) random prefix, with a mask length distribution
+ * loosely like that of a full table */
+static inline void bench_pfx(uint64_t *state, bgpstream_addr_version_t v,
+                             bgpstream_pfx_storage_t *pfx)
+{
+  uint32_t *w;
+
+  memset(pfx, 0, sizeof(*pfx));
+  pfx->address.version = v;
+  if (v == BGPSTREAM_ADDR_VERSION_IPV4) {
+    pfx->mask_len = 16 + bench_rand(state) % 9;
+    pfx->address.ipv4.s_addr =
+      htonl(bench_rand(state) & (0xffffffff << (32 - pfx->mask_len)));
+  } else {
+    pfx->mask_len = 32 + (bench_rand(state) % 5) * 4;
+    w = (uint32_t *)&pfx->address.ipv6.s6_addr[0];
+    w[0] = htonl(0x20000000 | (bench_rand(state) & 0x0fffffff));
+    if (pfx->mask_len > 32) {
+      w[1] = htonl(bench_rand(state) & (0xffffffff << (64 - pfx->mask_len)));
+    }
+  }
+}
+
+/* Seconds since start */
+static inline double bench_elapsed(struct timespec *start)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) +
+         (now.tv_nsec - start->tv_nsec) / 1000000000.0;
+}
@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2015 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __BGPSTREAM_TEST_HTTP_H
+#define __BGPSTREAM_TEST_HTTP_H
+
+/* A minimal HTTP server on the loopback interface, for tests of the code
+ * that talks to web servers. Every connection is served by its own thread,
+ * which reads the request headers and passes them to the handler. The
+ * connection is closed once the handler returns. */
+
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define TEST_HTTP_REQ_LEN 4096
+
+/* Called with the connection and the request headers (NUL-terminated) */
+typedef void(test_http_handler_t)(int fd, const char *req);
+
+/* Port the server listens on (once started) */
+static int test_http_port;
+
+static int test_http_fd = -1;
+static pthread_t test_http_thread;
+static test_http_handler_t *test_http_handler;
+
+/* Write the whole buffer to the connection. Returns -1 if the client went
+   away */
+static int test_http_send(int fd, const void *buf, size_t len)
+{
+  const uint8_t *p = buf;
+  ssize_t wlen;
+
+  while (len > 0) {
+    if ((wlen = send(fd, p, len, MSG_NOSIGNAL)) <= 0) {
+      return -1;
+    }
+    p += wlen;
+    len -= wlen;
+  }
+  return 0;
+}
+
+static void *test_http_serve_conn(void *user)
+{
+  int fd = (int)(intptr_t)user;
+  char req[TEST_HTTP_REQ_LEN];
+  size_t req_len = 0;
+  ssize_t rlen;
+
+  // read the request headers (the body is always empty)
+  while (req_len < TEST_HTTP_REQ_LEN - 1) {
+    if ((rlen = recv(fd, req + req_len, TEST_HTTP_REQ_LEN - 1 - req_len, 0)) <=
+        0) {
+      close(fd);
+      return NULL;
+    }
+    req_len += rlen;
+    req[req_len] = '\0';
+    if (strstr(req, "\r\n\r\n") != NULL) {
+      break;
+    }
+  }
+
+  test_http_handler(fd, req);
+  close(fd);
+  return NULL;
+}
+
+static void *test_http_serve(void *user)
+{
+  pthread_t thread;
+  int fd;
+
+  while ((fd = accept(test_http_fd, NULL, NULL)) >= 0) {
+    if (pthread_create(&thread, NULL, test_http_serve_conn,
+                       (void *)(intptr_t)fd) != 0) {
+      close(fd);
+      continue;
+    }
+    pthread_detach(thread);
+  }
+  return NULL;
+}
+
+/* Start serving requests with the given handler. Returns -1 on error */
+static int test_http_start(test_http_handler_t *handler)
+{
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+
+  test_http_handler = handler;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = 0;
+  if ((test_http_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+      bind(test_http_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(test_http_fd, 64) != 0 ||
+      getsockname(test_http_fd, (struct sockaddr *)&addr, &addr_len) != 0) {
+    return -1;
+  }
+  test_http_port = ntohs(addr.sin_port);
+
+  return pthread_create(&test_http_thread, NULL, test_http_serve, NULL);
+}
+
+/* Stop accepting connections (connections being served are not waited for) */
+static void test_http_stop()
+{
+  // wakes up the accept() call
+  shutdown(test_http_fd, SHUT_RDWR);
+  pthread_join(test_http_thread, NULL);
+  close(test_http_fd);
+  test_http_fd = -1;
+}
+
+#endif /* __BGPSTREAM_TEST_HTTP_H */
@@ -53,6 +53,7 @@
 #define PEERASN_CMD_CNT 1000
 #define WINDOW_CMD_CNT 1024
 #define OPTION_CMD_CNT 1024
+#define MIRROR_CMD_CNT 100
 #define BGPSTREAM_RECORD_OUTPUT_FORMAT                                         \
   "# Record format:\n"                                                         \
   "# "                                                                         \
@@ -86,6 +87,8 @@ static bgpstream_t *bs;
 static bgpstream_data_interface_id_t di_id_default = 0;
 static bgpstream_data_interface_id_t di_id = 0;
 static bgpstream_data_interface_info_t *di_info = NULL;
+static bgpstream_data_interface_id_t live_di_id = 0;
+static bgpstream_data_interface_info_t *live_di_info = NULL;
 
 static void data_if_usage()
 {
@@ -107,17 +110,18 @@ static void data_if_usage()
   }
 }
 
-static void dump_if_options()
+static void dump_if_options(bgpstream_data_interface_id_t id,
+                            bgpstream_data_interface_info_t *info)
 {
-  assert(di_id != _BGPSTREAM_DATA_INTERFACE_INVALID);
+  assert(id != _BGPSTREAM_DATA_INTERFACE_INVALID);
 
   bgpstream_data_interface_option_t *options;
   int opt_cnt = 0;
   int i;
 
-  opt_cnt = bgpstream_get_data_interface_options(bs, di_id, &options);
+  opt_cnt = bgpstream_get_data_interface_options(bs, id, &options);
 
-  fprintf(stderr, "Data interface options for '%s':\n", di_info->name);
+  fprintf(stderr, "Data interface options for '%s':\n", info->name);
   if (opt_cnt == 0) {
     fprintf(stderr, "   [NONE]\n");
   } else {
@@ -128,6 +132,47 @@ static void dump_if_options()
   fprintf(stderr, "\n");
 }
 
+/* Set the given "<name>=<value>" options for the given data interface.
+ * Returns 0 if all options were set, 1 if the user asked for the list of
+ * options, and -1 if an error occurred. */
+static int set_if_options(bgpstream_data_interface_id_t id,
+                          bgpstream_data_interface_info_t *info, char **opts,
+                          int opts_cnt)
+{
+  bgpstream_data_interface_option_t *option;
+  char *endp;
+  int i;
+
+  for (i = 0; i < opts_cnt; i++) {
+    if (*opts[i] == '?') {
+      dump_if_options(id, info);
+      return 1;
+    }
+    if ((endp = strchr(opts[i], '=')) == NULL) {
+      fprintf(stderr, "ERROR: Malformed data interface option (%s)\n",
+              opts[i]);
+      fprintf(stderr, "ERROR: Expecting <option-name>,<option-value>\n");
+      return -1;
+    }
+    *endp = '\0';
+    endp++;
+    if ((option = bgpstream_get_data_interface_option_by_name(bs, id,
+                                                              opts[i])) ==
+        NULL) {
+      fprintf(stderr, "ERROR: Invalid option '%s' for data interface '%s'\n",
+              opts[i], info->name);
+      return -1;
+    }
+    if (bgpstream_set_data_interface_option(bs, option, endp) != 0) {
+      fprintf(stderr,
+              "ERROR: Failed to set option '%s' for data interface '%s'\n",
+              opts[i], info->name);
+      return -1;
+    }
+  }
+  return 0;
+}
+
 static void usage()
 {
   fprintf(
@@ -145,6 +190,14 @@ static void usage()
     "current\n"
     "                  data interface. (data interface can be selected using "
     "-d)\n"
+    "   -D <interface> once the data interface selected using -d has no more "
+    "data,\n"
+    "                  continue streaming live data from the given interface\n"
+    "                  (records already read from the first interface are "
+    "skipped)\n"
+    "   -O <option-name=option-value>*\n"
+    "                  set an option for the live data interface "
+    "(selected using -D)\n"
     "   -p <project>   process records from only the given project "
     "(routeviews, ris)*\n"
     "   -c <collector> process records from only the given collector*\n"
@@ -166,6 +219,10 @@ static void usage()
     "                    (omitting the end parameter enables live mode)*\n"
     "   -P <period>    process a rib files every <period> seconds (bgp "
     "time)\n"
+    "   -M <url-prefix=dir>\n"
+    "                  read files under <url-prefix> from the local mirror "
+    "<dir>\n"
+    "                  when a copy is present*\n"
     "   -j <peer ASN>  return valid elems originated by a specific peer "
     "ASN*\n"
     "   -k <prefix>    return valid elems associated with a specific "
@@ -237,6 +294,10 @@ int main(int argc, char *argv[])
 
   char *interface_options[OPTION_CMD_CNT];
   int interface_options_cnt = 0;
+  char *live_interface_options[OPTION_CMD_CNT];
+  int live_interface_options_cnt = 0;
+  char *mirrors[MIRROR_CMD_CNT];
+  int mirrors_cnt = 0;
 
 #ifdef WITH_RPKI
   struct rpki_window rpki_windows[WINDOW_CMD_CNT];
@@ -255,9 +316,8 @@ int main(int argc, char *argv[])
 
   int rec_limit = -1;
 
-  bgpstream_data_interface_option_t *option;
-
   int i;
+  int rc;
 
   /* required to be created before usage is called */
   bs = bgpstream_create();
@@ -273,7 +333,7 @@ int main(int argc, char *argv[])
   bgpstream_record_t *bs_record = NULL;
 
   while (prevoptind = optind,
-         (opt = getopt(argc, argv, "f:I:d:o:p:c:t:w:j:k:y:P:n:H:lrmeivh?")) >= 0) {
+         (opt = getopt(argc, argv, "f:I:d:D:o:O:p:c:t:w:j:k:y:P:M:n:H:lrmeivh?")) >= 0) {
     if (optind == prevoptind + 2 && (optarg == NULL || *optarg == '-')) {
       opt = ':';
       --optind;
@@ -362,6 +422,15 @@ int main(int argc, char *argv[])
     case 'P':
       rib_period = atoi(optarg);
       break;
+    case 'M':
+      if (mirrors_cnt == MIRROR_CMD_CNT) {
+        fprintf(stderr, "ERROR: A maximum of %d mirrors can be specified\n",
+                MIRROR_CMD_CNT);
+        usage();
+        goto err;
+      }
+      mirrors[mirrors_cnt++] = strdup(optarg);
+      break;
     case 'd':
       if ((di_id = bgpstream_get_data_interface_id_by_name(bs, optarg)) == 0) {
         fprintf(stderr, "ERROR: Invalid data interface name '%s'\n", optarg);
@@ -380,6 +449,25 @@ int main(int argc, char *argv[])
       }
       interface_options[interface_options_cnt++] = strdup(optarg);
       break;
+    case 'D':
+      if ((live_di_id = bgpstream_get_data_interface_id_by_name(bs, optarg)) ==
+          0) {
+        fprintf(stderr, "ERROR: Invalid data interface name '%s'\n", optarg);
+        usage();
+        goto err;
+      }
+      live_di_info = bgpstream_get_data_interface_info(bs, live_di_id);
+      break;
+    case 'O':
+      if (live_interface_options_cnt == OPTION_CMD_CNT) {
+        fprintf(stderr,
+                "ERROR: A maximum of %d interface options can be specified\n",
+                OPTION_CMD_CNT);
+        usage();
+        goto err;
+      }
+      live_interface_options[live_interface_options_cnt++] = strdup(optarg);
+      break;
 
     case 'n':
       rec_limit = atoi(optarg);
@@ -435,40 +523,39 @@ int main(int argc, char *argv[])
     }
   }
 
+  rc = set_if_options(di_id, di_info, interface_options,
+                      interface_options_cnt);
   for (i = 0; i < interface_options_cnt; i++) {
-    if (*interface_options[i] == '?') {
-      dump_if_options();
-      usage();
-      goto done;
-    } else {
-      /* actually set this option */
-      if ((endp = strchr(interface_options[i], '=')) == NULL) {
-        fprintf(stderr, "ERROR: Malformed data interface option (%s)\n",
-                interface_options[i]);
-        fprintf(stderr, "ERROR: Expecting <option-name>,<option-value>\n");
-        usage();
-        goto err;
-      }
-      *endp = '\0';
-      endp++;
-      if ((option = bgpstream_get_data_interface_option_by_name(
-             bs, di_id, interface_options[i])) == NULL) {
-        fprintf(stderr, "ERROR: Invalid option '%s' for data interface '%s'\n",
-                interface_options[i], di_info->name);
-        usage();
-        goto err;
-      }
-      if (bgpstream_set_data_interface_option(bs, option, endp) != 0) {
-        fprintf(stderr, "ERROR: Failed to set option '%s' for data interface '%s'\n",
-                interface_options[i], di_info->name);
-        usage();
-        goto err;
-      }
-    }
     free(interface_options[i]);
-    interface_options[i] = NULL;
   }
   interface_options_cnt = 0;
+  if (rc != 0) {
+    usage();
+    if (rc > 0) {
+      goto done;
+    }
+    goto err;
+  }
+
+  if (live_interface_options_cnt > 0 && live_di_id == 0) {
+    fprintf(stderr, "ERROR: Live data interface options given without a live "
+                    "data interface (-D)\n");
+    usage();
+    goto err;
+  }
+  rc = set_if_options(live_di_id, live_di_info, live_interface_options,
+                      live_interface_options_cnt);
+  for (i = 0; i < live_interface_options_cnt; i++) {
+    free(live_interface_options[i]);
+  }
+  live_interface_options_cnt = 0;
+  if (rc != 0) {
+    usage();
+    if (rc > 0) {
+      goto done;
+    }
+    goto err;
+  }
 
   if (windows_cnt == 0 && !intervalstring) {
     if (di_id == BGPSTREAM_DATA_INTERFACE_BROKER) {
@@ -550,9 +637,35 @@ int main(int argc, char *argv[])
     bgpstream_add_rib_period_filter(bs, rib_period);
   }
 
+  /* local mirrors */
+  for (i = 0; i < mirrors_cnt; i++) {
+    if ((endp = strchr(mirrors[i], '=')) == NULL) {
+      fprintf(stderr, "ERROR: Malformed mirror (%s)\n", mirrors[i]);
+      fprintf(stderr, "ERROR: Expecting <url-prefix>=<dir>\n");
+      usage();
+      goto err;
+    }
+    *endp = '\0';
+    endp++;
+    if (bgpstream_add_mirror(bs, mirrors[i], endp) != 0) {
+      fprintf(stderr, "ERROR: Could not add mirror for %s\n", mirrors[i]);
+      goto err;
+    }
+    free(mirrors[i]);
+    mirrors[i] = NULL;
+  }
+  mirrors_cnt = 0;
+
   /* set data interface */
   bgpstream_set_data_interface(bs, di_id);
 
+  /* and the one to switch to once it has caught up */
+  if (live_di_id != 0 &&
+      bgpstream_set_live_data_interface(bs, live_di_id) != 0) {
+    fprintf(stderr, "ERROR: Could not set live data interface\n");
+    goto err;
+  }
+
   /* live */
   if (live != 0) {
     bgpstream_set_live_mode(bs);
@@ -649,10 +762,16 @@ int main(int argc, char *argv[])
  done:
   /* deallocate memory for interface */
   bgpstream_destroy(bs);
+  for (i = 0; i < mirrors_cnt; i++) {
+    free(mirrors[i]);
+  }
   return 0;
 
 err:
   bgpstream_destroy(bs);
+  for (i = 0; i < mirrors_cnt; i++) {
+    free(mirrors[i]);
+  }
 #ifdef WITH_RPKI
   if(rpki_input != NULL && rpki_input->rpki_active){
     bgpstream_rpki_destroy_cfg(cfg);